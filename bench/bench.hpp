@@ -0,0 +1,299 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_BENCH_BENCH_HPP
+#define CANARY_BENCH_BENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace bench
+{
+
+using clock = std::chrono::steady_clock;
+
+/// Command line options common to all benchmarks.
+struct options
+{
+    /// Number of frames sent by each throughput scenario.
+    std::size_t frames = 100000;
+    /// Number of round trips made by each latency scenario.
+    std::size_t round_trips = 10000;
+    /// Name of the first interface, used by all scenarios.
+    std::string interface0 = "vcan0";
+    /// Name of the second interface, used by round-trip scenarios.
+    std::string interface1 = "vcan1";
+    /// Path of the JSON output file, empty means standard output.
+    std::string output;
+
+    /// Parses `--frames N`, `--round-trips N`, `--if0 NAME`, `--if1 NAME`
+    /// and `--output PATH`.
+    static options parse(int argc, char** argv)
+    {
+        options opts;
+        for (int i = 1; i + 1 < argc; i += 2)
+        {
+            std::string const key = argv[i];
+            std::string const value = argv[i + 1];
+            if (key == "--frames")
+            {
+                opts.frames = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (key == "--round-trips")
+            {
+                opts.round_trips = std::strtoull(value.c_str(), nullptr, 10);
+            }
+            else if (key == "--if0")
+            {
+                opts.interface0 = value;
+            }
+            else if (key == "--if1")
+            {
+                opts.interface1 = value;
+            }
+            else if (key == "--output")
+            {
+                opts.output = value;
+            }
+            else
+            {
+                std::cerr << "Unknown option: " << key << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        return opts;
+    }
+};
+
+/// Collects latency samples and summarizes them as percentiles.
+class latency_recorder
+{
+public:
+    explicit latency_recorder(std::size_t expected = 0)
+    {
+        samples_.reserve(expected);
+    }
+
+    void record(clock::duration d)
+    {
+        samples_.push_back(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+    }
+
+    std::size_t size() const noexcept
+    {
+        return samples_.size();
+    }
+
+    /// Returns the `p`-th percentile (in the range [0, 100]) in nanoseconds.
+    double percentile(double p)
+    {
+        if (samples_.empty())
+        {
+            return 0;
+        }
+        sort();
+        auto const rank = static_cast<std::size_t>(
+          p / 100.0 * static_cast<double>(samples_.size() - 1) + 0.5);
+        return static_cast<double>(samples_[rank]);
+    }
+
+    double mean() const
+    {
+        if (samples_.empty())
+        {
+            return 0;
+        }
+        long double sum = 0;
+        for (auto s : samples_)
+        {
+            sum += s;
+        }
+        return static_cast<double>(sum / samples_.size());
+    }
+
+private:
+    void sort()
+    {
+        if (!sorted_)
+        {
+            std::sort(samples_.begin(), samples_.end());
+            sorted_ = true;
+        }
+    }
+
+    std::vector<std::int64_t> samples_;
+    bool sorted_ = false;
+};
+
+/// Result of a single benchmark scenario, serialized as a flat JSON object
+/// with an optional nested latency object.
+class result
+{
+public:
+    explicit result(std::string name)
+    {
+        field("name", quote(name));
+    }
+
+    result& value(std::string const& key, double v)
+    {
+        std::ostringstream os;
+        os << v;
+        return field(key, os.str());
+    }
+
+    result& value(std::string const& key, std::size_t v)
+    {
+        return field(key, std::to_string(v));
+    }
+
+    result& value(std::string const& key, std::string const& v)
+    {
+        return field(key, quote(v));
+    }
+
+    result& value(std::string const& key, char const* v)
+    {
+        return field(key, quote(v));
+    }
+
+    result& value(std::string const& key, bool v)
+    {
+        return field(key, v ? "true" : "false");
+    }
+
+    /// Adds throughput fields computed from the number of frames and the
+    /// elapsed time.
+    result& throughput(std::size_t frames, clock::duration elapsed)
+    {
+        auto const seconds =
+          std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+            .count();
+        value("frames", frames);
+        value("seconds", seconds);
+        return value("frames_per_second",
+                     seconds > 0 ? static_cast<double>(frames) / seconds : 0.0);
+    }
+
+    /// Adds a `latency_ns` object with percentiles of the recorded samples.
+    result& latency(latency_recorder& r)
+    {
+        std::ostringstream os;
+        os << "{\"samples\": " << r.size() << ", \"mean\": " << r.mean()
+           << ", \"p50\": " << r.percentile(50)
+           << ", \"p90\": " << r.percentile(90)
+           << ", \"p99\": " << r.percentile(99)
+           << ", \"p99.9\": " << r.percentile(99.9)
+           << ", \"max\": " << r.percentile(100) << '}';
+        return field("latency_ns", os.str());
+    }
+
+    std::string const& json() const noexcept
+    {
+        return json_;
+    }
+
+private:
+    static std::string quote(std::string const& s)
+    {
+        std::string out{"\""};
+        for (auto c : s)
+        {
+            if (c == '"' || c == '\\')
+            {
+                out += '\\';
+            }
+            out += c;
+        }
+        return out + '"';
+    }
+
+    result& field(std::string const& key, std::string const& json_value)
+    {
+        if (!json_.empty())
+        {
+            json_ += ", ";
+        }
+        json_ += quote(key) + ": " + json_value;
+        return *this;
+    }
+
+    std::string json_;
+};
+
+/// Collection of results of a benchmark executable, written as a single JSON
+/// document so that results can be compared between releases.
+class report
+{
+public:
+    report(std::string benchmark, options const& opts)
+      : benchmark_{std::move(benchmark)}
+      , opts_{opts}
+    {
+    }
+
+    void add(result r)
+    {
+        std::cerr << r.json() << '\n';
+        results_.push_back(std::move(r));
+    }
+
+    void write() const
+    {
+        if (opts_.output.empty())
+        {
+            write(std::cout);
+            return;
+        }
+        std::ofstream os{opts_.output};
+        write(os);
+    }
+
+    void write(std::ostream& os) const
+    {
+        os << "{\n  \"benchmark\": \"" << benchmark_ << "\",\n"
+           << "  \"compiler\": \"" << compiler() << "\",\n"
+           << "  \"results\": [\n";
+        for (std::size_t i = 0; i < results_.size(); ++i)
+        {
+            os << "    {" << results_[i].json() << '}'
+               << (i + 1 < results_.size() ? ",\n" : "\n");
+        }
+        os << "  ]\n}\n";
+    }
+
+private:
+    static std::string compiler()
+    {
+#if defined(__clang__)
+        return "clang " __clang_version__;
+#elif defined(__GNUC__)
+        return "gcc " __VERSION__;
+#else
+        return "unknown";
+#endif
+    }
+
+    std::string benchmark_;
+    options opts_;
+    std::vector<result> results_;
+};
+
+} // namespace bench
+
+#endif // CANARY_BENCH_BENCH_HPP
@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Frames per second the bus load estimator processes: bit counting with
+// exact and worst-case stuffing, and the monitor, for random classic and
+// CAN FD traffic. A saturated 1 Mbit/s classic bus carries fewer than 20000
+// frames per second. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/bus_load.hpp>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+struct classic_frame
+{
+    static constexpr char const* type = "classic";
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+struct fd_frame
+{
+    static constexpr char const* type = "fd";
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 64> payload{};
+};
+
+template<class Frame>
+std::vector<Frame>
+make_traffic(std::size_t frames)
+{
+    std::mt19937 rng{7};
+    std::uniform_int_distribution<std::uint32_t> id{0, 0x7FF};
+    std::uniform_int_distribution<int> byte{0, 255};
+    std::vector<Frame> traffic(frames);
+    for (auto& f : traffic)
+    {
+        f.header.id(id(rng));
+        f.header.payload_length(f.payload.size());
+        f.header.bit_rate_switch(true);
+        for (auto& b : f.payload)
+        {
+            b = static_cast<std::uint8_t>(byte(rng));
+        }
+    }
+    return traffic;
+}
+
+char const*
+mode_name(canary::stuffing mode)
+{
+    return mode == canary::stuffing::exact ? "exact" : "worst_case";
+}
+
+template<class Frame>
+bench::result
+count(bench::options const& opts, canary::stuffing mode)
+{
+    auto const traffic = make_traffic<Frame>(opts.frames);
+    std::uint64_t bits = 0;
+    auto const start = clock::now();
+    for (auto const& f : traffic)
+    {
+        bits += canary::count_frame_bits(net::buffer(&f, sizeof(f)), mode)
+                  .total();
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{"count_frame_bits"}
+      .value("frame_type", Frame::type)
+      .value("stuffing", mode_name(mode))
+      .throughput(traffic.size(), elapsed)
+      .value("bits", static_cast<std::size_t>(bits));
+}
+
+template<class Frame>
+bench::result
+monitor(bench::options const& opts, bool per_id)
+{
+    auto const traffic = make_traffic<Frame>(opts.frames);
+    canary::bus_load_monitor::options mopts;
+    mopts.per_id = per_id;
+    canary::bus_load_monitor monitor{mopts};
+    auto time = canary::timestamp_now();
+    auto const start = clock::now();
+    for (auto const& f : traffic)
+    {
+        time += std::chrono::microseconds{100};
+        monitor.add(net::buffer(&f, sizeof(f)), time);
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{"monitor"}
+      .value("frame_type", Frame::type)
+      .value("per_id", per_id)
+      .throughput(traffic.size(), elapsed)
+      .value("load", monitor.load(0, time));
+}
+
+template<class Frame>
+void
+run(bench::report& report, bench::options const& opts)
+{
+    report.add(count<Frame>(opts, canary::stuffing::exact));
+    report.add(count<Frame>(opts, canary::stuffing::worst_case));
+    report.add(monitor<Frame>(opts, false));
+    report.add(monitor<Frame>(opts, true));
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"bus_load", opts};
+    run<classic_frame>(report, opts);
+    run<fd_frame>(report, opts);
+    report.write();
+}
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Cost per frame of the change-detection filter, for traffic in which a
+// varying fraction of frames changed, compared to decoding every signal of
+// the frames. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/change_filter.hpp>
+#include <canary/signal.hpp>
+
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+constexpr std::uint32_t distinct_ids = 256;
+
+struct classic_frame
+{
+    static constexpr char const* type = "classic";
+    static constexpr unsigned int signal_bits = 8;
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+struct fd_frame
+{
+    static constexpr char const* type = "fd";
+    static constexpr unsigned int signal_bits = 32;
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 64> payload{};
+};
+
+// Traffic cycling through `distinct_ids` IDs, in which `change_percent` of
+// the IDs carry a different payload in every frame, and the others always
+// carry the same payload.
+template<class Frame>
+std::vector<Frame>
+make_traffic(std::size_t frames, std::size_t change_percent)
+{
+    std::vector<Frame> traffic(frames);
+    for (std::size_t i = 0; i < frames; ++i)
+    {
+        auto& f = traffic[i];
+        auto const id = static_cast<std::uint32_t>(i % distinct_ids);
+        f.header.id(id);
+        f.header.payload_length(f.payload.size());
+        if (id * 100 < change_percent * distinct_ids)
+        {
+            auto const round = static_cast<std::uint32_t>(i / distinct_ids);
+            std::memcpy(&f.payload.back() - 3, &round, sizeof(round));
+        }
+    }
+    return traffic;
+}
+
+template<class Frame>
+bench::result
+filter(bench::options const& opts, std::size_t change_percent)
+{
+    auto const traffic = make_traffic<Frame>(opts.frames, change_percent);
+    canary::change_filter filter;
+    auto const now = canary::timestamp_now();
+    auto const start = clock::now();
+    for (auto const& f : traffic)
+    {
+        filter.accept(net::buffer(&f, sizeof(f)), now);
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{"filter"}
+      .value("frame_type", Frame::type)
+      .value("change_percent", change_percent)
+      .throughput(traffic.size(), elapsed)
+      .value("passed", filter.passed());
+}
+
+template<class Frame>
+bench::result
+decode(bench::options const& opts)
+{
+    auto const traffic = make_traffic<Frame>(opts.frames, 100);
+    std::vector<canary::signal_definition> signals;
+    for (unsigned int bit = 0; bit < 8 * sizeof(Frame{}.payload);
+         bit += Frame::signal_bits)
+    {
+        signals.push_back(canary::signal_definition{}
+                            .start_bit(bit)
+                            .length(Frame::signal_bits)
+                            .scale(0.5, -10.0));
+    }
+
+    double sum = 0;
+    auto const start = clock::now();
+    for (auto const& f : traffic)
+    {
+        for (auto const& s : signals)
+        {
+            sum += canary::decode(s, f.payload.data(), f.payload.size());
+        }
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{"decode"}
+      .value("frame_type", Frame::type)
+      .value("signals", signals.size())
+      .throughput(traffic.size(), elapsed)
+      .value("checksum", sum);
+}
+
+template<class Frame>
+void
+run(bench::report& report, bench::options const& opts)
+{
+    std::size_t const change_percents[] = {0, 10, 100};
+    for (auto p : change_percents)
+    {
+        report.add(filter<Frame>(opts, p));
+    }
+    report.add(decode<Frame>(opts));
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"change_filter", opts};
+    run<classic_frame>(report, opts);
+    run<fd_frame>(report, opts);
+    report.write();
+}
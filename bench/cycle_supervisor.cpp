@@ -0,0 +1,220 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Per-frame cost of supervising the cycle times of 5000 IDs on 4 buses, with
+// periods of 10 ms to 1 s (about 134k frames per second in total, more than
+// 4 fully loaded 1 Mbit/s buses carry), replaying a synthetic trace in which
+// 1% of the IDs stop for a second. The cycle supervisor is compared with
+// re-arming one steady_timer per ID for every frame. The load is the fraction
+// of one core taken at the rate of the trace. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/cycle_supervisor.hpp>
+
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+using std::chrono::milliseconds;
+
+constexpr std::size_t id_count = 5000;
+constexpr unsigned int buses = 4;
+
+struct classic_frame
+{
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+struct record
+{
+    classic_frame frame;
+    std::chrono::nanoseconds offset;
+    unsigned int interface_index;
+    std::size_t index;
+};
+
+struct trace
+{
+    std::vector<milliseconds> periods;
+    std::vector<record> records;
+    double frames_per_second;
+};
+
+std::uint32_t
+id_of(std::size_t i)
+{
+    return static_cast<std::uint32_t>(0x100 + i / buses);
+}
+
+trace
+make_trace(std::size_t frames)
+{
+    std::mt19937 rng{9};
+    milliseconds const choices[] = {milliseconds{10},
+                                    milliseconds{20},
+                                    milliseconds{50},
+                                    milliseconds{100},
+                                    milliseconds{200},
+                                    milliseconds{500},
+                                    milliseconds{1000}};
+    std::uniform_int_distribution<std::size_t> pick{0, 6};
+    std::uniform_real_distribution<double> jitter{-0.05, 0.05};
+    trace t;
+    double rate = 0;
+    using event = std::pair<std::int64_t, std::size_t>;
+    std::priority_queue<event, std::vector<event>, std::greater<event>> next;
+    for (std::size_t i = 0; i < id_count; ++i)
+    {
+        t.periods.push_back(choices[pick(rng)]);
+        auto const p = std::chrono::nanoseconds{t.periods.back()}.count();
+        rate += 1e9 / static_cast<double>(p);
+        next.emplace(static_cast<std::int64_t>(
+                       static_cast<double>(p) * (1.0 + jitter(rng))),
+                     i);
+    }
+    t.frames_per_second = rate;
+
+    // IDs with an index divisible by 100 are silent from 2 to 3 seconds.
+    std::int64_t const silent_begin = 2000000000;
+    std::int64_t const silent_end = 3000000000;
+    t.records.reserve(frames);
+    while (t.records.size() < frames)
+    {
+        auto const e = next.top();
+        next.pop();
+        auto const i = e.second;
+        auto const p = std::chrono::nanoseconds{t.periods[i]}.count();
+        next.emplace(
+          e.first + static_cast<std::int64_t>(static_cast<double>(p) *
+                                              (1.0 + jitter(rng))),
+          i);
+        if (i % 100 == 0 && e.first >= silent_begin && e.first < silent_end)
+        {
+            continue;
+        }
+        record r;
+        r.frame.header.id(id_of(i));
+        r.frame.header.payload_length(8);
+        r.offset = std::chrono::nanoseconds{e.first};
+        r.interface_index = static_cast<unsigned int>(i % buses);
+        r.index = i;
+        t.records.push_back(r);
+    }
+    return t;
+}
+
+double
+ns_per_frame(clock::duration elapsed, std::size_t frames)
+{
+    return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+               .count()) /
+           static_cast<double>(frames);
+}
+
+bench::result
+supervisor(trace const& t)
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor sup{ioc};
+    auto const t0 = canary::cycle_supervisor::clock::now();
+    for (std::size_t i = 0; i < id_count; ++i)
+    {
+        sup.supervise(i % buses, id_of(i), false, t.periods[i], t0);
+    }
+
+    // The wheel is advanced once per tick of trace time, as its timer
+    // would.
+    auto const start = clock::now();
+    auto next_tick = t0;
+    for (auto const& r : t.records)
+    {
+        auto const now = t0 + r.offset;
+        if (now >= next_tick)
+        {
+            sup.advance(now);
+            next_tick = now + milliseconds{1};
+        }
+        sup.update(net::buffer(&r.frame, sizeof(r.frame)),
+                   r.interface_index,
+                   now);
+    }
+    auto const elapsed = clock::now() - start;
+    auto const ns = ns_per_frame(elapsed, t.records.size());
+    return bench::result{"cycle_supervisor"}
+      .value("ids", sup.size())
+      .throughput(t.records.size(), elapsed)
+      .value("ns_per_frame", ns)
+      .value("load", ns * t.frames_per_second / 1e9)
+      .value("timeouts", sup.timeouts())
+      .value("recoveries", sup.recoveries());
+}
+
+bench::result
+timer_per_id(trace const& t)
+{
+    net::io_context ioc{1};
+    std::vector<std::unique_ptr<net::steady_timer>> timers;
+    for (std::size_t i = 0; i < id_count; ++i)
+    {
+        timers.emplace_back(new net::steady_timer{ioc});
+    }
+    std::size_t timeouts = 0;
+
+    auto const start = clock::now();
+    std::size_t n = 0;
+    for (auto const& r : t.records)
+    {
+        auto& timer = *timers[r.index];
+        timer.expires_after(3 * t.periods[r.index]);
+        timer.async_wait([&timeouts](canary::error_code ec) {
+            timeouts += ec ? 0 : 1;
+        });
+        // Runs the handlers of the cancelled waits, as the event loop of a
+        // receiver would.
+        if (++n % 64 == 0)
+        {
+            ioc.poll();
+        }
+    }
+    ioc.poll();
+    auto const elapsed = clock::now() - start;
+    for (auto& timer : timers)
+    {
+        timer->cancel();
+    }
+    ioc.poll();
+    auto const ns = ns_per_frame(elapsed, t.records.size());
+    return bench::result{"timer_per_id"}
+      .value("ids", id_count)
+      .throughput(t.records.size(), elapsed)
+      .value("ns_per_frame", ns)
+      .value("load", ns * t.frames_per_second / 1e9);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"cycle_supervisor", opts};
+    auto const t = make_trace(opts.frames);
+    report.add(supervisor(t));
+    report.add(timer_per_id(t));
+    report.write();
+}
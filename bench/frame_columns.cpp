@@ -0,0 +1,190 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Frames per second converted from classic and CAN FD frame arrays into
+// id, flags, length and payload columns and back, compared with a loop over
+// the frame_header accessors. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/frame_columns.hpp>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+
+struct classic_frame
+{
+    static constexpr char const* type = "classic";
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+struct fd_frame
+{
+    static constexpr char const* type = "fd";
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 64> payload{};
+};
+
+template<class Frame>
+std::vector<Frame>
+make_traffic(std::size_t frames)
+{
+    std::mt19937 rng{7};
+    std::uniform_int_distribution<std::uint32_t> id{0, 0x7FF};
+    std::uniform_int_distribution<int> byte{0, 255};
+    std::vector<Frame> traffic(frames);
+    for (auto& f : traffic)
+    {
+        f.header.id(id(rng));
+        f.header.payload_length(f.payload.size());
+        for (auto& b : f.payload)
+        {
+            b = static_cast<std::uint8_t>(byte(rng));
+        }
+    }
+    return traffic;
+}
+
+template<class Frame>
+struct columns
+{
+    static constexpr std::size_t words = sizeof(Frame::payload) / 8;
+
+    explicit columns(std::size_t n)
+      : id(n)
+      , flags(n)
+      , length(n)
+      , payload(words, std::vector<std::uint64_t>(n))
+    {
+        view.id = id.data();
+        view.flags = flags.data();
+        view.length = length.data();
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            view.payload[w] = payload[w].data();
+        }
+    }
+
+    std::vector<std::uint32_t> id;
+    std::vector<std::uint8_t> flags;
+    std::vector<std::uint8_t> length;
+    std::vector<std::vector<std::uint64_t>> payload;
+    canary::frame_columns view;
+};
+
+// Fills the same columns one frame at a time through the accessors.
+template<class Frame>
+void
+accessor_columns(std::vector<Frame> const& traffic, columns<Frame>& c)
+{
+    for (std::size_t i = 0; i < traffic.size(); ++i)
+    {
+        auto const& h = traffic[i].header;
+        c.id[i] = h.id();
+        c.flags[i] = static_cast<std::uint8_t>(
+          (h.error() ? canary::frame_flag::error : 0) |
+          (h.remote_transmission() ? canary::frame_flag::remote : 0) |
+          (h.extended_format() ? canary::frame_flag::extended : 0) |
+          (h.bit_rate_switch() ? canary::frame_flag::bit_rate_switch : 0) |
+          (h.error_state_indicator()
+             ? canary::frame_flag::error_state_indicator
+             : 0) |
+          (h.fd_format() ? canary::frame_flag::fd_format : 0));
+        c.length[i] = static_cast<std::uint8_t>(h.payload_length());
+        for (std::size_t w = 0; w < columns<Frame>::words; ++w)
+        {
+            std::memcpy(&c.payload[w][i], traffic[i].payload.data() + 8 * w, 8);
+        }
+    }
+}
+
+template<class Frame>
+bench::result
+convert(bench::options const& opts, char const* direction, bool bulk)
+{
+    auto traffic = make_traffic<Frame>(opts.frames);
+    columns<Frame> c{traffic.size()};
+    canary::to_columns(traffic.data(), traffic.size(), c.view);
+    bool const to = std::string{direction} == "to_columns";
+
+    auto const start = clock::now();
+    if (to && bulk)
+    {
+        canary::to_columns(traffic.data(), traffic.size(), c.view);
+    }
+    else if (to)
+    {
+        accessor_columns(traffic, c);
+    }
+    else if (bulk)
+    {
+        canary::from_columns(c.view, traffic.size(), traffic.data());
+    }
+    else
+    {
+        for (std::size_t i = 0; i < traffic.size(); ++i)
+        {
+            auto& h = traffic[i].header;
+            h.id(c.id[i]);
+            auto const flags = c.flags[i];
+            h.error((flags & canary::frame_flag::error) != 0);
+            h.remote_transmission((flags & canary::frame_flag::remote) != 0);
+            h.extended_format((flags & canary::frame_flag::extended) != 0);
+            h.bit_rate_switch((flags & canary::frame_flag::bit_rate_switch) !=
+                              0);
+            h.error_state_indicator(
+              (flags & canary::frame_flag::error_state_indicator) != 0);
+            h.fd_format((flags & canary::frame_flag::fd_format) != 0);
+            h.payload_length(c.length[i]);
+            for (std::size_t w = 0; w < columns<Frame>::words; ++w)
+            {
+                std::memcpy(
+                  traffic[i].payload.data() + 8 * w, &c.payload[w][i], 8);
+            }
+        }
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{direction}
+      .value("frame_type", Frame::type)
+      .value("method", bulk ? "bulk" : "accessors")
+      .throughput(traffic.size(), elapsed);
+}
+
+template<class Frame>
+void
+run(bench::report& report, bench::options const& opts)
+{
+    for (auto direction : {"to_columns", "from_columns"})
+    {
+        report.add(convert<Frame>(opts, direction, false));
+        report.add(convert<Frame>(opts, direction, true));
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"frame_columns", opts};
+    run<classic_frame>(report, opts);
+    run<fd_frame>(report, opts);
+    report.write();
+}
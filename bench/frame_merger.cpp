@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Cost per frame of merging synthetic per-interface streams by timestamp,
+// from 2 to 16 sources. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/frame_merger.hpp>
+
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+struct classic_frame
+{
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+bench::result
+merge(bench::options const& opts, std::size_t sources)
+{
+    canary::frame_merger::options mopts;
+    mopts.sources = sources;
+    canary::frame_merger merger{mopts};
+
+    // Every source pushes frames in bursts of up to 16 frames, with random
+    // gaps, like a receive loop draining a socket.
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> gap{1, 500};
+    std::uniform_int_distribution<std::size_t> burst{1, 16};
+    std::vector<canary::timestamp> next(sources, canary::timestamp{});
+    classic_frame f{};
+    f.header.payload_length(8);
+    std::vector<canary::merged_frame> out;
+    std::size_t emitted = 0;
+
+    auto const start = clock::now();
+    std::size_t pushed = 0;
+    while (pushed < opts.frames)
+    {
+        for (std::size_t s = 0; s < sources && pushed < opts.frames; ++s)
+        {
+            for (auto n = burst(rng); n > 0 && pushed < opts.frames; --n)
+            {
+                next[s] += std::chrono::microseconds{gap(rng)};
+                merger.push(s, net::buffer(&f, sizeof(f)), next[s]);
+                ++pushed;
+            }
+            while (merger.pop(out) > 0)
+            {
+                emitted += out.size();
+            }
+        }
+    }
+    while (merger.drain(out) > 0)
+    {
+        emitted += out.size();
+    }
+    auto const elapsed = clock::now() - start;
+
+    return bench::result{"merge"}
+      .value("sources", sources)
+      .throughput(emitted, elapsed)
+      .value("late", merger.late());
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"frame_merger", opts};
+
+    std::size_t const source_counts[] = {2, 6, 16};
+    for (auto n : source_counts)
+    {
+        report.add(merge(opts, n));
+    }
+
+    report.write();
+}
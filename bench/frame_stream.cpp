@@ -0,0 +1,141 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Throughput and coroutine resumptions per frame of frame_stream, compared
+// to a coroutine awaiting async_receive once per frame.
+
+#include "vcan.hpp"
+
+#include <canary/frame_stream.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/use_awaitable.hpp>
+#else // CANARY_STANDALONE_ASIO
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+template<class Frame>
+bench::result
+per_frame(bench::options const& opts)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    std::size_t received = 0;
+    std::size_t resumes = 0;
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    net::co_spawn(
+      ioc,
+      [&]() -> net::awaitable<void> {
+          Frame f{};
+          while (true)
+          {
+              co_await rx.async_receive(net::buffer(&f, sizeof(f)),
+                                        net::use_awaitable);
+              ++resumes;
+              if (f.header.id() == bench::stop_id)
+              {
+                  co_return;
+              }
+              ++received;
+          }
+      },
+      net::detached);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("api", "async_receive")
+      .value("frame_type", Frame::type)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received)
+      .value("resumes_per_frame",
+             static_cast<double>(resumes) / static_cast<double>(received));
+}
+
+template<class Frame>
+bench::result
+batched(bench::options const& opts, std::size_t batch_size)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    typename canary::frame_stream<Frame>::options stream_opts;
+    stream_opts.batch_size = batch_size;
+    canary::frame_stream<Frame> stream{rx, stream_opts};
+
+    std::size_t received = 0;
+    std::size_t resumes = 0;
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    net::co_spawn(
+      ioc,
+      [&]() -> net::awaitable<void> {
+          while (true)
+          {
+              auto const batch =
+                co_await stream.async_next(net::use_awaitable);
+              ++resumes;
+              for (auto const& f : batch)
+              {
+                  if (f.header.id() == bench::stop_id)
+                  {
+                      co_return;
+                  }
+                  ++received;
+              }
+          }
+      },
+      net::detached);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("api", "frame_stream")
+      .value("frame_type", Frame::type)
+      .value("batch_size", batch_size)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received)
+      .value("resumes_per_frame",
+             static_cast<double>(resumes) / static_cast<double>(received));
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"frame_stream", opts};
+
+    report.add(per_frame<bench::classic_frame>(opts));
+    report.add(per_frame<bench::fd_frame>(opts));
+    std::size_t const batch_sizes[] = {8, 64, 256};
+    for (auto n : batch_sizes)
+    {
+        report.add(batched<bench::classic_frame>(opts, n));
+        report.add(batched<bench::fd_frame>(opts, n));
+    }
+
+    report.write();
+}
@@ -0,0 +1,169 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Forwarding throughput and latency of the userspace gateway, compared to
+// the same route offloaded to the kernel's CAN gateway. Frames are sent on
+// the first interface and received on the second one.
+
+#include "vcan.hpp"
+
+#include <canary/gateway.hpp>
+
+#include <memory>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+// A route from the first to the second interface, forwarded by a userspace
+// gateway on its own thread, or by the kernel.
+class forwarder
+{
+public:
+    forwarder(bench::options const& opts, bool kernel)
+      : src_{bench::open_socket<bench::fd_frame>(ioc_, opts.interface0)}
+      , dst_{bench::open_socket<bench::fd_frame>(ioc_, opts.interface1)}
+    {
+        gateway_.add_route(src_, dst_, canary::gateway::route{});
+        if (kernel)
+        {
+            kernel_.reset(new canary::kernel_gateway{});
+            gateway_.offload(*kernel_);
+        }
+        else
+        {
+            gateway_.start();
+            thread_ = std::thread{[this] { ioc_.run(); }};
+        }
+    }
+
+    ~forwarder()
+    {
+        if (kernel_)
+        {
+            for (auto const& r : gateway_.offloaded())
+            {
+                canary::error_code ec;
+                kernel_->remove(r, ec);
+            }
+            return;
+        }
+        net::post(ioc_, [this] { gateway_.stop(); });
+        thread_.join();
+    }
+
+    std::size_t dropped() const noexcept
+    {
+        return gateway_.dropped();
+    }
+
+private:
+    net::io_context ioc_{1};
+    canary::raw::socket src_;
+    canary::raw::socket dst_;
+    canary::gateway gateway_;
+    std::unique_ptr<canary::kernel_gateway> kernel_;
+    std::thread thread_;
+};
+
+char const*
+path_name(bool kernel)
+{
+    return kernel ? "kernel" : "userspace";
+}
+
+template<class Frame>
+bench::result
+throughput(bench::options const& opts, bool kernel)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface1);
+    forwarder fwd{opts, kernel};
+
+    std::size_t received = 0;
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    Frame f{};
+    while (true)
+    {
+        rx.receive(net::buffer(&f, sizeof(f)));
+        if (f.header.id() == bench::stop_id)
+        {
+            break;
+        }
+        ++received;
+    }
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("path", path_name(kernel))
+      .value("frame_type", Frame::type)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received)
+      .value("dropped", fwd.dropped());
+}
+
+template<class Frame>
+bench::result
+latency(bench::options const& opts, bool kernel)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface1);
+    forwarder fwd{opts, kernel};
+
+    bench::latency_recorder latency{opts.round_trips};
+    auto f = bench::make_frame<Frame>(bench::data_id);
+    for (std::size_t i = 0; i < opts.round_trips; ++i)
+    {
+        auto const start = clock::now();
+        bench::send_frame(tx, f);
+        rx.receive(net::buffer(&f, sizeof(f)));
+        latency.record(clock::now() - start);
+    }
+
+    return bench::result{"latency"}
+      .value("path", path_name(kernel))
+      .value("frame_type", Frame::type)
+      .latency(latency);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"gateway", opts};
+
+    bool const paths[] = {false, true};
+    for (auto kernel : paths)
+    {
+        try
+        {
+            report.add(throughput<bench::classic_frame>(opts, kernel));
+            report.add(throughput<bench::fd_frame>(opts, kernel));
+            report.add(latency<bench::classic_frame>(opts, kernel));
+            report.add(latency<bench::fd_frame>(opts, kernel));
+        }
+        catch (canary::system_error const& e)
+        {
+            // The kernel path requires the can-gw module and CAP_NET_ADMIN.
+            report.add(bench::result{"unavailable"}
+                         .value("path", path_name(kernel))
+                         .value("error", e.what()));
+        }
+    }
+
+    report.write();
+}
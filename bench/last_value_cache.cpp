@@ -0,0 +1,210 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Cost of updating the latest-value cache from a receive path, and how reads
+// scale with the number of reader threads while frames keep arriving,
+// compared to a `std::map` protected by a mutex. No CAN interface is used.
+
+#include "bench.hpp"
+
+#include <canary/last_value_cache.hpp>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+constexpr std::uint32_t distinct_ids = 256;
+
+struct fd_frame
+{
+    canary::frame_header header;
+    std::array<std::uint8_t, 64> payload{};
+};
+
+fd_frame
+make_frame(std::uint32_t id, bool extended)
+{
+    fd_frame f{};
+    f.header.extended_format(extended);
+    f.header.id(id);
+    f.header.payload_length(f.payload.size());
+    return f;
+}
+
+// The lock-free cache.
+class lock_free
+{
+public:
+    static constexpr char const* name = "last_value_cache";
+
+    void update(fd_frame const& f)
+    {
+        cache_.update(net::buffer(&f, sizeof(f)));
+    }
+
+    bool get(std::uint32_t id, bool extended)
+    {
+        return cache_.get(id, extended, snapshot_);
+    }
+
+private:
+    canary::last_value_cache cache_;
+    static thread_local canary::last_value_cache::snapshot snapshot_;
+};
+
+thread_local canary::last_value_cache::snapshot lock_free::snapshot_;
+
+// The usual alternative, a map from ID to frame behind a mutex.
+class locked_map
+{
+public:
+    static constexpr char const* name = "mutex_map";
+
+    void update(fd_frame const& f)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        map_[key(f.header.id(), f.header.extended_format())] = f;
+    }
+
+    bool get(std::uint32_t id, bool extended)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto const it = map_.find(key(id, extended));
+        if (it == map_.end())
+        {
+            return false;
+        }
+        snapshot_ = it->second;
+        return true;
+    }
+
+private:
+    static std::uint32_t key(std::uint32_t id, bool extended)
+    {
+        return extended ? id | 0x80000000U : id;
+    }
+
+    std::mutex mutex_;
+    std::map<std::uint32_t, fd_frame> map_;
+    static thread_local fd_frame snapshot_;
+};
+
+thread_local fd_frame locked_map::snapshot_;
+
+std::vector<fd_frame>
+make_frames(bool extended)
+{
+    std::vector<fd_frame> frames;
+    for (std::uint32_t i = 0; i < distinct_ids; ++i)
+    {
+        frames.push_back(make_frame(extended ? 0x18DA0000 + i : i, extended));
+    }
+    return frames;
+}
+
+template<class Cache>
+bench::result
+writer(bench::options const& opts, bool extended)
+{
+    Cache cache;
+    auto const frames = make_frames(extended);
+    auto const start = clock::now();
+    for (std::size_t i = 0; i < opts.frames; ++i)
+    {
+        cache.update(frames[i % frames.size()]);
+    }
+    auto const elapsed = clock::now() - start;
+    return bench::result{"update"}
+      .value("cache", Cache::name)
+      .value("extended", extended)
+      .throughput(opts.frames, elapsed);
+}
+
+template<class Cache>
+bench::result
+readers(bench::options const& opts, std::size_t count)
+{
+    Cache cache;
+    auto const frames = make_frames(false);
+    for (auto const& f : frames)
+    {
+        cache.update(f);
+    }
+
+    std::atomic<bool> done{false};
+    std::atomic<std::size_t> reads{0};
+    std::vector<std::thread> threads;
+    for (std::size_t r = 0; r < count; ++r)
+    {
+        threads.emplace_back([&, r] {
+            std::size_t n = 0;
+            auto id = static_cast<std::uint32_t>(r);
+            while (!done.load(std::memory_order_relaxed))
+            {
+                cache.get(id++ % distinct_ids, false);
+                ++n;
+            }
+            reads += n;
+        });
+    }
+
+    auto const start = clock::now();
+    for (std::size_t i = 0; i < opts.frames; ++i)
+    {
+        cache.update(frames[i % frames.size()]);
+    }
+    auto const elapsed = clock::now() - start;
+    done = true;
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    auto const seconds =
+      std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+        .count();
+    return bench::result{"readers"}
+      .value("cache", Cache::name)
+      .value("readers", count)
+      .throughput(opts.frames, elapsed)
+      .value("reads_per_second", static_cast<double>(reads) / seconds);
+}
+
+template<class Cache>
+void
+run(bench::report& report, bench::options const& opts)
+{
+    report.add(writer<Cache>(opts, false));
+    report.add(writer<Cache>(opts, true));
+    std::size_t const reader_counts[] = {1, 2, 4, 8};
+    for (auto n : reader_counts)
+    {
+        report.add(readers<Cache>(opts, n));
+    }
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"last_value_cache", opts};
+    run<lock_free>(report, opts);
+    run<locked_map>(report, opts);
+    report.write();
+}
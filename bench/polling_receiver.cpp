@@ -0,0 +1,130 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Round-trip latency distribution of polling_receiver compared to the
+// reactor (epoll) based async_receive path.
+
+#include "vcan.hpp"
+
+#include <canary/polling_receiver.hpp>
+
+#include <functional>
+#include <iostream>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+bench::result
+epoll_round_trip(bench::options const& opts)
+{
+    using frame = bench::classic_frame;
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<frame>(ioc, opts.interface1);
+    bench::latency_recorder latency{opts.round_trips};
+    {
+        bench::echo_server<frame> echo{opts, 0};
+        auto f = bench::make_frame<frame>(bench::data_id);
+        std::size_t remaining = opts.round_trips;
+        auto start = clock::now();
+        std::function<void(canary::error_code, std::size_t)> on_receive =
+          [&](canary::error_code ec, std::size_t) {
+              latency.record(clock::now() - start);
+              if (ec || --remaining == 0)
+              {
+                  return;
+              }
+              start = clock::now();
+              bench::send_frame(tx, f);
+              rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+          };
+        bench::send_frame(tx, f);
+        rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+        ioc.run();
+        bench::send_stop<frame>(tx);
+    }
+
+    return bench::result{"round_trip"}
+      .value("receiver", "epoll")
+      .latency(latency);
+}
+
+bench::result
+polling_round_trip(bench::options const& opts,
+                   canary::polling_receiver::options const& popts,
+                   char const* name)
+{
+    using frame = bench::classic_frame;
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<frame>(ioc, opts.interface0);
+    auto rx_sock = bench::open_socket<frame>(ioc, opts.interface1);
+    canary::polling_receiver rx{rx_sock, popts};
+    bench::latency_recorder latency{opts.round_trips};
+    {
+        bench::echo_server<frame> echo{opts, 0};
+        auto f = bench::make_frame<frame>(bench::data_id);
+        std::size_t remaining = opts.round_trips;
+        auto start = clock::now();
+        std::function<void(canary::error_code, std::size_t)> on_receive =
+          [&](canary::error_code ec, std::size_t) {
+              latency.record(clock::now() - start);
+              if (ec || --remaining == 0)
+              {
+                  return;
+              }
+              start = clock::now();
+              bench::send_frame(tx, f);
+              rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+          };
+        bench::send_frame(tx, f);
+        rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+        rx.run();
+        bench::send_stop<frame>(tx);
+    }
+
+    return bench::result{"round_trip"}
+      .value("receiver", name)
+      .value("blocking_waits", rx.blocking_waits())
+      .latency(latency);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"polling_receiver", opts};
+
+    report.add(epoll_round_trip(opts));
+
+    canary::polling_receiver::options popts;
+    report.add(polling_round_trip(opts, popts, "polling"));
+
+    popts.busy_poll = std::chrono::microseconds{50};
+    report.add(polling_round_trip(opts, popts, "polling_busy_poll"));
+
+    // Pinning and real-time scheduling need a spare CPU and privileges.
+    popts.cpu = 1;
+    popts.fifo_priority = 50;
+    try
+    {
+        report.add(polling_round_trip(opts, popts, "polling_pinned_fifo"));
+    }
+    catch (canary::system_error const& e)
+    {
+        std::cerr << "skipping pinned SCHED_FIFO scenario: " << e.what()
+                  << '\n';
+    }
+
+    report.write();
+}
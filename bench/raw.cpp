@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Throughput and round-trip latency of the send/receive paths of raw CAN
+// sockets over virtual CAN interfaces.
+
+#include "vcan.hpp"
+
+#include <functional>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+template<class Frame>
+bench::result
+sync_throughput(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0, filters);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    std::size_t received = 0;
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    Frame f{};
+    while (true)
+    {
+        rx.receive(net::buffer(&f, sizeof(f)));
+        if (f.header.id() == bench::stop_id)
+        {
+            break;
+        }
+        ++received;
+    }
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("api", "sync")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received);
+}
+
+template<class Frame>
+bench::result
+async_throughput(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0, filters);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    std::size_t received = 0;
+    Frame f{};
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    std::function<void(canary::error_code, std::size_t)> on_receive =
+      [&](canary::error_code ec, std::size_t) {
+          if (ec || f.header.id() == bench::stop_id)
+          {
+              return;
+          }
+          ++received;
+          rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+      };
+    rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("api", "async_receive")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received);
+}
+
+template<class Frame>
+bench::result
+sync_round_trip(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface1);
+    bench::latency_recorder latency{opts.round_trips};
+    {
+        bench::echo_server<Frame> echo{opts, filters};
+        auto f = bench::make_frame<Frame>(bench::data_id);
+        for (std::size_t i = 0; i < opts.round_trips; ++i)
+        {
+            auto const start = clock::now();
+            bench::send_frame(tx, f);
+            rx.receive(net::buffer(&f, sizeof(f)));
+            latency.record(clock::now() - start);
+        }
+        bench::send_stop<Frame>(tx);
+    }
+
+    return bench::result{"round_trip"}
+      .value("api", "sync")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .latency(latency);
+}
+
+template<class Frame>
+bench::result
+async_round_trip(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface1);
+    bench::latency_recorder latency{opts.round_trips};
+    {
+        bench::echo_server<Frame> echo{opts, filters};
+        auto f = bench::make_frame<Frame>(bench::data_id);
+        std::size_t remaining = opts.round_trips;
+        auto start = clock::now();
+        std::function<void(canary::error_code, std::size_t)> on_receive =
+          [&](canary::error_code ec, std::size_t) {
+              latency.record(clock::now() - start);
+              if (ec || --remaining == 0)
+              {
+                  return;
+              }
+              start = clock::now();
+              bench::send_frame(tx, f);
+              rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+          };
+        bench::send_frame(tx, f);
+        rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+        ioc.run();
+        bench::send_stop<Frame>(tx);
+    }
+
+    return bench::result{"round_trip"}
+      .value("api", "async_receive")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .latency(latency);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"raw", opts};
+
+    report.add(sync_throughput<bench::classic_frame>(opts, 0));
+    report.add(sync_throughput<bench::fd_frame>(opts, 0));
+    report.add(async_throughput<bench::classic_frame>(opts, 0));
+    report.add(async_throughput<bench::fd_frame>(opts, 0));
+
+    report.add(sync_round_trip<bench::classic_frame>(opts, 0));
+    report.add(sync_round_trip<bench::fd_frame>(opts, 0));
+    report.add(async_round_trip<bench::classic_frame>(opts, 0));
+    report.add(async_round_trip<bench::fd_frame>(opts, 0));
+
+    std::size_t const filter_counts[] = {1, 8, 64, CAN_RAW_FILTER_MAX};
+    for (auto n : filter_counts)
+    {
+        report.add(sync_throughput<bench::classic_frame>(opts, n));
+        report.add(async_throughput<bench::classic_frame>(opts, n));
+        report.add(sync_round_trip<bench::classic_frame>(opts, n));
+    }
+
+    report.write();
+}
@@ -0,0 +1,126 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Throughput and round-trip latency of raw CAN sockets driven by C++20
+// coroutines, as in examples/raw/async/cpp20_coro.cpp.
+
+#include "vcan.hpp"
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/co_spawn.hpp>
+#include <asio/detached.hpp>
+#include <asio/use_awaitable.hpp>
+#else // CANARY_STANDALONE_ASIO
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+template<class Frame>
+bench::result
+coro_throughput(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0, filters);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    std::size_t received = 0;
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    net::co_spawn(
+      ioc,
+      [&]() -> net::awaitable<void> {
+          Frame f{};
+          while (true)
+          {
+              co_await rx.async_receive(net::buffer(&f, sizeof(f)),
+                                        net::use_awaitable);
+              if (f.header.id() == bench::stop_id)
+              {
+                  co_return;
+              }
+              ++received;
+          }
+      },
+      net::detached);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+    sender.join();
+
+    return bench::result{"throughput"}
+      .value("api", "coroutine")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .throughput(received, elapsed)
+      .value("lost", opts.frames - received);
+}
+
+template<class Frame>
+bench::result
+coro_round_trip(bench::options const& opts, std::size_t filters)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface1);
+    bench::latency_recorder latency{opts.round_trips};
+    {
+        bench::echo_server<Frame> echo{opts, filters};
+        net::co_spawn(
+          ioc,
+          [&]() -> net::awaitable<void> {
+              auto f = bench::make_frame<Frame>(bench::data_id);
+              for (std::size_t i = 0; i < opts.round_trips; ++i)
+              {
+                  auto const start = clock::now();
+                  bench::send_frame(tx, f);
+                  co_await rx.async_receive(net::buffer(&f, sizeof(f)),
+                                            net::use_awaitable);
+                  latency.record(clock::now() - start);
+              }
+          },
+          net::detached);
+        ioc.run();
+        bench::send_stop<Frame>(tx);
+    }
+
+    return bench::result{"round_trip"}
+      .value("api", "coroutine")
+      .value("frame_type", Frame::type)
+      .value("filters", filters)
+      .latency(latency);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"raw_coro", opts};
+
+    report.add(coro_throughput<bench::classic_frame>(opts, 0));
+    report.add(coro_throughput<bench::fd_frame>(opts, 0));
+    report.add(coro_round_trip<bench::classic_frame>(opts, 0));
+    report.add(coro_round_trip<bench::fd_frame>(opts, 0));
+
+    std::size_t const filter_counts[] = {1, 8, 64, CAN_RAW_FILTER_MAX};
+    for (auto n : filter_counts)
+    {
+        report.add(coro_throughput<bench::classic_frame>(opts, n));
+        report.add(coro_round_trip<bench::classic_frame>(opts, n));
+    }
+
+    report.write();
+}
@@ -0,0 +1,109 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Scaling of sharded_receiver from 1 to 8 workers, with a fixed amount of
+// simulated decoding work per frame.
+
+#include "vcan.hpp"
+
+#include <canary/sharded_receiver.hpp>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+// Busy-waits for `d`, standing in for per-frame decoding work.
+void
+work(clock::duration d)
+{
+    auto const until = clock::now() + d;
+    while (clock::now() < until)
+    {
+    }
+}
+
+bench::result
+scale(bench::options const& opts,
+      std::size_t workers,
+      clock::duration per_frame)
+{
+    auto const ep = canary::raw::endpoint{
+      canary::get_interface_index(opts.interface0)};
+    canary::sharded_receiver::options ropts;
+    ropts.workers = workers;
+    ropts.bucket_bits = 8;
+    ropts.pin_workers = true;
+    ropts.first_cpu = 1;
+    ropts.rebalance_interval = std::chrono::milliseconds{100};
+
+    std::atomic<std::size_t> processed{0};
+    canary::sharded_receiver receiver{
+      ep, ropts, [&](std::size_t, canary::sharded_receiver::frame const&) {
+          work(per_frame);
+          processed.fetch_add(1, std::memory_order_relaxed);
+      }};
+    receiver.start();
+
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<bench::fd_frame>(ioc, opts.interface0);
+    auto f = bench::make_frame<bench::fd_frame>(0);
+    auto const start = clock::now();
+    for (std::size_t i = 0; i < opts.frames; ++i)
+    {
+        f.header.id(static_cast<std::uint32_t>(i % 0x7FF));
+        bench::send_frame(tx, f);
+    }
+
+    // Wait until no more frames are processed for a while.
+    auto last = processed.load();
+    auto last_change = clock::now();
+    auto done = last_change;
+    while (clock::now() - last_change < std::chrono::milliseconds{200})
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        auto const now = processed.load();
+        if (now != last)
+        {
+            last = now;
+            last_change = done = clock::now();
+        }
+    }
+    receiver.stop();
+
+    return bench::result{"sharded_receiver"}
+      .value("workers", workers)
+      .value("work_ns",
+             static_cast<std::size_t>(
+               std::chrono::duration_cast<std::chrono::nanoseconds>(per_frame)
+                 .count()))
+      .throughput(last, done - start)
+      .value("lost", opts.frames - last)
+      .value("handoffs", static_cast<std::size_t>(receiver.handoffs()));
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"sharded_receiver", opts};
+
+    std::size_t const worker_counts[] = {1, 2, 4, 8};
+    for (auto n : worker_counts)
+    {
+        report.add(scale(opts, n, std::chrono::microseconds{0}));
+        report.add(scale(opts, n, std::chrono::microseconds{2}));
+        report.add(scale(opts, n, std::chrono::microseconds{10}));
+    }
+
+    report.write();
+}
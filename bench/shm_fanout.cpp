@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// CPU time spent delivering every frame to N consumers, each with its own raw
+// socket, compared to one raw socket fanned out through shared memory. The
+// CPU time of the whole process, including the sender, is measured.
+
+#include "vcan.hpp"
+
+#include <canary/shm_fanout.hpp>
+
+#include <memory>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+// User and system CPU time used by all threads of the process.
+clock::duration
+cpu_time()
+{
+    ::rusage ru{};
+    ::getrusage(RUSAGE_SELF, &ru);
+    auto const us = [](::timeval const& tv) {
+        return std::chrono::seconds{tv.tv_sec} +
+               std::chrono::microseconds{tv.tv_usec};
+    };
+    return std::chrono::duration_cast<clock::duration>(us(ru.ru_utime) +
+                                                       us(ru.ru_stime));
+}
+
+bench::result
+make_result(char const* path,
+            std::size_t consumers,
+            std::size_t received,
+            clock::duration elapsed,
+            clock::duration cpu)
+{
+    auto const cpu_ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(cpu).count();
+    return bench::result{"fanout"}
+      .value("path", path)
+      .value("consumers", consumers)
+      .throughput(received, elapsed)
+      .value("cpu_ms", static_cast<double>(cpu_ns) / 1e6)
+      .value("cpu_ns_per_delivery",
+             received > 0 ? static_cast<double>(cpu_ns) /
+                              static_cast<double>(received)
+                          : 0.0);
+}
+
+bench::result
+sockets(bench::options const& opts, std::size_t consumers)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<bench::classic_frame>(ioc, opts.interface0);
+    std::vector<canary::raw::socket> rxs;
+    for (std::size_t i = 0; i < consumers; ++i)
+    {
+        rxs.push_back(
+          bench::open_socket<bench::classic_frame>(ioc, opts.interface0));
+    }
+
+    std::atomic<std::size_t> received{0};
+    auto const cpu_start = cpu_time();
+    auto const start = clock::now();
+    std::vector<std::thread> threads;
+    for (auto& rx : rxs)
+    {
+        threads.emplace_back([&rx, &received] {
+            bench::classic_frame f{};
+            std::size_t n = 0;
+            while (true)
+            {
+                rx.receive(net::buffer(&f, sizeof(f)));
+                if (f.header.id() == bench::stop_id)
+                {
+                    break;
+                }
+                ++n;
+            }
+            received += n;
+        });
+    }
+    bench::flood<bench::classic_frame>(tx, opts.frames);
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    auto const elapsed = clock::now() - start;
+    return make_result(
+      "sockets", consumers, received, elapsed, cpu_time() - cpu_start);
+}
+
+bench::result
+shared_memory(bench::options const& opts, std::size_t consumers)
+{
+    auto const path =
+      "/dev/shm/canary-bench-" + std::to_string(::getpid());
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<bench::classic_frame>(ioc, opts.interface0);
+    auto rx = bench::open_socket<bench::classic_frame>(ioc, opts.interface0);
+    canary::shm_publisher::options popts;
+    popts.capacity = 1 << 16;
+    canary::shm_publisher pub{path, popts};
+    std::vector<std::unique_ptr<canary::shm_subscriber>> subs;
+    for (std::size_t i = 0; i < consumers; ++i)
+    {
+        subs.emplace_back(new canary::shm_subscriber{path});
+    }
+
+    std::atomic<std::size_t> received{0};
+    std::atomic<std::size_t> lost{0};
+    auto const cpu_start = cpu_time();
+    auto const start = clock::now();
+    pub.start(rx);
+    std::thread publisher{[&ioc] { ioc.run(); }};
+    std::vector<std::thread> threads;
+    for (auto& sub : subs)
+    {
+        threads.emplace_back([&sub, &received, &lost] {
+            std::array<std::uint8_t, canary::fd_frame_size> b{};
+            canary::frame_header h;
+            std::size_t n = 0;
+            canary::error_code ec;
+            while (sub->receive(
+                     net::buffer(b), std::chrono::seconds{1}, ec) > 0)
+            {
+                std::memcpy(&h, b.data(), sizeof(h));
+                if (h.id() == bench::stop_id)
+                {
+                    break;
+                }
+                ++n;
+            }
+            received += n;
+            lost += sub->lost();
+        });
+    }
+    bench::flood<bench::classic_frame>(tx, opts.frames);
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    auto const elapsed = clock::now() - start;
+    auto const cpu = cpu_time() - cpu_start;
+    net::post(ioc, [&] { pub.stop(rx); });
+    publisher.join();
+    return make_result("shared_memory", consumers, received, elapsed, cpu)
+      .value("lost", static_cast<std::size_t>(lost))
+      .value("wakeups", static_cast<std::size_t>(pub.wakeups()));
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"shm_fanout", opts};
+
+    std::size_t const consumer_counts[] = {1, 4, 16};
+    for (auto n : consumer_counts)
+    {
+        report.add(sockets(opts, n));
+        report.add(shared_memory(opts, n));
+    }
+
+    report.write();
+}
@@ -0,0 +1,145 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Frames per second delivered by the simulated bus in virtual time, from 1 to
+// 64 sending nodes to a receive loop, with and without injected errors. The
+// speedup is the simulated bus time divided by the wall-clock time. No CAN
+// interface is used.
+
+#include "bench.hpp"
+
+#include <canary/receive_loop.hpp>
+#include <canary/sim.hpp>
+
+#include <memory>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+struct classic_frame
+{
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+// Sends its share of frames, waiting whenever the transmit queue is full.
+class sender
+{
+public:
+    sender(canary::sim::bus& bus, std::uint32_t id, std::size_t frames)
+      : sock_{bus}
+      , remaining_{frames}
+    {
+        frame_.header.id(id);
+        frame_.header.payload_length(8);
+    }
+
+    void run()
+    {
+        canary::error_code ec;
+        while (remaining_ > 0)
+        {
+            ++frame_.payload[0];
+            sock_.send(net::buffer(&frame_, sizeof(frame_)), 0, ec);
+            if (ec)
+            {
+                sock_.async_wait(canary::sim::socket::wait_write,
+                                 [this](canary::error_code) { run(); });
+                return;
+            }
+            --remaining_;
+        }
+    }
+
+private:
+    canary::sim::socket sock_;
+    classic_frame frame_;
+    std::size_t remaining_;
+};
+
+bench::result
+deliver(bench::options const& opts, std::size_t nodes, double errors)
+{
+    net::io_context ioc{1};
+    canary::sim::bus::options bopts;
+    bopts.error_probability = errors;
+    canary::sim::bus bus{ioc, bopts};
+    canary::sim::socket rx{bus};
+
+    std::vector<std::unique_ptr<sender>> senders;
+    for (std::size_t i = 0; i < nodes; ++i)
+    {
+        senders.emplace_back(new sender{
+          bus, static_cast<std::uint32_t>(0x100 + i), opts.frames / nodes});
+    }
+    auto const total = opts.frames / nodes * nodes;
+
+    canary::handler_arena arena;
+    classic_frame in{};
+    std::size_t received = 0;
+    auto const start = clock::now();
+    for (auto& s : senders)
+    {
+        s->run();
+    }
+    canary::async_receive_loop(
+      rx,
+      arena,
+      net::buffer(&in, sizeof(in)),
+      [&](canary::error_code ec, std::size_t) {
+          if (ec)
+          {
+              return false;
+          }
+          // Drains the frames delivered by the current batch of the bus.
+          canary::error_code rec;
+          do
+          {
+              ++received;
+          } while (rx.receive(net::buffer(&in, sizeof(in)), 0, rec) > 0);
+          return received < total;
+      });
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+
+    auto const simulated =
+      std::chrono::duration_cast<std::chrono::duration<double>>(
+        bus.elapsed());
+    auto const wall =
+      std::chrono::duration_cast<std::chrono::duration<double>>(elapsed);
+    return bench::result{"deliver"}
+      .value("nodes", nodes)
+      .value("error_probability", errors)
+      .throughput(received, elapsed)
+      .value("bus_errors", bus.errors())
+      .value("dropped", rx.dropped())
+      .value("speedup", simulated.count() / wall.count());
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"sim", opts};
+
+    std::size_t const node_counts[] = {1, 16, 64};
+    for (auto n : node_counts)
+    {
+        report.add(deliver(opts, n, 0.0));
+    }
+    report.add(deliver(opts, 16, 0.01));
+
+    report.write();
+}
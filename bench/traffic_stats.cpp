@@ -0,0 +1,187 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Per-frame cost of the traffic statistics, replaying a synthetic trace of
+// 1M frames per second over 2 interfaces, for increasing numbers of IDs with
+// periods spread over two orders of magnitude. The load is the fraction of
+// one core the statistics take at that rate. The cost of a snapshot and of
+// the difference of two snapshots is reported as well. No CAN interface is
+// used.
+
+#include "bench.hpp"
+
+#include <canary/traffic_stats.hpp>
+
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+struct classic_frame
+{
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+struct record
+{
+    classic_frame frame;
+    canary::timestamp time;
+    unsigned int interface_index;
+};
+
+// Every ID repeats with its own period, with up to 5% of jitter, and the
+// periods are scaled so that the trace carries 1M frames per second.
+std::vector<record>
+make_trace(std::size_t frames, std::size_t ids)
+{
+    std::mt19937 rng{3};
+    std::uniform_real_distribution<double> period{1.0, 100.0};
+    std::uniform_real_distribution<double> jitter{-0.05, 0.05};
+    std::vector<double> periods(ids);
+    double rate = 0;
+    for (auto& p : periods)
+    {
+        p = period(rng);
+        rate += 1.0 / p;
+    }
+    // Seconds per unit of period, so that the rates add up to 1M per second.
+    auto const scale = rate / 1e6;
+
+    using event = std::pair<double, std::size_t>;
+    std::priority_queue<event, std::vector<event>, std::greater<event>> next;
+    for (std::size_t i = 0; i < ids; ++i)
+    {
+        next.emplace(periods[i] * scale * (1.0 + jitter(rng)), i);
+    }
+    std::vector<record> trace(frames);
+    for (auto& r : trace)
+    {
+        auto const e = next.top();
+        next.pop();
+        auto const i = e.second;
+        // A quarter of the IDs, and all IDs which do not fit in 11 bits,
+        // are extended.
+        auto const n = static_cast<std::uint32_t>(i / 2);
+        r.interface_index = static_cast<unsigned int>(i % 2);
+        r.frame.header.extended_format(n >= 0x800 || n % 4 == 3);
+        r.frame.header.id(r.frame.header.extended_format() ? 0x18DA0000 + n
+                                                           : n);
+        r.frame.header.payload_length(i % 9);
+        r.time = canary::timestamp{std::chrono::nanoseconds{
+          static_cast<std::int64_t>(e.first * 1e9)}};
+        next.emplace(e.first + periods[i] * scale * (1.0 + jitter(rng)), i);
+    }
+    return trace;
+}
+
+std::size_t
+capacity_for(std::size_t ids)
+{
+    std::size_t n = 1;
+    while (n < 2 * ids)
+    {
+        n *= 2;
+    }
+    return n;
+}
+
+bench::result
+add(bench::options const& opts, std::size_t ids)
+{
+    auto const trace = make_trace(opts.frames, ids);
+    canary::traffic_stats::options sopts;
+    sopts.capacity = capacity_for(ids);
+    canary::traffic_stats stats{sopts};
+
+    auto const start = clock::now();
+    for (auto const& r : trace)
+    {
+        stats.add(net::buffer(&r.frame, sizeof(r.frame)),
+                  r.time,
+                  r.interface_index);
+    }
+    auto const elapsed = clock::now() - start;
+    auto const ns_per_frame =
+      static_cast<double>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+          .count()) /
+      static_cast<double>(trace.size());
+    return bench::result{"add"}
+      .value("ids", stats.size())
+      .throughput(trace.size(), elapsed)
+      .value("ns_per_frame", ns_per_frame)
+      .value("load_at_1m", ns_per_frame / 1000.0);
+}
+
+bench::result
+snapshot(bench::options const& opts, std::size_t ids)
+{
+    auto const trace = make_trace(opts.frames, ids);
+    canary::traffic_stats::options sopts;
+    sopts.capacity = capacity_for(ids);
+    canary::traffic_stats stats{sopts};
+    auto const half = trace.size() / 2;
+    for (std::size_t i = 0; i < half; ++i)
+    {
+        auto const& r = trace[i];
+        stats.add(net::buffer(&r.frame, sizeof(r.frame)),
+                  r.time,
+                  r.interface_index);
+    }
+    auto const older = stats.snapshot();
+    for (std::size_t i = half; i < trace.size(); ++i)
+    {
+        auto const& r = trace[i];
+        stats.add(net::buffer(&r.frame, sizeof(r.frame)),
+                  r.time,
+                  r.interface_index);
+    }
+
+    auto const start = clock::now();
+    auto const newer = stats.snapshot();
+    auto const taken = clock::now();
+    auto const diff = newer.since(older);
+    auto const done = clock::now();
+    auto const us = [](clock::duration d) {
+        return static_cast<double>(
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(d)
+                   .count()) /
+               1e3;
+    };
+    return bench::result{"snapshot"}
+      .value("ids", newer.ids.size())
+      .value("snapshot_us", us(taken - start))
+      .value("since_us", us(done - taken))
+      .value("active_ids", diff.ids.size());
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto opts = bench::options::parse(argc, argv);
+    bench::report report{"traffic_stats", opts};
+    std::size_t const id_counts[] = {64, 1024, 8192};
+    for (auto n : id_counts)
+    {
+        report.add(add(opts, n));
+    }
+    for (auto n : id_counts)
+    {
+        report.add(snapshot(opts, n));
+    }
+    report.write();
+}
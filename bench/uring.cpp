@@ -0,0 +1,223 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Receive and send paths of uring_socket compared to the reactor (epoll)
+// based paths of raw sockets, in frames per second and CPU time spent per
+// frame by the thread doing the I/O.
+
+#include "vcan.hpp"
+
+#include <canary/uring.hpp>
+
+#include <ctime>
+#include <functional>
+
+namespace
+{
+
+using bench::clock;
+namespace net = canary::net;
+
+std::chrono::nanoseconds
+thread_cpu_time()
+{
+    ::timespec ts{};
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return std::chrono::seconds{ts.tv_sec} +
+           std::chrono::nanoseconds{ts.tv_nsec};
+}
+
+double
+per_frame(std::chrono::nanoseconds cpu, std::size_t frames)
+{
+    return frames == 0 ? 0.0
+                       : static_cast<double>(cpu.count()) /
+                           static_cast<double>(frames);
+}
+
+template<class Frame>
+bench::result
+epoll_receive(bench::options const& opts)
+{
+    net::io_context ioc{1};
+    auto rx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    std::size_t received = 0;
+    Frame f{};
+    auto const cpu = thread_cpu_time();
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    std::function<void(canary::error_code, std::size_t)> on_receive =
+      [&](canary::error_code ec, std::size_t) {
+          if (ec || f.header.id() == bench::stop_id)
+          {
+              return;
+          }
+          ++received;
+          rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+      };
+    rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+    auto const used = thread_cpu_time() - cpu;
+    sender.join();
+
+    return bench::result{"receive"}
+      .value("backend", "epoll")
+      .value("frame_type", Frame::type)
+      .throughput(received, elapsed)
+      .value("cpu_ns_per_frame", per_frame(used, received))
+      .value("lost", opts.frames - received);
+}
+
+template<class Frame>
+bench::result
+uring_receive(bench::options const& opts)
+{
+    net::io_context ioc{1};
+    auto rx_sock = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+
+    canary::uring_context ctx;
+    canary::uring_socket::options ropts;
+    ropts.max_frame_size = sizeof(Frame);
+    ropts.receive_buffers = 1024;
+    canary::uring_socket rx{ctx, rx_sock, ropts};
+
+    std::size_t received = 0;
+    rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer b, canary::timestamp) {
+          if (ec)
+          {
+              return;
+          }
+          Frame const* f = static_cast<Frame const*>(b.data());
+          if (f->header.id() == bench::stop_id)
+          {
+              ctx.stop();
+              return;
+          }
+          ++received;
+      });
+
+    auto const cpu = thread_cpu_time();
+    auto const start = clock::now();
+    std::thread sender{[&] { bench::flood<Frame>(tx, opts.frames); }};
+    ctx.run();
+    auto const elapsed = clock::now() - start;
+    auto const used = thread_cpu_time() - cpu;
+    sender.join();
+
+    return bench::result{"receive"}
+      .value("backend", "io_uring")
+      .value("frame_type", Frame::type)
+      .throughput(received, elapsed)
+      .value("cpu_ns_per_frame", per_frame(used, received))
+      .value("lost", opts.frames - received)
+      .value("buffer_exhaustions", rx.buffer_exhaustions());
+}
+
+template<class Frame>
+bench::result
+epoll_send(bench::options const& opts)
+{
+    net::io_context ioc{1};
+    auto tx = bench::open_socket<Frame>(ioc, opts.interface0);
+    auto const f = bench::make_frame<Frame>(bench::data_id);
+
+    auto const cpu = thread_cpu_time();
+    auto const start = clock::now();
+    for (std::size_t i = 0; i < opts.frames; ++i)
+    {
+        bench::send_frame(tx, f);
+    }
+    auto const elapsed = clock::now() - start;
+    auto const used = thread_cpu_time() - cpu;
+
+    return bench::result{"send"}
+      .value("backend", "epoll")
+      .value("frame_type", Frame::type)
+      .throughput(opts.frames, elapsed)
+      .value("cpu_ns_per_frame", per_frame(used, opts.frames));
+}
+
+template<class Frame>
+bench::result
+uring_send(bench::options const& opts, std::size_t slots)
+{
+    net::io_context ioc{1};
+    auto tx_sock = bench::open_socket<Frame>(ioc, opts.interface0);
+    canary::uring_context ctx;
+    canary::uring_socket::options topts;
+    topts.max_frame_size = sizeof(Frame);
+    topts.send_slots = slots;
+    canary::uring_socket tx{ctx, tx_sock, topts};
+
+    // Frames rejected by a full transmit queue are sent again.
+    std::size_t sent = 0;
+    std::size_t retries = 0;
+    tx.on_send_complete([&](canary::error_code ec, std::size_t) {
+        if (ec)
+        {
+            ++retries;
+            return;
+        }
+        ++sent;
+    });
+
+    auto const f = bench::make_frame<Frame>(bench::data_id);
+    auto const cpu = thread_cpu_time();
+    auto const start = clock::now();
+    std::size_t queued = 0;
+    while (sent < opts.frames)
+    {
+        while (queued - retries < opts.frames &&
+               tx.send(net::buffer(&f, sizeof(f))))
+        {
+            ++queued;
+        }
+        ctx.run_one();
+    }
+    auto const elapsed = clock::now() - start;
+    auto const used = thread_cpu_time() - cpu;
+
+    return bench::result{"send"}
+      .value("backend", "io_uring")
+      .value("frame_type", Frame::type)
+      .value("batch", slots)
+      .throughput(sent, elapsed)
+      .value("cpu_ns_per_frame", per_frame(used, sent))
+      .value("retries", retries);
+}
+
+} // namespace
+
+int
+main(int argc, char** argv)
+{
+    auto const opts = bench::options::parse(argc, argv);
+    bench::report report{"uring", opts};
+
+    report.add(epoll_receive<bench::classic_frame>(opts));
+    report.add(uring_receive<bench::classic_frame>(opts));
+    report.add(epoll_receive<bench::fd_frame>(opts));
+    report.add(uring_receive<bench::fd_frame>(opts));
+
+    report.add(epoll_send<bench::classic_frame>(opts));
+    report.add(epoll_send<bench::fd_frame>(opts));
+    std::size_t const batches[] = {1, 16, 256};
+    for (auto n : batches)
+    {
+        report.add(uring_send<bench::classic_frame>(opts, n));
+        report.add(uring_send<bench::fd_frame>(opts, n));
+    }
+
+    report.write();
+}
@@ -0,0 +1,198 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_BENCH_VCAN_HPP
+#define CANARY_BENCH_VCAN_HPP
+
+#include "bench.hpp"
+
+#include <canary/frame_header.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+
+#include <array>
+#include <thread>
+
+namespace bench
+{
+
+namespace net = canary::net;
+
+/// Classic CAN frame, as read from a raw socket.
+struct classic_frame
+{
+    static constexpr char const* type = "classic";
+    static constexpr bool is_fd = false;
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 8> payload{};
+};
+
+/// CAN FD frame, as read from a raw socket with FD frames enabled.
+struct fd_frame
+{
+    static constexpr char const* type = "fd";
+    static constexpr bool is_fd = true;
+
+    canary::frame_header header;
+    std::array<std::uint8_t, 64> payload{};
+};
+
+/// ID of frames carrying benchmark traffic.
+constexpr std::uint32_t data_id = 0x100;
+/// ID of the frame which tells the receiving side to stop.
+constexpr std::uint32_t stop_id = 0x101;
+
+/// Makes a frame with a full payload.
+template<class Frame>
+Frame
+make_frame(std::uint32_t id)
+{
+    Frame f{};
+    f.header.id(id);
+    f.header.payload_length(f.payload.size());
+    return f;
+}
+
+/// Builds a filter list of length `n`, where only the last filter matches the
+/// benchmark traffic, so that the kernel has to evaluate all of them.
+inline std::vector<canary::filter>
+make_filters(std::size_t n)
+{
+    std::vector<canary::filter> filters;
+    for (std::size_t i = 0; i + 1 < n; ++i)
+    {
+        filters.push_back(canary::filter{}
+                            .id(0x200 + static_cast<std::uint32_t>(i))
+                            .id_mask(0x7FF)
+                            .extended_format(false));
+    }
+    if (n > 0)
+    {
+        filters.push_back(canary::filter{}.id(data_id).id_mask(0x7FE));
+    }
+    return filters;
+}
+
+/// Opens a raw socket bound to the named interface, configured for the frame
+/// type and with `filters` filters installed (none if 0).
+template<class Frame>
+canary::raw::socket
+open_socket(net::io_context& ioc,
+            std::string const& interface_name,
+            std::size_t filters = 0)
+{
+    canary::raw::socket sock{
+      ioc,
+      canary::raw::endpoint{canary::get_interface_index(interface_name)}};
+    if (Frame::is_fd)
+    {
+        sock.set_option(canary::flexible_data_rate{true});
+    }
+    if (filters > 0)
+    {
+        auto const fs = make_filters(filters);
+        sock.set_option(canary::filter_if_any{fs.data(), fs.size()});
+    }
+    sock.set_option(net::socket_base::receive_buffer_size{1 << 22});
+    return sock;
+}
+
+/// Sends a frame, retrying while the interface transmit queue is full.
+template<class Frame>
+void
+send_frame(canary::raw::socket& sock, Frame const& f)
+{
+    canary::error_code ec;
+    while (true)
+    {
+        sock.send(net::buffer(&f, sizeof(f)), 0, ec);
+        if (ec != net::error::no_buffer_space)
+        {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    if (ec)
+    {
+        throw canary::system_error{ec};
+    }
+}
+
+/// Sends the stop frame a few times, in case the receiver drops some of them
+/// due to a full receive buffer.
+template<class Frame>
+void
+send_stop(canary::raw::socket& sock)
+{
+    auto const f = make_frame<Frame>(stop_id);
+    for (int i = 0; i < 10; ++i)
+    {
+        send_frame(sock, f);
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+}
+
+/// Sends `n` data frames as fast as possible followed by the stop frame.
+template<class Frame>
+void
+flood(canary::raw::socket& sock, std::size_t n)
+{
+    auto const f = make_frame<Frame>(data_id);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        send_frame(sock, f);
+    }
+    send_stop<Frame>(sock);
+}
+
+/// Echoes every frame received on `in` to `out` until the stop frame arrives.
+/// Runs on its own thread, so that round trips measure a full
+/// receive/send cycle on each side.
+template<class Frame>
+class echo_server
+{
+public:
+    echo_server(options const& opts, std::size_t filters)
+      : in_{open_socket<Frame>(ioc_, opts.interface0, filters)}
+      , out_{open_socket<Frame>(ioc_, opts.interface1)}
+      , thread_{[this] { run(); }}
+    {
+    }
+
+    ~echo_server()
+    {
+        thread_.join();
+    }
+
+private:
+    void run()
+    {
+        Frame f{};
+        while (true)
+        {
+            in_.receive(net::buffer(&f, sizeof(f)));
+            if (f.header.id() == stop_id)
+            {
+                return;
+            }
+            send_frame(out_, f);
+        }
+    }
+
+    net::io_context ioc_{1};
+    canary::raw::socket in_;
+    canary::raw::socket out_;
+    std::thread thread_;
+};
+
+} // namespace bench
+
+#endif // CANARY_BENCH_VCAN_HPP
@@ -0,0 +1,740 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_BUS_LOAD_HPP
+#define CANARY_BUS_LOAD_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/detail/id_key.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace canary
+{
+
+/// How stuff bits are counted.
+enum class stuffing
+{
+    /// The stuff bits the frame actually needs, given its ID, payload and,
+    /// for classic frames, CRC.
+    exact,
+    /// The largest number of stuff bits any frame with the same format and
+    /// payload length may need.
+    worst_case
+};
+
+/// Number of bits a frame occupies on the bus, including the 3-bit
+/// intermission which separates it from the next frame.
+struct frame_bits
+{
+    /// Bits transmitted with the nominal (arbitration) bit rate.
+    std::uint32_t nominal = 0;
+    /// Bits transmitted with the data bit rate, i.e. the data phase of CAN FD
+    /// frames with the bit rate switch flag set.
+    std::uint32_t data = 0;
+
+    /// Total number of bits.
+    std::uint32_t total() const noexcept
+    {
+        return nominal + data;
+    }
+};
+
+/// Bit rates of a CAN bus.
+struct bit_timing
+{
+    /// The nominal (arbitration) bit rate, in bits per second.
+    std::uint32_t nominal_bitrate = 500000;
+    /// The data bit rate of CAN FD frames, in bits per second. Zero means
+    /// the nominal bit rate.
+    std::uint32_t data_bitrate = 2000000;
+};
+
+namespace detail
+{
+
+// Bits following the CRC sequence, which are never stuffed: CRC delimiter,
+// ACK slot, ACK delimiter, end of frame and intermission.
+constexpr std::uint32_t frame_trailer_bits = 1 + 1 + 1 + 7 + 3;
+
+// Writes bits most significant first, as they appear on the bus.
+class bit_writer
+{
+public:
+    // Appends the `n` lowest bits of `value`, at most 32.
+    void put(std::uint32_t value, unsigned int n) noexcept
+    {
+        bits_ = (bits_ << n) | (value & ((std::uint64_t{1} << n) - 1));
+        pending_ += n;
+        while (pending_ >= 8)
+        {
+            pending_ -= 8;
+            bytes_[size_++] = static_cast<std::uint8_t>(bits_ >> pending_);
+        }
+    }
+
+    void put_bytes(unsigned char const* p, std::size_t n) noexcept
+    {
+        if (pending_ == 0)
+        {
+            std::memcpy(&bytes_[size_], p, n);
+            size_ += n;
+            return;
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            put(p[i], 8);
+        }
+    }
+
+    // The bit stream, with the last partial byte padded with zeros.
+    unsigned char const* data() noexcept
+    {
+        if (pending_ != 0)
+        {
+            bytes_[size_] =
+              static_cast<std::uint8_t>(bits_ << (8 - pending_));
+        }
+        return bytes_.data();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return 8 * size_ + pending_;
+    }
+
+private:
+    // Large enough for the longest CAN FD header and a 64-byte payload.
+    std::array<std::uint8_t, 72> bytes_;
+    std::size_t size_ = 0;
+    std::uint64_t bits_ = 0;
+    unsigned int pending_ = 0;
+};
+
+// The state of the bit stuffing rule: the value of the last bit, in bit 3,
+// and the number of consecutive bits with that value, 0 before the first
+// bit.
+inline unsigned int
+stuff_step(unsigned int state, unsigned int bit, std::uint32_t& stuffed)
+{
+    auto last = state >> 3;
+    auto run = state & 7U;
+    if (run != 0 && bit == last)
+    {
+        ++run;
+    }
+    else
+    {
+        last = bit;
+        run = 1;
+    }
+    if (run == 5)
+    {
+        // The stuff bit has the opposite value, and starts a new run.
+        ++stuffed;
+        last ^= 1U;
+        run = 1;
+    }
+    return (last << 3) | run;
+}
+
+// Stuff bits inserted into every byte, for every state, and the state after
+// the byte: the number of stuff bits in the upper 4 bits of an entry.
+struct stuff_table
+{
+    stuff_table() noexcept
+    {
+        for (unsigned int state = 0; state < 16; ++state)
+        {
+            for (unsigned int byte = 0; byte < 256; ++byte)
+            {
+                std::uint32_t stuffed = 0;
+                auto s = state;
+                for (int bit = 7; bit >= 0; --bit)
+                {
+                    s = stuff_step(s, (byte >> bit) & 1U, stuffed);
+                }
+                entries[state][byte] = static_cast<std::uint8_t>(
+                  (stuffed << 4) | s);
+            }
+        }
+    }
+
+    std::uint8_t entries[16][256];
+};
+
+inline stuff_table const&
+stuff_lookup() noexcept
+{
+    static stuff_table const table;
+    return table;
+}
+
+// Counts the stuff bits inserted into bits [begin, end) of a bit stream.
+inline std::uint32_t
+count_stuff_bits(unsigned char const* p,
+                 std::size_t begin,
+                 std::size_t end,
+                 unsigned int& state) noexcept
+{
+    std::uint32_t stuffed = 0;
+    auto const bit = [p](std::size_t i) {
+        return (p[i / 8] >> (7 - i % 8)) & 1U;
+    };
+    for (; begin < end && begin % 8 != 0; ++begin)
+    {
+        state = stuff_step(state, bit(begin), stuffed);
+    }
+    auto const& table = stuff_lookup();
+    for (; begin + 8 <= end; begin += 8)
+    {
+        auto const e = table.entries[state][p[begin / 8]];
+        stuffed += e >> 4;
+        state = e & 0x0FU;
+    }
+    for (; begin < end; ++begin)
+    {
+        state = stuff_step(state, bit(begin), stuffed);
+    }
+    return stuffed;
+}
+
+// CRC-15 of classic frames, x^15 + x^14 + x^10 + x^8 + x^7 + x^4 + x^3 + 1.
+constexpr std::uint16_t crc15_polynomial = 0x4599;
+
+struct crc15_table
+{
+    crc15_table() noexcept
+    {
+        for (unsigned int i = 0; i < 256; ++i)
+        {
+            auto crc = i << 7;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc & 0x4000U) ? (crc << 1) ^ crc15_polynomial
+                                      : crc << 1;
+            }
+            entries[i] = static_cast<std::uint16_t>(crc & 0x7FFFU);
+        }
+    }
+
+    std::uint16_t entries[256];
+};
+
+// Computes the CRC-15 of the first `bits` bits of a bit stream.
+inline std::uint16_t
+crc15(unsigned char const* p, std::size_t bits) noexcept
+{
+    static crc15_table const table;
+    unsigned int crc = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= bits; i += 8)
+    {
+        crc = ((crc << 8) ^
+               table.entries[((crc >> 7) ^ p[i / 8]) & 0xFFU]) &
+              0x7FFFU;
+    }
+    for (; i < bits; ++i)
+    {
+        auto const next = ((p[i / 8] >> (7 - i % 8)) ^ (crc >> 14)) & 1U;
+        crc = (crc << 1) & 0x7FFFU;
+        if (next)
+        {
+            crc ^= crc15_polynomial;
+        }
+    }
+    return static_cast<std::uint16_t>(crc);
+}
+
+// Worst-case number of stuff bits in `bits` bits subject to stuffing: the
+// first stuff bit follows 5 bits, every further one 4 bits.
+inline std::uint32_t
+worst_case_stuff_bits(std::size_t bits) noexcept
+{
+    return bits == 0 ? 0 : static_cast<std::uint32_t>((bits - 1) / 4);
+}
+
+// Writes the start of frame and the identifier fields, up to and including
+// the identifier extension bit of extended frames.
+inline void
+put_identifier(bit_writer& w, frame_header const& h) noexcept
+{
+    w.put(0, 1); // Start of frame
+    if (h.extended_format())
+    {
+        w.put(h.id() >> 18, 11);
+        w.put(1, 1); // Substitute remote request
+        w.put(1, 1); // Identifier extension
+        w.put(h.id(), 18);
+    }
+    else
+    {
+        w.put(h.id(), 11);
+    }
+}
+
+inline frame_bits
+classic_frame_bits(frame_header const& h,
+                   unsigned char const* payload,
+                   stuffing mode) noexcept
+{
+    auto const remote = h.remote_transmission();
+    auto const length =
+      remote ? 0 : std::min<std::size_t>(h.payload_length(), 8);
+    // From the start of frame to the CRC sequence.
+    auto const stuffed_bits =
+      (h.extended_format() ? 39 : 19) + 8 * length + 15;
+    frame_bits bits;
+    bits.nominal =
+      static_cast<std::uint32_t>(stuffed_bits) + frame_trailer_bits;
+    if (mode == stuffing::worst_case)
+    {
+        bits.nominal += worst_case_stuff_bits(stuffed_bits);
+        return bits;
+    }
+
+    // Classic frames may carry a data length code above 8, which the
+    // kernel keeps in the last byte of the header.
+    auto const raw_dlc = payload[-1];
+    auto const dlc = h.payload_length() >= 8 && raw_dlc > 8 && raw_dlc <= 15
+                       ? raw_dlc
+                       : static_cast<std::uint8_t>(
+                           std::min<std::size_t>(h.payload_length(), 8));
+    bit_writer w;
+    put_identifier(w, h);
+    w.put(remote ? 1 : 0, 1);
+    w.put(0, 1); // Identifier extension, or reserved bit r1
+    w.put(0, 1); // Reserved bit r0
+    w.put(dlc, 4);
+    w.put_bytes(payload, length);
+    w.put(crc15(w.data(), w.size()), 15);
+    unsigned int state = 0;
+    bits.nominal += count_stuff_bits(w.data(), 0, w.size(), state);
+    return bits;
+}
+
+inline frame_bits
+fd_frame_bits(frame_header const& h,
+              unsigned char const* payload,
+              stuffing mode) noexcept
+{
+    auto const length = fd_payload_length(h.payload_length());
+    // From the start of frame to the bit rate switch, and from the error
+    // state indicator to the end of the payload.
+    std::size_t const arbitration = h.extended_format() ? 36 : 17;
+    std::size_t const dynamic = arbitration + 5 + 8 * length;
+
+    std::uint32_t arbitration_stuff;
+    std::uint32_t data_stuff;
+    if (mode == stuffing::worst_case)
+    {
+        arbitration_stuff = worst_case_stuff_bits(arbitration);
+        data_stuff = worst_case_stuff_bits(dynamic) - arbitration_stuff;
+    }
+    else
+    {
+        bit_writer w;
+        put_identifier(w, h);
+        w.put(0, 1); // Remote request substitution
+        if (!h.extended_format())
+        {
+            w.put(0, 1); // Identifier extension
+        }
+        w.put(1, 1); // FD format
+        w.put(0, 1); // Reserved bit
+        w.put(h.bit_rate_switch() ? 1 : 0, 1);
+        w.put(h.error_state_indicator() ? 1 : 0, 1);
+        w.put(length_to_dlc(length), 4);
+        w.put_bytes(payload, length);
+        unsigned int state = 0;
+        arbitration_stuff = count_stuff_bits(w.data(), 0, arbitration, state);
+        data_stuff = count_stuff_bits(w.data(), arbitration, dynamic, state);
+    }
+
+    // Stuff count, CRC and their fixed stuff bits.
+    std::uint32_t const crc_field = length <= 16 ? 4 + 17 + 6 : 4 + 21 + 7;
+    frame_bits bits;
+    bits.nominal = static_cast<std::uint32_t>(arbitration) +
+                   arbitration_stuff + frame_trailer_bits;
+    bits.data = static_cast<std::uint32_t>(dynamic - arbitration) +
+                data_stuff + crc_field;
+    if (!h.bit_rate_switch())
+    {
+        bits.nominal += bits.data;
+        bits.data = 0;
+    }
+    return bits;
+}
+
+} // namespace detail
+
+/// Computes the number of bits a frame occupies on the bus, following
+/// ISO 11898-1:2015.
+///
+/// Classic frames consist of the fields from the start of frame to the CRC
+/// sequence, which are subject to bit stuffing, followed by 13 bits which
+/// are not. The CRC is computed, so that exact stuffing covers it too.
+/// Remote frames carry no payload.
+///
+/// CAN FD frames are subject to bit stuffing from the start of frame to the
+/// end of the payload, followed by the stuff count, the 17-bit (up to 16
+/// bytes) or 21-bit CRC and their 6 or 7 fixed stuff bits. Payloads are
+/// padded to the next valid CAN FD length. If the bit rate switch flag is
+/// set, the bits from the ESI flag to the CRC sequence are counted as data
+/// bits, the others as nominal bits.
+///
+/// \param frame A classic or CAN FD frame, as received from a raw socket.
+/// \param mode Whether exact or worst-case stuffing is counted.
+/// \returns The number of bits, zero for error frames and frames of other
+/// sizes.
+inline frame_bits
+count_frame_bits(net::const_buffer frame,
+                 stuffing mode = stuffing::exact) noexcept
+{
+    auto const size = frame.size();
+    if (size != classic_frame_size && size != fd_frame_size)
+    {
+        return frame_bits{};
+    }
+    auto const p = static_cast<unsigned char const*>(frame.data());
+    frame_header h;
+    std::memcpy(&h, p, sizeof(h));
+    if (h.error())
+    {
+        return frame_bits{};
+    }
+    return size == classic_frame_size
+             ? detail::classic_frame_bits(h, p + sizeof(h), mode)
+             : detail::fd_frame_bits(h, p + sizeof(h), mode);
+}
+
+/// Computes how long a frame occupies the bus.
+/// \param bits The number of bits of the frame.
+/// \param timing The bit rates of the bus.
+/// \returns The duration of the frame.
+inline std::chrono::nanoseconds
+frame_duration(frame_bits bits, bit_timing const& timing) noexcept
+{
+    std::uint64_t const ns_per_s = 1000000000;
+    auto const nominal = timing.nominal_bitrate;
+    auto const data =
+      timing.data_bitrate != 0 ? timing.data_bitrate : timing.nominal_bitrate;
+    if (nominal == 0)
+    {
+        return std::chrono::nanoseconds{0};
+    }
+    auto const ns = bits.nominal * ns_per_s / nominal +
+                    bits.data * ns_per_s / data;
+    return std::chrono::nanoseconds{static_cast<std::int64_t>(ns)};
+}
+
+/// Measures the load of CAN buses, overall and per CAN ID, over a sliding
+/// window, from the frames received on them.
+///
+/// Every frame is converted to the time it occupied the bus, from its exact
+/// or worst-case bit count and the bit rates of its interface, and added to
+/// the bucket of the window its timestamp falls into. The load is the
+/// fraction of the window the bus was busy. The window slides in steps of
+/// `options::window / options::buckets`. Frames older than the window are
+/// ignored.
+///
+/// Frames may come from the receive path of raw sockets, with reception
+/// timestamps and the interface index of the socket, or from trace files.
+///
+/// \notes The monitor is not thread-safe.
+class bus_load_monitor
+{
+public:
+    /// Configuration of the monitor.
+    struct options
+    {
+        /// Bit rates of interfaces without their own bit rates.
+        bit_timing timing;
+        /// The length of the sliding window.
+        std::chrono::nanoseconds window = std::chrono::seconds{1};
+        /// Number of steps the window slides in.
+        std::size_t buckets = 10;
+        /// Whether exact or worst-case stuffing is counted.
+        stuffing mode = stuffing::exact;
+        /// Whether the load of each CAN ID is measured.
+        bool per_id = true;
+    };
+
+    /// The load caused by one CAN ID.
+    struct id_load
+    {
+        /// The CAN ID, without flags.
+        std::uint32_t id;
+        /// Whether the ID is an extended (29-bit) ID.
+        bool extended;
+        /// Fraction of the window the bus was busy with frames with the ID.
+        double load;
+    };
+
+    /// Constructs a monitor with the default options.
+    bus_load_monitor()
+      : bus_load_monitor{options{}}
+    {
+    }
+
+    /// Constructs a monitor. Throws `system_error` if the number of buckets
+    /// is zero, or the window is shorter than one nanosecond per bucket.
+    /// \param opts Configuration of the monitor.
+    explicit bus_load_monitor(options const& opts)
+      : opts_{checked(opts)}
+      , bucket_ns_{opts.window.count() /
+                   static_cast<std::int64_t>(opts.buckets)}
+    {
+    }
+
+    /// Sets the bit rates of an interface.
+    /// \param interface_index The index of the interface.
+    /// \param timing The bit rates.
+    void timing(unsigned int interface_index, bit_timing const& timing)
+    {
+        find(interface_index).timing = timing;
+    }
+
+    /// Adds a frame.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket.
+    /// \param time The time the frame was received.
+    /// \param interface_index The interface the frame was received on.
+    /// \returns The number of bits of the frame.
+    frame_bits add(net::const_buffer frame,
+                   timestamp time,
+                   unsigned int interface_index = 0)
+    {
+        auto const bits = count_frame_bits(frame, opts_.mode);
+        if (bits.total() == 0)
+        {
+            return bits;
+        }
+        auto& bus = find(interface_index);
+        auto const busy = static_cast<std::uint64_t>(
+          frame_duration(bits, bus.timing).count());
+        auto const epoch = epoch_of(time);
+        bus.total.add(epoch, busy);
+        ++bus.frames;
+        bus.bits += bits.total();
+        if (opts_.per_id)
+        {
+            frame_header h;
+            std::memcpy(&h, frame.data(), sizeof(h));
+            auto const key = detail::id_key(h.id(), h.extended_format());
+            auto it = bus.ids.find(key);
+            if (it == bus.ids.end())
+            {
+                it = bus.ids.emplace(key, window{opts_.buckets}).first;
+            }
+            it->second.add(epoch, busy);
+        }
+        return bits;
+    }
+
+    /// Gets the load of a bus.
+    /// \param interface_index The index of the interface.
+    /// \param now The end of the window.
+    /// \returns The fraction of the window the bus was busy.
+    double load(unsigned int interface_index, timestamp now) const
+    {
+        auto const it = buses_.find(interface_index);
+        return it == buses_.end() ? 0.0 : fraction(it->second.total, now);
+    }
+
+    /// Gets the load caused by one CAN ID on a bus.
+    /// \param interface_index The index of the interface.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \param now The end of the window.
+    /// \returns The fraction of the window the bus was busy with frames with
+    /// the ID.
+    double load(unsigned int interface_index,
+                std::uint32_t id,
+                bool extended,
+                timestamp now) const
+    {
+        auto const bus = buses_.find(interface_index);
+        if (bus == buses_.end())
+        {
+            return 0.0;
+        }
+        auto const it = bus->second.ids.find(detail::id_key(id, extended));
+        return it == bus->second.ids.end() ? 0.0 : fraction(it->second, now);
+    }
+
+    /// Gets the load caused by every CAN ID seen on a bus.
+    /// \param interface_index The index of the interface.
+    /// \param now The end of the window.
+    /// \returns The IDs which caused load within the window, highest load
+    /// first.
+    std::vector<id_load> id_loads(unsigned int interface_index,
+                                  timestamp now) const
+    {
+        std::vector<id_load> loads;
+        auto const bus = buses_.find(interface_index);
+        if (bus == buses_.end())
+        {
+            return loads;
+        }
+        for (auto const& e : bus->second.ids)
+        {
+            auto const l = fraction(e.second, now);
+            if (l > 0)
+            {
+                loads.push_back(id_load{detail::key_id(e.first),
+                                        detail::key_extended(e.first),
+                                        l});
+            }
+        }
+        std::sort(loads.begin(),
+                  loads.end(),
+                  [](id_load const& a, id_load const& b) {
+                      return a.load != b.load ? a.load > b.load : a.id < b.id;
+                  });
+        return loads;
+    }
+
+    /// Number of frames added for an interface.
+    std::uint64_t frames(unsigned int interface_index) const
+    {
+        auto const it = buses_.find(interface_index);
+        return it == buses_.end() ? 0 : it->second.frames;
+    }
+
+    /// Number of bits of the frames added for an interface.
+    std::uint64_t bits(unsigned int interface_index) const
+    {
+        auto const it = buses_.find(interface_index);
+        return it == buses_.end() ? 0 : it->second.bits;
+    }
+
+private:
+    // Busy time per bucket, in a ring indexed by the bucket's epoch.
+    class window
+    {
+    public:
+        explicit window(std::size_t buckets)
+          : buckets_(buckets)
+        {
+        }
+
+        void add(std::int64_t epoch, std::uint64_t busy_ns)
+        {
+            auto& b = buckets_[static_cast<std::size_t>(epoch) %
+                               buckets_.size()];
+            if (b.epoch < epoch)
+            {
+                b.epoch = epoch;
+                b.busy_ns = 0;
+            }
+            if (b.epoch == epoch)
+            {
+                b.busy_ns += busy_ns;
+            }
+        }
+
+        std::uint64_t sum(std::int64_t now) const noexcept
+        {
+            auto const oldest =
+              now - static_cast<std::int64_t>(buckets_.size());
+            std::uint64_t busy = 0;
+            for (auto const& b : buckets_)
+            {
+                if (b.epoch > oldest && b.epoch <= now)
+                {
+                    busy += b.busy_ns;
+                }
+            }
+            return busy;
+        }
+
+    private:
+        struct bucket
+        {
+            std::int64_t epoch = -1;
+            std::uint64_t busy_ns = 0;
+        };
+
+        std::vector<bucket> buckets_;
+    };
+
+    struct bus
+    {
+        bus(bit_timing const& t, std::size_t buckets)
+          : timing{t}
+          , total{buckets}
+        {
+        }
+
+        bit_timing timing;
+        window total;
+        std::unordered_map<std::uint32_t, window> ids;
+        std::uint64_t frames = 0;
+        std::uint64_t bits = 0;
+    };
+
+    static options const& checked(options const& opts)
+    {
+        if (opts.buckets == 0 ||
+            opts.window.count() < static_cast<std::int64_t>(opts.buckets))
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    std::int64_t epoch_of(timestamp t) const noexcept
+    {
+        return t.time_since_epoch().count() / bucket_ns_;
+    }
+
+    double fraction(window const& w, timestamp now) const noexcept
+    {
+        return static_cast<double>(w.sum(epoch_of(now))) /
+               static_cast<double>(bucket_ns_ *
+                                   static_cast<std::int64_t>(opts_.buckets));
+    }
+
+    bus& find(unsigned int interface_index)
+    {
+        auto it = buses_.find(interface_index);
+        if (it == buses_.end())
+        {
+            it = buses_
+                   .emplace(interface_index, bus{opts_.timing, opts_.buckets})
+                   .first;
+        }
+        return it->second;
+    }
+
+    options opts_;
+    std::int64_t bucket_ns_;
+    std::unordered_map<unsigned int, bus> buses_;
+};
+
+} // namespace canary
+
+#endif // CANARY_BUS_LOAD_HPP
@@ -0,0 +1,286 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_CANNELLONI_HPP
+#define CANARY_CANNELLONI_HPP
+
+#include <canary/detail/config.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/error.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/error.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <arpa/inet.h>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace canary
+{
+
+/// Encoding of CAN frames in UDP datagrams, compatible with version 2 of the
+/// wire format of cannelloni (https://github.com/mguentner/cannelloni).
+///
+/// A datagram starts with a 5-byte header: the version, an operation code,
+/// a sequence number and the number of frames, as a big-endian 16-bit
+/// integer. Each frame follows as its CAN ID, including the flags, as a
+/// big-endian 32-bit integer, its payload length, with the most significant
+/// bit set for CAN FD frames, the CAN FD flags (CAN FD frames only) and the
+/// payload (except for remote transmission requests).
+namespace cannelloni
+{
+namespace wire
+{
+
+// Marks CAN FD frames in the length byte of an encoded frame.
+constexpr std::uint8_t fd_length_flag = 0x80;
+constexpr std::uint32_t rtr_flag = 0x40000000;
+// Offsets of the length and CAN FD flags in the kernel's frame layout.
+constexpr std::size_t length_offset = 4;
+constexpr std::size_t flags_offset = 5;
+
+} // namespace wire
+
+/// Version of the wire format.
+constexpr std::uint8_t version = 2;
+
+/// Operation code of datagrams carrying frames.
+constexpr std::uint8_t data_op = 0;
+
+/// Size of the datagram header.
+constexpr std::size_t header_size = 5;
+
+/// Largest encoded size of a frame.
+constexpr std::size_t max_frame_size = 4 + 1 + 1 + 64;
+
+/// Appends frames to a datagram.
+class writer
+{
+public:
+    /// Constructs a writer of an empty datagram.
+    /// \param datagram The memory of the datagram, at least `header_size`
+    /// bytes long. Ownership is retained by the caller.
+    explicit writer(net::mutable_buffer datagram) noexcept
+      : data_{static_cast<std::uint8_t*>(datagram.data())}
+      , capacity_{datagram.size()}
+    {
+        assert(capacity_ >= header_size);
+    }
+
+    /// Appends a frame, unless it does not fit.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket,
+    /// i.e. `classic_frame_size` or `fd_frame_size` bytes long.
+    /// \returns Whether the frame was appended.
+    bool append(net::const_buffer frame) noexcept
+    {
+        assert(frame.size() == classic_frame_size ||
+               frame.size() == fd_frame_size);
+        auto const src = static_cast<std::uint8_t const*>(frame.data());
+        auto const fd = frame.size() == fd_frame_size;
+        std::uint32_t can_id;
+        std::memcpy(&can_id, src, sizeof(can_id));
+        std::uint8_t length = src[wire::length_offset];
+        auto const max_length = fd ? 64 : 8;
+        length = static_cast<std::uint8_t>(
+          length > max_length ? max_length : length);
+        std::size_t const payload = (can_id & wire::rtr_flag) ? 0 : length;
+        std::size_t const needed = 4 + 1 + (fd ? 1 : 0) + payload;
+        if (size_ + needed > capacity_)
+        {
+            return false;
+        }
+        auto out = data_ + size_;
+        auto const id = htonl(can_id);
+        std::memcpy(out, &id, sizeof(id));
+        out += sizeof(id);
+        *out++ = fd ? static_cast<std::uint8_t>(length | wire::fd_length_flag)
+                    : length;
+        if (fd)
+        {
+            *out++ = src[wire::flags_offset];
+        }
+        std::memcpy(out, src + sizeof(frame_header), payload);
+        size_ += needed;
+        ++frames_;
+        return true;
+    }
+
+    /// Number of frames appended.
+    std::size_t frames() const noexcept
+    {
+        return frames_;
+    }
+
+    /// Whether no frames were appended.
+    bool empty() const noexcept
+    {
+        return frames_ == 0;
+    }
+
+    /// Size of the datagram, including the header.
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /// Writes the header of the datagram.
+    /// \param seq The sequence number of the datagram.
+    /// \returns The size of the datagram.
+    std::size_t finish(std::uint8_t seq) noexcept
+    {
+        data_[0] = version;
+        data_[1] = data_op;
+        data_[2] = seq;
+        auto const count = htons(static_cast<std::uint16_t>(frames_));
+        std::memcpy(data_ + 3, &count, sizeof(count));
+        return size_;
+    }
+
+    /// Starts a new datagram in the same memory.
+    void reset() noexcept
+    {
+        size_ = header_size;
+        frames_ = 0;
+    }
+
+    /// Starts a new datagram in other memory.
+    void reset(net::mutable_buffer datagram) noexcept
+    {
+        data_ = static_cast<std::uint8_t*>(datagram.data());
+        capacity_ = datagram.size();
+        assert(capacity_ >= header_size);
+        reset();
+    }
+
+private:
+    std::uint8_t* data_;
+    std::size_t capacity_;
+    std::size_t size_ = header_size;
+    std::size_t frames_ = 0;
+};
+
+/// Reads frames from a datagram.
+class reader
+{
+public:
+    /// Constructs a reader of a datagram.
+    /// \param datagram The received datagram. Ownership is retained by the
+    /// caller.
+    /// \param ec Set to `net::error::message_size` if the datagram is shorter
+    /// than its header, or to `net::error::operation_not_supported` if it is
+    /// not a version 2 data datagram.
+    reader(net::const_buffer datagram, error_code& ec) noexcept
+      : data_{static_cast<std::uint8_t const*>(datagram.data())}
+      , size_{datagram.size()}
+    {
+        if (size_ < header_size)
+        {
+            ec = net::error::message_size;
+            return;
+        }
+        if (data_[0] != version || data_[1] != data_op)
+        {
+            ec = net::error::operation_not_supported;
+            return;
+        }
+        std::uint16_t count;
+        std::memcpy(&count, data_ + 3, sizeof(count));
+        remaining_ = ntohs(count);
+        offset_ = header_size;
+        ec = {};
+    }
+
+    /// Gets the sequence number of the datagram.
+    std::uint8_t sequence() const noexcept
+    {
+        return size_ >= header_size ? data_[2] : 0;
+    }
+
+    /// Number of frames not read yet.
+    std::size_t remaining() const noexcept
+    {
+        return remaining_;
+    }
+
+    /// Reads the next frame.
+    /// \param frame The buffer to decode the frame into, in the layout of a
+    /// frame received from a raw socket. Must be at least `fd_frame_size`
+    /// bytes long.
+    /// \param ec Set to `net::error::message_size` if the datagram is
+    /// truncated, or a payload length is invalid.
+    /// \returns The size of the frame, `classic_frame_size` or
+    /// `fd_frame_size`, or 0 if all frames were read, or on error.
+    std::size_t next(net::mutable_buffer frame, error_code& ec) noexcept
+    {
+        assert(frame.size() >= fd_frame_size);
+        ec = {};
+        if (remaining_ == 0)
+        {
+            return 0;
+        }
+        if (offset_ + 5 > size_)
+        {
+            return fail(ec);
+        }
+        auto in = data_ + offset_;
+        std::uint32_t id;
+        std::memcpy(&id, in, sizeof(id));
+        id = ntohl(id);
+        in += sizeof(id);
+        auto const fd = (*in & wire::fd_length_flag) != 0;
+        auto const length =
+          static_cast<std::uint8_t>(*in++ & ~wire::fd_length_flag);
+        if (length > (fd ? 64 : 8) || (fd && in == data_ + size_))
+        {
+            return fail(ec);
+        }
+        std::uint8_t flags = fd ? *in++ : 0;
+        auto const payload = (id & wire::rtr_flag) ? 0 : length;
+        if (in + payload > data_ + size_)
+        {
+            return fail(ec);
+        }
+
+        auto const out = static_cast<std::uint8_t*>(frame.data());
+        auto const frame_size = fd ? fd_frame_size : classic_frame_size;
+        std::memset(out, 0, frame_size);
+        std::memcpy(out, &id, sizeof(id));
+        out[wire::length_offset] = length;
+        out[wire::flags_offset] = flags;
+        std::memcpy(out + sizeof(frame_header), in, payload);
+        offset_ = static_cast<std::size_t>(in + payload - data_);
+        --remaining_;
+        return frame_size;
+    }
+
+private:
+    std::size_t fail(error_code& ec) noexcept
+    {
+        remaining_ = 0;
+        ec = net::error::message_size;
+        return 0;
+    }
+
+    std::uint8_t const* data_;
+    std::size_t size_;
+    std::size_t offset_ = 0;
+    std::size_t remaining_ = 0;
+};
+
+} // namespace cannelloni
+} // namespace canary
+
+#endif // CANARY_CANNELLONI_HPP
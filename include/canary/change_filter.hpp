@@ -0,0 +1,211 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_CHANGE_FILTER_HPP
+#define CANARY_CHANGE_FILTER_HPP
+
+#include <canary/detail/id_key.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace canary
+{
+
+/// Passes on only the frames whose contents changed since the previous frame
+/// with the same ID received on the same interface, similar to the content
+/// filtering of the kernel's broadcast manager, which is not available for
+/// sockets bound to all interfaces.
+///
+/// A frame is passed on if its payload, with the bits of the ID's mask set,
+/// its payload length or its flags changed, or if no frame with its ID was
+/// passed on for the keep-alive interval. Error frames are always passed on.
+///
+/// Frames are compared 64 bits at a time, only as many words as the frame
+/// occupies, without branches inside the loop, which the compiler may
+/// vectorize further. The state of an ID is allocated when its first frame
+/// arrives.
+///
+/// \notes The filter is not thread-safe.
+class change_filter
+{
+public:
+    /// Configuration of the filter.
+    struct options
+    {
+        /// Longest time between two frames with the same ID being passed on,
+        /// even if their contents did not change. Zero disables keep-alive.
+        std::chrono::nanoseconds keep_alive = std::chrono::milliseconds{0};
+    };
+
+    /// Constructs a filter with the default options.
+    change_filter()
+      : change_filter{options{}}
+    {
+    }
+
+    /// Constructs a filter.
+    /// \param opts Configuration of the filter.
+    explicit change_filter(options const& opts)
+      : opts_{opts}
+    {
+    }
+
+    /// Sets the bits of the payload which are compared for frames with an
+    /// ID, on all interfaces. All bits are compared by default.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \param mask The mask, one bit for every bit of the payload. Bytes
+    /// beyond the end of the mask are compared in full.
+    void mask(std::uint32_t id, bool extended, net::const_buffer mask)
+    {
+        words m;
+        m.fill(~std::uint64_t{0});
+        auto const size = mask.size() < payload_words * sizeof(std::uint64_t)
+                            ? mask.size()
+                            : payload_words * sizeof(std::uint64_t);
+        std::memcpy(&m[1], mask.data(), size);
+        auto const key = detail::id_key(id, extended);
+        masks_[key] = m;
+        for (auto& s : states_)
+        {
+            if (static_cast<std::uint32_t>(s.first) == key)
+            {
+                s.second.mask = m;
+            }
+        }
+    }
+
+    /// Decides whether a frame is passed on, and remembers its contents.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket.
+    /// Frames of other sizes are always passed on.
+    /// \param now The time the frame was received, e.g. its reception
+    /// timestamp, or `timestamp_now()`.
+    /// \param interface_index The interface the frame was received on.
+    /// \returns Whether the frame changed, or is due to be passed on to keep
+    /// its ID alive.
+    bool accept(net::const_buffer frame,
+                timestamp now,
+                unsigned int interface_index = 0)
+    {
+        auto const size = frame.size();
+        if (size != classic_frame_size && size != fd_frame_size)
+        {
+            ++passed_;
+            return true;
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        if (h.error())
+        {
+            ++passed_;
+            return true;
+        }
+
+        auto const key = detail::id_key(h.id(), h.extended_format());
+        auto const inserted = states_.emplace(
+          (std::uint64_t{interface_index} << 32) | key, state{});
+        auto& s = inserted.first->second;
+        if (inserted.second)
+        {
+            auto const m = masks_.find(key);
+            if (m != masks_.end())
+            {
+                s.mask = m->second;
+            }
+        }
+
+        auto const n = size / sizeof(std::uint64_t);
+        auto const p = static_cast<unsigned char const*>(frame.data());
+        std::uint64_t diff = size ^ s.size;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            std::uint64_t w;
+            std::memcpy(&w, p + i * sizeof(w), sizeof(w));
+            diff |= (w ^ s.contents[i]) & s.mask[i];
+            s.contents[i] = w;
+        }
+        s.size = size;
+
+        if (diff != 0 || inserted.second ||
+            (opts_.keep_alive.count() > 0 &&
+             now - s.last_passed >= opts_.keep_alive))
+        {
+            s.last_passed = now;
+            ++passed_;
+            return true;
+        }
+        ++suppressed_;
+        return false;
+    }
+
+    /// Forgets the contents of all IDs, so that the next frame with every ID
+    /// is passed on. Masks are kept.
+    void reset() noexcept
+    {
+        states_.clear();
+    }
+
+    /// Number of frames passed on.
+    std::size_t passed() const noexcept
+    {
+        return passed_;
+    }
+
+    /// Number of unchanged frames which were not passed on.
+    std::size_t suppressed() const noexcept
+    {
+        return suppressed_;
+    }
+
+private:
+    // The header and up to 64 bytes of payload of a frame.
+    static constexpr std::size_t payload_words = 64 / sizeof(std::uint64_t);
+    using words = std::array<std::uint64_t, 1 + payload_words>;
+
+    static_assert(sizeof(frame_header) == sizeof(std::uint64_t),
+                  "The header must occupy exactly one word");
+
+    struct state
+    {
+        state() noexcept
+        {
+            contents.fill(0);
+            mask.fill(~std::uint64_t{0});
+        }
+
+        words contents;
+        words mask;
+        std::size_t size = 0;
+        timestamp last_passed;
+    };
+
+    options opts_;
+    std::unordered_map<std::uint64_t, state> states_;
+    std::unordered_map<std::uint32_t, words> masks_;
+    std::size_t passed_ = 0;
+    std::size_t suppressed_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_CHANGE_FILTER_HPP
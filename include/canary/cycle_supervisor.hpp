@@ -0,0 +1,735 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_CYCLE_SUPERVISOR_HPP
+#define CANARY_CYCLE_SUPERVISOR_HPP
+
+#include <canary/detail/config.hpp>
+#include <canary/detail/id_key.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace canary
+{
+
+namespace detail
+{
+
+// Hierarchical timer wheel of entries identified by their index, with the
+// classic layout of 256 slots of one tick, followed by 3 levels of 64 slots,
+// each slot covering the whole previous level. Entries due within 256 ticks
+// are in the first level, later ones are moved down a level (cascaded) each
+// time the level below wraps around. Inserting and removing an entry is
+// O(1), and empty slots are skipped with a bitmap.
+class timer_wheel
+{
+public:
+    static constexpr std::uint32_t npos = 0xFFFFFFFF;
+
+    explicit timer_wheel(std::size_t capacity)
+      : links_(capacity)
+    {
+        heads_.fill(npos);
+    }
+
+    // The next tick to be processed by `advance`.
+    std::uint64_t now() const noexcept
+    {
+        return now_;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    bool linked(std::uint32_t i) const noexcept
+    {
+        return links_[i].slot != npos;
+    }
+
+    // Files an unlinked entry to expire at a tick. Ticks which already
+    // passed expire on the next `advance`, ticks too far ahead are clamped
+    // to the horizon of the wheel.
+    void insert(std::uint32_t i, std::uint64_t expiry) noexcept
+    {
+        if (expiry < now_)
+        {
+            expiry = now_;
+        }
+        if (expiry - now_ >= horizon)
+        {
+            expiry = now_ + horizon - 1;
+        }
+        auto const delta = expiry - now_;
+        std::uint32_t slot;
+        if (delta < first_slots)
+        {
+            slot = static_cast<std::uint32_t>(expiry & (first_slots - 1));
+        }
+        else
+        {
+            auto level = 1u;
+            while (delta >= std::uint64_t{1} << shift(level + 1))
+            {
+                ++level;
+            }
+            slot = level_base(level) +
+                   static_cast<std::uint32_t>((expiry >> shift(level)) &
+                                              (level_slots - 1));
+        }
+
+        auto& l = links_[i];
+        l.expiry = expiry;
+        l.slot = slot;
+        l.prev = npos;
+        l.next = heads_[slot];
+        if (l.next != npos)
+        {
+            links_[l.next].prev = i;
+        }
+        heads_[slot] = i;
+        bitmap_[slot / 64] |= std::uint64_t{1} << (slot % 64);
+        ++size_;
+    }
+
+    void remove(std::uint32_t i) noexcept
+    {
+        auto& l = links_[i];
+        if (l.prev != npos)
+        {
+            links_[l.prev].next = l.next;
+        }
+        else
+        {
+            heads_[l.slot] = l.next;
+            if (l.next == npos)
+            {
+                bitmap_[l.slot / 64] &= ~(std::uint64_t{1} << (l.slot % 64));
+            }
+        }
+        if (l.next != npos)
+        {
+            links_[l.next].prev = l.prev;
+        }
+        l.slot = npos;
+        --size_;
+    }
+
+    // Processes every tick up to and including `tick`, and invokes
+    // `expire(i)` for each entry due at one of them. The entry is unlinked
+    // first, so `expire` may file it again.
+    template<class Expire>
+    void advance(std::uint64_t tick, Expire&& expire)
+    {
+        while (now_ <= tick)
+        {
+            if (size_ == 0)
+            {
+                now_ = tick + 1;
+                return;
+            }
+            auto const i = static_cast<std::uint32_t>(now_ & (first_slots - 1));
+            if (i == 0)
+            {
+                cascade(1);
+            }
+            auto n = take(i);
+            while (n != npos)
+            {
+                auto const next = links_[n].next;
+                expire(n);
+                n = next;
+            }
+            auto const next = next_tick();
+            now_ = next <= tick ? next : tick + 1;
+        }
+    }
+
+    // The earliest tick `advance` has work at, the maximum value if the
+    // wheel is empty.
+    std::uint64_t next_expiry() const noexcept
+    {
+        if (size_ == 0)
+        {
+            return ~std::uint64_t{0};
+        }
+        auto const i = static_cast<std::uint32_t>(now_ & (first_slots - 1));
+        auto const j = first_set(i);
+        return j != npos ? now_ - i + j : (now_ | (first_slots - 1)) + 1;
+    }
+
+private:
+    static constexpr std::uint64_t first_slots = 256;
+    static constexpr std::uint64_t level_slots = 64;
+    static constexpr unsigned int levels = 4;
+    static constexpr std::uint64_t horizon = std::uint64_t{1} << 26;
+    static constexpr std::size_t slot_count = 256 + 3 * 64;
+
+    struct link
+    {
+        std::uint64_t expiry = 0;
+        std::uint32_t prev = npos;
+        std::uint32_t next = npos;
+        std::uint32_t slot = npos;
+    };
+
+    static unsigned int shift(unsigned int level) noexcept
+    {
+        return 8 + 6 * (level - 1);
+    }
+
+    static std::uint32_t level_base(unsigned int level) noexcept
+    {
+        return 256 + 64 * (level - 1);
+    }
+
+    // Unlinks every entry of a slot, returns the first of them.
+    std::uint32_t take(std::uint32_t slot) noexcept
+    {
+        auto const head = heads_[slot];
+        if (head == npos)
+        {
+            return npos;
+        }
+        heads_[slot] = npos;
+        bitmap_[slot / 64] &= ~(std::uint64_t{1} << (slot % 64));
+        for (auto n = head; n != npos; n = links_[n].next)
+        {
+            links_[n].slot = npos;
+            --size_;
+        }
+        return head;
+    }
+
+    // Files the entries of the current slot of a level again, into the
+    // levels below, then does the same for the level above if this level
+    // wrapped around as well.
+    void cascade(unsigned int level) noexcept
+    {
+        auto const index = static_cast<std::uint32_t>(
+          (now_ >> shift(level)) & (level_slots - 1));
+        auto n = take(level_base(level) + index);
+        while (n != npos)
+        {
+            auto const next = links_[n].next;
+            insert(n, links_[n].expiry);
+            n = next;
+        }
+        if (index == 0 && level + 1 < levels)
+        {
+            cascade(level + 1);
+        }
+    }
+
+    // The first non-empty slot of the first level at or after `from`.
+    std::uint32_t first_set(std::uint32_t from) const noexcept
+    {
+        for (auto w = from / 64; w < first_slots / 64; ++w)
+        {
+            auto bits = bitmap_[w];
+            if (w == from / 64)
+            {
+                bits &= ~std::uint64_t{0} << (from % 64);
+            }
+            if (bits != 0)
+            {
+                return w * 64 +
+                       static_cast<std::uint32_t>(__builtin_ctzll(bits));
+            }
+        }
+        return npos;
+    }
+
+    // The tick after `now_` with work, or the next wrap around of the first
+    // level.
+    std::uint64_t next_tick() const noexcept
+    {
+        auto const i = static_cast<std::uint32_t>(now_ & (first_slots - 1));
+        auto const j = i + 1 < first_slots ? first_set(i + 1) : npos;
+        return j != npos ? now_ - i + j : (now_ | (first_slots - 1)) + 1;
+    }
+
+    std::vector<link> links_;
+    std::array<std::uint32_t, slot_count> heads_;
+    std::array<std::uint64_t, slot_count / 64> bitmap_{};
+    std::uint64_t now_ = 0;
+    std::size_t size_ = 0;
+};
+
+} // namespace detail
+
+/// Events raised by `cycle_supervisor`.
+enum class cycle_event
+{
+    /// No frame with the ID was received within its timeout.
+    timeout,
+    /// A frame with the ID was received after a timeout.
+    recovery
+};
+
+/// The state of a supervised ID, passed along with its events.
+struct cycle_status
+{
+    /// The interface the ID is supervised on.
+    unsigned int interface_index;
+    /// The CAN ID, without flags.
+    std::uint32_t id;
+    /// Whether the ID is an extended (29-bit) ID.
+    bool extended;
+    /// The expected period.
+    std::chrono::nanoseconds period;
+    /// The time a frame was last received, or supervision started.
+    std::chrono::steady_clock::time_point last_seen;
+    /// Number of timeouts of the ID so far.
+    std::size_t timeouts;
+};
+
+/// Supervises the cycle times of periodic messages: every supervised CAN ID
+/// must be received at least once per timeout, a multiple of its expected
+/// period, otherwise a timeout event is raised. The next frame with the ID
+/// raises a recovery event.
+///
+/// Supervised IDs are kept in a flat open-addressing hash table, and their
+/// deadlines in a hierarchical timer wheel driven by a single timer. A frame
+/// only moves the deadline of its ID forward, in O(1), without touching the
+/// wheel or the timer. When the wheel reaches an entry whose deadline moved,
+/// the entry is filed again, so every ID is handled by the wheel about once
+/// per timeout rather than once per frame.
+///
+/// Timeouts are raised up to one `options::resolution` late, never early.
+/// Timeout events are raised from a handler of the supervisor's executor,
+/// recovery events from `update`.
+///
+/// \notes The supervisor is not thread-safe, frames must be passed to
+/// `update` from handlers of the supervisor's executor. Pending operations
+/// refer to the supervisor, which must outlive them.
+class cycle_supervisor
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// Invoked with every timeout and recovery.
+    using event_handler = std::function<void(cycle_event, cycle_status const&)>;
+
+    /// Configuration of the supervisor.
+    struct options
+    {
+        /// The length of one tick of the timer wheel. Deadlines are rounded
+        /// up to it, and the wheel supports timeouts of up to 2^26 ticks.
+        std::chrono::nanoseconds resolution = std::chrono::milliseconds{1};
+        /// The timeout of an ID as a multiple of its period.
+        double timeout_factor = 3.0;
+        /// Largest number of supervised IDs over all interfaces, a power of
+        /// two.
+        std::size_t capacity = 8192;
+    };
+
+    /// Constructs a supervisor with the default options.
+    /// \param ex The executor or execution context of the timer.
+    template<class ExecutorOrContext>
+    explicit cycle_supervisor(ExecutorOrContext&& ex)
+      : cycle_supervisor{std::forward<ExecutorOrContext>(ex), options{}}
+    {
+    }
+
+    /// Constructs a supervisor. Throws `system_error` if the resolution is
+    /// not positive, the timeout factor is below 1 or the capacity is not a
+    /// power of two.
+    /// \param ex The executor or execution context of the timer.
+    /// \param opts Configuration of the supervisor.
+    template<class ExecutorOrContext>
+    cycle_supervisor(ExecutorOrContext&& ex, options const& opts)
+      : opts_{checked(opts)}
+      , timer_{std::forward<ExecutorOrContext>(ex)}
+      , epoch_{clock::now()}
+      , entries_(opts.capacity)
+      , wheel_{opts.capacity}
+      , mask_{opts.capacity - 1}
+    {
+    }
+
+    cycle_supervisor(cycle_supervisor const&) = delete;
+    cycle_supervisor& operator=(cycle_supervisor const&) = delete;
+
+    /// Sets the handler of timeout and recovery events.
+    void on_event(event_handler handler)
+    {
+        handler_ = std::move(handler);
+    }
+
+    /// Starts supervising an ID, or changes the period of a supervised one.
+    /// A new ID must be received within its timeout from now. Throws
+    /// `system_error` if the period is not positive or the table is full.
+    /// \param interface_index The interface the ID is received on.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \param period The expected period.
+    /// \param now The current time.
+    void supervise(unsigned int interface_index,
+                   std::uint32_t id,
+                   bool extended,
+                   std::chrono::nanoseconds period,
+                   clock::time_point now = clock::now())
+    {
+        if (period.count() <= 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        auto const i = insert(key_of(interface_index, id, extended));
+        if (i == npos)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::no_buffer_space});
+        }
+        auto& e = entries_[i];
+        if (e.state == entry_state::free)
+        {
+            e.state = entry_state::running;
+            e.last_seen = now;
+            e.timeouts = 0;
+            ++size_;
+        }
+        e.period = period;
+        e.timeout = std::chrono::nanoseconds{static_cast<std::int64_t>(
+          static_cast<double>(period.count()) * opts_.timeout_factor)};
+        e.deadline = deadline(e.last_seen, e.timeout);
+        if (e.state == entry_state::running)
+        {
+            // The deadline may have moved back, which the wheel must see.
+            if (wheel_.linked(i))
+            {
+                wheel_.remove(i);
+            }
+            wheel_.insert(i, e.deadline);
+            schedule();
+        }
+    }
+
+    /// Stops supervising an ID.
+    /// \param interface_index The interface the ID is received on.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \returns Whether the ID was supervised.
+    bool unsupervise(unsigned int interface_index,
+                     std::uint32_t id,
+                     bool extended) noexcept
+    {
+        auto const i = find(key_of(interface_index, id, extended));
+        if (i == npos)
+        {
+            return false;
+        }
+        auto& e = entries_[i];
+        if (e.state == entry_state::timed_out)
+        {
+            --timed_out_;
+        }
+        if (wheel_.linked(i))
+        {
+            wheel_.remove(i);
+        }
+        // The key stays, so probe sequences passing the entry are kept.
+        e.state = entry_state::removed;
+        --size_;
+        return true;
+    }
+
+    /// Moves the deadline of the ID of a received frame forward. Raises a
+    /// recovery event if the ID timed out.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket.
+    /// \param interface_index The interface the frame was received on.
+    /// \param now The time the frame was received.
+    /// \returns Whether the ID of the frame is supervised.
+    bool update(net::const_buffer frame,
+                unsigned int interface_index = 0,
+                clock::time_point now = clock::now())
+    {
+        if (frame.size() != classic_frame_size &&
+            frame.size() != fd_frame_size)
+        {
+            return false;
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        if (h.error())
+        {
+            return false;
+        }
+        auto const i =
+          find(key_of(interface_index, h.id(), h.extended_format()));
+        if (i == npos)
+        {
+            return false;
+        }
+        auto& e = entries_[i];
+        e.last_seen = now;
+        e.deadline = deadline(now, e.timeout);
+        if (e.state == entry_state::timed_out)
+        {
+            e.state = entry_state::running;
+            --timed_out_;
+            ++recoveries_;
+            wheel_.insert(i, e.deadline);
+            schedule();
+            raise(cycle_event::recovery, i);
+        }
+        return true;
+    }
+
+    /// Raises the timeouts of deadlines up to a point in time. Called by the
+    /// timer of the supervisor, and may be called directly, e.g. to replay a
+    /// trace with its own timestamps.
+    /// \param now The current time.
+    void advance(clock::time_point now = clock::now())
+    {
+        expired_.clear();
+        wheel_.advance(tick_of(now), [this](std::uint32_t i) {
+            auto& e = entries_[i];
+            if (e.deadline > wheel_.now())
+            {
+                wheel_.insert(i, e.deadline);
+                return;
+            }
+            e.state = entry_state::timed_out;
+            ++e.timeouts;
+            ++timed_out_;
+            ++timeouts_;
+            expired_.push_back(i);
+        });
+        schedule();
+        // Handlers may change the supervised IDs, so events are raised once
+        // the wheel is consistent.
+        for (std::size_t n = 0; n < expired_.size(); ++n)
+        {
+            if (entries_[expired_[n]].state == entry_state::timed_out)
+            {
+                raise(cycle_event::timeout, expired_[n]);
+            }
+        }
+    }
+
+    /// Whether an ID is supervised and timed out.
+    bool timed_out(unsigned int interface_index,
+                   std::uint32_t id,
+                   bool extended) const noexcept
+    {
+        auto const i = find(key_of(interface_index, id, extended));
+        return i != npos && entries_[i].state == entry_state::timed_out;
+    }
+
+    /// Number of supervised IDs.
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /// Number of supervised IDs which are currently timed out.
+    std::size_t timed_out() const noexcept
+    {
+        return timed_out_;
+    }
+
+    /// Number of timeout events so far.
+    std::size_t timeouts() const noexcept
+    {
+        return timeouts_;
+    }
+
+    /// Number of recovery events so far.
+    std::size_t recoveries() const noexcept
+    {
+        return recoveries_;
+    }
+
+private:
+    static constexpr std::uint32_t npos = detail::timer_wheel::npos;
+
+    enum class entry_state : std::uint8_t
+    {
+        free,
+        running,
+        timed_out,
+        removed
+    };
+
+    // The fields used by `update` come first.
+    struct entry
+    {
+        std::uint64_t key = 0;
+        entry_state state = entry_state::free;
+        std::uint64_t deadline = 0;
+        std::chrono::nanoseconds timeout{0};
+        clock::time_point last_seen;
+        std::chrono::nanoseconds period{0};
+        std::size_t timeouts = 0;
+    };
+
+    static options const& checked(options const& opts)
+    {
+        auto const n = opts.capacity;
+        if (opts.resolution.count() <= 0 || !(opts.timeout_factor >= 1.0) ||
+            n == 0 || (n & (n - 1)) != 0 || n > npos)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    static std::uint64_t key_of(unsigned int interface_index,
+                                std::uint32_t id,
+                                bool extended) noexcept
+    {
+        return std::uint64_t{interface_index} << 32 |
+               detail::id_key(id, extended);
+    }
+
+    std::uint64_t tick_of(clock::time_point t) const noexcept
+    {
+        auto const d =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(t - epoch_)
+            .count();
+        return d <= 0 ? 0
+                      : static_cast<std::uint64_t>(d /
+                                                   opts_.resolution.count());
+    }
+
+    // The first tick at which a deadline has certainly passed.
+    std::uint64_t deadline(clock::time_point last,
+                           std::chrono::nanoseconds timeout) const noexcept
+    {
+        return tick_of(last + timeout) + 1;
+    }
+
+    std::uint32_t find(std::uint64_t key) const noexcept
+    {
+        auto i = detail::key_slot(key, mask_);
+        for (std::size_t n = 0; n <= mask_; ++n)
+        {
+            auto const& e = entries_[i];
+            if (e.state == entry_state::free)
+            {
+                return npos;
+            }
+            if (e.key == key)
+            {
+                return e.state == entry_state::removed
+                         ? npos
+                         : static_cast<std::uint32_t>(i);
+            }
+            i = detail::next_slot(i, mask_);
+        }
+        return npos;
+    }
+
+    // Returns the entry of a key, claiming a free one if the key is new. A
+    // removed entry is only reused by its own key.
+    std::uint32_t insert(std::uint64_t key) noexcept
+    {
+        auto i = detail::key_slot(key, mask_);
+        for (std::size_t n = 0; n <= mask_; ++n)
+        {
+            auto& e = entries_[i];
+            if (e.key == key && e.state != entry_state::free)
+            {
+                if (e.state == entry_state::removed)
+                {
+                    e.state = entry_state::free;
+                }
+                return static_cast<std::uint32_t>(i);
+            }
+            if (e.state == entry_state::free)
+            {
+                e.key = key;
+                return static_cast<std::uint32_t>(i);
+            }
+            i = detail::next_slot(i, mask_);
+        }
+        return npos;
+    }
+
+    void schedule()
+    {
+        auto const next = wheel_.next_expiry();
+        if (next == ~std::uint64_t{0} || (armed_ && next >= armed_tick_))
+        {
+            return;
+        }
+        armed_ = true;
+        armed_tick_ = next;
+        timer_.expires_at(
+          epoch_ + std::chrono::duration_cast<clock::duration>(
+                     opts_.resolution * static_cast<std::int64_t>(next)));
+        auto const generation = ++generation_;
+        timer_.async_wait([this, generation](error_code ec) {
+            if (ec || generation != generation_)
+            {
+                return;
+            }
+            armed_ = false;
+            advance();
+        });
+    }
+
+    void raise(cycle_event event, std::uint32_t i)
+    {
+        if (!handler_)
+        {
+            return;
+        }
+        auto const& e = entries_[i];
+        cycle_status const status{
+          static_cast<unsigned int>(e.key >> 32),
+          detail::key_id(static_cast<std::uint32_t>(e.key)),
+          detail::key_extended(static_cast<std::uint32_t>(e.key)),
+          e.period,
+          e.last_seen,
+          e.timeouts};
+        handler_(event, status);
+    }
+
+    options opts_;
+    net::steady_timer timer_;
+    clock::time_point epoch_;
+    std::vector<entry> entries_;
+    detail::timer_wheel wheel_;
+    std::size_t mask_;
+    event_handler handler_;
+    std::vector<std::uint32_t> expired_;
+    std::size_t size_ = 0;
+    std::size_t timed_out_ = 0;
+    std::size_t timeouts_ = 0;
+    std::size_t recoveries_ = 0;
+    bool armed_ = false;
+    std::uint64_t armed_tick_ = 0;
+    std::size_t generation_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_CYCLE_SUPERVISOR_HPP
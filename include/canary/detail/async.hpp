@@ -0,0 +1,95 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_DETAIL_ASYNC_HPP
+#define CANARY_DETAIL_ASYNC_HPP
+
+#include <canary/detail/config.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/async_result.hpp>
+#include <asio/compose.hpp>
+#include <asio/error.hpp>
+#include <asio/post.hpp>
+#else
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/compose.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <cerrno>
+#include <memory>
+#include <type_traits>
+
+namespace canary
+{
+namespace detail
+{
+
+// Return type of an initiating function.
+template<class CompletionToken, class Signature>
+using async_return_t = typename net::async_result<
+  typename std::decay<CompletionToken>::type,
+  Signature>::return_type;
+
+// Sets `ec` from the current value of errno, using the same category as the
+// errors reported by ASIO's socket operations.
+inline void
+assign_errno(error_code& ec)
+{
+    ec.assign(errno, net::error::get_system_category());
+}
+
+// Throws a `system_error` built from the current value of errno.
+inline void
+throw_errno()
+{
+    error_code ec;
+    detail::assign_errno(ec);
+    canary::detail::throw_exception(system_error{ec});
+}
+
+// Tracks the lifetime of an object whose internal handlers capture `this`.
+// Handlers hold a token, and must return without touching the object once
+// the token expired: when the object is destroyed, or when `invalidate`
+// abandons the handlers pending so far.
+class lifetime
+{
+public:
+    using token = std::weak_ptr<char>;
+
+    lifetime()
+      : alive_{std::make_shared<char>()}
+    {
+    }
+
+    lifetime(lifetime const&) = delete;
+    lifetime& operator=(lifetime const&) = delete;
+
+    // Returns a token for a handler about to be started.
+    token get() const noexcept
+    {
+        return alive_;
+    }
+
+    // Expires the tokens of all pending handlers.
+    void invalidate()
+    {
+        alive_ = std::make_shared<char>();
+    }
+
+private:
+    std::shared_ptr<char> alive_;
+};
+
+} // namespace detail
+} // namespace canary
+
+#endif // CANARY_DETAIL_ASYNC_HPP
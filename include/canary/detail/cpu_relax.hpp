@@ -0,0 +1,33 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_DETAIL_CPU_RELAX_HPP
+#define CANARY_DETAIL_CPU_RELAX_HPP
+
+namespace canary
+{
+namespace detail
+{
+
+// Hints the CPU that the caller is spinning, to save power and leave
+// execution resources to a sibling hardware thread.
+inline void
+cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+} // namespace detail
+} // namespace canary
+
+#endif // CANARY_DETAIL_CPU_RELAX_HPP
@@ -0,0 +1,66 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_DETAIL_ID_KEY_HPP
+#define CANARY_DETAIL_ID_KEY_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace canary
+{
+namespace detail
+{
+
+// Set in the key of an extended ID.
+constexpr std::uint32_t extended_key_flag = 0x80000000U;
+
+// Key of a CAN ID in tables holding both standard and extended IDs: the ID
+// masked to its format, with `extended_key_flag` set if it is extended.
+inline std::uint32_t
+id_key(std::uint32_t id, bool extended) noexcept
+{
+    return extended ? (id & 0x1FFFFFFFU) | extended_key_flag : id & 0x7FFU;
+}
+
+// The CAN ID of a key.
+inline std::uint32_t
+key_id(std::uint32_t key) noexcept
+{
+    return key & 0x1FFFFFFFU;
+}
+
+// Whether a key is the key of an extended ID.
+inline bool
+key_extended(std::uint32_t key) noexcept
+{
+    return (key & extended_key_flag) != 0;
+}
+
+// First slot probed for a key in an open addressing table of `mask + 1`
+// slots, a power of two. Multiplicative hashing spreads sequential IDs over
+// the table.
+inline std::size_t
+key_slot(std::uint64_t key, std::size_t mask) noexcept
+{
+    return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) &
+           mask;
+}
+
+// Slot probed after `i`, when it holds another key.
+inline std::size_t
+next_slot(std::size_t i, std::size_t mask) noexcept
+{
+    return (i + 1) & mask;
+}
+
+} // namespace detail
+} // namespace canary
+
+#endif // CANARY_DETAIL_ID_KEY_HPP
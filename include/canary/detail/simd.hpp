@@ -0,0 +1,40 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_DETAIL_SIMD_HPP
+#define CANARY_DETAIL_SIMD_HPP
+
+#if !defined(CANARY_NO_SIMD) && defined(__GNUC__) &&                          \
+  (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#ifndef CANARY_HAS_AVX2_DISPATCH
+#define CANARY_HAS_AVX2_DISPATCH
+#endif // CANARY_HAS_AVX2_DISPATCH
+#endif
+
+#ifdef CANARY_HAS_AVX2_DISPATCH
+
+namespace canary
+{
+namespace detail
+{
+
+inline bool
+has_avx2() noexcept
+{
+    static bool const value = __builtin_cpu_supports("avx2");
+    return value;
+}
+
+} // namespace detail
+} // namespace canary
+
+#endif // CANARY_HAS_AVX2_DISPATCH
+
+#endif // CANARY_DETAIL_SIMD_HPP
@@ -131,6 +131,16 @@ public:
         return (id_ & invert_flag);
     }
 
+    /// Checks whether a frame matches this filter, the same way the kernel
+    /// does.
+    /// \param can_id The CAN ID of the frame, including the extended format,
+    /// remote transmission and error flags, as in `can_frame::can_id`.
+    bool matches(std::uint32_t can_id) const noexcept
+    {
+        auto const equal = ((can_id ^ id_) & mask_ & ~invert_flag) == 0;
+        return equal != negation();
+    }
+
 private:
     static constexpr std::uint32_t id_bitmask = 0x1FFFFFFF;
     static constexpr std::uint32_t format_flag = 0x80000000;
@@ -0,0 +1,359 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_FRAME_HPP
+#define CANARY_FRAME_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/xl_frame_header.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace canary
+{
+
+/// The format of a frame received from a raw CAN socket.
+enum class frame_format
+{
+    /// A classic CAN frame, with a payload of up to 8 bytes.
+    classic,
+    /// A CAN FD frame, with a payload of up to 64 bytes.
+    fd,
+    /// A CAN XL frame, with a payload of 1 to 2048 bytes.
+    xl
+};
+
+/// Size of a classic CAN frame, as received from a raw socket.
+constexpr std::size_t classic_frame_size = sizeof(frame_header) + 8;
+
+/// Size of a CAN FD frame, as received from a raw socket.
+constexpr std::size_t fd_frame_size = sizeof(frame_header) + 64;
+
+/// Size of the largest CAN XL frame. CAN XL frames are received with only
+/// as many payload bytes as they carry.
+constexpr std::size_t xl_frame_max_size =
+  sizeof(xl_frame_header) + xl_max_payload_length;
+
+/// A frame received into a caller-provided buffer. Refers to the buffer,
+/// nothing is copied.
+struct received_frame
+{
+    /// The format of the frame.
+    frame_format format = frame_format::classic;
+    /// The header of a classic or CAN FD frame, at the beginning of the
+    /// buffer. Null for CAN XL frames.
+    frame_header* header = nullptr;
+    /// The header of a CAN XL frame, at the beginning of the buffer. Null for
+    /// classic and CAN FD frames.
+    xl_frame_header* xl_header = nullptr;
+    /// The payload of the frame, as long as the payload length in its
+    /// header.
+    net::mutable_buffer payload;
+};
+
+/// Interprets the bytes received from a raw CAN socket.
+///
+/// A raw socket with `flexible_data_rate` enabled receives both classic and
+/// CAN FD frames, which the kernel tells apart by the number of bytes it
+/// writes: `classic_frame_size` for classic frames, `fd_frame_size` for CAN
+/// FD frames. So buffers of `fd_frame_size` bytes can receive mixed traffic,
+/// and each frame can be handled in place. With `xl_frames` enabled, the
+/// socket receives CAN XL frames as well, which are told apart by the XL
+/// format flag, and need buffers of `xl_frame_max_size` bytes.
+///
+/// \param buffer The buffer the frame was received into, at least
+/// `received` bytes long.
+/// \param received The number of bytes received.
+/// \param ec Set to `net::error::message_size` if the size is not that of a
+/// classic, CAN FD or CAN XL frame, or if the payload length in the header
+/// does not match the size of the frame.
+/// \returns The received frame.
+inline received_frame
+parse_frame(net::mutable_buffer buffer, std::size_t received, error_code& ec)
+{
+    received_frame f;
+    if (buffer.size() < received || received <= sizeof(xl_frame_header))
+    {
+        ec = net::error::message_size;
+        return f;
+    }
+
+    // The flags of a CAN XL frame overlap the payload length of classic and
+    // CAN FD frames, which never has the XL format flag set.
+    auto const xl = static_cast<xl_frame_header*>(buffer.data());
+    if (xl->xl_format())
+    {
+        if (received != sizeof(xl_frame_header) + xl->payload_length())
+        {
+            ec = net::error::message_size;
+            return f;
+        }
+        f.format = frame_format::xl;
+        f.xl_header = xl;
+        f.payload =
+          net::buffer(buffer + sizeof(xl_frame_header), xl->payload_length());
+        ec = {};
+        return f;
+    }
+
+    if (received == classic_frame_size)
+    {
+        f.format = frame_format::classic;
+    }
+    else if (received == fd_frame_size)
+    {
+        f.format = frame_format::fd;
+    }
+    else
+    {
+        ec = net::error::message_size;
+        return f;
+    }
+
+    f.header = static_cast<frame_header*>(buffer.data());
+    auto const length = f.header->payload_length();
+    if (length > received - sizeof(frame_header))
+    {
+        ec = net::error::message_size;
+        return f;
+    }
+    f.payload = net::buffer(buffer + sizeof(frame_header), length);
+    ec = {};
+    return f;
+}
+
+/// Receives a classic, CAN FD or CAN XL frame. The buffer must be suitably
+/// aligned for a `frame_header`, and should be `fd_frame_size` bytes long, or
+/// `xl_frame_max_size` bytes long if CAN XL frames are enabled.
+/// \param sock The socket to receive from.
+/// \param buffer The buffer to receive into.
+/// \param ec Set to indicate what error occurred, if any.
+/// \returns The received frame.
+template<class Socket>
+received_frame
+receive_frame(Socket& sock, net::mutable_buffer buffer, error_code& ec)
+{
+    auto const n = sock.receive(buffer, 0, ec);
+    if (ec)
+    {
+        return received_frame{};
+    }
+    return parse_frame(buffer, n, ec);
+}
+
+namespace detail
+{
+
+template<class Socket>
+class receive_frame_op
+{
+public:
+    receive_frame_op(Socket& sock, net::mutable_buffer buffer)
+      : sock_{sock}
+      , buffer_{buffer}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self)
+    {
+        auto& sock = sock_;
+        auto const buffer = buffer_;
+        sock.async_receive(buffer, std::move(self));
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec, std::size_t n)
+    {
+        received_frame f;
+        if (!ec)
+        {
+            f = parse_frame(buffer_, n, ec);
+        }
+        self.complete(ec, f);
+    }
+
+private:
+    Socket& sock_;
+    net::mutable_buffer buffer_;
+};
+
+} // namespace detail
+
+/// Asynchronously receives a classic, CAN FD or CAN XL frame. The completion
+/// signature is `void(error_code, received_frame)`.
+/// \param sock The socket to receive from.
+/// \param buffer The buffer to receive into. The buffer must be suitably
+/// aligned for a `frame_header`, and should be `fd_frame_size` bytes long, or
+/// `xl_frame_max_size` bytes long if CAN XL frames are enabled.
+/// Ownership is retained by the caller, which must keep it valid until
+/// completion.
+/// \param token The completion token.
+template<class Socket, class CompletionToken>
+auto
+async_receive_frame(Socket& sock,
+                    net::mutable_buffer buffer,
+                    CompletionToken&& token)
+  -> detail::async_return_t<CompletionToken, void(error_code, received_frame)>
+{
+    return net::async_compose<CompletionToken,
+                              void(error_code, received_frame)>(
+      detail::receive_frame_op<Socket>{sock, buffer}, token, sock);
+}
+
+/// A fixed set of equally sized frame buffers, allocated once and recycled.
+///
+/// Buffers are acquired as `frame_pool::buffer` objects, which return them to
+/// the pool when destroyed, so that frames of any format can be received
+/// into a pooled buffer with `async_receive_frame`, and handed on without
+/// copying. The pool must outlive its buffers.
+///
+/// \notes The pool is not thread-safe.
+class frame_pool
+{
+public:
+    /// A buffer acquired from a pool. Move-only, returned to the pool on
+    /// destruction. An empty buffer is returned when the pool is exhausted.
+    class buffer
+    {
+    public:
+        /// Constructs an empty buffer.
+        buffer() noexcept = default;
+
+        buffer(buffer&& other) noexcept
+          : pool_{other.pool_}
+          , data_{other.data_}
+        {
+            other.pool_ = nullptr;
+            other.data_ = nullptr;
+        }
+
+        buffer& operator=(buffer&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                pool_ = other.pool_;
+                data_ = other.data_;
+                other.pool_ = nullptr;
+                other.data_ = nullptr;
+            }
+            return *this;
+        }
+
+        ~buffer()
+        {
+            release();
+        }
+
+        /// Whether the buffer holds memory.
+        explicit operator bool() const noexcept
+        {
+            return data_ != nullptr;
+        }
+
+        /// The memory of the buffer, suitably aligned for any frame header.
+        net::mutable_buffer data() const noexcept
+        {
+            return data_ ? net::buffer(data_, pool_->buffer_size_)
+                         : net::mutable_buffer{};
+        }
+
+        /// Returns the memory to the pool.
+        void release() noexcept
+        {
+            if (data_)
+            {
+                pool_->free_.push_back(data_);
+                data_ = nullptr;
+                pool_ = nullptr;
+            }
+        }
+
+    private:
+        friend class frame_pool;
+
+        buffer(frame_pool& pool, void* data) noexcept
+          : pool_{&pool}
+          , data_{data}
+        {
+        }
+
+        frame_pool* pool_ = nullptr;
+        void* data_ = nullptr;
+    };
+
+    /// Constructs a pool.
+    /// \param count The number of buffers.
+    /// \param buffer_size The size of each buffer, e.g. `fd_frame_size`, or
+    /// `xl_frame_max_size` to receive frames of any format.
+    frame_pool(std::size_t count, std::size_t buffer_size)
+      : buffer_size_{round_up(buffer_size)}
+      , storage_{new unit[count * (buffer_size_ / sizeof(unit))]}
+    {
+        free_.reserve(count);
+        for (std::size_t i = count; i > 0; --i)
+        {
+            free_.push_back(storage_.get() +
+                            (i - 1) * (buffer_size_ / sizeof(unit)));
+        }
+    }
+
+    frame_pool(frame_pool const&) = delete;
+    frame_pool& operator=(frame_pool const&) = delete;
+
+    /// Acquires a buffer, or returns an empty buffer if none is available.
+    buffer acquire() noexcept
+    {
+        if (free_.empty())
+        {
+            return buffer{};
+        }
+        auto const p = free_.back();
+        free_.pop_back();
+        return buffer{*this, p};
+    }
+
+    /// Number of buffers currently available.
+    std::size_t available() const noexcept
+    {
+        return free_.size();
+    }
+
+    /// The size of each buffer.
+    std::size_t buffer_size() const noexcept
+    {
+        return buffer_size_;
+    }
+
+private:
+    using unit = std::max_align_t;
+
+    static std::size_t round_up(std::size_t n) noexcept
+    {
+        return (n + sizeof(unit) - 1) / sizeof(unit) * sizeof(unit);
+    }
+
+    std::size_t buffer_size_;
+    std::unique_ptr<unit[]> storage_;
+    std::vector<void*> free_;
+};
+
+} // namespace canary
+
+#endif // CANARY_FRAME_HPP
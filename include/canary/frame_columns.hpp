@@ -0,0 +1,427 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_FRAME_COLUMNS_HPP
+#define CANARY_FRAME_COLUMNS_HPP
+
+#include <canary/detail/simd.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/timestamp.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace canary
+{
+
+/// Bits of the flags column of `frame_columns`.
+struct frame_flag
+{
+    enum : std::uint8_t
+    {
+        /// The frame is an error frame.
+        error = 0x01,
+        /// The frame is a remote transmission request.
+        remote = 0x02,
+        /// The frame has an extended (29-bit) identifier.
+        extended = 0x04,
+        /// The CAN FD bit rate switch flag.
+        bit_rate_switch = 0x08,
+        /// The CAN FD error state indicator flag.
+        error_state_indicator = 0x10,
+        /// The CAN FD format flag.
+        fd_format = 0x20
+    };
+};
+
+/// Struct-of-arrays representation of an array of frames: element `i` of
+/// every column belongs to frame `i`. Null columns are skipped.
+struct frame_columns
+{
+    /// Identifiers, without flags.
+    std::uint32_t* id = nullptr;
+    /// Combination of `frame_flag` bits.
+    std::uint8_t* flags = nullptr;
+    /// Payload lengths in bytes.
+    std::uint8_t* length = nullptr;
+    /// Payload columns of 64-bit words: `payload[w][i]` holds bytes
+    /// `8 * w` to `8 * w + 7` of frame `i`, in memory order. Lanes past the
+    /// payload capacity of the frame type are skipped.
+    std::array<std::uint64_t*, 8> payload{};
+    /// Timestamps, in nanoseconds since the epoch of the system clock.
+    std::int64_t* time = nullptr;
+};
+
+namespace detail
+{
+
+// The layout of a frame header, seen as two 32-bit words: the identifier word
+// carries the error, remote and extended flags in its top 3 bits, the second
+// word the length in its low byte and the CAN FD flags in the next byte.
+constexpr std::uint32_t header_id_mask = 0x1FFFFFFF;
+
+inline void
+to_columns_scalar(unsigned char const* frames,
+                  std::size_t stride,
+                  std::size_t words,
+                  std::size_t first,
+                  std::size_t count,
+                  frame_columns const& c) noexcept
+{
+    for (auto i = first; i < count; ++i)
+    {
+        auto const* p = frames + i * stride;
+        std::uint32_t id_word;
+        std::uint32_t meta;
+        std::memcpy(&id_word, p, 4);
+        std::memcpy(&meta, p + 4, 4);
+        if (c.id != nullptr)
+        {
+            c.id[i] = id_word & header_id_mask;
+        }
+        if (c.flags != nullptr)
+        {
+            c.flags[i] =
+              static_cast<std::uint8_t>((id_word >> 29) | (meta >> 8 & 7) << 3);
+        }
+        if (c.length != nullptr)
+        {
+            c.length[i] = static_cast<std::uint8_t>(meta);
+        }
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            if (c.payload[w] != nullptr)
+            {
+                std::memcpy(&c.payload[w][i],
+                            p + sizeof(frame_header) + 8 * w,
+                            8);
+            }
+        }
+    }
+}
+
+inline void
+from_columns_scalar(frame_columns const& c,
+                    std::size_t words,
+                    std::size_t first,
+                    std::size_t count,
+                    unsigned char* frames,
+                    std::size_t stride) noexcept
+{
+    for (auto i = first; i < count; ++i)
+    {
+        auto* p = frames + i * stride;
+        std::uint32_t const flags = c.flags != nullptr ? c.flags[i] : 0;
+        std::uint32_t const id_word =
+          (c.id != nullptr ? c.id[i] & header_id_mask : 0) | (flags & 7) << 29;
+        std::uint32_t const meta =
+          (c.length != nullptr ? c.length[i] : 0u) | (flags >> 3 & 7) << 8;
+        std::memcpy(p, &id_word, 4);
+        std::memcpy(p + 4, &meta, 4);
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            std::uint64_t const v =
+              c.payload[w] != nullptr ? c.payload[w][i] : 0;
+            std::memcpy(p + sizeof(frame_header) + 8 * w, &v, 8);
+        }
+    }
+}
+
+#ifdef CANARY_HAS_AVX2_DISPATCH
+
+// Splits the identifier words and the length/flags words of 8 frames into
+// the id, flags and length columns. The 8-bit columns are narrowed with a
+// byte shuffle within each 128-bit half, and a cross-half permutation.
+__attribute__((target("avx2"))) inline void
+store_header_columns(__m256i id_words,
+                     __m256i meta,
+                     std::size_t i,
+                     frame_columns const& c) noexcept
+{
+    if (c.id != nullptr)
+    {
+        auto const ids = _mm256_and_si256(
+          id_words, _mm256_set1_epi32(static_cast<int>(header_id_mask)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(c.id + i), ids);
+    }
+    auto const narrow = _mm256_setr_epi8(
+      0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    auto const gather = _mm256_setr_epi32(0, 4, 1, 1, 1, 1, 1, 1);
+    auto const seven = _mm256_set1_epi32(7);
+    if (c.flags != nullptr)
+    {
+        auto const flags = _mm256_or_si256(
+          _mm256_srli_epi32(id_words, 29),
+          _mm256_slli_epi32(
+            _mm256_and_si256(_mm256_srli_epi32(meta, 8), seven), 3));
+        auto const packed = _mm256_permutevar8x32_epi32(
+          _mm256_shuffle_epi8(flags, narrow), gather);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(c.flags + i),
+                         _mm256_castsi256_si128(packed));
+    }
+    if (c.length != nullptr)
+    {
+        auto const packed = _mm256_permutevar8x32_epi32(
+          _mm256_shuffle_epi8(meta, narrow), gather);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(c.length + i),
+                         _mm256_castsi256_si128(packed));
+    }
+}
+
+// Classic frames (16 bytes): 4 frames are loaded with two 256-bit loads, and
+// headers and payloads are separated with 64-bit unpacks and a lane
+// permutation. The headers of 8 frames are then split into the identifier
+// and length/flags words with a 32-bit permutation.
+__attribute__((target("avx2"))) inline std::size_t
+to_columns_classic_avx2(unsigned char const* frames,
+                        std::size_t count,
+                        frame_columns const& c) noexcept
+{
+    auto const even_odd = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i headers[2];
+        for (int half = 0; half < 2; ++half)
+        {
+            auto const* p = frames + (i + 4 * static_cast<std::size_t>(half)) *
+                                       (sizeof(frame_header) + 8);
+            // [h0 p0 | h1 p1] and [h2 p2 | h3 p3]
+            auto const a =
+              _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p));
+            auto const b =
+              _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p + 32));
+            // [h0 h2 | h1 h3] -> [h0 h1 h2 h3]
+            auto const h = _mm256_permute4x64_epi64(
+              _mm256_unpacklo_epi64(a, b), 0xD8);
+            if (c.payload[0] != nullptr)
+            {
+                auto const pl = _mm256_permute4x64_epi64(
+                  _mm256_unpackhi_epi64(a, b), 0xD8);
+                _mm256_storeu_si256(
+                  reinterpret_cast<__m256i*>(c.payload[0] + i + 4 * half),
+                  pl);
+            }
+            // [id0 id1 id2 id3 | meta0 meta1 meta2 meta3]
+            headers[half] = _mm256_permutevar8x32_epi32(h, even_odd);
+        }
+        store_header_columns(
+          _mm256_permute2x128_si256(headers[0], headers[1], 0x20),
+          _mm256_permute2x128_si256(headers[0], headers[1], 0x31),
+          i,
+          c);
+    }
+    return i;
+}
+
+// Other frame types: the header words of 8 frames and every payload lane of
+// 4 frames are gathered with a constant stride.
+__attribute__((target("avx2"))) inline std::size_t
+to_columns_gather_avx2(unsigned char const* frames,
+                       std::size_t stride,
+                       std::size_t words,
+                       std::size_t count,
+                       frame_columns const& c) noexcept
+{
+    auto const s = static_cast<int>(stride);
+    auto const index32 =
+      _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+    auto const index64 = _mm256_setr_epi64x(0, s, 2 * s, 3 * s);
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        auto const* p = frames + i * stride;
+        auto const id_words = _mm256_i32gather_epi32(
+          reinterpret_cast<int const*>(p), index32, 1);
+        auto const meta = _mm256_i32gather_epi32(
+          reinterpret_cast<int const*>(p + 4), index32, 1);
+        store_header_columns(id_words, meta, i, c);
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            if (c.payload[w] == nullptr)
+            {
+                continue;
+            }
+            auto const* q = p + sizeof(frame_header) + 8 * w;
+            for (std::size_t half = 0; half < 2; ++half)
+            {
+                auto const v = _mm256_i64gather_epi64(
+                  reinterpret_cast<long long const*>(q + 4 * half * stride),
+                  index64,
+                  1);
+                _mm256_storeu_si256(
+                  reinterpret_cast<__m256i*>(c.payload[w] + i + 4 * half), v);
+            }
+        }
+    }
+    return i;
+}
+
+// Classic frames (16 bytes): the inverse of `to_columns_classic_avx2`, with
+// the flag and length bytes widened to 32 bits and interleaved with the
+// identifiers, then with the payloads.
+__attribute__((target("avx2"))) inline std::size_t
+from_columns_classic_avx2(frame_columns const& c,
+                          std::size_t count,
+                          unsigned char* frames) noexcept
+{
+    auto const zero = _mm256_setzero_si256();
+    auto const seven = _mm256_set1_epi32(7);
+    auto const mask = _mm256_set1_epi32(static_cast<int>(header_id_mask));
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        auto const flags =
+          c.flags != nullptr
+            ? _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<__m128i const*>(c.flags + i)))
+            : zero;
+        auto const ids =
+          c.id != nullptr
+            ? _mm256_and_si256(
+                _mm256_loadu_si256(reinterpret_cast<__m256i const*>(c.id + i)),
+                mask)
+            : zero;
+        auto const lengths =
+          c.length != nullptr
+            ? _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+                reinterpret_cast<__m128i const*>(c.length + i)))
+            : zero;
+        auto const id_words = _mm256_or_si256(
+          ids, _mm256_slli_epi32(_mm256_and_si256(flags, seven), 29));
+        auto const meta = _mm256_or_si256(
+          lengths,
+          _mm256_slli_epi32(
+            _mm256_and_si256(_mm256_srli_epi32(flags, 3), seven), 8));
+        // [h0 h1 | h4 h5] and [h2 h3 | h6 h7]
+        auto const lo = _mm256_unpacklo_epi32(id_words, meta);
+        auto const hi = _mm256_unpackhi_epi32(id_words, meta);
+        __m256i const headers[2] = {_mm256_permute2x128_si256(lo, hi, 0x20),
+                                    _mm256_permute2x128_si256(lo, hi, 0x31)};
+        for (int half = 0; half < 2; ++half)
+        {
+            auto const h = headers[half];
+            auto const pl =
+              c.payload[0] != nullptr
+                ? _mm256_loadu_si256(reinterpret_cast<__m256i const*>(
+                    c.payload[0] + i + 4 * half))
+                : zero;
+            // [h0 p0 | h2 p2] and [h1 p1 | h3 p3]
+            auto const even = _mm256_unpacklo_epi64(h, pl);
+            auto const odd = _mm256_unpackhi_epi64(h, pl);
+            auto* p = frames + (i + 4 * static_cast<std::size_t>(half)) *
+                                 (sizeof(frame_header) + 8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+                                _mm256_permute2x128_si256(even, odd, 0x20));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(p + 32),
+                                _mm256_permute2x128_si256(even, odd, 0x31));
+        }
+    }
+    return i;
+}
+
+#endif // CANARY_HAS_AVX2_DISPATCH
+
+} // namespace detail
+
+/// Converts an array of frames into columns. `Frame` must be a standard
+/// layout type that starts with a `frame_header` immediately followed by the
+/// payload (e.g. `::can_frame` or `::canfd_frame`), whose size is a multiple
+/// of 8 bytes and at most 64 bytes.
+/// \notes When the CPU supports AVX2, classic frames are split with shuffles
+/// and other frame types are gathered, 8 frames at a time.
+/// \param frames Pointer to an array of frames.
+/// \param count Number of frames.
+/// \param columns The output columns, each with room for `count` elements.
+/// \param times Optional timestamps of the frames, for the time column.
+template<class Frame>
+void
+to_columns(Frame const* frames,
+           std::size_t count,
+           frame_columns const& columns,
+           timestamp const* times = nullptr) noexcept
+{
+    static_assert(sizeof(Frame) > sizeof(frame_header),
+                  "Frame must contain a payload after the header.");
+    constexpr std::size_t words = (sizeof(Frame) - sizeof(frame_header)) / 8;
+    static_assert(words <= 8 &&
+                    (sizeof(Frame) - sizeof(frame_header)) % 8 == 0,
+                  "Frame payload must be a whole number of 64-bit words, at "
+                  "most 64 bytes.");
+    auto const* p = reinterpret_cast<unsigned char const*>(frames);
+    std::size_t first = 0;
+#ifdef CANARY_HAS_AVX2_DISPATCH
+    if (detail::has_avx2())
+    {
+        first = sizeof(Frame) == sizeof(frame_header) + 8
+                  ? detail::to_columns_classic_avx2(p, count, columns)
+                  : detail::to_columns_gather_avx2(
+                      p, sizeof(Frame), words, count, columns);
+    }
+#endif // CANARY_HAS_AVX2_DISPATCH
+    detail::to_columns_scalar(p, sizeof(Frame), words, first, count, columns);
+
+    if (times != nullptr && columns.time != nullptr)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            columns.time[i] = times[i].time_since_epoch().count();
+        }
+    }
+}
+
+/// Converts columns back into an array of frames, the inverse of
+/// `to_columns`. Null columns produce zeros, and the padding of the header
+/// is cleared.
+/// \notes When the CPU supports AVX2, classic frames are assembled with
+/// shuffles, 8 frames at a time.
+/// \param columns The input columns, each with `count` elements.
+/// \param count Number of frames.
+/// \param frames Pointer to the output array of frames.
+/// \param times Optional output timestamps, from the time column.
+template<class Frame>
+void
+from_columns(frame_columns const& columns,
+             std::size_t count,
+             Frame* frames,
+             timestamp* times = nullptr) noexcept
+{
+    static_assert(sizeof(Frame) > sizeof(frame_header),
+                  "Frame must contain a payload after the header.");
+    constexpr std::size_t words = (sizeof(Frame) - sizeof(frame_header)) / 8;
+    static_assert(words <= 8 &&
+                    (sizeof(Frame) - sizeof(frame_header)) % 8 == 0,
+                  "Frame payload must be a whole number of 64-bit words, at "
+                  "most 64 bytes.");
+    auto* p = reinterpret_cast<unsigned char*>(frames);
+    std::size_t first = 0;
+#ifdef CANARY_HAS_AVX2_DISPATCH
+    if (sizeof(Frame) == sizeof(frame_header) + 8 &&
+        detail::has_avx2())
+    {
+        first = detail::from_columns_classic_avx2(columns, count, p);
+    }
+#endif // CANARY_HAS_AVX2_DISPATCH
+    detail::from_columns_scalar(columns, words, first, count, p, sizeof(Frame));
+
+    if (times != nullptr && columns.time != nullptr)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            times[i] = timestamp{std::chrono::nanoseconds{columns.time[i]}};
+        }
+    }
+}
+
+} // namespace canary
+
+#endif // CANARY_FRAME_COLUMNS_HPP
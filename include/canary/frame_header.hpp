@@ -137,7 +137,75 @@ public:
         return length_;
     }
 
+    /// Sets the bit rate switch flag of a CAN FD frame. The flag determines
+    /// whether the payload is transmitted with the second (data) bit rate.
+    /// \param value The value of the flag.
+    void bit_rate_switch(bool value)
+    {
+        set_flag(brs_flag, value);
+    }
+
+    /// Gets the bit rate switch flag of a CAN FD frame.
+    /// \returns The value of the flag. True indicates the payload was
+    /// transmitted with the second (data) bit rate.
+    bool bit_rate_switch() const noexcept
+    {
+        return (flags_ & brs_flag);
+    }
+
+    /// Sets the error state indicator flag of a CAN FD frame.
+    /// \notes The flag is generated by the transmitting CAN controller,
+    /// setting it when sending may be ignored, or may make the frame look
+    /// like it was sent by an error passive node.
+    /// \param value The value of the flag.
+    void error_state_indicator(bool value)
+    {
+        set_flag(esi_flag, value);
+    }
+
+    /// Gets the error state indicator flag of a CAN FD frame.
+    /// \returns The value of the flag. True indicates the transmitting node
+    /// was error passive.
+    bool error_state_indicator() const noexcept
+    {
+        return (flags_ & esi_flag);
+    }
+
+    /// Sets the FD format flag, which marks a frame as a CAN FD frame
+    /// regardless of the size it is stored in.
+    /// \notes Recent kernels set this flag on all received CAN FD frames,
+    /// older kernels never set it. The size of a received frame tells the
+    /// formats apart on all kernels (see `parse_frame`).
+    /// \param value The value of the flag.
+    void fd_format(bool value)
+    {
+        set_flag(fdf_flag, value);
+    }
+
+    /// Gets the FD format flag.
+    /// \returns The value of the flag. True indicates a CAN FD frame.
+    bool fd_format() const noexcept
+    {
+        return (flags_ & fdf_flag);
+    }
+
 private:
+    void set_flag(std::uint8_t flag, bool value) noexcept
+    {
+        if (value)
+        {
+            flags_ = static_cast<std::uint8_t>(flags_ | flag);
+        }
+        else
+        {
+            flags_ = static_cast<std::uint8_t>(flags_ & ~flag);
+        }
+    }
+
+    static constexpr std::uint8_t brs_flag = 0x01;
+    static constexpr std::uint8_t esi_flag = 0x02;
+    static constexpr std::uint8_t fdf_flag = 0x04;
+
     static constexpr std::uint32_t id_mask = 0x1FFFFFFF;
     static constexpr std::uint32_t format_flag = 0x80000000;
     static constexpr std::uint32_t rtr_flag = 0x40000000;
@@ -152,6 +220,50 @@ private:
 static_assert(sizeof(frame_header) == sizeof(std::uint32_t) * 2,
               "Size of frame header must be exactly 8 bytes");
 
+/// Converts a data length code to a payload length. Codes above 8 are only
+/// valid in CAN FD frames, and map to lengths of 12 to 64 bytes. Codes above
+/// 15 are treated as 15.
+/// \param dlc The data length code.
+/// \returns The payload length in bytes.
+inline std::size_t
+dlc_to_length(std::uint8_t dlc) noexcept
+{
+    static constexpr std::uint8_t lengths[16] = {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    return lengths[dlc & 0x0F];
+}
+
+/// Converts a payload length to the smallest data length code which can hold
+/// it. Lengths above 64 bytes are treated as 64.
+/// \param length The payload length in bytes.
+/// \returns The data length code.
+inline std::uint8_t
+length_to_dlc(std::size_t length) noexcept
+{
+    static constexpr std::uint8_t codes[65] = {
+      0,  1,  2,  3,  4,  5,  6,  7,  8,                          // 0-8
+      9,  9,  9,  9,                                              // 9-12
+      10, 10, 10, 10,                                             // 13-16
+      11, 11, 11, 11,                                             // 17-20
+      12, 12, 12, 12,                                             // 21-24
+      13, 13, 13, 13, 13, 13, 13, 13,                             // 25-32
+      14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, 14, // 33-48
+      15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, // 49-64
+    };
+    return codes[length > 64 ? 64 : length];
+}
+
+/// Rounds a payload length up to the nearest length a CAN FD frame can
+/// carry (0-8, 12, 16, 20, 24, 32, 48 or 64 bytes). The unused bytes of a
+/// rounded payload should be padded, e.g. with zeros.
+/// \param length The payload length in bytes, at most 64.
+/// \returns The rounded length.
+inline std::size_t
+fd_payload_length(std::size_t length) noexcept
+{
+    return dlc_to_length(length_to_dlc(length));
+}
+
 } // namespace canary
 
 #endif // CANARY_FRAME_HEADER_HPP
@@ -0,0 +1,292 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_FRAME_MERGER_HPP
+#define CANARY_FRAME_MERGER_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/frame.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace canary
+{
+
+/// A frame emitted by a `frame_merger`.
+struct merged_frame
+{
+    /// The source the frame was pushed from.
+    std::size_t source;
+    /// The timestamp of the frame.
+    timestamp time;
+    /// The frame. Refers to memory owned by the merger, which is valid until
+    /// the next call to `push` or `pop`.
+    net::const_buffer data;
+};
+
+/// Merges frames from several sources, e.g. sockets bound to different
+/// interfaces or trace files, into a single stream ordered by timestamp.
+///
+/// Each source must push its frames in timestamp order, which holds for the
+/// kernel's reception timestamps of a socket. Frames are held back until no
+/// source can push an earlier frame anymore, i.e. until their timestamp is
+/// not later than the last timestamp pushed by every source which has not
+/// finished. Merging trace files relies on this rule alone, and is exact.
+///
+/// Live sources may be idle for a long time, so frames are also released once
+/// they are older than the reorder window, relative to the current time
+/// passed to `pop`. A frame pushed after a later frame was already emitted is
+/// late: it is counted, and emitted as soon as possible, out of order.
+///
+/// Pending frames are kept in a binary heap ordered by timestamp, and
+/// frames with equal timestamps are emitted in the order they were pushed.
+///
+/// \notes The merger is not thread-safe.
+class frame_merger
+{
+public:
+    /// Configuration of the merger.
+    struct options
+    {
+        /// Number of sources, identified by indices from 0.
+        std::size_t sources = 1;
+        /// How long frames are held back waiting for earlier frames from
+        /// idle live sources.
+        std::chrono::nanoseconds reorder_window = std::chrono::milliseconds{10};
+        /// Largest number of frames emitted by one call to `pop`.
+        std::size_t batch_size = 64;
+    };
+
+    /// Constructs a merger. Throws `system_error` if there are no sources or
+    /// the batch size is zero.
+    /// \param opts Configuration of the merger.
+    explicit frame_merger(options const& opts)
+      : opts_{checked(opts)}
+      , sources_(opts.sources)
+    {
+    }
+
+    /// Adds a frame.
+    /// \param source The index of the source.
+    /// \param frame A classic or CAN FD frame. The frame is copied.
+    /// \param time The timestamp of the frame.
+    /// \returns Whether the frame was added. Frames longer than
+    /// `fd_frame_size` are not.
+    bool push(std::size_t source, net::const_buffer frame, timestamp time)
+    {
+        release();
+        if (frame.size() > fd_frame_size)
+        {
+            return false;
+        }
+        auto& s = sources_.at(source);
+        s.watermark = time;
+        s.started = true;
+        if (emitted_any_ && time < last_emitted_)
+        {
+            ++late_;
+            auto const lateness = last_emitted_ - time;
+            max_lateness_ = std::max(max_lateness_, lateness);
+        }
+
+        std::size_t index;
+        if (free_.empty())
+        {
+            index = slots_.size();
+            slots_.emplace_back();
+        }
+        else
+        {
+            index = free_.back();
+            free_.pop_back();
+        }
+        auto& sl = slots_[index];
+        std::memcpy(sl.data.data(), frame.data(), frame.size());
+        sl.size = frame.size();
+        heap_.push_back(entry{time, sequence_++, source, index});
+        std::push_heap(heap_.begin(), heap_.end(), later);
+        return true;
+    }
+
+    /// Marks a source as finished, e.g. at the end of a trace file, so that
+    /// frames are no longer held back waiting for it.
+    /// \param source The index of the source.
+    void finish(std::size_t source)
+    {
+        sources_.at(source).finished = true;
+    }
+
+    /// Emits the frames which no source can precede anymore.
+    /// \param out Set to the emitted frames, in timestamp order, at most
+    /// `options::batch_size`.
+    /// \returns The number of frames emitted.
+    std::size_t pop(std::vector<merged_frame>& out)
+    {
+        return emit(out, safe_time());
+    }
+
+    /// Emits the frames which no source can precede anymore, and those older
+    /// than the reorder window.
+    /// \param out Set to the emitted frames, in timestamp order, at most
+    /// `options::batch_size`.
+    /// \param now The current time, of the clock which timestamps frames.
+    /// \returns The number of frames emitted.
+    std::size_t pop(std::vector<merged_frame>& out, timestamp now)
+    {
+        return emit(out, std::max(safe_time(), now - opts_.reorder_window));
+    }
+
+    /// Emits pending frames regardless of the sources, e.g. on shutdown.
+    /// \param out Set to the emitted frames, in timestamp order, at most
+    /// `options::batch_size`.
+    /// \returns The number of frames emitted.
+    std::size_t drain(std::vector<merged_frame>& out)
+    {
+        return emit(out, timestamp::max());
+    }
+
+    /// Number of frames waiting to be emitted.
+    std::size_t pending() const noexcept
+    {
+        return heap_.size();
+    }
+
+    /// Number of frames pushed after a later frame was emitted.
+    std::size_t late() const noexcept
+    {
+        return late_;
+    }
+
+    /// Largest difference between the timestamp of a late frame and the last
+    /// frame emitted before it was pushed.
+    std::chrono::nanoseconds max_lateness() const noexcept
+    {
+        return max_lateness_;
+    }
+
+private:
+    struct entry
+    {
+        timestamp time;
+        std::uint64_t sequence;
+        std::size_t source;
+        std::size_t slot;
+    };
+
+    struct slot
+    {
+        std::array<unsigned char, fd_frame_size> data;
+        std::size_t size;
+    };
+
+    struct source_state
+    {
+        timestamp watermark;
+        bool started = false;
+        bool finished = false;
+    };
+
+    static options const& checked(options const& opts)
+    {
+        if (opts.sources == 0 || opts.batch_size == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    // Orders the heap so that its front is the earliest entry.
+    static bool later(entry const& a, entry const& b) noexcept
+    {
+        return a.time != b.time ? a.time > b.time : a.sequence > b.sequence;
+    }
+
+    // The latest time up to which every unfinished source has pushed frames.
+    timestamp safe_time() const noexcept
+    {
+        auto t = timestamp::max();
+        for (auto const& s : sources_)
+        {
+            if (s.finished)
+            {
+                continue;
+            }
+            if (!s.started)
+            {
+                return timestamp::min();
+            }
+            t = std::min(t, s.watermark);
+        }
+        return t;
+    }
+
+    std::size_t emit(std::vector<merged_frame>& out, timestamp until)
+    {
+        release();
+        out.clear();
+        while (!heap_.empty() && out.size() < opts_.batch_size)
+        {
+            auto const& e = heap_.front();
+            auto const is_late = emitted_any_ && e.time < last_emitted_;
+            if (e.time > until && !is_late)
+            {
+                break;
+            }
+            auto const& sl = slots_[e.slot];
+            out.push_back(merged_frame{
+              e.source, e.time, net::buffer(sl.data.data(), sl.size)});
+            released_.push_back(e.slot);
+            if (!is_late)
+            {
+                last_emitted_ = e.time;
+                emitted_any_ = true;
+            }
+            std::pop_heap(heap_.begin(), heap_.end(), later);
+            heap_.pop_back();
+        }
+        return out.size();
+    }
+
+    // Reuses the slots of the frames emitted by the previous call to `pop`.
+    void release()
+    {
+        free_.insert(free_.end(), released_.begin(), released_.end());
+        released_.clear();
+    }
+
+    options opts_;
+    std::vector<source_state> sources_;
+    std::vector<entry> heap_;
+    std::vector<slot> slots_;
+    std::vector<std::size_t> free_;
+    std::vector<std::size_t> released_;
+    std::uint64_t sequence_ = 0;
+    timestamp last_emitted_;
+    bool emitted_any_ = false;
+    std::size_t late_ = 0;
+    std::chrono::nanoseconds max_lateness_{0};
+};
+
+} // namespace canary
+
+#endif // CANARY_FRAME_MERGER_HPP
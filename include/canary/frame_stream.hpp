@@ -0,0 +1,337 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_FRAME_STREAM_HPP
+#define CANARY_FRAME_STREAM_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <sys/socket.h>
+#include <vector>
+
+namespace canary
+{
+
+/// A contiguous range of frames received by a `basic_frame_stream`.
+///
+/// The frames are stored in the stream, and remain valid until the next
+/// receive on the stream is started.
+template<class Frame>
+class frame_batch
+{
+public:
+    using value_type = Frame;
+    using iterator = Frame*;
+
+    /// Constructs an empty batch.
+    frame_batch() noexcept = default;
+
+    /// Constructs a batch of `size` frames starting at `data`.
+    frame_batch(Frame* data, std::size_t size) noexcept
+      : data_{data}
+      , size_{size}
+    {
+    }
+
+    iterator begin() const noexcept
+    {
+        return data_;
+    }
+
+    iterator end() const noexcept
+    {
+        return data_ + size_;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    Frame& operator[](std::size_t i) const noexcept
+    {
+        return data_[i];
+    }
+
+private:
+    Frame* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/// Receives frames from a socket in batches.
+///
+/// Each receive waits until the socket is readable, and then drains all
+/// frames which are available, up to `options::batch_size`, with a single
+/// `recvmmsg` call, into a buffer owned by the stream. A consumer which
+/// handles frames one at a time, e.g. a coroutine awaiting `async_receive`,
+/// is resumed once per frame. A consumer of a frame stream is resumed once
+/// per batch, so the cost of a resumption is shared by all frames which
+/// arrived while the previous batch was being processed:
+///
+/// \code
+/// canary::frame_stream<can_frame> stream{sock};
+/// for (;;)
+/// {
+///     for (auto& f : co_await stream.async_next(net::use_awaitable))
+///     {
+///         process(f);
+///     }
+/// }
+/// \endcode
+///
+/// A frame shorter than `Frame` (e.g. a classic frame received into a CAN FD
+/// sized frame) only overwrites the beginning of its slot, and is described
+/// by its header.
+///
+/// \notes At most one receive may be outstanding. The stream refers to the
+/// socket, which must outlive it, and pending operations refer to the
+/// stream, which must outlive them.
+template<class Frame, class Socket>
+class basic_frame_stream
+{
+public:
+    /// The type of a received batch.
+    using batch_type = frame_batch<Frame>;
+
+    /// Configuration of the stream.
+    struct options
+    {
+        /// Largest number of frames received at once.
+        std::size_t batch_size = 64;
+    };
+
+    /// Constructs a stream with the default options.
+    /// \param sock The socket to receive from.
+    explicit basic_frame_stream(Socket& sock)
+      : basic_frame_stream{sock, options{}}
+    {
+    }
+
+    /// Constructs a stream. Throws `system_error` if the batch size is zero.
+    /// \param sock The socket to receive from.
+    /// \param opts Configuration of the stream.
+    basic_frame_stream(Socket& sock, options const& opts)
+      : sock_{sock}
+      , timer_{sock.get_executor()}
+      , frames_(opts.batch_size)
+      , iovs_(opts.batch_size)
+      , msgs_(opts.batch_size)
+    {
+        if (opts.batch_size == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        for (std::size_t i = 0; i < frames_.size(); ++i)
+        {
+            iovs_[i].iov_base = &frames_[i];
+            iovs_[i].iov_len = sizeof(Frame);
+            msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    basic_frame_stream(basic_frame_stream const&) = delete;
+    basic_frame_stream& operator=(basic_frame_stream const&) = delete;
+
+    /// Asynchronously receives the next batch of frames, which contains at
+    /// least one frame unless an error occurred. The completion signature is
+    /// `void(error_code, batch_type)`.
+    /// \param token The completion token.
+    template<class CompletionToken>
+    auto async_next(CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, batch_type)>
+    {
+        return net::async_compose<CompletionToken,
+                                  void(error_code, batch_type)>(
+          next_op{*this, std::chrono::steady_clock::duration::zero()},
+          token,
+          sock_);
+    }
+
+    /// Asynchronously receives the next batch of frames, failing with
+    /// `net::error::timed_out` if no frame arrives within the timeout. The
+    /// completion signature is `void(error_code, batch_type)`.
+    /// \param timeout How long to wait for a frame. Must be positive.
+    /// \param token The completion token.
+    template<class Rep, class Period, class CompletionToken>
+    auto async_next(std::chrono::duration<Rep, Period> timeout,
+                    CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, batch_type)>
+    {
+        return net::async_compose<CompletionToken,
+                                  void(error_code, batch_type)>(
+          next_op{
+            *this,
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              timeout)},
+          token,
+          sock_);
+    }
+
+    /// Cancels the outstanding receive, which fails with
+    /// `net::error::operation_aborted`. Cancels all other asynchronous
+    /// operations on the socket as well.
+    void cancel()
+    {
+        ++generation_;
+        timer_.cancel();
+        sock_.cancel();
+    }
+
+    /// Returns the socket.
+    Socket& socket() noexcept
+    {
+        return sock_;
+    }
+
+private:
+    class next_op
+    {
+    public:
+        next_op(basic_frame_stream& s,
+                std::chrono::steady_clock::duration timeout)
+          : stream_{s}
+          , timeout_{timeout}
+        {
+        }
+
+        template<class Self>
+        void operator()(Self& self)
+        {
+            error_code ec;
+            auto const n = stream_.drain(ec);
+            if (n > 0 || ec)
+            {
+                // Must not complete within the initiating function.
+                net::post(stream_.sock_.get_executor(),
+                          std::bind(std::move(self), ec, n));
+                return;
+            }
+            if (timeout_ > std::chrono::steady_clock::duration::zero())
+            {
+                stream_.start_timer(timeout_);
+            }
+            stream_.wait(std::move(self));
+        }
+
+        template<class Self>
+        void operator()(Self& self, error_code ec)
+        {
+            if (stream_.timed_out_)
+            {
+                ec = net::error::timed_out;
+            }
+            std::size_t n = 0;
+            if (!ec)
+            {
+                n = stream_.drain(ec);
+                if (n == 0 && !ec)
+                {
+                    stream_.wait(std::move(self));
+                    return;
+                }
+            }
+            (*this)(self, ec, n);
+        }
+
+        template<class Self>
+        void operator()(Self& self, error_code ec, std::size_t n)
+        {
+            stream_.stop_timer();
+            self.complete(ec, batch_type{stream_.frames_.data(), n});
+        }
+
+    private:
+        basic_frame_stream& stream_;
+        std::chrono::steady_clock::duration timeout_;
+    };
+
+    std::size_t drain(error_code& ec)
+    {
+        auto const r = ::recvmmsg(sock_.native_handle(),
+                                  msgs_.data(),
+                                  static_cast<unsigned>(msgs_.size()),
+                                  MSG_DONTWAIT,
+                                  nullptr);
+        if (r < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                detail::assign_errno(ec);
+            }
+            return 0;
+        }
+        return static_cast<std::size_t>(r);
+    }
+
+    template<class Self>
+    void wait(Self&& self)
+    {
+        sock_.async_wait(Socket::wait_read, std::forward<Self>(self));
+    }
+
+    void start_timer(std::chrono::steady_clock::duration timeout)
+    {
+        auto const generation = ++generation_;
+        timing_ = true;
+        timer_.expires_after(timeout);
+        timer_.async_wait([this, generation](error_code ec) {
+            if (!ec && generation == generation_)
+            {
+                timed_out_ = true;
+                sock_.cancel();
+            }
+        });
+    }
+
+    void stop_timer()
+    {
+        if (!timing_)
+        {
+            return;
+        }
+        ++generation_;
+        timing_ = false;
+        timed_out_ = false;
+        timer_.cancel();
+    }
+
+    Socket& sock_;
+    net::steady_timer timer_;
+    std::vector<Frame> frames_;
+    std::vector<::iovec> iovs_;
+    std::vector<::mmsghdr> msgs_;
+    std::size_t generation_ = 0;
+    bool timing_ = false;
+    bool timed_out_ = false;
+};
+
+/// A frame stream for raw CAN sockets.
+template<class Frame>
+using frame_stream = basic_frame_stream<Frame, raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_FRAME_STREAM_HPP
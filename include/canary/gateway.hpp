@@ -0,0 +1,387 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_GATEWAY_HPP
+#define CANARY_GATEWAY_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/filter.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/kernel_gateway.hpp>
+#include <canary/raw.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sys/socket.h>
+#include <vector>
+
+namespace canary
+{
+
+/// Forwards frames between sockets in userspace, e.g. between raw sockets
+/// bound to different CAN interfaces.
+///
+/// Each route forwards the frames received on a source socket which match
+/// any of its filters to a destination socket, optionally rewriting their
+/// CAN ID. Frames are received and sent in batches, with one `recvmmsg` call
+/// per source and one `sendmmsg` call per route. Payloads are sent straight
+/// from the receive buffer, only the header of a frame is copied, so that
+/// its ID can be rewritten independently for every route.
+///
+/// Frames which the destination cannot accept, e.g. because the transmit
+/// queue of its interface is full, are dropped and counted, like the kernel's
+/// gateway does. Classic and CAN FD frames are forwarded, a raw socket must
+/// have `flexible_data_rate` enabled to receive CAN FD frames. Frames of other
+/// sizes, e.g. CAN XL frames, are ignored.
+///
+/// Routes which the kernel's gateway can handle may be moved to it with
+/// `offload`, in which case frames never reach userspace.
+///
+/// \notes The gateway is not thread-safe. It refers to its sockets, which
+/// must outlive it, and pending operations refer to the gateway, which must
+/// outlive them. A raw socket does not receive the frames it sends, so the
+/// same socket should be used as the source of one direction and the
+/// destination of the other, when forwarding both ways between two
+/// interfaces.
+template<class Socket>
+class basic_gateway
+{
+public:
+    /// Configuration of the gateway.
+    struct options
+    {
+        /// Largest number of frames received from a source at once.
+        std::size_t batch_size = 64;
+    };
+
+    /// A forwarding route.
+    struct route
+    {
+        /// Frames matching any of the filters are forwarded. No filters
+        /// forward every frame.
+        std::vector<filter> filters;
+        /// Rewrite applied to the CAN ID of forwarded frames.
+        id_rewrite rewrite;
+        /// Whether CAN FD frames are forwarded, in addition to classic
+        /// frames.
+        bool fd_frames = true;
+    };
+
+    /// Constructs a gateway with the default options.
+    basic_gateway()
+      : basic_gateway{options{}}
+    {
+    }
+
+    /// Constructs a gateway. Throws `system_error` if the batch size is zero.
+    /// \param opts Configuration of the gateway.
+    explicit basic_gateway(options const& opts)
+      : opts_{opts}
+    {
+        if (opts.batch_size == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+    }
+
+    basic_gateway(basic_gateway const&) = delete;
+    basic_gateway& operator=(basic_gateway const&) = delete;
+
+    /// Adds a route. Must not be called while the gateway is running.
+    /// \param source The socket frames are received from.
+    /// \param destination The socket frames are sent to.
+    /// \param r The route.
+    void add_route(Socket& source, Socket& destination, route r)
+    {
+        find_source(source).routes.emplace_back(
+          new route_state{destination, std::move(r), opts_.batch_size});
+    }
+
+    /// Starts forwarding on all sources.
+    void start()
+    {
+        running_ = true;
+        for (auto& s : sources_)
+        {
+            if (!s->routes.empty())
+            {
+                wait(*s);
+            }
+        }
+    }
+
+    /// Stops forwarding. Cancels all asynchronous operations on the source
+    /// sockets.
+    void stop()
+    {
+        running_ = false;
+        for (auto& s : sources_)
+        {
+            s->sock.cancel();
+        }
+    }
+
+    /// Moves all routes between raw sockets which the kernel's gateway can
+    /// handle, i.e. those with at most one filter, to the kernel. Each moved
+    /// route is installed as one kernel rule for classic frames and, if CAN
+    /// FD frames are forwarded, one for CAN FD frames. Must not be called
+    /// while the gateway is running. Throws `system_error` on failure, in
+    /// which case the route which could not be installed, and those after
+    /// it, remain in userspace.
+    /// \param kernel The kernel gateway to install the rules with.
+    /// \returns The number of routes moved.
+    std::size_t offload(kernel_gateway& kernel)
+    {
+        std::size_t moved = 0;
+        for (auto& s : sources_)
+        {
+            auto const src = s->sock.local_endpoint().interface_index();
+            auto& routes = s->routes;
+            for (auto it = routes.begin(); it != routes.end();)
+            {
+                auto const& r = (*it)->r;
+                if (r.filters.size() > 1)
+                {
+                    ++it;
+                    continue;
+                }
+                kernel_gateway::rule rule;
+                rule.source = src;
+                rule.destination =
+                  (*it)->destination.local_endpoint().interface_index();
+                if (!r.filters.empty())
+                {
+                    rule.match = r.filters.front();
+                }
+                rule.rewrite = r.rewrite;
+                kernel.add(rule);
+                if (r.fd_frames)
+                {
+                    auto fd_rule = rule;
+                    fd_rule.fd_frames = true;
+                    error_code ec;
+                    kernel.add(fd_rule, ec);
+                    if (ec)
+                    {
+                        error_code ignored;
+                        kernel.remove(rule, ignored);
+                        canary::detail::throw_exception(system_error{ec});
+                    }
+                    offloaded_.push_back(fd_rule);
+                }
+                offloaded_.push_back(rule);
+                it = routes.erase(it);
+                ++moved;
+            }
+        }
+        return moved;
+    }
+
+    /// The kernel rules installed by `offload`, which
+    /// `kernel_gateway::remove` removes again.
+    std::vector<kernel_gateway::rule> const& offloaded() const noexcept
+    {
+        return offloaded_;
+    }
+
+    /// Number of frames forwarded.
+    std::size_t forwarded() const noexcept
+    {
+        return forwarded_;
+    }
+
+    /// Number of frames the destination did not accept.
+    std::size_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+private:
+    struct route_state
+    {
+        route_state(Socket& dst, route rt, std::size_t batch_size)
+          : destination{dst}
+          , r(std::move(rt))
+          , headers(batch_size)
+          , iovs(2 * batch_size)
+          , msgs(batch_size)
+        {
+        }
+
+        Socket& destination;
+        route r;
+        std::vector<frame_header> headers;
+        std::vector<::iovec> iovs;
+        std::vector<::mmsghdr> msgs;
+    };
+
+    struct source
+    {
+        source(Socket& s, std::size_t batch_size)
+          : sock{s}
+          , frames(batch_size * slot_units)
+          , iovs(batch_size)
+          , msgs(batch_size)
+        {
+            for (std::size_t i = 0; i < batch_size; ++i)
+            {
+                iovs[i].iov_base = slot(i);
+                iovs[i].iov_len = fd_frame_size;
+                msgs[i].msg_hdr.msg_iov = &iovs[i];
+                msgs[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+
+        std::uint8_t* slot(std::size_t i) noexcept
+        {
+            return reinterpret_cast<std::uint8_t*>(&frames[i * slot_units]);
+        }
+
+        static constexpr std::size_t slot_units =
+          (fd_frame_size + sizeof(std::max_align_t) - 1) /
+          sizeof(std::max_align_t);
+
+        Socket& sock;
+        std::vector<std::max_align_t> frames;
+        std::vector<::iovec> iovs;
+        std::vector<::mmsghdr> msgs;
+        std::vector<std::unique_ptr<route_state>> routes;
+    };
+
+    source& find_source(Socket& sock)
+    {
+        for (auto& s : sources_)
+        {
+            if (&s->sock == &sock)
+            {
+                return *s;
+            }
+        }
+        sources_.emplace_back(new source{sock, opts_.batch_size});
+        return *sources_.back();
+    }
+
+    void wait(source& s)
+    {
+        s.sock.async_wait(Socket::wait_read, [this, &s](error_code ec) {
+            if (ec || !running_)
+            {
+                return;
+            }
+            forward(s);
+            wait(s);
+        });
+    }
+
+    void forward(source& s)
+    {
+        auto const r = ::recvmmsg(s.sock.native_handle(),
+                                  s.msgs.data(),
+                                  static_cast<unsigned>(s.msgs.size()),
+                                  MSG_DONTWAIT,
+                                  nullptr);
+        if (r <= 0)
+        {
+            return;
+        }
+        auto const n = static_cast<std::size_t>(r);
+        for (auto& rs : s.routes)
+        {
+            forward(s, n, *rs);
+        }
+    }
+
+    void forward(source& s, std::size_t n, route_state& rs)
+    {
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            auto const size = s.msgs[i].msg_len;
+            if (size != classic_frame_size &&
+                (size != fd_frame_size || !rs.r.fd_frames))
+            {
+                continue;
+            }
+            auto const frame = s.slot(i);
+            std::uint32_t can_id;
+            std::memcpy(&can_id, frame, sizeof(can_id));
+            if (!matches(rs.r.filters, can_id))
+            {
+                continue;
+            }
+
+            auto& h = rs.headers[count];
+            std::memcpy(&h, frame, sizeof(h));
+            h.id(rs.r.rewrite.apply(h.id()));
+            auto const iov = &rs.iovs[2 * count];
+            iov[0].iov_base = &h;
+            iov[0].iov_len = sizeof(h);
+            iov[1].iov_base = frame + sizeof(h);
+            iov[1].iov_len = size - sizeof(h);
+            rs.msgs[count].msg_hdr.msg_iov = iov;
+            rs.msgs[count].msg_hdr.msg_iovlen = 2;
+            ++count;
+        }
+
+        std::size_t sent = 0;
+        while (sent < count)
+        {
+            auto const r = ::sendmmsg(rs.destination.native_handle(),
+                                      rs.msgs.data() + sent,
+                                      static_cast<unsigned>(count - sent),
+                                      MSG_DONTWAIT);
+            if (r <= 0)
+            {
+                if (r < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            sent += static_cast<std::size_t>(r);
+        }
+        forwarded_ += sent;
+        dropped_ += count - sent;
+    }
+
+    static bool matches(std::vector<filter> const& filters,
+                        std::uint32_t can_id) noexcept
+    {
+        if (filters.empty())
+        {
+            return true;
+        }
+        for (auto const& f : filters)
+        {
+            if (f.matches(can_id))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    options opts_;
+    std::vector<std::unique_ptr<source>> sources_;
+    std::vector<kernel_gateway::rule> offloaded_;
+    bool running_ = false;
+    std::size_t forwarded_ = 0;
+    std::size_t dropped_ = 0;
+};
+
+/// A gateway between raw CAN sockets.
+using gateway = basic_gateway<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_GATEWAY_HPP
@@ -0,0 +1,380 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_INSTRUMENTED_SOCKET_HPP
+#define CANARY_INSTRUMENTED_SOCKET_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/isotp.hpp>
+#include <canary/metrics.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+#include <canary/timestamp.hpp>
+
+#include <utility>
+
+namespace canary
+{
+
+namespace detail
+{
+
+inline void
+record_receive(socket_metrics& m,
+               error_code const& ec,
+               std::size_t n,
+               timestamp ts) noexcept
+{
+    if (ec)
+    {
+        if (ec != net::error::operation_aborted)
+        {
+            m.errors.add();
+        }
+        return;
+    }
+    m.frames_received.add();
+    m.bytes_received.add(n);
+    if (ts.time_since_epoch().count() != 0)
+    {
+        m.receive_latency.record(canary::timestamp_now() - ts);
+    }
+}
+
+inline void
+record_send(socket_metrics& m, error_code const& ec, std::size_t n) noexcept
+{
+    if (!ec)
+    {
+        m.frames_sent.add();
+        m.bytes_sent.add(n);
+    }
+    else if (ec == net::error::would_block ||
+             ec == net::error::no_buffer_space)
+    {
+        m.would_block.add();
+    }
+    else if (ec != net::error::operation_aborted)
+    {
+        m.errors.add();
+    }
+}
+
+template<class Socket, class MutableBufferSequence>
+class instrumented_receive_op
+{
+public:
+    instrumented_receive_op(Socket& sock,
+                            socket_metrics& metrics,
+                            MutableBufferSequence const& buffers,
+                            int flags)
+      : sock_{sock}
+      , metrics_{metrics}
+      , buffers_{buffers}
+      , flags_{flags}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec = {})
+    {
+        if (state_ != state::done)
+        {
+            if (!ec)
+            {
+                n_ = detail::receive_timestamped_once(
+                  sock_.native_handle(), buffers_, flags_, ts_, ec);
+                if (ec == net::error::would_block)
+                {
+                    metrics_.would_block.add();
+                    n_ = 0;
+                    state_ = state::waiting;
+                    sock_.async_wait(Socket::wait_read, std::move(self));
+                    return;
+                }
+            }
+
+            auto const started = state_ == state::starting;
+            ec_ = ec;
+            state_ = state::done;
+            if (started)
+            {
+                // Completed without waiting, the handler must not be invoked
+                // from within the initiating function.
+                net::post(sock_.get_executor(), std::move(self));
+                return;
+            }
+        }
+
+        // Recorded right before invoking the handler, so that the latency
+        // includes time spent in the reactor and the scheduler queue.
+        detail::record_receive(metrics_, ec_, n_, ts_);
+        self.complete(ec_, n_);
+    }
+
+private:
+    enum class state
+    {
+        starting,
+        waiting,
+        done
+    };
+
+    Socket& sock_;
+    socket_metrics& metrics_;
+    MutableBufferSequence buffers_;
+    int flags_;
+    timestamp ts_{};
+    error_code ec_;
+    std::size_t n_ = 0;
+    state state_ = state::starting;
+};
+
+template<class Socket, class ConstBufferSequence>
+class instrumented_send_op
+{
+public:
+    instrumented_send_op(Socket& sock,
+                         socket_metrics& metrics,
+                         ConstBufferSequence const& buffers,
+                         int flags)
+      : sock_{sock}
+      , metrics_{metrics}
+      , buffers_{buffers}
+      , flags_{flags}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec = {}, std::size_t n = 0)
+    {
+        if (!started_)
+        {
+            started_ = true;
+            sock_.async_send(buffers_, flags_, std::move(self));
+            return;
+        }
+        detail::record_send(metrics_, ec, n);
+        self.complete(ec, n);
+    }
+
+private:
+    Socket& sock_;
+    socket_metrics& metrics_;
+    ConstBufferSequence buffers_;
+    int flags_;
+    bool started_ = false;
+};
+
+} // namespace detail
+
+/// Wraps a CAN socket and keeps per-socket counters (frames, bytes, errors and
+/// would-block events) and a histogram of the time from kernel reception of a
+/// frame to completion of the receive operation.
+///
+/// Metrics can be read at any time, from any thread, using
+/// `metrics().snapshot()` and exported with `write_text`.
+/// \notes When `CANARY_DISABLE_METRICS` is defined, all operations forward
+/// directly to the wrapped socket.
+template<class Socket>
+class basic_instrumented_socket
+{
+public:
+    /// The type of the wrapped socket.
+    using next_layer_type = Socket;
+    /// The type of the executor associated with the socket.
+    using executor_type = typename Socket::executor_type;
+    /// The protocol type.
+    using protocol_type = typename Socket::protocol_type;
+    /// The endpoint type.
+    using endpoint_type = typename Socket::endpoint_type;
+
+    /// Takes ownership of an existing socket.
+    explicit basic_instrumented_socket(next_layer_type socket)
+      : socket_{std::move(socket)}
+    {
+        enable_timestamps();
+    }
+
+    /// Constructs a socket and binds it to the endpoint.
+    template<class ExecutionContextOrExecutor>
+    basic_instrumented_socket(ExecutionContextOrExecutor&& ctx,
+                              endpoint_type const& ep)
+      : socket_{std::forward<ExecutionContextOrExecutor>(ctx), ep}
+    {
+        enable_timestamps();
+    }
+
+    /// Returns the executor associated with the socket.
+    executor_type get_executor() noexcept
+    {
+        return socket_.get_executor();
+    }
+
+    /// Returns the wrapped socket.
+    next_layer_type& next_layer() noexcept
+    {
+        return socket_;
+    }
+
+    /// Returns the wrapped socket.
+    next_layer_type const& next_layer() const noexcept
+    {
+        return socket_;
+    }
+
+    /// Returns the metrics of this socket.
+    socket_metrics& metrics() noexcept
+    {
+        return metrics_;
+    }
+
+    /// Returns the metrics of this socket.
+    socket_metrics const& metrics() const noexcept
+    {
+        return metrics_;
+    }
+
+    /// Sends a frame, see `basic_raw_socket::send`.
+    template<class ConstBufferSequence>
+    std::size_t send(ConstBufferSequence const& buffers,
+                     net::socket_base::message_flags flags,
+                     error_code& ec)
+    {
+        auto const n = socket_.send(buffers, flags, ec);
+        detail::record_send(metrics_, ec, n);
+        return n;
+    }
+
+    /// Sends a frame, see `basic_raw_socket::send`.
+    template<class ConstBufferSequence>
+    std::size_t send(ConstBufferSequence const& buffers,
+                     net::socket_base::message_flags flags = 0)
+    {
+        error_code ec;
+        auto const n = send(buffers, flags, ec);
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+        return n;
+    }
+
+    /// Receives a frame, see `basic_raw_socket::receive`.
+    template<class MutableBufferSequence>
+    std::size_t receive(MutableBufferSequence const& buffers,
+                        net::socket_base::message_flags flags,
+                        error_code& ec)
+    {
+#ifdef CANARY_DISABLE_METRICS
+        return socket_.receive(buffers, flags, ec);
+#else
+        timestamp ts{};
+        std::size_t n;
+        while (true)
+        {
+            n = detail::receive_timestamped_once(
+              socket_.native_handle(), buffers, flags, ts, ec);
+            if (ec != net::error::would_block)
+            {
+                break;
+            }
+            metrics_.would_block.add();
+            if (socket_.non_blocking())
+            {
+                return 0;
+            }
+            socket_.wait(next_layer_type::wait_read, ec);
+            if (ec)
+            {
+                break;
+            }
+        }
+        detail::record_receive(metrics_, ec, n, ts);
+        return n;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Receives a frame, see `basic_raw_socket::receive`.
+    template<class MutableBufferSequence>
+    std::size_t receive(MutableBufferSequence const& buffers,
+                        net::socket_base::message_flags flags = 0)
+    {
+        error_code ec;
+        auto const n = receive(buffers, flags, ec);
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+        return n;
+    }
+
+    /// Asynchronously sends a frame, see `basic_raw_socket::async_send`.
+    template<class ConstBufferSequence, class CompletionToken>
+    auto async_send(ConstBufferSequence const& buffers,
+                    CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+    {
+#ifdef CANARY_DISABLE_METRICS
+        return socket_.async_send(buffers,
+                                  std::forward<CompletionToken>(token));
+#else
+        return net::async_compose<CompletionToken,
+                                  void(error_code, std::size_t)>(
+          detail::instrumented_send_op<Socket, ConstBufferSequence>{
+            socket_, metrics_, buffers, 0},
+          token,
+          socket_);
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Asynchronously receives a frame, see `basic_raw_socket::async_receive`.
+    template<class MutableBufferSequence, class CompletionToken>
+    auto async_receive(MutableBufferSequence const& buffers,
+                       CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+    {
+#ifdef CANARY_DISABLE_METRICS
+        return socket_.async_receive(buffers,
+                                     std::forward<CompletionToken>(token));
+#else
+        return net::async_compose<CompletionToken,
+                                  void(error_code, std::size_t)>(
+          detail::instrumented_receive_op<Socket, MutableBufferSequence>{
+            socket_, metrics_, buffers, 0},
+          token,
+          socket_);
+#endif // CANARY_DISABLE_METRICS
+    }
+
+private:
+    void enable_timestamps()
+    {
+#ifndef CANARY_DISABLE_METRICS
+        if (socket_.is_open())
+        {
+            error_code ec;
+            socket_.set_option(receive_timestamp{true}, ec);
+        }
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    next_layer_type socket_;
+    socket_metrics metrics_;
+};
+
+/// Instrumented raw CAN socket.
+using instrumented_raw_socket = basic_instrumented_socket<raw::socket>;
+
+/// Instrumented ISO-TP socket.
+using instrumented_isotp_socket = basic_instrumented_socket<isotp::socket>;
+
+} // namespace canary
+
+#endif // CANARY_INSTRUMENTED_SOCKET_HPP
@@ -51,4 +51,11 @@ public:
 
 } // namespace canary
 
+#ifdef CANARY_SEPARATE_COMPILATION
+// Instantiated once, in canary/src.hpp.
+extern template class canary::basic_endpoint<canary::isotp>;
+extern template class canary::net::basic_socket<canary::isotp>;
+extern template class canary::net::basic_datagram_socket<canary::isotp>;
+#endif // CANARY_SEPARATE_COMPILATION
+
 #endif // CANARY_ISOTP_HPP
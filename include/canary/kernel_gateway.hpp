@@ -0,0 +1,356 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_KERNEL_GATEWAY_HPP
+#define CANARY_KERNEL_GATEWAY_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/filter.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <linux/can.h>
+#include <linux/can/gw.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace canary
+{
+
+/// Rewrites the CAN ID of forwarded frames. The bits of the ID selected by
+/// the mask are replaced with the corresponding bits of the value, i.e. the
+/// new ID is `(id & ~mask) | (value & mask)`. The format, remote transmission
+/// and error flags of the frame are preserved. In its default-constructed
+/// state, the ID is left unchanged.
+struct id_rewrite
+{
+    /// Constructs a rewrite which leaves the ID unchanged.
+    id_rewrite() = default;
+
+    /// Constructs a rewrite of the bits selected by `mask`.
+    id_rewrite(std::uint32_t mask, std::uint32_t value) noexcept
+      : mask_{mask & id_bitmask}
+      , value_{value & mask & id_bitmask}
+    {
+    }
+
+    /// Constructs a rewrite which replaces the whole ID with `id`.
+    static id_rewrite replace(std::uint32_t id) noexcept
+    {
+        return id_rewrite{id_bitmask, id};
+    }
+
+    /// Gets the mask of rewritten bits.
+    std::uint32_t mask() const noexcept
+    {
+        return mask_;
+    }
+
+    /// Gets the value of rewritten bits.
+    std::uint32_t value() const noexcept
+    {
+        return value_;
+    }
+
+    /// Whether the rewrite leaves the ID unchanged.
+    bool empty() const noexcept
+    {
+        return mask_ == 0;
+    }
+
+    /// Applies the rewrite to a CAN ID.
+    std::uint32_t apply(std::uint32_t id) const noexcept
+    {
+        return (id & ~mask_) | value_;
+    }
+
+private:
+    static constexpr std::uint32_t id_bitmask = 0x1FFFFFFF;
+
+    std::uint32_t mask_ = 0;
+    std::uint32_t value_ = 0;
+};
+
+namespace detail
+{
+
+// Builds an rtnetlink request for the kernel's CAN_GW module.
+class cgw_message
+{
+public:
+    cgw_message(std::uint16_t type, std::uint16_t gw_flags, std::uint32_t seq)
+      : data_(NLMSG_LENGTH(sizeof(::rtcanmsg)))
+    {
+        ::nlmsghdr h{};
+        h.nlmsg_type = type;
+        h.nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        h.nlmsg_seq = seq;
+        std::memcpy(data_.data(), &h, sizeof(h));
+
+        ::rtcanmsg m{};
+        m.can_family = AF_CAN;
+        m.gwtype = CGW_TYPE_CAN_CAN;
+        m.flags = gw_flags;
+        std::memcpy(data_.data() + NLMSG_HDRLEN, &m, sizeof(m));
+        update_length();
+    }
+
+    template<class T>
+    void attribute(std::uint16_t type, T const& value)
+    {
+        auto const offset = NLMSG_ALIGN(data_.size());
+        data_.resize(offset + RTA_SPACE(sizeof(T)));
+        ::rtattr a{};
+        a.rta_len = static_cast<unsigned short>(RTA_LENGTH(sizeof(T)));
+        a.rta_type = type;
+        std::memcpy(data_.data() + offset, &a, sizeof(a));
+        std::memcpy(data_.data() + offset + RTA_LENGTH(0), &value, sizeof(T));
+        update_length();
+    }
+
+    std::vector<std::uint8_t> const& data() const noexcept
+    {
+        return data_;
+    }
+
+private:
+    void update_length() noexcept
+    {
+        auto const length = static_cast<std::uint32_t>(data_.size());
+        std::memcpy(data_.data(), &length, sizeof(length));
+    }
+
+    std::vector<std::uint8_t> data_;
+};
+
+} // namespace detail
+
+/// Configures the kernel's CAN gateway (the `can-gw` module) over rtnetlink,
+/// so that frames are forwarded between CAN interfaces without reaching
+/// userspace. This is the programmatic equivalent of the `cangw` tool.
+///
+/// Each rule forwards either classic or CAN FD frames received on one
+/// interface, which match a single filter, to another interface, optionally
+/// rewriting their CAN ID. Changing the rules requires CAP_NET_ADMIN.
+///
+/// \notes Rules stay installed after the object is destroyed, until removed
+/// with `remove` or `clear`, or until the module is unloaded.
+class kernel_gateway
+{
+public:
+    /// A forwarding rule.
+    struct rule
+    {
+        /// Index of the interface frames are received from.
+        unsigned int source = 0;
+        /// Index of the interface frames are sent to.
+        unsigned int destination = 0;
+        /// Frames matching this filter are forwarded. In its
+        /// default-constructed state, the filter matches any frame.
+        filter match;
+        /// Rewrite applied to the CAN ID of forwarded frames.
+        id_rewrite rewrite;
+        /// Whether the rule applies to CAN FD frames, instead of classic
+        /// frames. Requires Linux 5.10 or later.
+        bool fd_frames = false;
+        /// Largest number of gateway hops of a forwarded frame, 0 means the
+        /// module's default.
+        std::uint8_t max_hops = 0;
+    };
+
+    /// Opens a netlink socket. Throws `system_error` on failure.
+    kernel_gateway()
+      : fd_{::socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE)}
+    {
+        if (fd_ < 0)
+        {
+            detail::throw_errno();
+        }
+    }
+
+    kernel_gateway(kernel_gateway const&) = delete;
+    kernel_gateway& operator=(kernel_gateway const&) = delete;
+
+    ~kernel_gateway()
+    {
+        ::close(fd_);
+    }
+
+    /// Installs a rule. Throws `system_error` on failure.
+    void add(rule const& r)
+    {
+        error_code ec;
+        add(r, ec);
+        throw_if(ec);
+    }
+
+    /// Installs a rule.
+    /// \param ec Set to indicate what error occurred, if any.
+    void add(rule const& r, error_code& ec)
+    {
+        request(make_message(RTM_NEWROUTE, r, ++seq_), ec);
+    }
+
+    /// Removes a rule, which must be equal to an installed one. Throws
+    /// `system_error` on failure.
+    void remove(rule const& r)
+    {
+        error_code ec;
+        remove(r, ec);
+        throw_if(ec);
+    }
+
+    /// Removes a rule, which must be equal to an installed one.
+    /// \param ec Set to indicate what error occurred, if any.
+    void remove(rule const& r, error_code& ec)
+    {
+        request(make_message(RTM_DELROUTE, r, ++seq_), ec);
+    }
+
+    /// Removes all rules, including those installed by other processes.
+    /// Throws `system_error` on failure.
+    void clear()
+    {
+        error_code ec;
+        clear(ec);
+        throw_if(ec);
+    }
+
+    /// Removes all rules, including those installed by other processes.
+    /// \param ec Set to indicate what error occurred, if any.
+    void clear(error_code& ec)
+    {
+        detail::cgw_message m{RTM_DELROUTE, 0, ++seq_};
+        m.attribute(CGW_SRC_IF, std::uint32_t{0});
+        m.attribute(CGW_DST_IF, std::uint32_t{0});
+        request(m, ec);
+    }
+
+    /// Builds the rtnetlink request which adds (`RTM_NEWROUTE`) or removes
+    /// (`RTM_DELROUTE`) a rule.
+    static detail::cgw_message
+    make_message(std::uint16_t type, rule const& r, std::uint32_t seq)
+    {
+        detail::cgw_message m{
+          type,
+          static_cast<std::uint16_t>(r.fd_frames ? CGW_FLAGS_CAN_FD : 0),
+          seq};
+        m.attribute(CGW_SRC_IF, std::uint32_t{r.source});
+        m.attribute(CGW_DST_IF, std::uint32_t{r.destination});
+        m.attribute(CGW_FILTER, r.match);
+        if (!r.rewrite.empty())
+        {
+            // The kernel applies AND before OR, the flags are preserved by
+            // the AND mask.
+            if (r.fd_frames)
+            {
+                m.attribute(CGW_FDMOD_AND, fd_mod(~r.rewrite.mask()));
+                m.attribute(CGW_FDMOD_OR, fd_mod(r.rewrite.value()));
+            }
+            else
+            {
+                m.attribute(CGW_MOD_AND, classic_mod(~r.rewrite.mask()));
+                m.attribute(CGW_MOD_OR, classic_mod(r.rewrite.value()));
+            }
+        }
+        if (r.max_hops > 0)
+        {
+            m.attribute(CGW_LIM_HOPS, r.max_hops);
+        }
+        return m;
+    }
+
+private:
+    static ::cgw_frame_mod classic_mod(std::uint32_t id) noexcept
+    {
+        ::cgw_frame_mod mod{};
+        mod.cf.can_id = id;
+        mod.modtype = CGW_MOD_ID;
+        return mod;
+    }
+
+    static ::cgw_fdframe_mod fd_mod(std::uint32_t id) noexcept
+    {
+        ::cgw_fdframe_mod mod{};
+        mod.cf.can_id = id;
+        mod.modtype = CGW_MOD_ID;
+        return mod;
+    }
+
+    static void throw_if(error_code const& ec)
+    {
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+    }
+
+    // Sends a request and waits for the kernel's acknowledgement.
+    void request(detail::cgw_message const& m, error_code& ec)
+    {
+        ::sockaddr_nl kernel{};
+        kernel.nl_family = AF_NETLINK;
+        auto const& data = m.data();
+        if (::sendto(fd_,
+                     data.data(),
+                     data.size(),
+                     0,
+                     reinterpret_cast<::sockaddr const*>(&kernel),
+                     sizeof(kernel)) < 0)
+        {
+            detail::assign_errno(ec);
+            return;
+        }
+
+        ::nlmsghdr request;
+        std::memcpy(&request, data.data(), sizeof(request));
+        alignas(::nlmsghdr) std::uint8_t reply[4096];
+        while (true)
+        {
+            auto r = ::recv(fd_, reply, sizeof(reply), 0);
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                detail::assign_errno(ec);
+                return;
+            }
+            auto len = static_cast<unsigned int>(r);
+            for (auto h = reinterpret_cast<::nlmsghdr*>(reply);
+                 NLMSG_OK(h, len);
+                 h = NLMSG_NEXT(h, len))
+            {
+                if (h->nlmsg_seq != request.nlmsg_seq ||
+                    h->nlmsg_type != NLMSG_ERROR)
+                {
+                    continue;
+                }
+                auto const e = static_cast<::nlmsgerr const*>(NLMSG_DATA(h));
+                ec = {};
+                if (e->error < 0)
+                {
+                    ec.assign(-e->error, net::error::get_system_category());
+                }
+                return;
+            }
+        }
+    }
+
+    int fd_;
+    std::uint32_t seq_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_KERNEL_GATEWAY_HPP
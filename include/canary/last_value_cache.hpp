@@ -0,0 +1,267 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_LAST_VALUE_CACHE_HPP
+#define CANARY_LAST_VALUE_CACHE_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/detail/cpu_relax.hpp>
+#include <canary/detail/id_key.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+namespace canary
+{
+
+/// Keeps the latest frame received with every CAN ID, for threads which only
+/// need the current value of a signal rather than every frame.
+///
+/// One thread, typically the one receiving frames, calls `update` for every
+/// frame. Any number of other threads call `get` to copy the latest frame
+/// with an ID, without locks or allocation. Each entry is protected by a
+/// seqlock, so readers never block the writer: a reader which overlaps with
+/// an update of the same entry retries the copy.
+///
+/// Standard IDs are stored in a table indexed by the ID. Extended IDs are
+/// stored in an open-addressing hash table of `options::extended_capacity`
+/// entries. Entries are never removed, extended IDs which do not fit in the
+/// table are not cached and counted by `overflows`.
+///
+/// \notes `update` must only be called by one thread at a time. `get` may be
+/// called concurrently by any number of threads.
+class last_value_cache
+{
+public:
+    /// Configuration of the cache.
+    struct options
+    {
+        /// Largest number of distinct extended IDs, a power of two.
+        std::size_t extended_capacity = 1024;
+    };
+
+    /// A copy of the latest frame with an ID.
+    struct snapshot
+    {
+        /// The header of the frame.
+        frame_header header;
+        /// The payload of the frame, `header.payload_length()` bytes of
+        /// which are valid.
+        std::array<std::uint8_t, 64> payload;
+        /// The time the frame was received, as passed to `update`.
+        timestamp time;
+        /// Number of frames received with the ID so far, including this
+        /// one. Changes whenever a new frame arrives, even if its contents
+        /// are the same.
+        std::uint64_t updates;
+    };
+
+    /// Constructs a cache with the default options.
+    last_value_cache()
+      : last_value_cache{options{}}
+    {
+    }
+
+    /// Constructs a cache. Throws `system_error` if the extended capacity is
+    /// not a power of two.
+    /// \param opts Configuration of the cache.
+    explicit last_value_cache(options const& opts)
+      : standard_{new entry[standard_ids]}
+      , extended_{new entry[checked(opts).extended_capacity]}
+      , extended_mask_{opts.extended_capacity - 1}
+    {
+    }
+
+    last_value_cache(last_value_cache const&) = delete;
+    last_value_cache& operator=(last_value_cache const&) = delete;
+
+    /// Stores a frame as the latest one with its ID.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket.
+    /// \param time The time the frame was received.
+    /// \returns Whether the frame was stored. Error frames, frames of other
+    /// sizes and extended IDs which do not fit in the cache are not.
+    bool update(net::const_buffer frame,
+                timestamp time = timestamp{}) noexcept
+    {
+        if (frame.size() != classic_frame_size &&
+            frame.size() != fd_frame_size)
+        {
+            return false;
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        if (h.error())
+        {
+            return false;
+        }
+        auto const e =
+          h.extended_format() ? insert(h.id()) : &standard(h.id());
+        if (e == nullptr)
+        {
+            ++overflows_;
+            return false;
+        }
+
+        auto const version = e->version.load(std::memory_order_relaxed);
+        e->version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto const payload = frame.size() - sizeof(h);
+        std::memcpy(&e->value.header, &h, sizeof(h));
+        std::memcpy(e->value.payload.data(),
+                    static_cast<std::uint8_t const*>(frame.data()) + sizeof(h),
+                    payload);
+        std::memset(e->value.payload.data() + payload,
+                    0,
+                    e->value.payload.size() - payload);
+        e->value.time = time;
+        e->value.updates = version / 2 + 1;
+        e->version.store(version + 2, std::memory_order_release);
+        return true;
+    }
+
+    /// Copies the latest frame with an ID.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \param out Set to the latest frame, if one was received.
+    /// \returns Whether a frame with the ID was received. False if the ID
+    /// does not fit its format.
+    bool get(std::uint32_t id, bool extended, snapshot& out) const noexcept
+    {
+        if (extended ? id >= (1U << 29) : id >= standard_ids)
+        {
+            return false;
+        }
+        auto const e = extended ? find(id) : &standard(id);
+        if (e == nullptr)
+        {
+            return false;
+        }
+        while (true)
+        {
+            auto const before = e->version.load(std::memory_order_acquire);
+            if (before == 0)
+            {
+                return false;
+            }
+            if (before % 2 != 0)
+            {
+                // The writer is between the two increments.
+                detail::cpu_relax();
+                continue;
+            }
+            std::memcpy(&out, &e->value, sizeof(out));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (e->version.load(std::memory_order_relaxed) == before)
+            {
+                return true;
+            }
+        }
+    }
+
+    /// Number of frames not stored because the extended ID table was full.
+    /// Must only be called by the thread calling `update`.
+    std::size_t overflows() const noexcept
+    {
+        return overflows_;
+    }
+
+private:
+    static constexpr std::size_t standard_ids = 2048;
+
+    struct entry
+    {
+        std::atomic<std::uint64_t> version{0};
+        // Key of the extended ID, 0 if the entry is free.
+        std::atomic<std::uint32_t> key{0};
+        snapshot value;
+    };
+
+    static options const& checked(options const& opts)
+    {
+        auto const n = opts.extended_capacity;
+        if (n == 0 || (n & (n - 1)) != 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    entry& standard(std::uint32_t id) const noexcept
+    {
+        return standard_[id & (standard_ids - 1)];
+    }
+
+    entry* find(std::uint32_t id) const noexcept
+    {
+        auto const key = detail::id_key(id, true);
+        auto i = detail::key_slot(key, extended_mask_);
+        for (std::size_t n = 0; n <= extended_mask_; ++n)
+        {
+            auto& e = extended_[i];
+            auto const k = e.key.load(std::memory_order_acquire);
+            if (k == key)
+            {
+                return &e;
+            }
+            if (k == 0)
+            {
+                return nullptr;
+            }
+            i = detail::next_slot(i, extended_mask_);
+        }
+        return nullptr;
+    }
+
+    entry* insert(std::uint32_t id) noexcept
+    {
+        auto const key = detail::id_key(id, true);
+        auto i = detail::key_slot(key, extended_mask_);
+        for (std::size_t n = 0; n <= extended_mask_; ++n)
+        {
+            auto& e = extended_[i];
+            auto const k = e.key.load(std::memory_order_relaxed);
+            if (k == key)
+            {
+                return &e;
+            }
+            if (k == 0)
+            {
+                // Readers treat an entry with version 0 as empty, so the
+                // key may be published before the first value.
+                e.key.store(key, std::memory_order_release);
+                return &e;
+            }
+            i = detail::next_slot(i, extended_mask_);
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<entry[]> standard_;
+    std::unique_ptr<entry[]> extended_;
+    std::size_t extended_mask_;
+    std::size_t overflows_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_LAST_VALUE_CACHE_HPP
@@ -0,0 +1,361 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_METRICS_HPP
+#define CANARY_METRICS_HPP
+
+#include <canary/detail/config.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace canary
+{
+
+/// Monotonic event counter which may be incremented concurrently without
+/// locks.
+class counter
+{
+public:
+    counter() = default;
+    counter(counter const&) = delete;
+    counter& operator=(counter const&) = delete;
+
+    /// Increments the counter by `n`.
+    void add(std::uint64_t n = 1) noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        value_.fetch_add(n, std::memory_order_relaxed);
+#else
+        (void)n;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Returns the current value of the counter.
+    std::uint64_t load() const noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        return value_.load(std::memory_order_relaxed);
+#else
+        return 0;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+private:
+#ifndef CANARY_DISABLE_METRICS
+    std::atomic<std::uint64_t> value_{0};
+#endif // CANARY_DISABLE_METRICS
+};
+
+/// A value which may go up and down, e.g. a queue depth, and which may be
+/// updated concurrently without locks.
+class gauge
+{
+public:
+    gauge() = default;
+    gauge(gauge const&) = delete;
+    gauge& operator=(gauge const&) = delete;
+
+    /// Sets the gauge to `v`.
+    void set(std::uint64_t v) noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        value_.store(v, std::memory_order_relaxed);
+#else
+        (void)v;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Sets the gauge to `v` if `v` is larger than the current value.
+    void set_max(std::uint64_t v) noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        auto prev = value_.load(std::memory_order_relaxed);
+        while (prev < v &&
+               !value_.compare_exchange_weak(prev, v, std::memory_order_relaxed))
+        {
+        }
+#else
+        (void)v;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Returns the current value of the gauge.
+    std::uint64_t load() const noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        return value_.load(std::memory_order_relaxed);
+#else
+        return 0;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+private:
+#ifndef CANARY_DISABLE_METRICS
+    std::atomic<std::uint64_t> value_{0};
+#endif // CANARY_DISABLE_METRICS
+};
+
+/// A point-in-time copy of a `latency_histogram`.
+class histogram_snapshot
+{
+public:
+    /// Number of significant bits kept for each value, i.e. each power of two
+    /// range is divided into `2^sub_bucket_bits` buckets, which bounds the
+    /// relative error of reported values to 6.25%.
+    static constexpr unsigned int sub_bucket_bits = 4;
+    /// Values are clamped to `2^max_exponent - 1` nanoseconds (~18 minutes).
+    static constexpr unsigned int max_exponent = 40;
+    /// Number of buckets.
+    static constexpr std::size_t bucket_count =
+      (max_exponent - sub_bucket_bits + 1) << sub_bucket_bits;
+
+    /// Returns the index of the bucket which holds `value`.
+    static std::size_t bucket_index(std::uint64_t value) noexcept
+    {
+        constexpr std::uint64_t linear = 1u << sub_bucket_bits;
+        constexpr std::uint64_t max_value =
+          (std::uint64_t{1} << max_exponent) - 1;
+        if (value < linear)
+        {
+            return static_cast<std::size_t>(value);
+        }
+        if (value > max_value)
+        {
+            value = max_value;
+        }
+        auto const e =
+          63u - static_cast<unsigned int>(__builtin_clzll(value));
+        auto const sub = (value >> (e - sub_bucket_bits)) & (linear - 1);
+        return static_cast<std::size_t>(
+          ((e - sub_bucket_bits + 1) << sub_bucket_bits) + sub);
+    }
+
+    /// Returns the smallest value which falls into bucket `i`.
+    static std::uint64_t bucket_lower_bound(std::size_t i) noexcept
+    {
+        constexpr std::size_t linear = std::size_t{1} << sub_bucket_bits;
+        if (i < linear)
+        {
+            return i;
+        }
+        auto const e = (i >> sub_bucket_bits) + sub_bucket_bits - 1;
+        auto const sub = i & (linear - 1);
+        return (std::uint64_t{linear + sub}) << (e - sub_bucket_bits);
+    }
+
+    /// Returns the largest value which falls into bucket `i`.
+    static std::uint64_t bucket_upper_bound(std::size_t i) noexcept
+    {
+        return i + 1 < bucket_count ? bucket_lower_bound(i + 1) - 1
+                                    : (std::uint64_t{1} << max_exponent) - 1;
+    }
+
+    /// Number of recorded values in each bucket.
+    std::array<std::uint64_t, bucket_count> buckets{};
+    /// Number of recorded values.
+    std::uint64_t count = 0;
+    /// Sum of recorded values.
+    std::uint64_t sum = 0;
+    /// Largest recorded value.
+    std::uint64_t max = 0;
+
+    /// Returns the mean of recorded values.
+    double mean() const noexcept
+    {
+        return count == 0 ? 0.0
+                          : static_cast<double>(sum) / static_cast<double>(count);
+    }
+
+    /// Returns an upper bound of the `p`-th percentile, where `p` is in the
+    /// range [0, 100].
+    std::uint64_t percentile(double p) const noexcept
+    {
+        if (count == 0)
+        {
+            return 0;
+        }
+        auto rank = static_cast<std::uint64_t>(
+          p / 100.0 * static_cast<double>(count) + 0.5);
+        rank = rank == 0 ? 1 : (rank > count ? count : rank);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= rank)
+            {
+                auto const upper = bucket_upper_bound(i);
+                return upper < max ? upper : max;
+            }
+        }
+        return max;
+    }
+};
+
+/// Histogram of durations with logarithmically sized buckets (HDR-style),
+/// which may be updated concurrently without locks.
+class latency_histogram
+{
+public:
+    latency_histogram() = default;
+    latency_histogram(latency_histogram const&) = delete;
+    latency_histogram& operator=(latency_histogram const&) = delete;
+
+    /// Records a value, in nanoseconds.
+    void record(std::uint64_t ns) noexcept
+    {
+#ifndef CANARY_DISABLE_METRICS
+        buckets_[histogram_snapshot::bucket_index(ns)].fetch_add(
+          1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+        auto prev = max_.load(std::memory_order_relaxed);
+        while (prev < ns &&
+               !max_.compare_exchange_weak(prev, ns, std::memory_order_relaxed))
+        {
+        }
+#else
+        (void)ns;
+#endif // CANARY_DISABLE_METRICS
+    }
+
+    /// Records a duration. Negative durations are recorded as 0.
+    template<class Rep, class Period>
+    void record(std::chrono::duration<Rep, Period> d) noexcept
+    {
+        auto const ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        record(static_cast<std::uint64_t>(ns < 0 ? 0 : ns));
+    }
+
+    /// Copies the current state of the histogram. Concurrent updates may be
+    /// partially reflected in the copy.
+    histogram_snapshot snapshot() const noexcept
+    {
+        histogram_snapshot s;
+#ifndef CANARY_DISABLE_METRICS
+        for (std::size_t i = 0; i < histogram_snapshot::bucket_count; ++i)
+        {
+            s.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        s.count = count_.load(std::memory_order_relaxed);
+        s.sum = sum_.load(std::memory_order_relaxed);
+        s.max = max_.load(std::memory_order_relaxed);
+#endif // CANARY_DISABLE_METRICS
+        return s;
+    }
+
+private:
+#ifndef CANARY_DISABLE_METRICS
+    std::array<std::atomic<std::uint64_t>, histogram_snapshot::bucket_count>
+      buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+#endif // CANARY_DISABLE_METRICS
+};
+
+/// A point-in-time copy of `socket_metrics`.
+struct socket_metrics_snapshot
+{
+    std::uint64_t frames_received = 0;
+    std::uint64_t bytes_received = 0;
+    std::uint64_t frames_sent = 0;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t would_block = 0;
+    /// Time from kernel reception of a frame to completion of the receive
+    /// operation.
+    histogram_snapshot receive_latency;
+};
+
+/// Per-socket counters and latency histogram.
+/// \notes When `CANARY_DISABLE_METRICS` is defined, all updates are no-ops
+/// and the object holds no state.
+struct socket_metrics
+{
+    counter frames_received;
+    counter bytes_received;
+    counter frames_sent;
+    counter bytes_sent;
+    counter errors;
+    counter would_block;
+    latency_histogram receive_latency;
+
+    /// Copies the current state of all metrics.
+    socket_metrics_snapshot snapshot() const noexcept
+    {
+        socket_metrics_snapshot s;
+        s.frames_received = frames_received.load();
+        s.bytes_received = bytes_received.load();
+        s.frames_sent = frames_sent.load();
+        s.bytes_sent = bytes_sent.load();
+        s.errors = errors.load();
+        s.would_block = would_block.load();
+        s.receive_latency = receive_latency.snapshot();
+        return s;
+    }
+};
+
+/// Writes a histogram in a line-oriented text format, compatible with the
+/// Prometheus exposition format.
+/// \param os The output stream.
+/// \param name The metric name.
+/// \param h The histogram snapshot.
+/// \param labels Labels added to every line, e.g. `socket="vcan0"`.
+inline void
+write_text(std::ostream& os,
+           std::string const& name,
+           histogram_snapshot const& h,
+           std::string const& labels = {})
+{
+    auto const sep = labels.empty() ? "" : ",";
+    double const quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (auto q : quantiles)
+    {
+        os << name << "{" << labels << sep << "quantile=\"" << q << "\"} "
+           << h.percentile(q * 100.0) << '\n';
+    }
+    auto const braces = labels.empty() ? std::string{} : "{" + labels + "}";
+    os << name << "_max" << braces << ' ' << h.max << '\n';
+    os << name << "_sum" << braces << ' ' << h.sum << '\n';
+    os << name << "_count" << braces << ' ' << h.count << '\n';
+}
+
+/// Writes socket metrics in a line-oriented text format, compatible with the
+/// Prometheus exposition format. Metric names are prefixed with `canary_`.
+/// \param os The output stream.
+/// \param s The metrics snapshot.
+/// \param labels Labels added to every line, e.g. `socket="vcan0"`.
+inline void
+write_text(std::ostream& os,
+           socket_metrics_snapshot const& s,
+           std::string const& labels = {})
+{
+    auto const braces = labels.empty() ? std::string{} : "{" + labels + "}";
+    os << "canary_frames_received_total" << braces << ' ' << s.frames_received
+       << '\n'
+       << "canary_bytes_received_total" << braces << ' ' << s.bytes_received
+       << '\n'
+       << "canary_frames_sent_total" << braces << ' ' << s.frames_sent << '\n'
+       << "canary_bytes_sent_total" << braces << ' ' << s.bytes_sent << '\n'
+       << "canary_errors_total" << braces << ' ' << s.errors << '\n'
+       << "canary_would_block_total" << braces << ' ' << s.would_block
+       << '\n';
+    canary::write_text(
+      os, "canary_receive_latency_ns", s.receive_latency, labels);
+}
+
+} // namespace canary
+
+#endif // CANARY_METRICS_HPP
@@ -0,0 +1,291 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_POLLING_RECEIVER_HPP
+#define CANARY_POLLING_RECEIVER_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/detail/cpu_relax.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace canary
+{
+
+namespace detail
+{
+
+// Pins the calling thread to a CPU and/or switches it to SCHED_FIFO for the
+// lifetime of the object, restoring the previous settings afterwards.
+class scoped_realtime
+{
+public:
+    scoped_realtime(int cpu, int fifo_priority)
+    {
+        auto const self = ::pthread_self();
+        if (cpu >= 0)
+        {
+            ::pthread_getaffinity_np(self, sizeof(affinity_), &affinity_);
+            ::cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            check(::pthread_setaffinity_np(self, sizeof(set), &set));
+            pinned_ = true;
+        }
+        if (fifo_priority > 0)
+        {
+            ::pthread_getschedparam(self, &policy_, &param_);
+            ::sched_param p{};
+            p.sched_priority = fifo_priority;
+            auto const r = ::pthread_setschedparam(self, SCHED_FIFO, &p);
+            if (r != 0)
+            {
+                restore_affinity();
+                check(r);
+            }
+            scheduled_ = true;
+        }
+    }
+
+    scoped_realtime(scoped_realtime const&) = delete;
+    scoped_realtime& operator=(scoped_realtime const&) = delete;
+
+    ~scoped_realtime()
+    {
+        if (scheduled_)
+        {
+            ::pthread_setschedparam(::pthread_self(), policy_, &param_);
+        }
+        restore_affinity();
+    }
+
+private:
+    static void check(int r)
+    {
+        if (r != 0)
+        {
+            canary::detail::throw_exception(
+              system_error{error_code{r, net::error::get_system_category()}});
+        }
+    }
+
+    void restore_affinity()
+    {
+        if (pinned_)
+        {
+            ::pthread_setaffinity_np(
+              ::pthread_self(), sizeof(affinity_), &affinity_);
+            pinned_ = false;
+        }
+    }
+
+    ::cpu_set_t affinity_;
+    int policy_ = SCHED_OTHER;
+    ::sched_param param_{};
+    bool pinned_ = false;
+    bool scheduled_ = false;
+};
+
+} // namespace detail
+
+/// Receives frames by spinning on non-blocking receives, trading a CPU core
+/// for the wake-up latency of blocking or reactor-based receives.
+///
+/// Receives are started like `async_receive` on a socket and complete with
+/// the same handler signature, `void(error_code, std::size_t)`, but handlers
+/// are invoked by `run`, which polls the socket on the calling thread. After
+/// the socket has been idle for `options::spin`, `run` yields the CPU between
+/// polls, and after a further `options::yield`, it backs off to a blocking
+/// wait. The first frame received after a blocking wait resets the back-off.
+///
+/// \notes Except for `stop`, the receiver must only be used from the thread
+/// running `run` and from within its handlers. The socket is put into
+/// non-blocking mode and must outlive the receiver.
+template<class Socket>
+class basic_polling_receiver
+{
+public:
+    /// Invoked when a receive completes.
+    using handler_type = std::function<void(error_code, std::size_t)>;
+
+    /// Configuration of the polling loop.
+    struct options
+    {
+        /// How long to spin after the last frame before yielding.
+        std::chrono::nanoseconds spin = std::chrono::microseconds{200};
+        /// How long to yield between polls before blocking.
+        std::chrono::nanoseconds yield = std::chrono::milliseconds{1};
+        /// Value of the `busy_poll` socket option, zero to leave it
+        /// unchanged. Ignored if the kernel rejects it.
+        std::chrono::microseconds busy_poll{0};
+        /// CPU to pin the thread calling `run` to, or -1.
+        int cpu = -1;
+        /// If positive, the thread calling `run` is switched to `SCHED_FIFO`
+        /// with this priority.
+        int fifo_priority = 0;
+    };
+
+    /// Constructs a receiver with the default options.
+    /// \param sock The socket to receive from.
+    explicit basic_polling_receiver(Socket& sock)
+      : basic_polling_receiver{sock, options{}}
+    {
+    }
+
+    /// Constructs a receiver.
+    /// \param sock The socket to receive from.
+    /// \param opts Configuration of the polling loop.
+    basic_polling_receiver(Socket& sock, options const& opts)
+      : sock_{sock}
+      , opts_{opts}
+      , wake_fd_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+    {
+        if (wake_fd_ < 0)
+        {
+            detail::throw_errno();
+        }
+        sock_.non_blocking(true);
+        if (opts_.busy_poll.count() > 0)
+        {
+            error_code ec;
+            sock_.set_option(busy_poll{opts_.busy_poll}, ec);
+        }
+    }
+
+    basic_polling_receiver(basic_polling_receiver const&) = delete;
+    basic_polling_receiver& operator=(basic_polling_receiver const&) = delete;
+
+    ~basic_polling_receiver()
+    {
+        ::close(wake_fd_);
+    }
+
+    /// Starts a receive, which completes from within `run`. Only one receive
+    /// may be outstanding at a time.
+    /// \param buffer The buffer into which a frame will be received.
+    /// Ownership is retained by the caller, which must keep it valid until
+    /// completion.
+    /// \param handler Invoked when the receive completes.
+    void async_receive(net::mutable_buffer buffer, handler_type handler)
+    {
+        buffer_ = buffer;
+        handler_ = std::move(handler);
+    }
+
+    /// Polls the socket and invokes handlers until `stop` is called or no
+    /// receive is outstanding. Throws `system_error` if the requested CPU
+    /// affinity or scheduling policy cannot be applied.
+    /// \returns The number of handlers invoked.
+    std::size_t run()
+    {
+        detail::scoped_realtime rt{opts_.cpu, opts_.fifo_priority};
+        std::size_t n = 0;
+        auto last_frame = std::chrono::steady_clock::now();
+        while (handler_ && !stopped_.load(std::memory_order_acquire))
+        {
+            error_code ec;
+            auto const size = sock_.receive(buffer_, 0, ec);
+            if (ec == net::error::would_block)
+            {
+                idle(last_frame);
+                continue;
+            }
+            last_frame = std::chrono::steady_clock::now();
+            ++n;
+            auto handler = std::move(handler_);
+            handler_ = nullptr;
+            handler(ec, size);
+        }
+        return n;
+    }
+
+    /// Makes `run` return as soon as possible. May be called from any thread.
+    void stop() noexcept
+    {
+        stopped_.store(true, std::memory_order_release);
+        std::uint64_t one = 1;
+        auto const r = ::write(wake_fd_, &one, sizeof(one));
+        static_cast<void>(r);
+    }
+
+    /// Prepares a stopped receiver for another invocation of `run`.
+    void restart() noexcept
+    {
+        std::uint64_t value;
+        auto const r = ::read(wake_fd_, &value, sizeof(value));
+        static_cast<void>(r);
+        stopped_.store(false, std::memory_order_release);
+    }
+
+    /// Number of times `run` backed off to a blocking wait.
+    std::size_t blocking_waits() const noexcept
+    {
+        return blocking_waits_;
+    }
+
+    /// Returns the socket.
+    Socket& socket() noexcept
+    {
+        return sock_;
+    }
+
+private:
+    void idle(std::chrono::steady_clock::time_point& last_frame)
+    {
+        auto const idle_for = std::chrono::steady_clock::now() - last_frame;
+        if (idle_for < opts_.spin)
+        {
+            detail::cpu_relax();
+        }
+        else if (idle_for < opts_.spin + opts_.yield)
+        {
+            ::sched_yield();
+        }
+        else
+        {
+            ::pollfd fds[2] = {{sock_.native_handle(), POLLIN, 0},
+                               {wake_fd_, POLLIN, 0}};
+            ++blocking_waits_;
+            ::poll(fds, 2, -1);
+            // Spin again after waking up, the next frame of a burst is
+            // likely to follow shortly.
+            last_frame = std::chrono::steady_clock::now();
+        }
+    }
+
+    Socket& sock_;
+    options opts_;
+    int wake_fd_;
+    net::mutable_buffer buffer_;
+    handler_type handler_;
+    std::atomic<bool> stopped_{false};
+    std::size_t blocking_waits_ = 0;
+};
+
+/// A polling receiver for raw CAN sockets.
+using polling_receiver = basic_polling_receiver<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_POLLING_RECEIVER_HPP
@@ -51,4 +51,11 @@ public:
 
 } // namespace canary
 
+#ifdef CANARY_SEPARATE_COMPILATION
+// Instantiated once, in canary/src.hpp.
+extern template class canary::basic_endpoint<canary::raw>;
+extern template class canary::net::basic_socket<canary::raw>;
+extern template class canary::net::basic_raw_socket<canary::raw>;
+#endif // CANARY_SEPARATE_COMPILATION
+
 #endif // CANARY_RAW_HPP
@@ -0,0 +1,510 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_RECEIVE_LOOP_HPP
+#define CANARY_RECEIVE_LOOP_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/associated_allocator.hpp>
+#include <asio/associated_executor.hpp>
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+namespace canary
+{
+
+/// Memory for the state of the asynchronous operations of one receive loop,
+/// recycled from one operation to the next.
+///
+/// ASIO allocates the state of every asynchronous operation through the
+/// allocator associated with its completion handler. By default, it recycles
+/// memory through a small per-thread cache, which is shared by all operations
+/// running on the thread and falls back to the heap when it is exhausted. An
+/// arena dedicated to a socket keeps a fixed set of blocks for its operations
+/// instead, so that a receive loop does not allocate, regardless of what else
+/// runs on the thread.
+///
+/// Requests larger than a block, or made while all blocks are in use, are
+/// served from the heap and counted by `fallbacks`.
+///
+/// \notes Blocks may be allocated and released from different threads. The
+/// arena must outlive all operations using it.
+class handler_arena
+{
+public:
+    /// Constructs an arena with 4 blocks of 256 bytes, which fits the state
+    /// of a receive or wait operation of a socket, with a small handler.
+    handler_arena()
+      : handler_arena{4, 256}
+    {
+    }
+
+    /// Constructs an arena.
+    /// \param blocks The number of blocks.
+    /// \param block_size The size of each block, rounded up to a multiple of
+    /// the fundamental alignment.
+    handler_arena(std::size_t blocks, std::size_t block_size)
+      : blocks_{blocks}
+      , units_{(block_size + sizeof(unit) - 1) / sizeof(unit)}
+      , storage_{new unit[blocks_ * units_]}
+      , used_{new std::atomic<bool>[blocks_]}
+    {
+        for (std::size_t i = 0; i < blocks_; ++i)
+        {
+            used_[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    handler_arena(handler_arena const&) = delete;
+    handler_arena& operator=(handler_arena const&) = delete;
+
+    /// Allocates memory suitably aligned for any fundamental type.
+    /// \param size The number of bytes.
+    void* allocate(std::size_t size)
+    {
+        if (size <= block_size())
+        {
+            for (std::size_t i = 0; i < blocks_; ++i)
+            {
+                if (!used_[i].exchange(true, std::memory_order_acquire))
+                {
+                    return storage_.get() + i * units_;
+                }
+            }
+        }
+        fallbacks_.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(size);
+    }
+
+    /// Releases memory obtained from `allocate`.
+    void deallocate(void* p) noexcept
+    {
+        auto const u = static_cast<unit*>(p);
+        if (u >= storage_.get() && u < storage_.get() + blocks_ * units_)
+        {
+            auto const i =
+              static_cast<std::size_t>(u - storage_.get()) / units_;
+            used_[i].store(false, std::memory_order_release);
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    /// The size of each block.
+    std::size_t block_size() const noexcept
+    {
+        return units_ * sizeof(unit);
+    }
+
+    /// Number of allocations which were served from the heap.
+    std::size_t fallbacks() const noexcept
+    {
+        return fallbacks_.load(std::memory_order_relaxed);
+    }
+
+private:
+    using unit = std::max_align_t;
+
+    std::size_t blocks_;
+    std::size_t units_;
+    std::unique_ptr<unit[]> storage_;
+    std::unique_ptr<std::atomic<bool>[]> used_;
+    std::atomic<std::size_t> fallbacks_{0};
+};
+
+/// An allocator which obtains memory from a `handler_arena`.
+template<class T>
+class arena_allocator
+{
+public:
+    using value_type = T;
+
+    /// Constructs an allocator using an arena.
+    explicit arena_allocator(handler_arena& arena) noexcept
+      : arena_{&arena}
+    {
+    }
+
+    /// Converts from an allocator of another type, using the same arena.
+    template<class U>
+    arena_allocator(arena_allocator<U> const& other) noexcept
+      : arena_{&other.arena()}
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, std::size_t) noexcept
+    {
+        arena_->deallocate(p);
+    }
+
+    /// Returns the arena.
+    handler_arena& arena() const noexcept
+    {
+        return *arena_;
+    }
+
+    template<class U>
+    friend bool operator==(arena_allocator const& lhs,
+                           arena_allocator<U> const& rhs) noexcept
+    {
+        return &lhs.arena() == &rhs.arena();
+    }
+
+    template<class U>
+    friend bool operator!=(arena_allocator const& lhs,
+                           arena_allocator<U> const& rhs) noexcept
+    {
+        return !(lhs == rhs);
+    }
+
+private:
+    handler_arena* arena_;
+};
+
+/// A completion handler or token whose associated allocator uses an arena.
+///
+/// Invoking it invokes the wrapped handler, whose associated executor is
+/// preserved. Used as a completion token, the handler produced by the wrapped
+/// token is associated with the arena, which makes it possible to use an
+/// arena with tokens such as `use_awaitable`.
+template<class T>
+class arena_bound
+{
+public:
+    using allocator_type = arena_allocator<void>;
+
+    arena_bound(handler_arena& arena, T target)
+      : arena_{&arena}
+      , target_(std::move(target))
+    {
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type{*arena_};
+    }
+
+    /// Returns the arena.
+    handler_arena& arena() const noexcept
+    {
+        return *arena_;
+    }
+
+    /// Returns the wrapped handler or token.
+    T& get() noexcept
+    {
+        return target_;
+    }
+
+    /// Returns the wrapped handler or token.
+    T const& get() const noexcept
+    {
+        return target_;
+    }
+
+    template<class... Args>
+    auto operator()(Args&&... args)
+      -> decltype(std::declval<T&>()(std::forward<Args>(args)...))
+    {
+        return target_(std::forward<Args>(args)...);
+    }
+
+private:
+    handler_arena* arena_;
+    T target_;
+};
+
+/// Associates a completion handler or token with an arena.
+/// \param arena The arena which provides memory for the operation.
+/// \param target The completion handler or token.
+template<class T>
+arena_bound<typename std::decay<T>::type>
+bind_arena(handler_arena& arena, T&& target)
+{
+    return arena_bound<typename std::decay<T>::type>{
+      arena, std::forward<T>(target)};
+}
+
+namespace detail
+{
+
+// Associates the handler produced by a completion token with an arena.
+template<class Initiation>
+class arena_initiation
+{
+public:
+    arena_initiation(handler_arena& arena, Initiation init)
+      : arena_{arena}
+      , init_(std::move(init))
+    {
+    }
+
+    template<class Handler, class... Args>
+    void operator()(Handler&& handler, Args&&... args)
+    {
+        init_(canary::bind_arena(arena_, std::forward<Handler>(handler)),
+              std::forward<Args>(args)...);
+    }
+
+private:
+    handler_arena& arena_;
+    Initiation init_;
+};
+
+template<class Socket, class FrameHandler>
+class receive_loop_op
+{
+public:
+    receive_loop_op(Socket& sock,
+                    handler_arena& arena,
+                    net::mutable_buffer buffer,
+                    FrameHandler handler)
+      : sock_{sock}
+      , arena_{arena}
+      , buffer_{buffer}
+      , handler_(std::move(handler))
+    {
+    }
+
+    void start()
+    {
+        auto& sock = sock_;
+        auto const buffer = buffer_;
+        auto& arena = arena_;
+        sock.async_receive(buffer, canary::bind_arena(arena, std::move(*this)));
+    }
+
+    void operator()(error_code ec, std::size_t n)
+    {
+        if (handler_(ec, n))
+        {
+            start();
+        }
+    }
+
+private:
+    Socket& sock_;
+    handler_arena& arena_;
+    net::mutable_buffer buffer_;
+    FrameHandler handler_;
+};
+
+template<class Socket, class FrameHandler>
+class receive_batch_loop_op
+{
+public:
+    receive_batch_loop_op(Socket& sock,
+                          handler_arena& arena,
+                          net::mutable_buffer frames,
+                          std::size_t frame_size,
+                          FrameHandler handler)
+      : sock_{sock}
+      , arena_{arena}
+      , handler_(std::move(handler))
+    {
+        auto const count = frame_size == 0 ? 0 : frames.size() / frame_size;
+        if (count == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        iovs_.resize(count);
+        msgs_.resize(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            iovs_[i].iov_base =
+              static_cast<char*>(frames.data()) + i * frame_size;
+            iovs_[i].iov_len = frame_size;
+            msgs_[i] = ::mmsghdr{};
+            msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    void start()
+    {
+        auto& sock = sock_;
+        auto& arena = arena_;
+        sock.async_wait(Socket::wait_read,
+                        canary::bind_arena(arena, std::move(*this)));
+    }
+
+    void operator()(error_code ec)
+    {
+        std::size_t n = 0;
+        if (!ec)
+        {
+            auto const r = ::recvmmsg(sock_.native_handle(),
+                                      msgs_.data(),
+                                      static_cast<unsigned>(msgs_.size()),
+                                      MSG_DONTWAIT,
+                                      nullptr);
+            if (r < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                {
+                    start();
+                    return;
+                }
+                detail::assign_errno(ec);
+            }
+            else
+            {
+                n = static_cast<std::size_t>(r);
+            }
+        }
+        if (handler_(ec, n))
+        {
+            start();
+        }
+    }
+
+private:
+    Socket& sock_;
+    handler_arena& arena_;
+    FrameHandler handler_;
+    std::vector<::iovec> iovs_;
+    std::vector<::mmsghdr> msgs_;
+};
+
+} // namespace detail
+
+/// Receives frames in a loop, keeping the state of the receive operations in
+/// an arena.
+///
+/// The handler is invoked for every received frame, or error, with the
+/// signature `bool(error_code, std::size_t)`, and the loop continues while it
+/// returns `true`. Frames are received into the same buffer each time, which
+/// the handler must copy from if needed. Once the loop is running, no memory
+/// is allocated, provided the arena's blocks are large enough.
+///
+/// \param sock The socket to receive from.
+/// \param arena The arena for the operation state. Must outlive the loop.
+/// \param buffer The buffer for received frames. Must outlive the loop.
+/// \param handler The frame handler, invoked on the socket's executor.
+template<class Socket, class FrameHandler>
+void
+async_receive_loop(Socket& sock,
+                   handler_arena& arena,
+                   net::mutable_buffer buffer,
+                   FrameHandler&& handler)
+{
+    detail::receive_loop_op<Socket, typename std::decay<FrameHandler>::type>{
+      sock, arena, buffer, std::forward<FrameHandler>(handler)}
+      .start();
+}
+
+/// Receives frames in batches, in a loop, keeping the state of the wait
+/// operations in an arena.
+///
+/// Each time the socket becomes readable, all available frames, up to the
+/// capacity of `frames`, are received with a single `recvmmsg` call. The
+/// handler is invoked with the signature `bool(error_code, std::size_t)`,
+/// with the number of frames received, and the loop continues while it
+/// returns `true`. Frame `i` is stored at offset `i * frame_size` of
+/// `frames`. Apart from the message headers set up when the loop starts, no
+/// memory is allocated, provided the arena's blocks are large enough.
+///
+/// Throws `system_error` if `frames` cannot hold a single frame.
+///
+/// \param sock The socket to receive from.
+/// \param arena The arena for the operation state. Must outlive the loop.
+/// \param frames The buffer for received frames. Must outlive the loop.
+/// \param frame_size The size of each frame slot, e.g. `sizeof(can_frame)`.
+/// \param handler The batch handler, invoked on the socket's executor.
+template<class Socket, class FrameHandler>
+void
+async_receive_batch_loop(Socket& sock,
+                         handler_arena& arena,
+                         net::mutable_buffer frames,
+                         std::size_t frame_size,
+                         FrameHandler&& handler)
+{
+    detail::receive_batch_loop_op<Socket,
+                                  typename std::decay<FrameHandler>::type>{
+      sock, arena, frames, frame_size, std::forward<FrameHandler>(handler)}
+      .start();
+}
+
+} // namespace canary
+
+#ifdef CANARY_STANDALONE_ASIO
+namespace asio
+{
+#else
+namespace boost
+{
+namespace asio
+{
+#endif // CANARY_STANDALONE_ASIO
+
+// Inherits the traits of the wrapped handler, which tell ASIO whether the
+// handler has an executor of its own.
+template<class T, class Executor>
+struct associated_executor<canary::arena_bound<T>, Executor>
+  : associated_executor<T, Executor>
+{
+    using type = typename associated_executor<T, Executor>::type;
+
+    static type get(canary::arena_bound<T> const& b,
+                    Executor const& ex = Executor{}) noexcept
+    {
+        return associated_executor<T, Executor>::get(b.get(), ex);
+    }
+};
+
+template<class T, class Signature>
+class async_result<canary::arena_bound<T>, Signature>
+{
+public:
+    using completion_handler_type = canary::arena_bound<T>;
+    using return_type = typename async_result<T, Signature>::return_type;
+
+    template<class Initiation, class... Args>
+    static return_type initiate(Initiation&& init,
+                                canary::arena_bound<T> token,
+                                Args&&... args)
+    {
+        return async_initiate<T, Signature>(
+          canary::detail::arena_initiation<
+            typename std::decay<Initiation>::type>{
+            token.arena(), std::forward<Initiation>(init)},
+          token.get(),
+          std::forward<Args>(args)...);
+    }
+};
+
+#ifdef CANARY_STANDALONE_ASIO
+} // namespace asio
+#else
+} // namespace asio
+} // namespace boost
+#endif // CANARY_STANDALONE_ASIO
+
+#endif // CANARY_RECEIVE_LOOP_HPP
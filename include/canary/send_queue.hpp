@@ -0,0 +1,364 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SEND_QUEUE_HPP
+#define CANARY_SEND_QUEUE_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+
+namespace canary
+{
+
+namespace detail
+{
+
+// A send waiting in a send_queue, with its type-erased completion handler.
+template<class Socket>
+class queued_send
+{
+public:
+    virtual ~queued_send() = default;
+
+    virtual std::size_t try_send(Socket& sock, error_code& ec) = 0;
+
+    virtual void complete(error_code ec, std::size_t n) = 0;
+
+    // Completes the send with `operation_aborted`, through the executor.
+    virtual void abort(typename Socket::executor_type const& ex) = 0;
+};
+
+template<class Socket, class Self, class ConstBufferSequence>
+class queued_send_impl : public queued_send<Socket>
+{
+public:
+    queued_send_impl(Self&& self, ConstBufferSequence const& buffers)
+      : self_{std::move(self)}
+      , buffers_{buffers}
+    {
+    }
+
+    std::size_t try_send(Socket& sock, error_code& ec) override
+    {
+        return sock.send(buffers_, 0, ec);
+    }
+
+    void complete(error_code ec, std::size_t n) override
+    {
+        self_.complete(ec, n);
+    }
+
+    void abort(typename Socket::executor_type const& ex) override
+    {
+        net::post(ex,
+                  std::bind(std::move(self_),
+                            error_code{net::error::operation_aborted},
+                            std::size_t{0}));
+    }
+
+private:
+    Self self_;
+    ConstBufferSequence buffers_;
+};
+
+} // namespace detail
+
+/// Sends frames in order, retrying instead of failing when the socket or the
+/// interface transmit queue is full, with a bounded number of frames in
+/// flight.
+///
+/// A raw CAN socket fails a send with `no_buffer_space` (ENOBUFS) when the
+/// transmit queue of the interface is full. Neither `send` nor `async_send`
+/// retry in that case. The send queue keeps frames which could not be sent
+/// and retries them: after waiting for the socket to become writable, if the
+/// socket would block, or after an exponentially growing delay, if the
+/// interface queue is full. The kernel does not signal when the interface
+/// queue drains, so there is no readiness event to wait for in that case.
+///
+/// An `async_send` completes once the kernel accepted the frame, which
+/// naturally throttles a producer that waits for completions. At most
+/// `options::max_in_flight` frames may be waiting at once. Sends started
+/// beyond that limit fail immediately with `net::error::no_buffer_space`, and
+/// the handler set with `on_full` is notified when the queue becomes full and
+/// when it has room again, so that producers may pause instead.
+///
+/// Sends still queued when the queue is destroyed or cancelled, or when the
+/// wait for the socket is cancelled, complete with
+/// `net::error::operation_aborted`.
+///
+/// \notes The queue is not thread-safe, sends must be started from handlers
+/// of the socket's executor (or while it is not running). The socket is put
+/// into non-blocking mode and stays in it, so that a full socket fails a
+/// send with `would_block` instead of waiting.
+template<class Socket>
+class basic_send_queue
+{
+public:
+    /// Configuration of the send queue.
+    struct options
+    {
+        /// Largest number of frames waiting to be sent.
+        std::size_t max_in_flight = 64;
+        /// Delay before the first retry after the interface queue was full.
+        std::chrono::microseconds min_retry{20};
+        /// Upper bound of the retry delay, which doubles with every
+        /// consecutive failure.
+        std::chrono::microseconds max_retry{2000};
+        /// Largest number of frames sent before yielding to other handlers.
+        std::size_t batch_size = 64;
+    };
+
+    /// Constructs a send queue with the default options.
+    /// \param sock The socket to send to.
+    explicit basic_send_queue(Socket& sock)
+      : basic_send_queue{sock, options{}}
+    {
+    }
+
+    /// Constructs a send queue.
+    /// \param sock The socket to send to.
+    /// \param opts Configuration of the send queue.
+    basic_send_queue(Socket& sock, options const& opts)
+      : sock_{sock}
+      , opts_{opts}
+      , timer_{sock.get_executor()}
+      , retry_delay_{opts.min_retry}
+    {
+        sock_.non_blocking(true);
+    }
+
+    basic_send_queue(basic_send_queue const&) = delete;
+    basic_send_queue& operator=(basic_send_queue const&) = delete;
+
+    /// Destroys the send queue, aborting queued sends.
+    ~basic_send_queue()
+    {
+        timer_.cancel();
+        abort();
+    }
+
+    /// Asynchronously sends a frame, after all frames queued before it. The
+    /// completion signature is `void(error_code, std::size_t)`.
+    /// \param buffers The frame. Ownership is retained by the caller, which
+    /// must keep it valid until completion.
+    /// \param token The completion token.
+    template<class ConstBufferSequence, class CompletionToken>
+    auto async_send(ConstBufferSequence const& buffers, CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+    {
+        return net::async_compose<CompletionToken,
+                                  void(error_code, std::size_t)>(
+          send_op<ConstBufferSequence>{*this, buffers}, token, sock_);
+    }
+
+    /// Aborts all queued sends, which complete with
+    /// `net::error::operation_aborted`.
+    void cancel()
+    {
+        auto const was_full = full();
+        lifetime_.invalidate();
+        timer_.cancel();
+        abort();
+        if (was_full && on_full_)
+        {
+            on_full_(false);
+        }
+    }
+
+    /// Sets the handler invoked with `true` when the queue becomes full, and
+    /// with `false` when it has room again.
+    void on_full(std::function<void(bool)> handler)
+    {
+        on_full_ = std::move(handler);
+    }
+
+    /// Number of frames waiting to be sent.
+    std::size_t in_flight() const noexcept
+    {
+        return queue_.size();
+    }
+
+    /// Whether sends are currently rejected.
+    bool full() const noexcept
+    {
+        return queue_.size() >= opts_.max_in_flight;
+    }
+
+    /// Number of times a frame was retried after the interface queue was
+    /// full.
+    std::size_t retries() const noexcept
+    {
+        return retries_;
+    }
+
+private:
+    template<class ConstBufferSequence>
+    class send_op
+    {
+    public:
+        send_op(basic_send_queue& q, ConstBufferSequence const& buffers)
+          : queue_{q}
+          , buffers_{buffers}
+        {
+        }
+
+        template<class Self>
+        void operator()(Self& self)
+        {
+            if (queue_.full())
+            {
+                net::post(queue_.sock_.get_executor(),
+                          std::bind(std::move(self),
+                                    error_code{net::error::no_buffer_space},
+                                    std::size_t{0}));
+                return;
+            }
+            queue_.push(std::unique_ptr<detail::queued_send<Socket>>{
+              new detail::queued_send_impl<Socket, Self, ConstBufferSequence>{
+                std::move(self), buffers_}});
+        }
+
+        template<class Self>
+        void operator()(Self& self, error_code ec, std::size_t n)
+        {
+            self.complete(ec, n);
+        }
+
+    private:
+        basic_send_queue& queue_;
+        ConstBufferSequence buffers_;
+    };
+
+    void push(std::unique_ptr<detail::queued_send<Socket>> s)
+    {
+        queue_.push_back(std::move(s));
+        if (full() && on_full_)
+        {
+            on_full_(true);
+        }
+        if (!busy_)
+        {
+            // The first attempt must not complete within the initiating
+            // function.
+            busy_ = true;
+            schedule();
+        }
+    }
+
+    void schedule()
+    {
+        auto const alive = lifetime_.get();
+        net::post(sock_.get_executor(), [this, alive] {
+            if (!alive.expired())
+            {
+                process();
+            }
+        });
+    }
+
+    void resume(detail::lifetime::token const& alive, error_code ec)
+    {
+        if (alive.expired())
+        {
+            return;
+        }
+        if (ec == net::error::operation_aborted)
+        {
+            cancel();
+            return;
+        }
+        process();
+    }
+
+    void abort()
+    {
+        auto queue = std::move(queue_);
+        queue_.clear();
+        busy_ = false;
+        auto const ex = sock_.get_executor();
+        for (auto& s : queue)
+        {
+            s->abort(ex);
+        }
+    }
+
+    void process()
+    {
+        for (std::size_t n = 0; n < opts_.batch_size && !queue_.empty(); ++n)
+        {
+            error_code ec;
+            auto const size = queue_.front()->try_send(sock_, ec);
+            if (ec == net::error::would_block)
+            {
+                auto const alive = lifetime_.get();
+                sock_.async_wait(Socket::wait_write,
+                                 [this, alive](error_code ec) {
+                                     resume(alive, ec);
+                                 });
+                return;
+            }
+            if (ec == net::error::no_buffer_space)
+            {
+                ++retries_;
+                timer_.expires_after(retry_delay_);
+                retry_delay_ = std::min(retry_delay_ * 2, opts_.max_retry);
+                auto const alive = lifetime_.get();
+                timer_.async_wait(
+                  [this, alive](error_code ec) { resume(alive, ec); });
+                return;
+            }
+            retry_delay_ = opts_.min_retry;
+
+            auto const was_full = full();
+            auto s = std::move(queue_.front());
+            queue_.pop_front();
+            if (was_full && on_full_)
+            {
+                on_full_(false);
+            }
+            s->complete(ec, size);
+        }
+
+        if (queue_.empty())
+        {
+            busy_ = false;
+            return;
+        }
+        schedule();
+    }
+
+    Socket& sock_;
+    options opts_;
+    net::steady_timer timer_;
+    std::chrono::microseconds retry_delay_;
+    std::deque<std::unique_ptr<detail::queued_send<Socket>>> queue_;
+    std::function<void(bool)> on_full_;
+    bool busy_ = false;
+    std::size_t retries_ = 0;
+    detail::lifetime lifetime_;
+};
+
+/// A send queue for raw CAN sockets.
+using send_queue = basic_send_queue<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_SEND_QUEUE_HPP
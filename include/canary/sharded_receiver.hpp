@@ -0,0 +1,534 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SHARDED_RECEIVER_HPP
+#define CANARY_SHARDED_RECEIVER_HPP
+
+#include <canary/frame_header.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <vector>
+
+namespace canary
+{
+
+namespace detail
+{
+
+// Moves buckets from the most to the least loaded worker, as long as that
+// reduces the load of the most loaded worker and it exceeds the mean load by
+// more than `threshold`. Moving few buckets keeps the number of hand-offs
+// low. Returns true if the assignment was changed.
+inline bool
+rebalance_buckets(std::vector<std::uint64_t> const& bucket_load,
+                  std::vector<std::size_t>& assignment,
+                  std::size_t workers,
+                  double threshold)
+{
+    std::vector<std::uint64_t> load(workers);
+    std::uint64_t total = 0;
+    for (std::size_t b = 0; b < assignment.size(); ++b)
+    {
+        load[assignment[b]] += bucket_load[b];
+        total += bucket_load[b];
+    }
+    auto const mean = static_cast<double>(total) / static_cast<double>(workers);
+
+    bool changed = false;
+    for (std::size_t moves = 0; moves < assignment.size(); ++moves)
+    {
+        auto const max_it = std::max_element(load.begin(), load.end());
+        auto const min_it = std::min_element(load.begin(), load.end());
+        auto const from = static_cast<std::size_t>(max_it - load.begin());
+        auto const to = static_cast<std::size_t>(min_it - load.begin());
+        if (static_cast<double>(*max_it) <= mean * threshold)
+        {
+            break;
+        }
+
+        // Largest bucket whose move still strictly lowers the maximum.
+        std::size_t best = assignment.size();
+        for (std::size_t b = 0; b < assignment.size(); ++b)
+        {
+            if (assignment[b] != from || bucket_load[b] == 0 ||
+                load[to] + bucket_load[b] >= load[from])
+            {
+                continue;
+            }
+            if (best == assignment.size() || bucket_load[b] > bucket_load[best])
+            {
+                best = b;
+            }
+        }
+        if (best == assignment.size())
+        {
+            break;
+        }
+        assignment[best] = to;
+        load[from] -= bucket_load[best];
+        load[to] += bucket_load[best];
+        changed = true;
+    }
+    return changed;
+}
+
+} // namespace detail
+
+/// Splits the receive load of a CAN interface across worker threads.
+///
+/// The CAN ID space is split into `2^bucket_bits` buckets by the low bits of
+/// the ID. Each worker owns a raw socket, bound to the same endpoint, whose
+/// `filter_if_any` list contains one filter per bucket it owns, so that the
+/// kernel does the sharding. Workers run their own `io_context` on a
+/// dedicated thread, optionally pinned to a CPU.
+///
+/// Frame rates are measured per bucket and, periodically, buckets are moved
+/// from the most to the least loaded workers. A bucket is handed off without
+/// losing, duplicating or reordering frames: the new owner starts buffering
+/// frames of the bucket, the old owner stops receiving them and delivers
+/// everything still queued in its socket, then the new owner delivers the
+/// buffered frames received after the last frame delivered by the old owner,
+/// as determined by kernel reception timestamps. Hence, frames of a given ID
+/// are always delivered in order, although frames of different IDs may be
+/// delivered concurrently by different workers.
+class sharded_receiver
+{
+public:
+    /// A received frame.
+    struct frame
+    {
+        /// Frame header.
+        frame_header header;
+        /// Frame payload, only the first `header.payload_length()` bytes are
+        /// meaningful.
+        std::array<std::uint8_t, 64> payload;
+        /// Number of bytes received, i.e. the size of `can_frame` or
+        /// `canfd_frame`.
+        std::size_t size;
+        /// Kernel reception timestamp.
+        timestamp time;
+    };
+
+    /// Invoked for every received frame with the index of the worker which
+    /// received it. May be invoked concurrently by different workers.
+    using handler_type = std::function<void(std::size_t, frame const&)>;
+
+    /// Configuration of the receiver.
+    struct options
+    {
+        /// Number of worker threads.
+        std::size_t workers = 1;
+        /// The ID space is split into `2^bucket_bits` buckets. Must not exceed
+        /// 9, because of the limit of filters per socket.
+        unsigned int bucket_bits = 6;
+        /// Whether workers are pinned to CPUs `first_cpu`, `first_cpu + 1`,
+        /// etc.
+        bool pin_workers = false;
+        /// First CPU to pin workers to.
+        unsigned int first_cpu = 0;
+        /// Whether FD frames are received.
+        bool flexible_data_rate = true;
+        /// Interval between automatic rebalancing, zero disables it.
+        std::chrono::milliseconds rebalance_interval{1000};
+        /// Buckets are moved only if the most loaded worker exceeds the mean
+        /// load by this factor.
+        double imbalance_threshold = 1.25;
+    };
+
+    /// Constructs the receiver. Workers are not started until `start` is
+    /// called.
+    /// \param ep The endpoint which all worker sockets are bound to.
+    /// \param opts The configuration.
+    /// \param handler Invoked for every received frame.
+    sharded_receiver(raw::endpoint const& ep,
+                     options const& opts,
+                     handler_type handler)
+      : endpoint_{ep}
+      , opts_{opts}
+      , handler_{std::move(handler)}
+      , buckets_{std::size_t{1} << opts.bucket_bits}
+      , assignment_(buckets_)
+      , timer_{control_}
+    {
+        assert(opts.workers > 0 && "At least one worker is required.");
+        assert(buckets_ <= CAN_RAW_FILTER_MAX &&
+               "Too many buckets for the filter limit.");
+        for (std::size_t b = 0; b < buckets_; ++b)
+        {
+            assignment_[b] = b % opts_.workers;
+        }
+        for (std::size_t i = 0; i < opts_.workers; ++i)
+        {
+            workers_.emplace_back(new worker{*this, i});
+        }
+    }
+
+    sharded_receiver(sharded_receiver const&) = delete;
+    sharded_receiver& operator=(sharded_receiver const&) = delete;
+
+    /// Stops all workers.
+    ~sharded_receiver()
+    {
+        stop();
+    }
+
+    /// Opens worker sockets and starts worker threads.
+    void start()
+    {
+        for (auto& w : workers_)
+        {
+            w->open();
+        }
+        for (auto& w : workers_)
+        {
+            w->start();
+        }
+        control_thread_ = std::thread{[this] { control_.run(); }};
+        net::post(control_, [this] { schedule_rebalance(); });
+    }
+
+    /// Stops all workers and joins their threads. Frames queued in worker
+    /// sockets are discarded.
+    void stop()
+    {
+        control_guard_.reset();
+        control_.stop();
+        if (control_thread_.joinable())
+        {
+            control_thread_.join();
+        }
+        for (auto& w : workers_)
+        {
+            w->stop();
+        }
+    }
+
+    /// Requests an immediate rebalancing. Has no effect if hand-offs from
+    /// the previous rebalancing are still in progress.
+    void rebalance()
+    {
+        net::post(control_, [this] { do_rebalance(); });
+    }
+
+    /// Returns the index of the worker which owns each bucket.
+    std::vector<std::size_t> assignment() const
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return assignment_;
+    }
+
+    /// Returns the number of frames received by each worker.
+    std::vector<std::uint64_t> frames_per_worker() const
+    {
+        std::vector<std::uint64_t> frames;
+        for (auto const& w : workers_)
+        {
+            frames.push_back(w->frames.load(std::memory_order_relaxed));
+        }
+        return frames;
+    }
+
+    /// Returns the number of bucket hand-offs completed so far.
+    std::uint64_t handoffs() const noexcept
+    {
+        return handoffs_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct pending_bucket
+    {
+        bool active = false;
+        std::vector<frame> frames;
+    };
+
+    struct worker
+    {
+        worker(sharded_receiver& r, std::size_t i)
+          : owner{r}
+          , index{i}
+          , socket{ioc}
+          , owned(r.buckets_)
+          , pending(r.buckets_)
+          , last_delivered(r.buckets_)
+          , bucket_frames{new std::atomic<std::uint64_t>[r.buckets_]}
+        {
+            for (std::size_t b = 0; b < r.buckets_; ++b)
+            {
+                owned[b] = r.assignment_[b] == i;
+                bucket_frames[b].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        void open()
+        {
+            socket.open(raw{});
+            socket.set_option(receive_timestamp{true});
+            if (owner.opts_.flexible_data_rate)
+            {
+                socket.set_option(flexible_data_rate{true});
+            }
+            apply_filters();
+            socket.bind(owner.endpoint_);
+        }
+
+        void start()
+        {
+            wait();
+            thread = std::thread{[this] {
+                if (owner.opts_.pin_workers)
+                {
+                    pin();
+                }
+                ioc.run();
+            }};
+        }
+
+        void stop()
+        {
+            guard.reset();
+            ioc.stop();
+            if (thread.joinable())
+            {
+                thread.join();
+            }
+        }
+
+        void pin()
+        {
+            auto const cpus = std::max(1u, std::thread::hardware_concurrency());
+            ::cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET((owner.opts_.first_cpu + index) % cpus, &set);
+            ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        }
+
+        void apply_filters()
+        {
+            std::vector<filter> filters;
+            auto const mask = static_cast<std::uint32_t>(owner.buckets_ - 1);
+            for (std::size_t b = 0; b < owner.buckets_; ++b)
+            {
+                if (owned[b])
+                {
+                    filters.push_back(
+                      filter{}.id(static_cast<std::uint32_t>(b)).id_mask(mask));
+                }
+            }
+            socket.set_option(filter_if_any{filters.data(), filters.size()});
+        }
+
+        // Reading happens only in `drain`, so no frame is ever held by a
+        // pending operation while a hand-off is being processed.
+        void wait()
+        {
+            socket.async_wait(raw::socket::wait_read, [this](error_code ec) {
+                if (ec)
+                {
+                    return;
+                }
+                drain();
+                wait();
+            });
+        }
+
+        void drain()
+        {
+            frame f;
+            while (true)
+            {
+                error_code ec;
+                f.size = detail::receive_timestamped_once(
+                  socket.native_handle(),
+                  net::buffer(&f.header, sizeof(f.header) + sizeof(f.payload)),
+                  0,
+                  f.time,
+                  ec);
+                if (ec)
+                {
+                    return;
+                }
+                process(f);
+            }
+        }
+
+        void process(frame const& f)
+        {
+            frames.store(frames.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+            auto const b = f.header.id() & (owner.buckets_ - 1);
+            auto& count = bucket_frames[b];
+            count.store(count.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+            if (pending[b].active)
+            {
+                pending[b].frames.push_back(f);
+                return;
+            }
+            last_delivered[b] = f.time;
+            owner.handler_(index, f);
+        }
+
+        // Hand-off, step 1: the new owner buffers frames of the bucket.
+        void acquire(std::size_t b)
+        {
+            pending[b].active = true;
+            owned[b] = true;
+            apply_filters();
+        }
+
+        // Hand-off, step 2: the old owner stops receiving frames of the
+        // bucket and delivers those already queued in its socket.
+        timestamp release(std::size_t b)
+        {
+            owned[b] = false;
+            apply_filters();
+            drain();
+            return last_delivered[b];
+        }
+
+        // Hand-off, step 3: the new owner delivers buffered frames which the
+        // old owner did not deliver.
+        void complete(std::size_t b, timestamp last)
+        {
+            auto& p = pending[b];
+            p.active = false;
+            for (auto const& f : p.frames)
+            {
+                if (f.time > last)
+                {
+                    last_delivered[b] = f.time;
+                    owner.handler_(index, f);
+                }
+            }
+            p.frames.clear();
+        }
+
+        sharded_receiver& owner;
+        std::size_t index;
+        net::io_context ioc{1};
+        net::executor_work_guard<net::io_context::executor_type> guard{
+          ioc.get_executor()};
+        raw::socket socket;
+        std::vector<bool> owned;
+        std::vector<pending_bucket> pending;
+        std::vector<timestamp> last_delivered;
+        std::unique_ptr<std::atomic<std::uint64_t>[]> bucket_frames;
+        std::atomic<std::uint64_t> frames{0};
+        std::thread thread;
+    };
+
+    void schedule_rebalance()
+    {
+        if (opts_.rebalance_interval.count() == 0)
+        {
+            return;
+        }
+        timer_.expires_after(opts_.rebalance_interval);
+        timer_.async_wait([this](error_code ec) {
+            if (ec)
+            {
+                return;
+            }
+            do_rebalance();
+            schedule_rebalance();
+        });
+    }
+
+    void do_rebalance()
+    {
+        if (handoffs_in_progress_ > 0)
+        {
+            return;
+        }
+
+        std::vector<std::uint64_t> load(buckets_);
+        for (auto& w : workers_)
+        {
+            for (std::size_t b = 0; b < buckets_; ++b)
+            {
+                load[b] +=
+                  w->bucket_frames[b].exchange(0, std::memory_order_relaxed);
+            }
+        }
+
+        auto next = assignment_;
+        if (!detail::rebalance_buckets(
+              load, next, workers_.size(), opts_.imbalance_threshold))
+        {
+            return;
+        }
+
+        for (std::size_t b = 0; b < buckets_; ++b)
+        {
+            if (next[b] != assignment_[b])
+            {
+                handoff(b, *workers_[assignment_[b]], *workers_[next[b]]);
+            }
+        }
+        std::lock_guard<std::mutex> lock{mutex_};
+        assignment_ = std::move(next);
+    }
+
+    void handoff(std::size_t b, worker& from, worker& to)
+    {
+        ++handoffs_in_progress_;
+        net::post(to.ioc, [this, b, &from, &to] {
+            to.acquire(b);
+            net::post(from.ioc, [this, b, &from, &to] {
+                auto const last = from.release(b);
+                net::post(to.ioc, [this, b, last, &to] {
+                    to.complete(b, last);
+                    handoffs_.fetch_add(1, std::memory_order_relaxed);
+                    net::post(control_, [this] { --handoffs_in_progress_; });
+                });
+            });
+        });
+    }
+
+    raw::endpoint endpoint_;
+    options opts_;
+    handler_type handler_;
+    std::size_t buckets_;
+    mutable std::mutex mutex_;
+    std::vector<std::size_t> assignment_;
+    std::vector<std::unique_ptr<worker>> workers_;
+    net::io_context control_{1};
+    net::executor_work_guard<net::io_context::executor_type> control_guard_{
+      control_.get_executor()};
+    net::steady_timer timer_;
+    std::thread control_thread_;
+    std::size_t handoffs_in_progress_ = 0;
+    std::atomic<std::uint64_t> handoffs_{0};
+};
+
+} // namespace canary
+
+#endif // CANARY_SHARDED_RECEIVER_HPP
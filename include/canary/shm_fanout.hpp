@@ -0,0 +1,633 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SHM_FANOUT_HPP
+#define CANARY_SHM_FANOUT_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/frame.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <string>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace canary
+{
+
+namespace detail
+{
+
+constexpr std::uint64_t shm_ring_magic = 0x63616e6172790001; // "canary", v1
+
+// Beginning of the shared memory file. Members written by the publisher and
+// read by subscribers are on separate cache lines.
+struct shm_ring_header
+{
+    std::atomic<std::uint64_t> magic;
+    std::uint64_t capacity;
+    alignas(64) std::atomic<std::uint64_t> head;
+    alignas(64) std::atomic<std::uint32_t> futex;
+    std::atomic<std::uint32_t> closed;
+    alignas(64) std::atomic<std::uint32_t> waiters;
+};
+
+// A frame in the ring, protected by a seqlock. While the frame with sequence
+// number `n` is written, the version is `2n + 1`, afterwards it is `2n + 2`.
+struct shm_slot
+{
+    std::atomic<std::uint64_t> version;
+    std::uint32_t size;
+    std::uint32_t reserved;
+    unsigned char data[fd_frame_size];
+};
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t),
+              "Futex words must be plain 32-bit integers");
+
+inline std::size_t
+shm_ring_size(std::uint64_t capacity) noexcept
+{
+    return sizeof(shm_ring_header) +
+           static_cast<std::size_t>(capacity) * sizeof(shm_slot);
+}
+
+// A shared mapping of a file. A file created by the mapping is kept open
+// and locked until the mapping is destroyed, which tells a ring of a live
+// publisher from one left behind by a process which died, whose lock the
+// kernel released. If creating the mapping fails, the file is removed.
+class shm_mapping
+{
+public:
+    shm_mapping(std::string const& path, bool create, std::size_t size)
+    {
+        auto const flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0);
+        auto const fd = ::open(path.c_str(), flags, 0600);
+        if (fd < 0)
+        {
+            detail::throw_errno();
+        }
+        if (create && (::flock(fd, LOCK_EX) != 0 ||
+                       ::ftruncate(fd, static_cast<::off_t>(size)) != 0))
+        {
+            close_and_throw(fd, path);
+        }
+        if (!create)
+        {
+            struct ::stat st;
+            if (::fstat(fd, &st) != 0)
+            {
+                close_and_throw(fd, {});
+            }
+            size = static_cast<std::size_t>(st.st_size);
+        }
+        auto const p =
+          ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close_and_throw(fd, create ? path : std::string{});
+        }
+        if (create)
+        {
+            fd_ = fd;
+        }
+        else
+        {
+            ::close(fd);
+        }
+        data_ = p;
+        size_ = size;
+    }
+
+    shm_mapping(shm_mapping const&) = delete;
+    shm_mapping& operator=(shm_mapping const&) = delete;
+
+    ~shm_mapping()
+    {
+        ::munmap(data_, size_);
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+    }
+
+    void* data() const noexcept
+    {
+        return data_;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+private:
+    [[noreturn]] static void close_and_throw(int fd, std::string const& path)
+    {
+        error_code ec;
+        detail::assign_errno(ec);
+        if (!path.empty())
+        {
+            ::unlink(path.c_str());
+        }
+        ::close(fd);
+        canary::detail::throw_exception(system_error{ec});
+    }
+
+    int fd_ = -1;
+    void* data_;
+    std::size_t size_;
+};
+
+inline long
+futex(std::atomic<std::uint32_t>& word,
+      int op,
+      std::uint32_t value,
+      ::timespec const* timeout = nullptr) noexcept
+{
+    return ::syscall(
+      SYS_futex, reinterpret_cast<std::uint32_t*>(&word), op, value, timeout);
+}
+
+// Removes a ring whose publisher died without removing it, after closing the
+// ring, so that its subscribers fail with eof rather than wait forever. The
+// file is left alone if it is locked by a live publisher, or if it is not a
+// complete ring.
+inline void
+shm_remove_stale(std::string const& path) noexcept
+{
+    auto const fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct ::stat st;
+    struct ::stat linked;
+    if (::flock(fd, LOCK_EX | LOCK_NB) == 0 && ::fstat(fd, &st) == 0 &&
+        static_cast<std::size_t>(st.st_size) >= sizeof(shm_ring_header) &&
+        ::stat(path.c_str(), &linked) == 0 && linked.st_dev == st.st_dev &&
+        linked.st_ino == st.st_ino)
+    {
+        auto const p = ::mmap(nullptr,
+                              sizeof(shm_ring_header),
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED,
+                              fd,
+                              0);
+        if (p != MAP_FAILED)
+        {
+            auto const header = static_cast<shm_ring_header*>(p);
+            if (header->magic.load(std::memory_order_acquire) ==
+                shm_ring_magic)
+            {
+                header->closed.store(1, std::memory_order_seq_cst);
+                header->futex.fetch_add(1, std::memory_order_seq_cst);
+                futex(header->futex, FUTEX_WAKE, INT_MAX);
+                ::unlink(path.c_str());
+            }
+            ::munmap(p, sizeof(shm_ring_header));
+        }
+    }
+    ::close(fd);
+}
+
+} // namespace detail
+
+/// Publishes frames to any number of local processes through a ring buffer
+/// in shared memory.
+///
+/// Every process which opens its own raw socket makes the kernel clone each
+/// frame for it, and pays for its own system calls. A publisher receives
+/// frames from a socket once, and copies them into a ring of
+/// `options::capacity` frames in a shared memory file, which is read by
+/// `shm_subscriber`s, each with its own cursor. Each frame in the ring is
+/// protected by a seqlock, so the publisher never waits for subscribers: a
+/// subscriber which falls more than `capacity` frames behind detects that it
+/// was overrun, and skips ahead.
+///
+/// Subscribers which wait for frames sleep on a futex in the shared memory.
+/// The publisher only makes a system call to wake them, once per batch of
+/// frames, while any subscriber is waiting.
+///
+/// \notes Only one publisher may exist per file. The publisher creates the
+/// file, and removes it on destruction. A ring left behind by a publisher
+/// which died is closed, so that its subscribers fail with `net::error::eof`,
+/// and replaced. Any other existing file is an error. A file in `/dev/shm`
+/// keeps the ring in memory. The publisher is not thread-safe.
+class shm_publisher
+{
+public:
+    /// Configuration of the publisher.
+    struct options
+    {
+        /// Number of frames in the ring, a power of two.
+        std::size_t capacity = 4096;
+        /// Largest number of frames received from a socket at once.
+        std::size_t batch_size = 64;
+    };
+
+    /// Creates a ring with the default options.
+    /// \param path The path of the shared memory file, e.g.
+    /// `/dev/shm/canary-vcan0`.
+    explicit shm_publisher(std::string path)
+      : shm_publisher{std::move(path), options{}}
+    {
+    }
+
+    /// Creates a ring. Throws `system_error` if the file cannot be created,
+    /// e.g. because another publisher uses it, or if the capacity is not a
+    /// power of two, or the batch size is zero.
+    /// \param path The path of the shared memory file, e.g.
+    /// `/dev/shm/canary-vcan0`.
+    /// \param opts Configuration of the publisher.
+    shm_publisher(std::string path, options const& opts)
+      : path_{std::move(path)}
+      , frames_(checked(opts).batch_size * slot_units)
+      , iovs_(opts.batch_size)
+      , msgs_(opts.batch_size)
+      , mapping_{replaced(path_), true, detail::shm_ring_size(opts.capacity)}
+      , header_{new (mapping_.data()) detail::shm_ring_header{}}
+      , slots_{reinterpret_cast<detail::shm_slot*>(header_ + 1)}
+      , mask_{opts.capacity - 1}
+    {
+        header_->capacity = opts.capacity;
+        for (std::size_t i = 0; i < opts.capacity; ++i)
+        {
+            new (&slots_[i]) detail::shm_slot{};
+        }
+        for (std::size_t i = 0; i < opts.batch_size; ++i)
+        {
+            iovs_[i].iov_base = &frames_[i * slot_units];
+            iovs_[i].iov_len = fd_frame_size;
+            msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+        }
+        header_->magic.store(detail::shm_ring_magic, std::memory_order_release);
+    }
+
+    shm_publisher(shm_publisher const&) = delete;
+    shm_publisher& operator=(shm_publisher const&) = delete;
+
+    /// Closes the ring and removes the file. Subscribers which already
+    /// opened it may still read the frames left in the ring.
+    ~shm_publisher()
+    {
+        close();
+        ::unlink(path_.c_str());
+    }
+
+    /// Copies a frame into the ring, without waking subscribers.
+    /// \param frame A classic or CAN FD frame, at most `fd_frame_size` bytes
+    /// long.
+    void write(net::const_buffer frame) noexcept
+    {
+        auto const n = head_++;
+        auto& slot = slots_[n & mask_];
+        slot.version.store(2 * n + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        auto const size = frame.size() < fd_frame_size ? frame.size()
+                                                       : fd_frame_size;
+        std::memcpy(slot.data, frame.data(), size);
+        slot.size = static_cast<std::uint32_t>(size);
+        slot.version.store(2 * n + 2, std::memory_order_release);
+        header_->head.store(head_, std::memory_order_release);
+    }
+
+    /// Wakes the subscribers waiting for frames, if any.
+    void notify() noexcept
+    {
+        header_->futex.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (header_->waiters.load(std::memory_order_relaxed) > 0)
+        {
+            ++wakeups_;
+            detail::futex(header_->futex, FUTEX_WAKE, INT_MAX);
+        }
+    }
+
+    /// Copies a frame into the ring and wakes waiting subscribers.
+    void publish(net::const_buffer frame) noexcept
+    {
+        write(frame);
+        notify();
+    }
+
+    /// Starts publishing the frames received from a socket. A raw socket
+    /// must have `flexible_data_rate` enabled to publish CAN FD frames.
+    /// Frames of other sizes, e.g. CAN XL frames, are ignored.
+    /// \param sock The socket, which must outlive the publisher, or
+    /// `stop` must be called and its handlers run first.
+    template<class Socket>
+    void start(Socket& sock)
+    {
+        running_ = true;
+        sock.async_wait(Socket::wait_read, [this, &sock](error_code ec) {
+            if (ec || !running_)
+            {
+                return;
+            }
+            receive(sock.native_handle());
+            start(sock);
+        });
+    }
+
+    /// Stops publishing frames from a socket. Cancels all asynchronous
+    /// operations on the socket.
+    template<class Socket>
+    void stop(Socket& sock)
+    {
+        running_ = false;
+        sock.cancel();
+    }
+
+    /// Marks the ring as closed and wakes all subscribers, which fail with
+    /// `net::error::eof` once they read all frames.
+    void close() noexcept
+    {
+        header_->closed.store(1, std::memory_order_seq_cst);
+        notify();
+    }
+
+    /// Number of frames written to the ring.
+    std::uint64_t published() const noexcept
+    {
+        return head_;
+    }
+
+    /// Number of system calls made to wake subscribers.
+    std::uint64_t wakeups() const noexcept
+    {
+        return wakeups_;
+    }
+
+private:
+    static constexpr std::size_t slot_units =
+      (fd_frame_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+
+    static options const& checked(options const& opts)
+    {
+        if (opts.capacity == 0 || (opts.capacity & (opts.capacity - 1)) != 0 ||
+            opts.batch_size == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    static std::string const& replaced(std::string const& path) noexcept
+    {
+        detail::shm_remove_stale(path);
+        return path;
+    }
+
+    void receive(int fd)
+    {
+        auto const r = ::recvmmsg(fd,
+                                  msgs_.data(),
+                                  static_cast<unsigned>(msgs_.size()),
+                                  MSG_DONTWAIT,
+                                  nullptr);
+        if (r <= 0)
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < static_cast<std::size_t>(r); ++i)
+        {
+            auto const size = msgs_[i].msg_len;
+            if (size == classic_frame_size || size == fd_frame_size)
+            {
+                write(net::buffer(iovs_[i].iov_base, size));
+            }
+        }
+        notify();
+    }
+
+    std::string path_;
+    // Allocated before the file is created, so that nothing can throw once
+    // it exists.
+    std::vector<std::max_align_t> frames_;
+    std::vector<::iovec> iovs_;
+    std::vector<::mmsghdr> msgs_;
+    detail::shm_mapping mapping_;
+    detail::shm_ring_header* header_;
+    detail::shm_slot* slots_;
+    std::uint64_t mask_;
+    std::uint64_t head_ = 0;
+    std::uint64_t wakeups_ = 0;
+    bool running_ = false;
+};
+
+/// Reads the frames published by a `shm_publisher`, possibly in another
+/// process.
+///
+/// Each subscriber has its own cursor, and starts reading at the frame
+/// published after it was opened. A subscriber which falls behind by more
+/// than the capacity of the ring loses the overwritten frames: it skips
+/// ahead, so that half of the ring is left to catch up with, and counts the
+/// lost frames.
+///
+/// \notes The subscriber is not thread-safe.
+class shm_subscriber
+{
+public:
+    /// Opens a ring. Throws `system_error` if the file does not exist, or is
+    /// not a ring created by a `shm_publisher`.
+    /// \param path The path of the shared memory file.
+    explicit shm_subscriber(std::string const& path)
+      : mapping_{path, false, 0}
+      , header_{static_cast<detail::shm_ring_header*>(mapping_.data())}
+    {
+        if (mapping_.size() < sizeof(detail::shm_ring_header) ||
+            header_->magic.load(std::memory_order_acquire) !=
+              detail::shm_ring_magic ||
+            mapping_.size() < detail::shm_ring_size(header_->capacity))
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        slots_ = reinterpret_cast<detail::shm_slot*>(header_ + 1);
+        capacity_ = header_->capacity;
+        cursor_ = header_->head.load(std::memory_order_acquire);
+    }
+
+    shm_subscriber(shm_subscriber const&) = delete;
+    shm_subscriber& operator=(shm_subscriber const&) = delete;
+
+    /// Reads the next frame, if one was published.
+    /// \param frame The buffer to copy the frame into, which should be
+    /// `fd_frame_size` bytes long.
+    /// \returns The size of the frame, or 0 if no frame is available.
+    std::size_t try_receive(net::mutable_buffer frame) noexcept
+    {
+        while (true)
+        {
+            auto const& slot = slots_[cursor_ & (capacity_ - 1)];
+            auto const expected = 2 * cursor_ + 2;
+            auto const before = slot.version.load(std::memory_order_acquire);
+            if (before < expected)
+            {
+                // Not published yet, or being written.
+                return 0;
+            }
+            if (before == expected)
+            {
+                // The size may be torn by a concurrent write, which the
+                // version check below detects, so it is bounded by both
+                // buffers before copying.
+                auto size = static_cast<std::size_t>(slot.size);
+                size = size < sizeof(slot.data) ? size : sizeof(slot.data);
+                size = size < frame.size() ? size : frame.size();
+                std::memcpy(frame.data(), slot.data, size);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.version.load(std::memory_order_relaxed) == before)
+                {
+                    ++cursor_;
+                    return size;
+                }
+            }
+            skip_ahead();
+        }
+    }
+
+    /// Reads the next frame, waiting until one is published.
+    /// \param frame The buffer to copy the frame into, which should be
+    /// `fd_frame_size` bytes long.
+    /// \param ec Set to `net::error::eof` if the ring was closed and all
+    /// frames were read.
+    /// \returns The size of the frame, or 0 on error.
+    std::size_t receive(net::mutable_buffer frame, error_code& ec) noexcept
+    {
+        return receive(frame, nullptr, ec);
+    }
+
+    /// Reads the next frame, waiting until one is published, or the timeout
+    /// expires.
+    /// \param frame The buffer to copy the frame into, which should be
+    /// `fd_frame_size` bytes long.
+    /// \param timeout How long to wait for a frame.
+    /// \param ec Set to `net::error::timed_out` if the timeout expired, or to
+    /// `net::error::eof` if the ring was closed and all frames were read.
+    /// \returns The size of the frame, or 0 on error.
+    template<class Rep, class Period>
+    std::size_t receive(net::mutable_buffer frame,
+                        std::chrono::duration<Rep, Period> timeout,
+                        error_code& ec) noexcept
+    {
+        auto const ns =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(timeout);
+        ::timespec ts{};
+        ts.tv_sec = static_cast<::time_t>(ns.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(ns.count() % 1000000000);
+        return receive(frame, &ts, ec);
+    }
+
+    /// Number of frames lost, because the subscriber was overrun.
+    std::uint64_t lost() const noexcept
+    {
+        return lost_;
+    }
+
+    /// Number of frames published, but not read yet.
+    std::uint64_t lag() const noexcept
+    {
+        auto const head = header_->head.load(std::memory_order_acquire);
+        return head > cursor_ ? head - cursor_ : 0;
+    }
+
+private:
+    void skip_ahead() noexcept
+    {
+        auto const head = header_->head.load(std::memory_order_acquire);
+        auto const keep = capacity_ / 2;
+        auto const next = head > keep ? head - keep : 0;
+        if (next > cursor_)
+        {
+            lost_ += next - cursor_;
+            cursor_ = next;
+        }
+        else
+        {
+            // The publisher was faster than the head we read.
+            lost_ += 1;
+            cursor_ += 1;
+        }
+    }
+
+    std::size_t receive(net::mutable_buffer frame,
+                        ::timespec const* timeout,
+                        error_code& ec) noexcept
+    {
+        ec = {};
+        while (true)
+        {
+            auto n = try_receive(frame);
+            if (n > 0)
+            {
+                return n;
+            }
+
+            header_->waiters.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto const value = header_->futex.load(std::memory_order_seq_cst);
+            n = try_receive(frame);
+            auto const closed = header_->closed.load(std::memory_order_seq_cst);
+            long r = 0;
+            if (n == 0 && !closed)
+            {
+                r = detail::futex(header_->futex, FUTEX_WAIT, value, timeout);
+            }
+            header_->waiters.fetch_sub(1, std::memory_order_relaxed);
+            if (n > 0)
+            {
+                return n;
+            }
+            if (closed)
+            {
+                ec = net::error::eof;
+                return 0;
+            }
+            if (r != 0 && errno == ETIMEDOUT)
+            {
+                ec = net::error::timed_out;
+                return 0;
+            }
+        }
+    }
+
+    detail::shm_mapping mapping_;
+    detail::shm_ring_header* header_;
+    detail::shm_slot* slots_ = nullptr;
+    std::uint64_t capacity_ = 0;
+    std::uint64_t cursor_ = 0;
+    std::uint64_t lost_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_SHM_FANOUT_HPP
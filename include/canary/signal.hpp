@@ -0,0 +1,495 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SIGNAL_HPP
+#define CANARY_SIGNAL_HPP
+
+#include <canary/detail/config.hpp>
+#include <canary/detail/simd.hpp>
+#include <canary/frame_header.hpp>
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace canary
+{
+
+/// Bit layout of a signal within a frame payload.
+enum class byte_order
+{
+    /// Little-endian signal. The start bit is the least significant bit of the
+    /// signal.
+    intel,
+    /// Big-endian signal. The start bit is the most significant bit of the
+    /// signal, using the DBC (sawtooth) bit numbering.
+    motorola
+};
+
+/// Describes how a single signal is packed into a frame payload and how its
+/// raw value is scaled to a physical value, i.e. `raw * factor + offset`.
+/// Bit `n` of the payload is bit `n % 8` of byte `n / 8`.
+class signal_definition
+{
+public:
+    /// Sets the position of the start bit. For Intel signals, this is the
+    /// least significant bit, for Motorola signals - the most significant bit.
+    signal_definition& start_bit(unsigned int value)
+    {
+        assert(value < 64 * 8 && "Start bit must lie within a 64-byte payload.");
+        start_bit_ = static_cast<std::uint16_t>(value);
+        return *this;
+    }
+
+    /// Gets the position of the start bit.
+    unsigned int start_bit() const noexcept
+    {
+        return start_bit_;
+    }
+
+    /// Sets the length of the signal in bits.
+    /// \notes The length must be in the range [1, 64].
+    signal_definition& length(unsigned int value)
+    {
+        assert(value >= 1 && value <= 64 &&
+               "Signal length must be in the range [1, 64].");
+        length_ = static_cast<std::uint8_t>(value);
+        return *this;
+    }
+
+    /// Gets the length of the signal in bits.
+    unsigned int length() const noexcept
+    {
+        return length_;
+    }
+
+    /// Sets the byte order of the signal.
+    signal_definition& order(byte_order value)
+    {
+        order_ = value;
+        return *this;
+    }
+
+    /// Gets the byte order of the signal.
+    byte_order order() const noexcept
+    {
+        return order_;
+    }
+
+    /// Sets whether the raw value is a two's complement signed integer.
+    signal_definition& is_signed(bool value)
+    {
+        is_signed_ = value;
+        return *this;
+    }
+
+    /// Gets whether the raw value is a two's complement signed integer.
+    bool is_signed() const noexcept
+    {
+        return is_signed_;
+    }
+
+    /// Sets the linear conversion from the raw value to the physical value.
+    signal_definition& scale(double factor, double offset)
+    {
+        factor_ = factor;
+        offset_ = offset;
+        return *this;
+    }
+
+    /// Gets the factor of the raw to physical value conversion.
+    double factor() const noexcept
+    {
+        return factor_;
+    }
+
+    /// Gets the offset of the raw to physical value conversion.
+    double offset() const noexcept
+    {
+        return offset_;
+    }
+
+private:
+    double factor_ = 1.0;
+    double offset_ = 0.0;
+    std::uint16_t start_bit_ = 0;
+    std::uint8_t length_ = 1;
+    byte_order order_ = byte_order::intel;
+    bool is_signed_ = false;
+};
+
+/// Output of the batch decoder for a single signal. Either of the columns may
+/// be null, in which case it is not written.
+struct signal_column
+{
+    /// The decoded signal.
+    signal_definition signal;
+    /// Column of raw values, sign-extended for signed signals.
+    std::int64_t* raw = nullptr;
+    /// Column of physical values.
+    double* physical = nullptr;
+};
+
+namespace detail
+{
+
+inline std::uint64_t
+load_le64(unsigned char const* p, std::size_t n, std::size_t offset) noexcept
+{
+    unsigned char bytes[8] = {};
+    if (offset < n)
+    {
+        std::memcpy(bytes, p + offset, n - offset < 8 ? n - offset : 8);
+    }
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+    {
+        v = (v << 8) | bytes[i];
+    }
+    return v;
+}
+
+inline std::uint64_t
+load_be64(unsigned char const* p, std::size_t n, std::size_t offset) noexcept
+{
+    unsigned char bytes[8] = {};
+    if (offset < n)
+    {
+        std::memcpy(bytes, p + offset, n - offset < 8 ? n - offset : 8);
+    }
+    std::uint64_t v = 0;
+    for (int i = 0; i < 8; ++i)
+    {
+        v = (v << 8) | bytes[i];
+    }
+    return v;
+}
+
+inline unsigned char
+load_byte(unsigned char const* p, std::size_t n, std::size_t offset) noexcept
+{
+    return offset < n ? p[offset] : 0;
+}
+
+inline std::uint64_t
+low_mask(unsigned int bits) noexcept
+{
+    return bits >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << bits) - 1;
+}
+
+// Position of a Motorola start bit in the MSB-first linear numbering of the
+// payload, where position 0 is the most significant bit of byte 0.
+inline unsigned int
+motorola_linear_position(unsigned int start_bit) noexcept
+{
+    return (start_bit / 8) * 8 + (7 - start_bit % 8);
+}
+
+inline std::int64_t
+sign_extend(std::uint64_t v, unsigned int bits) noexcept
+{
+    if (bits >= 64)
+    {
+        return static_cast<std::int64_t>(v);
+    }
+    auto const m = std::uint64_t{1} << (bits - 1);
+    return static_cast<std::int64_t>((v ^ m) - m);
+}
+
+// Returns the index of the 64-bit payload word which fully contains the
+// signal and the right shift which moves the signal to bit 0 of that word
+// (after byte-swapping the word for Motorola signals). Returns false if the
+// signal straddles two words.
+inline bool
+signal_word(signal_definition const& s,
+            std::size_t& word,
+            unsigned int& shift) noexcept
+{
+    if (s.order() == byte_order::intel)
+    {
+        word = s.start_bit() / 64;
+        shift = s.start_bit() % 64;
+        return shift + s.length() <= 64;
+    }
+    auto const p = motorola_linear_position(s.start_bit());
+    word = p / 64;
+    if (p % 64 + s.length() > 64)
+    {
+        return false;
+    }
+    shift = 64 - p % 64 - s.length();
+    return true;
+}
+
+} // namespace detail
+
+/// Extracts the raw bits of a signal from a payload, without sign extension.
+/// Bits beyond the end of the payload are read as zero.
+/// \param s The signal definition.
+/// \param payload Pointer to the first byte of the payload.
+/// \param n The length of the payload.
+/// \returns The raw bits of the signal, in the least significant bits.
+inline std::uint64_t
+extract(signal_definition const& s,
+        unsigned char const* payload,
+        std::size_t n) noexcept
+{
+    auto const len = s.length();
+    if (s.order() == byte_order::intel)
+    {
+        auto const b = s.start_bit() / 8;
+        auto const shift = s.start_bit() % 8;
+        auto v = detail::load_le64(payload, n, b) >> shift;
+        if (shift + len > 64)
+        {
+            v |= std::uint64_t{detail::load_byte(payload, n, b + 8)}
+                 << (64 - shift);
+        }
+        return v & detail::low_mask(len);
+    }
+
+    auto const p = detail::motorola_linear_position(s.start_bit());
+    auto const b = p / 8;
+    auto const o = p % 8;
+    auto const word = detail::load_be64(payload, n, b);
+    if (o + len <= 64)
+    {
+        return (word << o) >> (64 - len);
+    }
+    auto const r = o + len - 64;
+    return ((word & detail::low_mask(64 - o)) << r) |
+           (detail::load_byte(payload, n, b + 8) >> (8 - r));
+}
+
+/// Decodes the raw value of a signal, sign-extended for signed signals.
+/// \param s The signal definition.
+/// \param payload Pointer to the first byte of the payload.
+/// \param n The length of the payload.
+/// \returns The raw value of the signal.
+inline std::int64_t
+decode_raw(signal_definition const& s,
+           unsigned char const* payload,
+           std::size_t n) noexcept
+{
+    auto const v = canary::extract(s, payload, n);
+    if (s.is_signed())
+    {
+        return detail::sign_extend(v, s.length());
+    }
+    return static_cast<std::int64_t>(v);
+}
+
+/// Decodes the physical value of a signal.
+/// \param s The signal definition.
+/// \param payload Pointer to the first byte of the payload.
+/// \param n The length of the payload.
+/// \returns The physical value of the signal.
+inline double
+decode(signal_definition const& s,
+       unsigned char const* payload,
+       std::size_t n) noexcept
+{
+    double raw;
+    if (s.is_signed())
+    {
+        raw = static_cast<double>(canary::decode_raw(s, payload, n));
+    }
+    else
+    {
+        raw = static_cast<double>(canary::extract(s, payload, n));
+    }
+    return raw * s.factor() + s.offset();
+}
+
+namespace detail
+{
+
+inline void
+decode_column_scalar(unsigned char const* payloads,
+                     std::size_t stride,
+                     std::size_t payload_size,
+                     std::size_t first,
+                     std::size_t count,
+                     signal_column const& c) noexcept
+{
+    for (auto i = first; i < count; ++i)
+    {
+        auto const* p = payloads + i * stride;
+        if (c.raw != nullptr)
+        {
+            c.raw[i] = canary::decode_raw(c.signal, p, payload_size);
+        }
+        if (c.physical != nullptr)
+        {
+            c.physical[i] = canary::decode(c.signal, p, payload_size);
+        }
+    }
+}
+
+#ifdef CANARY_HAS_AVX2_DISPATCH
+
+// Decodes 4 frames per iteration: gathers the payload word containing the
+// signal from each frame, byte-swaps it for Motorola signals, then shifts,
+// masks and sign-extends all lanes at once. Returns the number of frames
+// decoded, the remainder is left to the scalar kernel.
+__attribute__((target("avx2"))) inline std::size_t
+decode_column_avx2(unsigned char const* payloads,
+                   std::size_t stride,
+                   std::size_t payload_size,
+                   std::size_t count,
+                   signal_column const& c) noexcept
+{
+    std::size_t word;
+    unsigned int shift;
+    if (!detail::signal_word(c.signal, word, shift) ||
+        (word + 1) * 8 > payload_size)
+    {
+        return 0;
+    }
+
+    auto const len = c.signal.length();
+    auto const is_signed = c.signal.is_signed();
+    auto const bswap = c.signal.order() == byte_order::motorola;
+    // The int64 -> double conversion below is exact only for |v| < 2^51.
+    auto const convert = len <= 51;
+
+    auto const s = static_cast<long long>(stride);
+    auto const index = _mm256_set_epi64x(3 * s, 2 * s, s, 0);
+    auto const count_shift = _mm_cvtsi32_si128(static_cast<int>(shift));
+    auto const mask =
+      _mm256_set1_epi64x(static_cast<long long>(detail::low_mask(len)));
+    auto const sign = _mm256_set1_epi64x(
+      static_cast<long long>(std::uint64_t{1} << (len - 1)));
+    auto const swap = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                      0, 1, 2, 3, 4, 5, 6, 7,
+                                      8, 9, 10, 11, 12, 13, 14, 15,
+                                      0, 1, 2, 3, 4, 5, 6, 7);
+    auto const magic_i = _mm256_set1_epi64x(0x4338000000000000LL);
+    auto const magic_d = _mm256_castsi256_pd(magic_i);
+    auto const factor = _mm256_set1_pd(c.signal.factor());
+    auto const offset = _mm256_set1_pd(c.signal.offset());
+
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        auto const* base = payloads + i * stride + word * 8;
+        auto v = _mm256_i64gather_epi64(
+          reinterpret_cast<long long const*>(base), index, 1);
+        if (bswap)
+        {
+            v = _mm256_shuffle_epi8(v, swap);
+        }
+        v = _mm256_and_si256(_mm256_srl_epi64(v, count_shift), mask);
+        if (is_signed && len < 64)
+        {
+            v = _mm256_sub_epi64(_mm256_xor_si256(v, sign), sign);
+        }
+        if (c.raw != nullptr)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(c.raw + i), v);
+        }
+        if (c.physical != nullptr)
+        {
+            if (convert)
+            {
+                auto d = _mm256_sub_pd(
+                  _mm256_castsi256_pd(_mm256_add_epi64(v, magic_i)),
+                  magic_d);
+                d = _mm256_add_pd(_mm256_mul_pd(d, factor), offset);
+                _mm256_storeu_pd(c.physical + i, d);
+            }
+            else
+            {
+                alignas(32) std::int64_t lanes[4];
+                _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), v);
+                for (int j = 0; j < 4; ++j)
+                {
+                    auto const raw =
+                      is_signed
+                        ? static_cast<double>(lanes[j])
+                        : static_cast<double>(
+                            static_cast<std::uint64_t>(lanes[j]));
+                    c.physical[i + static_cast<std::size_t>(j)] =
+                      raw * c.signal.factor() + c.signal.offset();
+                }
+            }
+        }
+    }
+    return i;
+}
+
+#endif // CANARY_HAS_AVX2_DISPATCH
+
+} // namespace detail
+
+/// Decodes a set of signals from an array of frames into columns, i.e. the
+/// value of the signal described by `columns[k]` in frame `i` is written to
+/// `columns[k].raw[i]` and `columns[k].physical[i]`. Results are bit-exact
+/// with `decode_raw` and `decode` invoked on each frame with a payload length
+/// of `payload_size`.
+/// \notes When the CPU supports AVX2, signals which do not straddle a 64-bit
+/// payload word are extracted 4 frames at a time.
+/// \param payloads Pointer to the first payload byte of the first frame.
+/// \param stride Distance in bytes between payloads of consecutive frames.
+/// \param payload_size Number of payload bytes available in each frame.
+/// \param count Number of frames.
+/// \param columns Pointer to an array of output columns.
+/// \param n Number of columns.
+inline void
+decode_columns(unsigned char const* payloads,
+               std::size_t stride,
+               std::size_t payload_size,
+               std::size_t count,
+               signal_column const* columns,
+               std::size_t n) noexcept
+{
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        std::size_t first = 0;
+#ifdef CANARY_HAS_AVX2_DISPATCH
+        if (detail::has_avx2())
+        {
+            first = detail::decode_column_avx2(
+              payloads, stride, payload_size, count, columns[k]);
+        }
+#endif // CANARY_HAS_AVX2_DISPATCH
+        detail::decode_column_scalar(
+          payloads, stride, payload_size, first, count, columns[k]);
+    }
+}
+
+/// Decodes a set of signals from a contiguous array of frames. `Frame` must be
+/// a standard layout type that starts with a `frame_header` immediately
+/// followed by the payload (e.g. `::can_frame` or `::canfd_frame`).
+/// \param frames Pointer to an array of frames.
+/// \param count Number of frames.
+/// \param columns Pointer to an array of output columns.
+/// \param n Number of columns.
+template<class Frame>
+void
+decode_columns(Frame const* frames,
+               std::size_t count,
+               signal_column const* columns,
+               std::size_t n) noexcept
+{
+    static_assert(sizeof(Frame) > sizeof(frame_header),
+                  "Frame must contain a payload after the header.");
+    canary::decode_columns(
+      reinterpret_cast<unsigned char const*>(frames) + sizeof(frame_header),
+      sizeof(Frame),
+      sizeof(Frame) - sizeof(frame_header),
+      count,
+      columns,
+      n);
+}
+
+} // namespace canary
+
+#endif // CANARY_SIGNAL_HPP
@@ -0,0 +1,884 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SIM_HPP
+#define CANARY_SIM_HPP
+
+#include <canary/bus_load.hpp>
+#include <canary/detail/async.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/tx_scheduler.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/io_context.hpp>
+#include <asio/socket_base.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace canary
+{
+
+/// A simulated CAN bus, in the process, for tests and benchmarks which should
+/// not depend on the vcan kernel module.
+///
+/// `sim::socket` provides the same operations as `raw::socket` for sending
+/// and receiving frames, so that components templated on the socket type can
+/// run on a `sim::bus`.
+class sim
+{
+public:
+    class bus;
+    class socket;
+};
+
+namespace detail
+{
+
+// A frame queued in a simulated socket.
+struct sim_frame
+{
+    std::array<unsigned char, fd_frame_size> data;
+    std::size_t size;
+    std::uint32_t key;
+};
+
+// A wait operation on a simulated socket, with its type-erased handler.
+class sim_waiter
+{
+public:
+    virtual ~sim_waiter() = default;
+
+    virtual void invoke(error_code ec) = 0;
+};
+
+template<class Handler>
+class sim_waiter_impl : public sim_waiter
+{
+public:
+    explicit sim_waiter_impl(Handler&& handler)
+      : handler_{std::move(handler)}
+    {
+    }
+
+    void invoke(error_code ec) override
+    {
+        handler_(ec);
+    }
+
+private:
+    Handler handler_;
+};
+
+// Completes a wait operation from a posted handler, so that handlers never run
+// while the bus iterates over its sockets.
+struct sim_wakeup
+{
+    std::unique_ptr<sim_waiter> waiter;
+    error_code ec;
+
+    void operator()()
+    {
+        waiter->invoke(ec);
+    }
+};
+
+template<class Socket>
+class sim_wait_op
+{
+public:
+    sim_wait_op(Socket& sock, net::socket_base::wait_type w)
+      : sock_{sock}
+      , wait_{w}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self)
+    {
+        sock_.add_waiter(wait_, std::move(self));
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec)
+    {
+        self.complete(ec);
+    }
+
+private:
+    Socket& sock_;
+    net::socket_base::wait_type wait_;
+};
+
+template<class Socket, class MutableBufferSequence>
+class sim_receive_op
+{
+public:
+    sim_receive_op(Socket& sock, MutableBufferSequence const& buffers)
+      : sock_{sock}
+      , buffers_{buffers}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec = {})
+    {
+        if (state_ != state::done)
+        {
+            if (!ec)
+            {
+                n_ = sock_.receive(buffers_, 0, ec);
+                if (ec == net::error::would_block)
+                {
+                    state_ = state::waiting;
+                    sock_.async_wait(Socket::wait_read, std::move(self));
+                    return;
+                }
+            }
+
+            auto const started = state_ == state::starting;
+            ec_ = ec;
+            state_ = state::done;
+            if (started)
+            {
+                // Completed without waiting, the handler must not be invoked
+                // from within the initiating function.
+                net::post(sock_.get_executor(), std::move(self));
+                return;
+            }
+        }
+        self.complete(ec_, n_);
+    }
+
+private:
+    enum class state
+    {
+        starting,
+        waiting,
+        done
+    };
+
+    Socket& sock_;
+    MutableBufferSequence buffers_;
+    error_code ec_;
+    std::size_t n_ = 0;
+    state state_ = state::starting;
+};
+
+template<class Socket, class ConstBufferSequence>
+class sim_send_op
+{
+public:
+    sim_send_op(Socket& sock, ConstBufferSequence const& buffers)
+      : sock_{sock}
+      , buffers_{buffers}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self)
+    {
+        if (!done_)
+        {
+            // Like a raw socket, fails with `no_buffer_space` rather than
+            // waiting when the transmit queue is full.
+            n_ = sock_.send(buffers_, 0, ec_);
+            done_ = true;
+            net::post(sock_.get_executor(), std::move(self));
+            return;
+        }
+        self.complete(ec_, n_);
+    }
+
+private:
+    Socket& sock_;
+    ConstBufferSequence buffers_;
+    error_code ec_;
+    std::size_t n_ = 0;
+    bool done_ = false;
+};
+
+} // namespace detail
+
+/// A node of a simulated bus, with the operations of `raw::socket` for sending
+/// and receiving frames.
+///
+/// Sent frames are copied to the transmit queue of the socket, and delivered
+/// to every other socket on the bus once they win arbitration and have been
+/// transmitted. A frame is not delivered back to the socket which sent it.
+///
+/// Synchronous operations never block, since the bus runs on the same
+/// `io_context` as the caller: `receive` fails with `would_block` when no
+/// frame is waiting, regardless of the non-blocking mode, and `send` fails
+/// with `no_buffer_space` when the transmit queue is full, like a raw socket
+/// when the interface queue is full.
+///
+/// \notes Sockets are not thread-safe. Pending operations refer to the
+/// socket, which must outlive them.
+class sim::socket : public net::socket_base
+{
+public:
+    /// The type of the executor of the bus.
+    using executor_type = net::io_context::executor_type;
+
+    /// Attaches a socket to a bus.
+    /// \param b The bus. Must outlive the socket.
+    explicit socket(sim::bus& b);
+
+    /// Detaches the socket from the bus, see `close`.
+    ~socket()
+    {
+        close();
+    }
+
+    socket(socket const&) = delete;
+    socket& operator=(socket const&) = delete;
+
+    /// Returns the executor of the bus.
+    executor_type get_executor() noexcept
+    {
+        return executor_;
+    }
+
+    /// Whether the socket is attached to a bus.
+    bool is_open() const noexcept
+    {
+        return bus_ != nullptr;
+    }
+
+    /// Detaches the socket from the bus, discarding queued frames. Pending
+    /// operations complete with `operation_aborted`.
+    void close();
+
+    /// Pending operations complete with `operation_aborted`.
+    void cancel()
+    {
+        abort(read_waiters_);
+        abort(write_waiters_);
+        abort(error_waiters_);
+    }
+
+    /// Sets the non-blocking mode. It has no effect, as operations never
+    /// block, but is accepted for compatibility with `raw::socket`.
+    void non_blocking(bool mode) noexcept
+    {
+        non_blocking_ = mode;
+    }
+
+    /// Returns the non-blocking mode.
+    bool non_blocking() const noexcept
+    {
+        return non_blocking_;
+    }
+
+    /// Limits the transmit queue of the socket to one frame per
+    /// `fd_frame_size` bytes of the buffer size, and at least one frame.
+    void set_option(send_buffer_size const& option) noexcept
+    {
+        tx_limit_ = queue_limit(option.value());
+    }
+
+    /// Limits the receive queue of the socket to one frame per
+    /// `fd_frame_size` bytes of the buffer size, and at least one frame.
+    void set_option(receive_buffer_size const& option) noexcept
+    {
+        rx_limit_ = queue_limit(option.value());
+    }
+
+    /// Returns the size of the next frame waiting to be received, or zero.
+    std::size_t available() const noexcept
+    {
+        return rx_.empty() ? 0 : rx_.front().size;
+    }
+
+    /// Number of frames lost to the receive queue limit or injected loss.
+    std::size_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+    /// Queues a frame for transmission. Throws `system_error` on failure.
+    /// \param buffers A classic or CAN FD frame, starting with a
+    /// `frame_header`.
+    /// \returns The size of the frame.
+    template<class ConstBufferSequence>
+    std::size_t send(ConstBufferSequence const& buffers,
+                     message_flags flags = 0)
+    {
+        error_code ec;
+        auto const n = send(buffers, flags, ec);
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+        return n;
+    }
+
+    /// Queues a frame for transmission.
+    /// \param buffers A classic or CAN FD frame, starting with a
+    /// `frame_header`. Other sizes fail with `invalid_argument`.
+    /// \param ec Set to `no_buffer_space` if the transmit queue is full.
+    /// \returns The size of the frame.
+    template<class ConstBufferSequence>
+    std::size_t send(ConstBufferSequence const& buffers,
+                     message_flags,
+                     error_code& ec)
+    {
+        auto const size = net::buffer_size(buffers);
+        if (size != classic_frame_size && size != fd_frame_size)
+        {
+            ec = net::error::invalid_argument;
+            return 0;
+        }
+        detail::sim_frame f;
+        net::buffer_copy(net::buffer(f.data), buffers);
+        f.size = size;
+        return push(f, ec);
+    }
+
+    /// Receives a frame. Throws `system_error` on failure.
+    /// \returns The size of the frame.
+    template<class MutableBufferSequence>
+    std::size_t receive(MutableBufferSequence const& buffers,
+                        message_flags flags = 0)
+    {
+        error_code ec;
+        auto const n = receive(buffers, flags, ec);
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+        return n;
+    }
+
+    /// Receives a frame. Frames larger than the buffers are truncated.
+    /// \param ec Set to `would_block` if no frame is waiting.
+    /// \returns The number of bytes received.
+    template<class MutableBufferSequence>
+    std::size_t receive(MutableBufferSequence const& buffers,
+                        message_flags,
+                        error_code& ec)
+    {
+        if (!is_open())
+        {
+            ec = net::error::bad_descriptor;
+            return 0;
+        }
+        if (rx_.empty())
+        {
+            ec = net::error::would_block;
+            return 0;
+        }
+        auto const& f = rx_.front();
+        auto const n =
+          net::buffer_copy(buffers, net::buffer(f.data.data(), f.size));
+        rx_.pop_front();
+        ec = {};
+        return n;
+    }
+
+    /// Asynchronously queues a frame for transmission. The completion
+    /// signature is `void(error_code, std::size_t)`.
+    template<class ConstBufferSequence, class CompletionToken>
+    auto async_send(ConstBufferSequence const& buffers,
+                    CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+    {
+        return net::async_compose<CompletionToken,
+                                  void(error_code, std::size_t)>(
+          detail::sim_send_op<socket, ConstBufferSequence>{*this, buffers},
+          token,
+          *this);
+    }
+
+    /// Asynchronously receives a frame, waiting until one arrives. The
+    /// completion signature is `void(error_code, std::size_t)`.
+    template<class MutableBufferSequence, class CompletionToken>
+    auto async_receive(MutableBufferSequence const& buffers,
+                       CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+    {
+        return net::async_compose<CompletionToken,
+                                  void(error_code, std::size_t)>(
+          detail::sim_receive_op<socket, MutableBufferSequence>{*this,
+                                                                 buffers},
+          token,
+          *this);
+    }
+
+    /// Asynchronously waits until a frame can be received (`wait_read`), or
+    /// the transmit queue has room (`wait_write`). The completion signature
+    /// is `void(error_code)`.
+    template<class CompletionToken>
+    auto async_wait(wait_type w, CompletionToken&& token)
+      -> detail::async_return_t<CompletionToken, void(error_code)>
+    {
+        return net::async_compose<CompletionToken, void(error_code)>(
+          detail::sim_wait_op<socket>{*this, w}, token, *this);
+    }
+
+private:
+    friend class sim::bus;
+    template<class Socket>
+    friend class detail::sim_wait_op;
+
+    using waiter_list = std::vector<std::unique_ptr<detail::sim_waiter>>;
+
+    static std::size_t queue_limit(int buffer_size) noexcept
+    {
+        auto const frames = static_cast<std::size_t>(std::max(buffer_size, 0)) /
+                            fd_frame_size;
+        return std::max<std::size_t>(frames, 1);
+    }
+
+    std::size_t push(detail::sim_frame& f, error_code& ec);
+
+    bool ready(wait_type w) const noexcept;
+
+    template<class Handler>
+    void add_waiter(wait_type w, Handler&& handler)
+    {
+        std::unique_ptr<detail::sim_waiter> waiter{
+          new detail::sim_waiter_impl<typename std::decay<Handler>::type>{
+            std::move(handler)}};
+        if (!is_open())
+        {
+            post(std::move(waiter), net::error::bad_descriptor);
+            return;
+        }
+        if (ready(w))
+        {
+            post(std::move(waiter), error_code{});
+            return;
+        }
+        switch (w)
+        {
+            case wait_read:
+                read_waiters_.push_back(std::move(waiter));
+                break;
+            case wait_write:
+                write_waiters_.push_back(std::move(waiter));
+                break;
+            default:
+                error_waiters_.push_back(std::move(waiter));
+                break;
+        }
+    }
+
+    void post(std::unique_ptr<detail::sim_waiter> waiter, error_code ec)
+    {
+        net::post(executor_, detail::sim_wakeup{std::move(waiter), ec});
+    }
+
+    void wake(waiter_list& waiters, error_code ec = {})
+    {
+        for (auto& w : waiters)
+        {
+            post(std::move(w), ec);
+        }
+        waiters.clear();
+    }
+
+    void abort(waiter_list& waiters)
+    {
+        wake(waiters, net::error::operation_aborted);
+    }
+
+    sim::bus* bus_;
+    executor_type executor_;
+    std::deque<detail::sim_frame> tx_;
+    std::deque<detail::sim_frame> rx_;
+    waiter_list read_waiters_;
+    waiter_list write_waiters_;
+    waiter_list error_waiters_;
+    std::size_t tx_limit_;
+    std::size_t rx_limit_;
+    bool non_blocking_ = false;
+    std::size_t dropped_ = 0;
+};
+
+/// A simulated CAN bus, running on an `io_context`.
+///
+/// Whenever the bus is idle and sockets have frames waiting, the frame which
+/// wins arbitration (see `arbitration_key`) among the first frames of every
+/// transmit queue is transmitted. Each socket sends its own frames in the
+/// order they were queued. Transmission takes the time of the frame's bits
+/// on the wire at the configured bit rates, counted by `count_frame_bits`.
+///
+/// By default, time is virtual: the bus advances its clock by the duration
+/// of each frame and delivers frames as fast as the `io_context` runs them,
+/// so results do not depend on the scheduler, and rates far beyond a real bus
+/// can be simulated. In real-time mode, a timer paces transmissions instead.
+///
+/// Errors and loss can be injected with fixed probabilities, drawn from a
+/// generator with a fixed seed, so runs are reproducible. A transmission
+/// error is followed by an error frame and an automatic retransmission, as
+/// on a real bus. Loss removes a frame for a single receiver, like a receive
+/// queue overrun.
+///
+/// \notes The bus is not thread-safe, and must only be used from its
+/// `io_context`. The bus must outlive all sockets attached to it. Handlers of
+/// the bus still pending when it is destroyed do nothing.
+class sim::bus
+{
+public:
+    /// The type of the executor the bus runs on.
+    using executor_type = net::io_context::executor_type;
+
+    /// Configuration of the bus.
+    struct options
+    {
+        /// Bit rates of the bus.
+        bit_timing timing;
+        /// How stuff bits are counted in the duration of frames.
+        stuffing mode = stuffing::exact;
+        /// Whether transmissions are paced by a timer, in real time.
+        bool real_time = false;
+        /// Probability that a transmission fails and is retransmitted.
+        double error_probability = 0.0;
+        /// Probability that a receiver loses a transmitted frame.
+        double loss_probability = 0.0;
+        /// Seed of the generator of errors and loss.
+        std::uint32_t seed = 1;
+        /// Largest number of frames waiting to be sent, per socket, unless
+        /// changed with the `send_buffer_size` option of the socket.
+        std::size_t transmit_queue_limit = 64;
+        /// Largest number of frames waiting to be received, per socket,
+        /// unless changed with the `receive_buffer_size` option.
+        std::size_t receive_queue_limit = 4096;
+        /// Largest number of frames transmitted in virtual time before
+        /// yielding to other handlers.
+        std::size_t batch_size = 64;
+    };
+
+    /// Constructs a bus with the default options.
+    /// \param ioc The `io_context` the bus runs on.
+    explicit bus(net::io_context& ioc)
+      : bus{ioc, options{}}
+    {
+    }
+
+    /// Constructs a bus. Throws `system_error` if a queue limit or the batch
+    /// size is zero, or a probability is not between 0 and 1.
+    /// \param ioc The `io_context` the bus runs on.
+    /// \param opts Configuration of the bus.
+    bus(net::io_context& ioc, options const& opts)
+      : opts_{checked(opts)}
+      , executor_{ioc.get_executor()}
+      , timer_{ioc}
+      , rng_{opts.seed}
+      , error_{opts.error_probability}
+      , loss_{opts.loss_probability}
+      , start_{std::chrono::steady_clock::now()}
+    {
+    }
+
+    bus(bus const&) = delete;
+    bus& operator=(bus const&) = delete;
+
+    ~bus()
+    {
+        timer_.cancel();
+    }
+
+    /// Returns the executor the bus runs on.
+    executor_type get_executor() noexcept
+    {
+        return executor_;
+    }
+
+    /// Time the bus has spent transmitting frames, including error frames.
+    /// In real-time mode, this includes idle periods between frames.
+    std::chrono::nanoseconds elapsed() const noexcept
+    {
+        return time_;
+    }
+
+    /// Number of frames transmitted successfully.
+    std::size_t frames() const noexcept
+    {
+        return frames_;
+    }
+
+    /// Number of injected transmission errors.
+    std::size_t errors() const noexcept
+    {
+        return errors_;
+    }
+
+    /// Number of frames removed for a receiver by injected loss.
+    std::size_t lost() const noexcept
+    {
+        return lost_;
+    }
+
+    /// Number of sockets attached to the bus.
+    std::size_t nodes() const noexcept
+    {
+        return nodes_.size();
+    }
+
+private:
+    friend class sim::socket;
+
+    enum class state
+    {
+        idle,
+        scheduled,
+        transmitting
+    };
+
+    // An error flag, delimiter and intermission, in nominal bits.
+    static constexpr std::uint32_t error_frame_bits = 20;
+
+    static options const& checked(options const& opts)
+    {
+        auto const probability = [](double p) { return p >= 0.0 && p <= 1.0; };
+        if (opts.transmit_queue_limit == 0 || opts.receive_queue_limit == 0 ||
+            opts.batch_size == 0 || !probability(opts.error_probability) ||
+            !probability(opts.loss_probability))
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    void attach(sim::socket* s)
+    {
+        nodes_.push_back(s);
+    }
+
+    void detach(sim::socket* s)
+    {
+        nodes_.erase(std::find(nodes_.begin(), nodes_.end(), s));
+        if (sender_ == s)
+        {
+            sender_ = nullptr;
+        }
+    }
+
+    void schedule()
+    {
+        if (state_ == state::idle)
+        {
+            state_ = state::scheduled;
+            auto const alive = lifetime_.get();
+            net::post(executor_, [this, alive] {
+                if (!alive.expired())
+                {
+                    transmit();
+                }
+            });
+        }
+    }
+
+    // Returns the socket whose first frame wins arbitration, or null.
+    sim::socket* arbitrate() const noexcept
+    {
+        sim::socket* winner = nullptr;
+        for (auto s : nodes_)
+        {
+            if (!s->tx_.empty() &&
+                (!winner || s->tx_.front().key < winner->tx_.front().key))
+            {
+                winner = s;
+            }
+        }
+        return winner;
+    }
+
+    std::chrono::nanoseconds duration(detail::sim_frame const& f) const
+    {
+        auto const bits = count_frame_bits(
+          net::buffer(f.data.data(), f.size), opts_.mode);
+        return frame_duration(bits, opts_.timing);
+    }
+
+    void transmit()
+    {
+        state_ = state::idle;
+        for (std::size_t n = 0; n < opts_.batch_size; ++n)
+        {
+            auto const winner = arbitrate();
+            if (!winner)
+            {
+                return;
+            }
+            auto const d = duration(winner->tx_.front());
+            if (opts_.real_time)
+            {
+                auto const now = std::chrono::steady_clock::now() - start_;
+                time_ = std::max<std::chrono::nanoseconds>(time_, now) + d;
+                sender_ = winner;
+                state_ = state::transmitting;
+                timer_.expires_at(start_ + time_);
+                auto const alive = lifetime_.get();
+                timer_.async_wait([this, alive](error_code ec) {
+                    if (alive.expired() ||
+                        ec == net::error::operation_aborted)
+                    {
+                        return;
+                    }
+                    state_ = state::idle;
+                    if (sender_)
+                    {
+                        finish(*sender_);
+                        sender_ = nullptr;
+                    }
+                    transmit();
+                });
+                return;
+            }
+            time_ += d;
+            finish(*winner);
+        }
+        schedule();
+    }
+
+    // Completes the transmission of the first frame of a socket.
+    void finish(sim::socket& sender)
+    {
+        if (error_.p() > 0.0 && error_(rng_))
+        {
+            // The frame stays queued, and takes part in the next arbitration.
+            ++errors_;
+            frame_bits bits;
+            bits.nominal = error_frame_bits;
+            time_ += frame_duration(bits, opts_.timing);
+            return;
+        }
+
+        auto const was_full = sender.tx_.size() >= sender.tx_limit_;
+        auto const& f = sender.tx_.front();
+        for (auto s : nodes_)
+        {
+            if (s == &sender)
+            {
+                continue;
+            }
+            if (loss_.p() > 0.0 && loss_(rng_))
+            {
+                ++lost_;
+                ++s->dropped_;
+                continue;
+            }
+            if (s->rx_.size() >= s->rx_limit_)
+            {
+                ++s->dropped_;
+                continue;
+            }
+            s->rx_.push_back(f);
+            if (s->rx_.size() == 1)
+            {
+                s->wake(s->read_waiters_);
+            }
+        }
+        sender.tx_.pop_front();
+        ++frames_;
+        if (was_full)
+        {
+            sender.wake(sender.write_waiters_);
+        }
+    }
+
+    options opts_;
+    executor_type executor_;
+    net::steady_timer timer_;
+    std::vector<sim::socket*> nodes_;
+    sim::socket* sender_ = nullptr;
+    state state_ = state::idle;
+    std::mt19937 rng_;
+    std::bernoulli_distribution error_;
+    std::bernoulli_distribution loss_;
+    std::chrono::steady_clock::time_point start_;
+    std::chrono::nanoseconds time_{0};
+    std::size_t frames_ = 0;
+    std::size_t errors_ = 0;
+    std::size_t lost_ = 0;
+    detail::lifetime lifetime_;
+};
+
+inline sim::socket::socket(sim::bus& b)
+  : bus_{&b}
+  , executor_{b.get_executor()}
+  , tx_limit_{b.opts_.transmit_queue_limit}
+  , rx_limit_{b.opts_.receive_queue_limit}
+{
+    b.attach(this);
+}
+
+inline void
+sim::socket::close()
+{
+    if (bus_)
+    {
+        bus_->detach(this);
+        bus_ = nullptr;
+    }
+    tx_.clear();
+    rx_.clear();
+    cancel();
+}
+
+inline std::size_t
+sim::socket::push(detail::sim_frame& f, error_code& ec)
+{
+    if (!is_open())
+    {
+        ec = net::error::bad_descriptor;
+        return 0;
+    }
+    if (tx_.size() >= tx_limit_)
+    {
+        ec = net::error::no_buffer_space;
+        return 0;
+    }
+    frame_header h;
+    std::memcpy(&h, f.data.data(), sizeof(h));
+    f.key = arbitration_key(h);
+    tx_.push_back(f);
+    bus_->schedule();
+    ec = {};
+    return f.size;
+}
+
+inline bool
+sim::socket::ready(wait_type w) const noexcept
+{
+    switch (w)
+    {
+        case wait_read:
+            return !rx_.empty();
+        case wait_write:
+            return tx_.size() < tx_limit_;
+        default:
+            return false;
+    }
+}
+
+} // namespace canary
+
+#endif // CANARY_SIM_HPP
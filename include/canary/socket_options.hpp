@@ -7,8 +7,10 @@
 #ifdef CANARY_HAS_STD_SPAN
 #include <span>
 #endif // CANARY_HAS_STD_SPAN
+#include <chrono>
 #include <cstdint>
 #include <linux/can/raw.h>
+#include <sys/socket.h>
 
 namespace canary
 {
@@ -57,6 +59,139 @@ private:
     int value_;
 };
 
+/// Enables the CAN XL frames socket option (`CAN_RAW_XL_FRAMES`).
+///
+/// Allows a raw CAN socket to send and receive CAN XL frames, with payloads
+/// of up to 2048 bytes, on interfaces whose MTU allows them. Classic frames,
+/// and CAN FD frames if `flexible_data_rate` is enabled too, may still be
+/// received. Requires Linux 6.2 or later.
+class xl_frames
+{
+public:
+    /// Constructs the option object.
+    /// \param value Value of the option. True indicates the XL frame option is
+    /// enabled.
+    explicit xl_frames(bool value = true)
+      : value_{value}
+    {
+    }
+
+    template<class Protocol>
+    static int level(Protocol&& /*p*/)
+    {
+        return SOL_CAN_RAW;
+    }
+
+    template<class Protocol>
+    static int name(Protocol&& /*p*/)
+    {
+        // CAN_RAW_XL_FRAMES, which older kernel headers do not define.
+        return 7;
+    }
+
+    template<class Protocol>
+    void const* data(Protocol&& /*p*/) const
+    {
+        return &value_;
+    }
+
+    template<class Protocol>
+    static std::size_t size(Protocol&& /*p*/)
+    {
+        return sizeof(value_);
+    }
+
+private:
+    int value_;
+};
+
+/// Enables nanosecond reception timestamps (`SO_TIMESTAMPNS`).
+///
+/// When enabled, the kernel records the time at which each frame arrived,
+/// which can be retrieved with `receive_timestamped`.
+class receive_timestamp
+{
+public:
+    /// Constructs the option object.
+    /// \param value Value of the option. True indicates reception timestamps
+    /// are enabled.
+    explicit receive_timestamp(bool value = true)
+      : value_{value}
+    {
+    }
+
+    template<class Protocol>
+    static int level(Protocol&& /*p*/)
+    {
+        return SOL_SOCKET;
+    }
+
+    template<class Protocol>
+    static int name(Protocol&& /*p*/)
+    {
+        return SO_TIMESTAMPNS;
+    }
+
+    template<class Protocol>
+    void const* data(Protocol&& /*p*/) const
+    {
+        return &value_;
+    }
+
+    template<class Protocol>
+    static std::size_t size(Protocol&& /*p*/)
+    {
+        return sizeof(value_);
+    }
+
+private:
+    int value_;
+};
+
+/// Sets the approximate time the kernel may busy poll the device queue when
+/// a receive finds no data (`SO_BUSY_POLL`).
+///
+/// Increasing the value beyond the `net.core.busy_read` system default
+/// requires the `CAP_NET_ADMIN` capability. It only has an effect for devices
+/// whose drivers support busy polling.
+class busy_poll
+{
+public:
+    /// Constructs the option object.
+    /// \param value Busy poll duration. Zero disables busy polling.
+    explicit busy_poll(std::chrono::microseconds value)
+      : value_{static_cast<int>(value.count())}
+    {
+    }
+
+    template<class Protocol>
+    static int level(Protocol&& /*p*/)
+    {
+        return SOL_SOCKET;
+    }
+
+    template<class Protocol>
+    static int name(Protocol&& /*p*/)
+    {
+        return SO_BUSY_POLL;
+    }
+
+    template<class Protocol>
+    void const* data(Protocol&& /*p*/) const
+    {
+        return &value_;
+    }
+
+    template<class Protocol>
+    static std::size_t size(Protocol&& /*p*/)
+    {
+        return sizeof(value_);
+    }
+
+private:
+    int value_;
+};
+
 /// Configures a raw CAN socket to use a disjunction of the filters provided to
 /// the constructor. A frame is accepted if it matches any provided filter.
 class filter_if_any
@@ -0,0 +1,44 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_SRC_HPP
+#define CANARY_SRC_HPP
+
+// Include this file in exactly one translation unit of a program built with
+// CANARY_SEPARATE_COMPILATION defined. It contains the definitions of the
+// non-template functions, and the explicit instantiations matching the extern
+// template declarations in raw.hpp and isotp.hpp. If ASIO is compiled
+// separately as well, its definitions are included here too.
+
+#ifndef CANARY_SEPARATE_COMPILATION
+#error Define CANARY_SEPARATE_COMPILATION to compile canary separately
+#endif // CANARY_SEPARATE_COMPILATION
+
+#ifdef CANARY_STANDALONE_ASIO
+#ifdef ASIO_SEPARATE_COMPILATION
+#include <asio/impl/src.hpp>
+#endif // ASIO_SEPARATE_COMPILATION
+#else
+#ifdef BOOST_ASIO_SEPARATE_COMPILATION
+#include <boost/asio/impl/src.hpp>
+#endif // BOOST_ASIO_SEPARATE_COMPILATION
+#endif // CANARY_STANDALONE_ASIO
+
+#include <canary/impl/interface_index.ipp>
+#include <canary/isotp.hpp>
+#include <canary/raw.hpp>
+
+template class canary::basic_endpoint<canary::raw>;
+template class canary::basic_endpoint<canary::isotp>;
+template class canary::net::basic_socket<canary::raw>;
+template class canary::net::basic_raw_socket<canary::raw>;
+template class canary::net::basic_socket<canary::isotp>;
+template class canary::net::basic_datagram_socket<canary::isotp>;
+
+#endif // CANARY_SRC_HPP
@@ -0,0 +1,265 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_TIMESTAMP_HPP
+#define CANARY_TIMESTAMP_HPP
+
+#include <canary/detail/async.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace canary
+{
+
+/// Time at which the kernel received a frame, measured by the system-wide
+/// realtime clock (`CLOCK_REALTIME`) with nanosecond resolution.
+using timestamp = std::chrono::time_point<std::chrono::system_clock,
+                                          std::chrono::nanoseconds>;
+
+/// Returns the current time of the clock used by reception timestamps.
+inline timestamp
+timestamp_now() noexcept
+{
+    ::timespec ts{};
+    ::clock_gettime(CLOCK_REALTIME, &ts);
+    return timestamp{std::chrono::seconds{ts.tv_sec} +
+                     std::chrono::nanoseconds{ts.tv_nsec}};
+}
+
+namespace detail
+{
+
+constexpr std::size_t max_iov = 16;
+
+template<class MutableBufferSequence>
+std::size_t
+to_iovec(MutableBufferSequence const& buffers, ::iovec (&iov)[max_iov])
+{
+    std::size_t n = 0;
+    auto const end = net::buffer_sequence_end(buffers);
+    for (auto it = net::buffer_sequence_begin(buffers); it != end && n < max_iov;
+         ++it, ++n)
+    {
+        net::mutable_buffer const b{*it};
+        iov[n].iov_base = b.data();
+        iov[n].iov_len = b.size();
+    }
+    return n;
+}
+
+// Extracts the SO_TIMESTAMPNS control message, if present.
+inline timestamp
+find_timestamp(::msghdr& msg) noexcept
+{
+    for (auto* c = CMSG_FIRSTHDR(&msg); c != nullptr; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            ::timespec ts;
+            std::memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return timestamp{std::chrono::seconds{ts.tv_sec} +
+                             std::chrono::nanoseconds{ts.tv_nsec}};
+        }
+    }
+    return timestamp{};
+}
+
+// Makes a single non-blocking attempt to receive a datagram along with its
+// reception timestamp. Fails with `would_block` if no data is available.
+template<class MutableBufferSequence>
+std::size_t
+receive_timestamped_once(int fd,
+                         MutableBufferSequence const& buffers,
+                         int flags,
+                         timestamp& ts,
+                         error_code& ec)
+{
+    ::iovec iov[max_iov];
+    union
+    {
+        ::cmsghdr align;
+        char data[CMSG_SPACE(sizeof(::timespec))];
+    } control;
+
+    ::msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = detail::to_iovec(buffers, iov);
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    ::ssize_t r;
+    do
+    {
+        r = ::recvmsg(fd, &msg, flags | MSG_DONTWAIT);
+    } while (r < 0 && errno == EINTR);
+
+    if (r < 0)
+    {
+        detail::assign_errno(ec);
+        return 0;
+    }
+    ec.clear();
+    ts = detail::find_timestamp(msg);
+    return static_cast<std::size_t>(r);
+}
+
+template<class Socket, class MutableBufferSequence>
+class receive_timestamped_op
+{
+public:
+    receive_timestamped_op(Socket& sock,
+                           MutableBufferSequence const& buffers,
+                           timestamp& ts)
+      : sock_{sock}
+      , buffers_{buffers}
+      , ts_{ts}
+    {
+    }
+
+    template<class Self>
+    void operator()(Self& self, error_code ec = {})
+    {
+        if (state_ == state::done)
+        {
+            self.complete(ec_, n_);
+            return;
+        }
+
+        if (!ec)
+        {
+            n_ = detail::receive_timestamped_once(
+              sock_.native_handle(), buffers_, 0, ts_, ec);
+            if (ec == net::error::would_block)
+            {
+                n_ = 0;
+                state_ = state::waiting;
+                sock_.async_wait(Socket::wait_read, std::move(self));
+                return;
+            }
+        }
+
+        if (state_ == state::starting)
+        {
+            // Completed without waiting, the handler must not be invoked from
+            // within the initiating function.
+            ec_ = ec;
+            state_ = state::done;
+            net::post(sock_.get_executor(), std::move(self));
+            return;
+        }
+        self.complete(ec, n_);
+    }
+
+private:
+    enum class state
+    {
+        starting,
+        waiting,
+        done
+    };
+
+    Socket& sock_;
+    MutableBufferSequence buffers_;
+    timestamp& ts_;
+    error_code ec_;
+    std::size_t n_ = 0;
+    state state_ = state::starting;
+};
+
+} // namespace detail
+
+/// Receives a frame along with the time at which the kernel received it.
+/// \notes Timestamps are only recorded by the kernel if the
+/// `receive_timestamp` option is enabled on the socket, otherwise `ts` is set
+/// to the epoch.
+/// \param sock The socket to receive from.
+/// \param buffers Buffers into which the frame will be received.
+/// \param ts Set to the reception timestamp of the frame.
+/// \param ec Set to indicate what error occurred, if any.
+/// \returns The number of bytes received.
+template<class Socket, class MutableBufferSequence>
+std::size_t
+receive_timestamped(Socket& sock,
+                    MutableBufferSequence const& buffers,
+                    timestamp& ts,
+                    error_code& ec)
+{
+    while (true)
+    {
+        auto const n = detail::receive_timestamped_once(
+          sock.native_handle(), buffers, 0, ts, ec);
+        if (ec != net::error::would_block || sock.non_blocking())
+        {
+            return n;
+        }
+        sock.wait(Socket::wait_read, ec);
+        if (ec)
+        {
+            return 0;
+        }
+    }
+}
+
+/// Receives a frame along with the time at which the kernel received it.
+/// Throws an instance of `system_error` on failure.
+/// \param sock The socket to receive from.
+/// \param buffers Buffers into which the frame will be received.
+/// \param ts Set to the reception timestamp of the frame.
+/// \returns The number of bytes received.
+template<class Socket, class MutableBufferSequence>
+std::size_t
+receive_timestamped(Socket& sock,
+                    MutableBufferSequence const& buffers,
+                    timestamp& ts)
+{
+    error_code ec;
+    auto const n = canary::receive_timestamped(sock, buffers, ts, ec);
+    if (ec)
+    {
+        canary::detail::throw_exception(system_error{ec});
+    }
+    return n;
+}
+
+/// Asynchronously receives a frame along with the time at which the kernel
+/// received it. The completion signature is `void(error_code, std::size_t)`.
+/// \param sock The socket to receive from.
+/// \param buffers Buffers into which the frame will be received. Ownership
+/// is retained by the caller, which must keep them valid until completion.
+/// \param ts Set to the reception timestamp of the frame. Must remain valid
+/// until completion.
+/// \param token The completion token.
+template<class Socket, class MutableBufferSequence, class CompletionToken>
+auto
+async_receive_timestamped(Socket& sock,
+                          MutableBufferSequence const& buffers,
+                          timestamp& ts,
+                          CompletionToken&& token)
+  -> detail::async_return_t<CompletionToken, void(error_code, std::size_t)>
+{
+    return net::async_compose<CompletionToken, void(error_code, std::size_t)>(
+      detail::receive_timestamped_op<Socket, MutableBufferSequence>{
+        sock, buffers, ts},
+      token,
+      sock);
+}
+
+} // namespace canary
+
+#endif // CANARY_TIMESTAMP_HPP
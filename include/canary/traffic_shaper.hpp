@@ -0,0 +1,676 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_TRAFFIC_SHAPER_HPP
+#define CANARY_TRAFFIC_SHAPER_HPP
+
+#include <canary/bus_load.hpp>
+#include <canary/detail/async.hpp>
+#include <canary/detail/id_key.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+namespace canary
+{
+
+/// A token bucket: tokens accumulate at a fixed rate, up to the burst size,
+/// and are taken by each frame which passes.
+///
+/// Tokens are kept in units of 10^-9 tokens, so that refilling by a number
+/// of nanoseconds is exact integer arithmetic. A cost larger than the burst
+/// size is allowed once the bucket is full, which leaves it in debt, so the
+/// long-term rate holds for any cost.
+class token_bucket
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// Constructs a bucket without a limit, which always has tokens.
+    token_bucket() = default;
+
+    /// Constructs a full bucket. Throws `system_error` if the burst size is
+    /// zero or larger than 10^9 tokens while the rate is not zero.
+    /// \param rate Tokens added per second, or 0 for no limit.
+    /// \param burst Largest number of tokens the bucket holds.
+    /// \param now The current time.
+    token_bucket(std::uint64_t rate,
+                 std::uint64_t burst,
+                 clock::time_point now)
+      : rate_{static_cast<std::int64_t>(rate < max_rate ? rate : max_rate)}
+      , capacity_{checked_capacity(rate, burst)}
+      , credit_{capacity_}
+      , last_{now}
+    {
+    }
+
+    /// Whether the bucket limits the rate.
+    bool limited() const noexcept
+    {
+        return rate_ != 0;
+    }
+
+    /// Adds the tokens accumulated since the last refill.
+    /// \param now The current time.
+    void refill(clock::time_point now) noexcept
+    {
+        if (!limited() || now <= last_)
+        {
+            return;
+        }
+        auto const elapsed = (now - last_).count();
+        last_ = now;
+        auto const missing = capacity_ - credit_;
+        if (missing <= 0)
+        {
+            return;
+        }
+        // Avoids overflowing the product below for long idle periods.
+        credit_ = elapsed > missing / rate_ ? capacity_
+                                            : credit_ + elapsed * rate_;
+    }
+
+    /// Whether there are enough tokens for a cost.
+    bool available(std::uint64_t cost) const noexcept
+    {
+        return !limited() || credit_ >= threshold(cost);
+    }
+
+    /// Takes tokens, possibly leaving the bucket in debt.
+    void take(std::uint64_t cost) noexcept
+    {
+        if (limited())
+        {
+            credit_ -= static_cast<std::int64_t>(cost) * scale;
+        }
+    }
+
+    /// Returns the time at which there will be enough tokens for a cost,
+    /// which is the time of the last refill if there already are.
+    clock::time_point ready_at(std::uint64_t cost) const noexcept
+    {
+        auto const need = limited() ? threshold(cost) - credit_ : 0;
+        if (need <= 0)
+        {
+            return last_;
+        }
+        return last_ + std::chrono::nanoseconds{(need + rate_ - 1) / rate_};
+    }
+
+private:
+    static constexpr std::int64_t scale = 1000000000;
+    static constexpr std::uint64_t max_burst = 1000000000;
+    static constexpr std::uint64_t max_rate = 1000000000000;
+
+    static std::int64_t checked_capacity(std::uint64_t rate,
+                                         std::uint64_t burst)
+    {
+        if (rate == 0)
+        {
+            return 0;
+        }
+        if (burst == 0 || burst > max_burst)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return static_cast<std::int64_t>(burst) * scale;
+    }
+
+    std::int64_t threshold(std::uint64_t cost) const noexcept
+    {
+        auto const t =
+          static_cast<std::int64_t>(cost < max_burst ? cost : max_burst) *
+          scale;
+        return t < capacity_ ? t : capacity_;
+    }
+
+    std::int64_t rate_ = 0;
+    std::int64_t capacity_ = 0;
+    std::int64_t credit_ = 0;
+    clock::time_point last_;
+};
+
+/// What happens to frames exceeding a rate limit.
+enum class shaping_policy
+{
+    /// Frames are held back until the limit allows sending them.
+    delay,
+    /// Frames are dropped.
+    drop
+};
+
+/// A limit of the rate of frames and of bits on the wire. A rate of zero
+/// means no limit.
+struct rate_limit
+{
+    /// Frames per second.
+    std::uint64_t frames_per_second = 0;
+    /// Number of frames which may be sent back to back.
+    std::uint64_t frame_burst = 1;
+    /// Bits on the wire per second, estimated by `count_frame_bits`.
+    std::uint64_t bits_per_second = 0;
+    /// Number of bits which may be sent back to back.
+    std::uint64_t bit_burst = 1000;
+    /// What happens to frames exceeding the limit.
+    shaping_policy policy = shaping_policy::delay;
+};
+
+/// The outcome of sending a frame through a traffic shaper.
+enum class shaping_result
+{
+    /// The frame was written to the socket.
+    sent,
+    /// The frame is held back, and will be written from a handler.
+    delayed,
+    /// The frame was dropped.
+    dropped
+};
+
+/// Limits the rate at which frames are written to a socket, per socket and
+/// per CAN ID, with token buckets for frames and for bits on the wire.
+///
+/// A frame within all limits is written immediately, unless frames are
+/// already held back. A frame exceeding a limit whose policy is
+/// `shaping_policy::drop` is dropped. Otherwise, the frame is held back in a
+/// queue per CAN ID, so frames with the same ID keep their order, while a
+/// flooding ID does not delay the others beyond the socket limit. Heads of
+/// the queues are ordered by the time their ID limit allows sending them, and
+/// a single timer is armed for the earliest of them, or for the time the
+/// socket limit allows the next frame.
+///
+/// Tokens are taken when a frame is written. The number of bits is
+/// estimated with `count_frame_bits`, including stuff bits.
+///
+/// \notes The shaper is not thread-safe, frames must be sent from handlers of
+/// the socket's executor (or while it is not running). Handlers still pending
+/// when the shaper is destroyed or cancelled do nothing. The socket is put
+/// into non-blocking mode, and left in it, so that writing a frame never
+/// waits for the socket.
+template<class Socket>
+class basic_traffic_shaper
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// Invoked when the socket fails to send a frame, which is then dropped.
+    using error_handler = std::function<void(error_code, frame_header)>;
+
+    /// Configuration of the shaper.
+    struct options
+    {
+        /// Limit of all frames written to the socket.
+        rate_limit socket_limit;
+        /// Largest number of frames held back. Further frames are dropped.
+        std::size_t queue_limit = 1024;
+        /// Largest number of frames written to the socket before yielding to
+        /// other handlers.
+        std::size_t batch_size = 16;
+        /// How stuff bits are counted in the number of bits on the wire.
+        stuffing mode = stuffing::exact;
+        /// Delay before retrying when the interface transmit queue is full.
+        std::chrono::microseconds retry_interval{100};
+    };
+
+    /// Constructs a shaper without a socket limit.
+    /// \param sock The socket to write to.
+    explicit basic_traffic_shaper(Socket& sock)
+      : basic_traffic_shaper{sock, options{}}
+    {
+    }
+
+    /// Constructs a shaper. Throws `system_error` if a limit is invalid, or
+    /// the queue limit or batch size is zero.
+    /// \param sock The socket to write to.
+    /// \param opts Configuration of the shaper.
+    basic_traffic_shaper(Socket& sock, options const& opts)
+      : sock_{sock}
+      , opts_{checked(opts)}
+      , timer_{sock.get_executor()}
+    {
+        auto const now = clock::now();
+        socket_ = make_buckets(opts_.socket_limit, now);
+        sock_.non_blocking(true);
+    }
+
+    basic_traffic_shaper(basic_traffic_shaper const&) = delete;
+    basic_traffic_shaper& operator=(basic_traffic_shaper const&) = delete;
+
+    ~basic_traffic_shaper()
+    {
+        timer_.cancel();
+    }
+
+    /// Sets the limit of a CAN ID, replacing the previous one. Frames held
+    /// back for the ID stay queued.
+    /// \param id The CAN ID.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    /// \param limit The limit. A default constructed limit removes it.
+    void limit(std::uint32_t id, bool extended, rate_limit const& limit)
+    {
+        auto& s = ids_[detail::id_key(id, extended)];
+        static_cast<buckets&>(s) = make_buckets(limit, clock::now());
+    }
+
+    /// Writes a frame, or holds it back if it exceeds a limit. Throws
+    /// `system_error` if the frame is larger than a CAN FD frame.
+    /// \param frame The frame, starting with a `frame_header`. Copied if it
+    /// is held back.
+    /// \returns What happened to the frame.
+    shaping_result send(net::const_buffer frame)
+    {
+        if (frame.size() < sizeof(frame_header) ||
+            frame.size() > sizeof(entry::data))
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::message_size});
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        auto const k = detail::id_key(h.id(), h.extended_format());
+        auto const bits = count_frame_bits(frame, opts_.mode).total();
+        auto const now = clock::now();
+
+        auto const it = ids_.find(k);
+        auto id_ok = true;
+        if (it != ids_.end())
+        {
+            id_ok = it->second.admits(bits, now);
+            if (!id_ok && it->second.policy == shaping_policy::drop)
+            {
+                ++dropped_;
+                return shaping_result::dropped;
+            }
+        }
+        auto const socket_ok = socket_.admits(bits, now);
+        if (!socket_ok && socket_.policy == shaping_policy::drop)
+        {
+            ++dropped_;
+            return shaping_result::dropped;
+        }
+
+        if (id_ok && socket_ok && pending_ == 0)
+        {
+            error_code ec;
+            sock_.send(frame, 0, ec);
+            if (!ec)
+            {
+                if (it != ids_.end())
+                {
+                    it->second.take(bits);
+                }
+                socket_.take(bits);
+                ++sent_;
+                return shaping_result::sent;
+            }
+            if (ec != net::error::would_block &&
+                ec != net::error::no_buffer_space)
+            {
+                ++errors_;
+                if (on_error_)
+                {
+                    on_error_(ec, h);
+                }
+                return shaping_result::dropped;
+            }
+            // The socket is full: hold the frame back until it drains.
+        }
+
+        if (pending_ >= opts_.queue_limit)
+        {
+            ++dropped_;
+            return shaping_result::dropped;
+        }
+        enqueue(k, frame, bits, now);
+        ++shaped_;
+        return shaping_result::delayed;
+    }
+
+    /// Discards the frames held back. Limits and their tokens are kept.
+    void cancel()
+    {
+        lifetime_.invalidate();
+        timer_.cancel();
+        for (auto it = ids_.begin(); it != ids_.end();)
+        {
+            it->second.queue.clear();
+            it = it->second.limited() ? std::next(it) : ids_.erase(it);
+        }
+        ready_.clear();
+        pending_ = 0;
+        state_ = state::idle;
+    }
+
+    /// Sets the handler invoked when the socket fails to send a frame.
+    void on_error(error_handler handler)
+    {
+        on_error_ = std::move(handler);
+    }
+
+    /// Number of frames held back.
+    std::size_t pending() const noexcept
+    {
+        return pending_;
+    }
+
+    /// Number of frames written to the socket.
+    std::size_t sent() const noexcept
+    {
+        return sent_;
+    }
+
+    /// Number of frames held back, at the time they were sent.
+    std::size_t shaped() const noexcept
+    {
+        return shaped_;
+    }
+
+    /// Number of frames dropped because they exceeded a limit, or the queue
+    /// was full.
+    std::size_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+    /// Number of frames dropped because the socket reported an error.
+    std::size_t errors() const noexcept
+    {
+        return errors_;
+    }
+
+private:
+    struct entry
+    {
+        std::array<unsigned char, fd_frame_size> data;
+        std::size_t size;
+        std::uint64_t bits;
+        std::uint64_t sequence;
+    };
+
+    struct buckets
+    {
+        token_bucket frames;
+        token_bucket bits;
+        shaping_policy policy = shaping_policy::delay;
+
+        bool limited() const noexcept
+        {
+            return frames.limited() || bits.limited();
+        }
+
+        bool admits(std::uint64_t cost, clock::time_point now) noexcept
+        {
+            frames.refill(now);
+            bits.refill(now);
+            return frames.available(1) && bits.available(cost);
+        }
+
+        void take(std::uint64_t cost) noexcept
+        {
+            frames.take(1);
+            bits.take(cost);
+        }
+
+        clock::time_point ready_at(std::uint64_t cost) const noexcept
+        {
+            return std::max(frames.ready_at(1), bits.ready_at(cost));
+        }
+    };
+
+    struct id_state : buckets
+    {
+        std::deque<entry> queue;
+    };
+
+    // The head of a non-empty queue, and when its ID limit allows sending it.
+    struct ready_entry
+    {
+        clock::time_point at;
+        std::uint64_t sequence;
+        std::uint32_t key;
+    };
+
+    enum class state
+    {
+        idle,
+        scheduled,
+        timer,
+        waiting
+    };
+
+    static options const& checked(options const& opts)
+    {
+        if (opts.queue_limit == 0 || opts.batch_size == 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    static buckets make_buckets(rate_limit const& limit,
+                                clock::time_point now)
+    {
+        buckets b;
+        b.frames =
+          token_bucket{limit.frames_per_second, limit.frame_burst, now};
+        b.bits = token_bucket{limit.bits_per_second, limit.bit_burst, now};
+        b.policy = limit.policy;
+        return b;
+    }
+
+    // Orders the ready heap so that its front is the earliest entry.
+    static bool later(ready_entry const& a, ready_entry const& b) noexcept
+    {
+        return a.at != b.at ? a.at > b.at : a.sequence > b.sequence;
+    }
+
+    void enqueue(std::uint32_t k,
+                 net::const_buffer frame,
+                 std::uint64_t bits,
+                 clock::time_point now)
+    {
+        auto& s = ids_[k];
+        s.queue.emplace_back();
+        auto& e = s.queue.back();
+        std::memcpy(e.data.data(), frame.data(), frame.size());
+        e.size = frame.size();
+        e.bits = bits;
+        e.sequence = sequence_++;
+        ++pending_;
+        // Also resumes after an aborted wait for the socket left frames
+        // held back.
+        if (s.queue.size() > 1)
+        {
+            if (state_ == state::idle)
+            {
+                schedule();
+            }
+            return;
+        }
+        auto const at = push_ready(k, s, now);
+        if (state_ == state::idle ||
+            (state_ == state::timer && at < timer_.expiry()))
+        {
+            schedule();
+        }
+    }
+
+    clock::time_point
+    push_ready(std::uint32_t k, id_state& s, clock::time_point now)
+    {
+        s.frames.refill(now);
+        s.bits.refill(now);
+        auto const& e = s.queue.front();
+        auto const at = std::max(now, s.ready_at(e.bits));
+        ready_.push_back(ready_entry{at, e.sequence, k});
+        std::push_heap(ready_.begin(), ready_.end(), later);
+        return at;
+    }
+
+    void schedule()
+    {
+        state_ = state::scheduled;
+        auto const wakeup = ++wakeup_;
+        auto const alive = lifetime_.get();
+        net::post(sock_.get_executor(), [this, alive, wakeup] {
+            resume(alive, wakeup, error_code{});
+        });
+    }
+
+    void wait_until(clock::time_point at)
+    {
+        state_ = state::timer;
+        auto const wakeup = ++wakeup_;
+        auto const alive = lifetime_.get();
+        timer_.expires_at(at);
+        timer_.async_wait([this, alive, wakeup](error_code ec) {
+            resume(alive, wakeup, ec);
+        });
+    }
+
+    // Ignores wakeups superseded by a later call to `schedule` or
+    // `wait_until`, such as a timer rearmed for an earlier frame. An aborted
+    // wait for the socket keeps the frames held back until the next send.
+    void resume(detail::lifetime::token const& alive,
+                std::uint64_t wakeup,
+                error_code ec)
+    {
+        if (alive.expired() || wakeup != wakeup_)
+        {
+            return;
+        }
+        if (ec == net::error::operation_aborted)
+        {
+            state_ = state::idle;
+            return;
+        }
+        drain();
+    }
+
+    void drain()
+    {
+        state_ = state::idle;
+        auto const now = clock::now();
+        for (std::size_t n = 0; n < opts_.batch_size && !ready_.empty(); ++n)
+        {
+            auto const head = ready_.front();
+            if (head.at > now)
+            {
+                wait_until(head.at);
+                return;
+            }
+            auto const it = ids_.find(head.key);
+            auto& s = it->second;
+            auto const& e = s.queue.front();
+            if (!socket_.admits(e.bits, now))
+            {
+                wait_until(socket_.ready_at(e.bits));
+                return;
+            }
+
+            error_code ec;
+            sock_.send(net::buffer(e.data.data(), e.size), 0, ec);
+            if (ec == net::error::would_block)
+            {
+                state_ = state::waiting;
+                auto const wakeup = ++wakeup_;
+                auto const alive = lifetime_.get();
+                sock_.async_wait(Socket::wait_write,
+                                 [this, alive, wakeup](error_code ec) {
+                                     resume(alive, wakeup, ec);
+                                 });
+                return;
+            }
+            if (ec == net::error::no_buffer_space)
+            {
+                // The interface queue is full, and the socket will not
+                // signal when it drains.
+                wait_until(now + opts_.retry_interval);
+                return;
+            }
+
+            frame_header h;
+            std::memcpy(&h, e.data.data(), sizeof(h));
+            if (ec)
+            {
+                ++errors_;
+            }
+            else
+            {
+                s.take(e.bits);
+                socket_.take(e.bits);
+                ++sent_;
+            }
+            std::pop_heap(ready_.begin(), ready_.end(), later);
+            ready_.pop_back();
+            s.queue.pop_front();
+            --pending_;
+            if (!s.queue.empty())
+            {
+                push_ready(head.key, s, now);
+            }
+            else if (!s.limited())
+            {
+                ids_.erase(it);
+            }
+            if (ec && on_error_)
+            {
+                on_error_(ec, h);
+            }
+        }
+
+        if (!ready_.empty() && state_ == state::idle)
+        {
+            schedule();
+        }
+    }
+
+    Socket& sock_;
+    options opts_;
+    net::steady_timer timer_;
+    buckets socket_;
+    std::unordered_map<std::uint32_t, id_state> ids_;
+    std::vector<ready_entry> ready_;
+    state state_ = state::idle;
+    std::uint64_t wakeup_ = 0;
+    std::uint64_t sequence_ = 0;
+    error_handler on_error_;
+    std::size_t pending_ = 0;
+    std::size_t sent_ = 0;
+    std::size_t shaped_ = 0;
+    std::size_t dropped_ = 0;
+    std::size_t errors_ = 0;
+    detail::lifetime lifetime_;
+};
+
+/// A traffic shaper for raw CAN sockets.
+using traffic_shaper = basic_traffic_shaper<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_TRAFFIC_SHAPER_HPP
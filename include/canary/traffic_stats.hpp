@@ -0,0 +1,599 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_TRAFFIC_STATS_HPP
+#define CANARY_TRAFFIC_STATS_HPP
+
+#include <canary/detail/config.hpp>
+#include <canary/detail/id_key.hpp>
+#include <canary/frame.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace canary
+{
+
+/// Statistics of the frames received with one CAN ID on one interface.
+struct id_stats
+{
+    /// The interface the frames were received on.
+    unsigned int interface_index = 0;
+    /// The CAN ID, without flags.
+    std::uint32_t id = 0;
+    /// Whether the ID is an extended (29-bit) ID.
+    bool extended = false;
+    /// Number of frames.
+    std::uint64_t frames = 0;
+    /// Number of frames with each data length code.
+    std::array<std::uint64_t, 16> dlc{};
+    /// The time the first frame was received.
+    timestamp first_seen;
+    /// The time the last frame was received.
+    timestamp last_seen;
+    /// Number of inter-arrival times measured. Frames received earlier than
+    /// the previous frame with the ID are counted, but not measured.
+    std::uint64_t intervals = 0;
+    /// Sum of the inter-arrival times.
+    std::chrono::nanoseconds interval_total{0};
+    /// Shortest inter-arrival time.
+    std::chrono::nanoseconds min_interval{0};
+    /// Longest inter-arrival time.
+    std::chrono::nanoseconds max_interval{0};
+    /// The first inter-arrival time measured. `deviation_sum` and
+    /// `deviation_squares` accumulate the difference of every inter-arrival
+    /// time from it, which keeps the variance exact for periodic IDs.
+    std::chrono::nanoseconds interval_base{0};
+    /// Sum of the deviations of inter-arrival times from `interval_base`.
+    double deviation_sum = 0;
+    /// Sum of the squared deviations of inter-arrival times from
+    /// `interval_base`.
+    double deviation_squares = 0;
+
+    /// Returns the mean inter-arrival time.
+    std::chrono::nanoseconds mean_interval() const noexcept
+    {
+        return intervals == 0
+                 ? std::chrono::nanoseconds{0}
+                 : interval_total / static_cast<std::int64_t>(intervals);
+    }
+
+    /// Returns the jitter, the standard deviation of inter-arrival times.
+    std::chrono::nanoseconds jitter() const noexcept
+    {
+        if (intervals == 0)
+        {
+            return std::chrono::nanoseconds{0};
+        }
+        auto const n = static_cast<double>(intervals);
+        auto const mean = deviation_sum / n;
+        auto const variance = deviation_squares / n - mean * mean;
+        return std::chrono::nanoseconds{static_cast<std::int64_t>(
+          variance > 0 ? std::sqrt(variance) + 0.5 : 0.0)};
+    }
+
+    /// Returns the rate of the ID in frames per second, from the mean
+    /// inter-arrival time.
+    double rate() const noexcept
+    {
+        return interval_total.count() <= 0
+                 ? 0.0
+                 : static_cast<double>(intervals) * 1e9 /
+                     static_cast<double>(interval_total.count());
+    }
+};
+
+/// The statistics of every CAN ID at one point in time, ordered by
+/// interface, then standard before extended IDs, then ID.
+struct traffic_snapshot
+{
+    /// The time the snapshot was taken.
+    timestamp time;
+    /// The statistics of the IDs which received frames.
+    std::vector<id_stats> ids;
+
+    /// Returns the statistics of an ID, or null if it received no frames.
+    /// \param interface_index The interface.
+    /// \param id The CAN ID, without flags.
+    /// \param extended Whether the ID is an extended (29-bit) ID.
+    id_stats const* find(unsigned int interface_index,
+                         std::uint32_t id,
+                         bool extended) const noexcept
+    {
+        auto const key = order_key(interface_index, id, extended);
+        auto const it = std::lower_bound(
+          ids.begin(), ids.end(), key, [](id_stats const& s, std::uint64_t k) {
+              return order_key(s.interface_index, s.id, s.extended) < k;
+          });
+        return it != ids.end() &&
+                   order_key(it->interface_index, it->id, it->extended) == key
+                 ? &*it
+                 : nullptr;
+    }
+
+    /// Returns the total number of frames.
+    std::uint64_t frames() const noexcept
+    {
+        std::uint64_t n = 0;
+        for (auto const& s : ids)
+        {
+            n += s.frames;
+        }
+        return n;
+    }
+
+    /// Returns the activity between an older snapshot of the same
+    /// `traffic_stats` and this one. Counts, the DLC distribution, the mean
+    /// inter-arrival time and the jitter only cover frames received in
+    /// between, IDs without such frames are left out. The first and last
+    /// seen times and the shortest and longest inter-arrival times are those
+    /// of this snapshot.
+    /// \param older The older snapshot.
+    traffic_snapshot since(traffic_snapshot const& older) const
+    {
+        traffic_snapshot d;
+        d.time = time;
+        auto prev = older.ids.begin();
+        for (auto const& s : ids)
+        {
+            auto const key = order_key(s.interface_index, s.id, s.extended);
+            while (prev != older.ids.end() &&
+                   order_key(prev->interface_index, prev->id, prev->extended) <
+                     key)
+            {
+                ++prev;
+            }
+            if (prev == older.ids.end() ||
+                order_key(prev->interface_index, prev->id, prev->extended) !=
+                  key)
+            {
+                d.ids.push_back(s);
+                continue;
+            }
+            if (s.frames == prev->frames)
+            {
+                continue;
+            }
+            auto e = s;
+            e.frames -= prev->frames;
+            for (std::size_t i = 0; i < e.dlc.size(); ++i)
+            {
+                e.dlc[i] -= prev->dlc[i];
+            }
+            e.intervals -= prev->intervals;
+            e.interval_total -= prev->interval_total;
+            e.deviation_sum -= prev->deviation_sum;
+            e.deviation_squares -= prev->deviation_squares;
+            d.ids.push_back(e);
+        }
+        return d;
+    }
+
+private:
+    static std::uint64_t order_key(unsigned int interface_index,
+                                   std::uint32_t id,
+                                   bool extended) noexcept
+    {
+        return std::uint64_t{interface_index} << 32 |
+               (extended ? detail::extended_key_flag : 0U) | (id & 0x1FFFFFFFU);
+    }
+};
+
+/// Collects statistics of the frames received with every CAN ID on every
+/// interface: counts, inter-arrival times and their jitter, the distribution
+/// of data length codes and the time each ID was last seen.
+///
+/// Frames are added one at a time, e.g. from a receive loop, with their
+/// reception timestamps. Each frame updates the entry of its ID in O(1),
+/// without allocation or locks: entries live in a flat open-addressing hash
+/// table of `options::capacity` entries, allocated on construction. IDs
+/// which do not fit in the table are not tracked and are counted by
+/// `overflows`. For short probe sequences, the capacity should be about
+/// twice the number of IDs expected.
+///
+/// `snapshot` copies the statistics for reporting, and
+/// `traffic_snapshot::since` turns two snapshots into the activity between
+/// them.
+///
+/// \notes The statistics are not thread-safe. Snapshots must be taken by the
+/// thread adding frames, e.g. from a handler of the receiving socket's
+/// executor, as `traffic_reporter` does.
+class traffic_stats
+{
+public:
+    /// Configuration of the statistics.
+    struct options
+    {
+        /// Largest number of distinct IDs over all interfaces, a power of
+        /// two.
+        std::size_t capacity = 4096;
+    };
+
+    /// Constructs statistics with the default options.
+    traffic_stats()
+      : traffic_stats{options{}}
+    {
+    }
+
+    /// Constructs statistics. Throws `system_error` if the capacity is not a
+    /// power of two.
+    /// \param opts Configuration of the statistics.
+    explicit traffic_stats(options const& opts)
+      : entries_{new entry[checked(opts).capacity]}
+      , mask_{opts.capacity - 1}
+    {
+    }
+
+    traffic_stats(traffic_stats const&) = delete;
+    traffic_stats& operator=(traffic_stats const&) = delete;
+
+    /// Adds a frame.
+    /// \param frame A classic or CAN FD frame, as received from a raw socket.
+    /// \param time The time the frame was received.
+    /// \param interface_index The interface the frame was received on.
+    /// \returns Whether the frame was added. Error frames, frames of other
+    /// sizes and IDs which do not fit in the table are not.
+    bool add(net::const_buffer frame,
+             timestamp time,
+             unsigned int interface_index = 0) noexcept
+    {
+        if (frame.size() != classic_frame_size &&
+            frame.size() != fd_frame_size)
+        {
+            return false;
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        if (h.error())
+        {
+            return false;
+        }
+        auto const e = insert(key_of(interface_index, h));
+        if (e == nullptr)
+        {
+            ++overflows_;
+            return false;
+        }
+
+        auto const t = time.time_since_epoch().count();
+        if (e->frames++ == 0)
+        {
+            e->first = t;
+            e->last = t;
+        }
+        else if (t >= e->last)
+        {
+            auto const interval = t - e->last;
+            e->last = t;
+            if (e->intervals++ == 0)
+            {
+                e->base = interval;
+                e->min = interval;
+                e->max = interval;
+            }
+            else
+            {
+                e->min = interval < e->min ? interval : e->min;
+                e->max = interval > e->max ? interval : e->max;
+            }
+            auto const d = static_cast<double>(interval - e->base);
+            e->deviation_sum += d;
+            e->deviation_squares += d * d;
+        }
+        ++e->dlc[length_to_dlc(h.payload_length())];
+        return true;
+    }
+
+    /// Copies the statistics of every ID which received frames.
+    /// \param now The time of the snapshot.
+    traffic_snapshot snapshot(timestamp now = timestamp_now()) const
+    {
+        std::vector<entry const*> used;
+        used.reserve(size_);
+        for (std::size_t i = 0; i <= mask_; ++i)
+        {
+            if (entries_[i].frames != 0)
+            {
+                used.push_back(&entries_[i]);
+            }
+        }
+        std::sort(
+          used.begin(), used.end(), [](entry const* a, entry const* b) {
+              return a->key < b->key;
+          });
+
+        traffic_snapshot s;
+        s.time = now;
+        s.ids.reserve(used.size());
+        for (auto e : used)
+        {
+            id_stats st;
+            st.interface_index = static_cast<unsigned int>(e->key >> 32);
+            auto const k = static_cast<std::uint32_t>(e->key);
+            st.id = detail::key_id(k);
+            st.extended = detail::key_extended(k);
+            st.frames = e->frames;
+            std::copy(e->dlc, e->dlc + 16, st.dlc.begin());
+            st.first_seen = timestamp{std::chrono::nanoseconds{e->first}};
+            st.last_seen = timestamp{std::chrono::nanoseconds{e->last}};
+            st.intervals = e->intervals;
+            st.interval_total = std::chrono::nanoseconds{e->last - e->first};
+            st.min_interval = std::chrono::nanoseconds{e->min};
+            st.max_interval = std::chrono::nanoseconds{e->max};
+            st.interval_base = std::chrono::nanoseconds{e->base};
+            st.deviation_sum = e->deviation_sum;
+            st.deviation_squares = e->deviation_squares;
+            s.ids.push_back(st);
+        }
+        return s;
+    }
+
+    /// Forgets every ID.
+    void clear() noexcept
+    {
+        std::fill(entries_.get(), entries_.get() + mask_ + 1, entry{});
+        size_ = 0;
+        overflows_ = 0;
+    }
+
+    /// Number of distinct IDs.
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    /// Number of frames not added because the table was full.
+    std::size_t overflows() const noexcept
+    {
+        return overflows_;
+    }
+
+private:
+    // The fields updated by every frame come first, the entry is free while
+    // `frames` is 0. Times are in nanoseconds since the epoch.
+    struct entry
+    {
+        std::uint64_t key = 0;
+        std::uint64_t frames = 0;
+        std::int64_t last = 0;
+        std::uint64_t intervals = 0;
+        std::int64_t min = 0;
+        std::int64_t max = 0;
+        std::int64_t base = 0;
+        double deviation_sum = 0;
+        double deviation_squares = 0;
+        std::uint64_t dlc[16] = {};
+        std::int64_t first = 0;
+    };
+
+    static options const& checked(options const& opts)
+    {
+        auto const n = opts.capacity;
+        if (n == 0 || (n & (n - 1)) != 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    static std::uint64_t key_of(unsigned int interface_index,
+                                frame_header const& h) noexcept
+    {
+        return std::uint64_t{interface_index} << 32 |
+               detail::id_key(h.id(), h.extended_format());
+    }
+
+    entry* insert(std::uint64_t key) noexcept
+    {
+        auto i = detail::key_slot(key, mask_);
+        for (std::size_t n = 0; n <= mask_; ++n)
+        {
+            auto& e = entries_[i];
+            if (e.frames == 0)
+            {
+                e.key = key;
+                ++size_;
+                return &e;
+            }
+            if (e.key == key)
+            {
+                return &e;
+            }
+            i = detail::next_slot(i, mask_);
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<entry[]> entries_;
+    std::size_t mask_;
+    std::size_t size_ = 0;
+    std::size_t overflows_ = 0;
+};
+
+/// Writes a snapshot in a line-oriented text format, compatible with the
+/// Prometheus exposition format. Every line is labelled with the interface
+/// index, the ID in hexadecimal and whether it is extended. Metric names are
+/// prefixed with `canary_id_`.
+/// \param os The output stream.
+/// \param s The snapshot, e.g. the activity of the last reporting interval.
+/// \param labels Labels added to every line, e.g. `host="gw1"`.
+inline void
+write_text(std::ostream& os,
+           traffic_snapshot const& s,
+           std::string const& labels = {})
+{
+    static char const digits[] = "0123456789abcdef";
+    auto const sep = labels.empty() ? "" : ",";
+    for (auto const& e : s.ids)
+    {
+        std::string id = "0x";
+        for (int shift = e.extended ? 28 : 8; shift >= 0; shift -= 4)
+        {
+            id += digits[(e.id >> shift) & 0xF];
+        }
+        auto const l = "{" + labels + sep + "interface=\"" +
+                       std::to_string(e.interface_index) + "\",id=\"" + id +
+                       "\",extended=\"" + (e.extended ? "1" : "0") + "\"";
+        os << "canary_id_frames_total" << l << "} " << e.frames << '\n'
+           << "canary_id_rate_hz" << l << "} " << e.rate() << '\n'
+           << "canary_id_interval_min_ns" << l << "} "
+           << e.min_interval.count() << '\n'
+           << "canary_id_interval_mean_ns" << l << "} "
+           << e.mean_interval().count() << '\n'
+           << "canary_id_interval_max_ns" << l << "} "
+           << e.max_interval.count() << '\n'
+           << "canary_id_jitter_ns" << l << "} " << e.jitter().count() << '\n'
+           << "canary_id_last_seen_ns" << l << "} "
+           << e.last_seen.time_since_epoch().count() << '\n';
+        for (std::size_t i = 0; i < e.dlc.size(); ++i)
+        {
+            if (e.dlc[i] != 0)
+            {
+                os << "canary_id_dlc_frames_total" << l << ",dlc=\"" << i
+                   << "\"} " << e.dlc[i] << '\n';
+            }
+        }
+    }
+}
+
+/// Periodically reports the activity of `traffic_stats`: every interval, the
+/// handler is invoked with the statistics of the frames added since the
+/// previous report, as computed by `traffic_snapshot::since`.
+///
+/// \notes Snapshots are taken from handlers of the reporter's executor, which
+/// must be the one frames are added from. Pending operations refer to the
+/// reporter, which must outlive them.
+class traffic_reporter
+{
+public:
+    /// Invoked with the activity of each interval.
+    using handler_type = std::function<void(traffic_snapshot const&)>;
+
+    /// Configuration of the reporter.
+    struct options
+    {
+        /// Time between reports.
+        std::chrono::nanoseconds interval = std::chrono::seconds{1};
+    };
+
+    /// Constructs a reporter which reports every second.
+    /// \param ex The executor or execution context of the timer.
+    /// \param stats The statistics to report.
+    template<class ExecutorOrContext>
+    traffic_reporter(ExecutorOrContext&& ex, traffic_stats& stats)
+      : traffic_reporter{std::forward<ExecutorOrContext>(ex), stats, options{}}
+    {
+    }
+
+    /// Constructs a reporter. Throws `system_error` if the interval is not
+    /// positive.
+    /// \param ex The executor or execution context of the timer.
+    /// \param stats The statistics to report.
+    /// \param opts Configuration of the reporter.
+    template<class ExecutorOrContext>
+    traffic_reporter(ExecutorOrContext&& ex,
+                     traffic_stats& stats,
+                     options const& opts)
+      : stats_{stats}
+      , opts_{checked(opts)}
+      , timer_{std::forward<ExecutorOrContext>(ex)}
+    {
+    }
+
+    traffic_reporter(traffic_reporter const&) = delete;
+    traffic_reporter& operator=(traffic_reporter const&) = delete;
+
+    /// Starts reporting, replacing the handler of a previous start. The
+    /// first report covers the frames added after this call.
+    /// \param handler The handler invoked with every report.
+    void start(handler_type handler)
+    {
+        handler_ = std::move(handler);
+        previous_ = stats_.snapshot();
+        timer_.expires_after(opts_.interval);
+        wait(++generation_);
+    }
+
+    /// Stops reporting. The handler is not invoked again until the next
+    /// `start`.
+    void stop()
+    {
+        ++generation_;
+        timer_.cancel();
+    }
+
+    /// Returns the snapshot the next report will be relative to.
+    traffic_snapshot const& previous() const noexcept
+    {
+        return previous_;
+    }
+
+private:
+    static options const& checked(options const& opts)
+    {
+        if (opts.interval.count() <= 0)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    void wait(std::size_t generation)
+    {
+        timer_.async_wait([this, generation](error_code ec) {
+            if (ec || generation != generation_)
+            {
+                return;
+            }
+            auto current = stats_.snapshot();
+            auto const report = current.since(previous_);
+            previous_ = std::move(current);
+            // Deadlines advance by whole intervals, so reports do not drift.
+            timer_.expires_at(timer_.expiry() + opts_.interval);
+            wait(generation);
+            // The handler may restart the reporter, replacing itself.
+            auto const handler = handler_;
+            handler(report);
+        });
+    }
+
+    traffic_stats& stats_;
+    options opts_;
+    net::steady_timer timer_;
+    handler_type handler_;
+    traffic_snapshot previous_;
+    std::size_t generation_ = 0;
+};
+
+} // namespace canary
+
+#endif // CANARY_TRAFFIC_STATS_HPP
@@ -0,0 +1,419 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_TX_SCHEDULER_HPP
+#define CANARY_TX_SCHEDULER_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/metrics.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace canary
+{
+
+/// Returns a key which orders frames the way bus arbitration does: a frame
+/// with a lower key wins arbitration against a frame with a higher key.
+///
+/// The base (11-bit) identifier is compared first. With equal base
+/// identifiers, a standard data frame beats a standard remote frame, which
+/// beats any extended frame, and extended frames are then compared by the
+/// remaining 18 bits of the identifier, data before remote.
+inline std::uint32_t
+arbitration_key(frame_header const& h) noexcept
+{
+    auto const rtr = h.remote_transmission() ? 1u : 0u;
+    if (!h.extended_format())
+    {
+        return (h.id() & 0x7FFu) << 21 | rtr << 20;
+    }
+    auto const id = h.id();
+    // The SRR and IDE bits of extended frames are recessive.
+    return (id >> 18) << 21 | 1u << 20 | 1u << 19 | (id & 0x3FFFFu) << 1 | rtr;
+}
+
+/// A point-in-time copy of the metrics of a transmit scheduler.
+struct tx_scheduler_metrics_snapshot
+{
+    /// Number of frames waiting in the scheduler.
+    std::uint64_t queue_depth = 0;
+    /// Largest number of frames which have been waiting at once.
+    std::uint64_t max_queue_depth = 0;
+    /// Frames handed to the socket.
+    std::uint64_t frames_sent = 0;
+    /// Frames whose payload was replaced by a newer payload for the same ID
+    /// before being sent.
+    std::uint64_t replaced = 0;
+    /// Frames dropped because the socket reported an error.
+    std::uint64_t errors = 0;
+    /// Times the scheduler had to wait for the socket to become writable, or
+    /// for the interface transmit queue to drain.
+    std::uint64_t waits = 0;
+    /// Time from queueing to sending, per priority class.
+    std::vector<histogram_snapshot> latency;
+};
+
+/// Writes transmit scheduler metrics in a line-oriented text format,
+/// compatible with the Prometheus exposition format. Metric names are
+/// prefixed with `canary_tx_`, latencies are labeled by priority class.
+/// \param os The output stream.
+/// \param s The metrics snapshot.
+/// \param labels Labels added to every line, e.g. `socket="vcan0"`.
+inline void
+write_text(std::ostream& os,
+           tx_scheduler_metrics_snapshot const& s,
+           std::string const& labels = {})
+{
+    auto const braces = labels.empty() ? std::string{} : "{" + labels + "}";
+    os << "canary_tx_queue_depth" << braces << ' ' << s.queue_depth << '\n'
+       << "canary_tx_queue_depth_max" << braces << ' ' << s.max_queue_depth
+       << '\n'
+       << "canary_tx_frames_sent_total" << braces << ' ' << s.frames_sent
+       << '\n'
+       << "canary_tx_replaced_total" << braces << ' ' << s.replaced << '\n'
+       << "canary_tx_errors_total" << braces << ' ' << s.errors << '\n'
+       << "canary_tx_waits_total" << braces << ' ' << s.waits << '\n';
+    for (std::size_t c = 0; c < s.latency.size(); ++c)
+    {
+        auto const class_label =
+          (labels.empty() ? "" : labels + ",") + "class=\"" +
+          std::to_string(c) + "\"";
+        canary::write_text(
+          os, "canary_tx_queue_latency_ns", s.latency[c], class_label);
+    }
+}
+
+/// Queues frames for transmission and writes them to a socket in bus
+/// arbitration order, rather than in the order they were queued.
+///
+/// When frames are queued faster than the bus can carry them, the kernel
+/// transmit queue delivers them in FIFO order, so a burst of low priority
+/// frames delays high priority frames queued after it. The scheduler keeps
+/// pending frames ordered by `arbitration_key`, optionally replacing the
+/// payload of a frame which is still waiting when a newer one for the same ID
+/// is queued, and writes them to the socket in batches, as long as the socket
+/// accepts them without blocking. To keep the kernel queue, which is still
+/// FIFO, short, the socket send buffer should be small (see
+/// `options::send_buffer_size`), so that the socket stops being writable
+/// after a few frames.
+///
+/// Frames are classified into priority classes by their base (11-bit)
+/// identifier, and the time each frame spends in the scheduler is recorded
+/// per class.
+///
+/// \notes The scheduler is not thread-safe, frames must be queued from
+/// handlers of the socket's executor (or while it is not running). Handlers
+/// still pending when the scheduler is destroyed or cancelled do nothing.
+/// The socket is put into non-blocking mode and left in it: on a blocking
+/// socket, a synchronous send waits for the socket to become writable, even
+/// with `MSG_DONTWAIT`.
+template<class Socket>
+class basic_tx_scheduler
+{
+public:
+    /// Invoked when the socket fails to send a frame, which is then dropped.
+    using error_handler = std::function<void(error_code, frame_header)>;
+
+    /// Configuration of the scheduler.
+    struct options
+    {
+        /// Whether a queued frame replaces a frame with the same ID which is
+        /// still waiting. Otherwise, frames with the same ID are sent in the
+        /// order they were queued.
+        bool replace_stale = true;
+        /// Largest number of frames written to the socket before yielding to
+        /// other handlers.
+        std::size_t batch_size = 16;
+        /// If positive, the send buffer size of the socket is set to this
+        /// value, limiting the number of frames queued in the kernel.
+        int send_buffer_size = 0;
+        /// Delay before retrying when the interface transmit queue is full.
+        std::chrono::microseconds retry_interval{100};
+        /// Upper bounds (exclusive) of the base identifiers of all but the
+        /// last priority class, in increasing order.
+        std::vector<std::uint32_t> class_bounds{0x100, 0x400};
+    };
+
+    /// Constructs a scheduler with the default options.
+    /// \param sock The socket to write to.
+    explicit basic_tx_scheduler(Socket& sock)
+      : basic_tx_scheduler{sock, options{}}
+    {
+    }
+
+    /// Constructs a scheduler.
+    /// \param sock The socket to write to.
+    /// \param opts Configuration of the scheduler.
+    basic_tx_scheduler(Socket& sock, options opts)
+      : sock_{sock}
+      , opts_{std::move(opts)}
+      , timer_{sock.get_executor()}
+      , latency_{new latency_histogram[opts_.class_bounds.size() + 1]}
+    {
+        sock_.non_blocking(true);
+        if (opts_.send_buffer_size > 0)
+        {
+            sock_.set_option(
+              net::socket_base::send_buffer_size{opts_.send_buffer_size});
+        }
+    }
+
+    /// Destroys the scheduler, discarding the frames still waiting.
+    ~basic_tx_scheduler()
+    {
+        timer_.cancel();
+    }
+
+    basic_tx_scheduler(basic_tx_scheduler const&) = delete;
+    basic_tx_scheduler& operator=(basic_tx_scheduler const&) = delete;
+
+    /// Queues a frame. It is written to the socket from a handler, after all
+    /// frames which win arbitration against it. Throws `system_error` if the
+    /// frame is larger than a CAN FD frame.
+    /// \param frame The frame, starting with a `frame_header`. Copied.
+    void send(net::const_buffer frame)
+    {
+        if (frame.size() < sizeof(frame_header) ||
+            frame.size() > sizeof(entry::data))
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::message_size});
+        }
+        frame_header h;
+        std::memcpy(&h, frame.data(), sizeof(h));
+        auto const key = arbitration_key(h);
+
+        auto it = queue_.end();
+        if (opts_.replace_stale)
+        {
+            it = queue_.find(key);
+        }
+        if (it != queue_.end())
+        {
+            metrics_.replaced.add();
+        }
+        else
+        {
+            it = queue_.emplace(key, entry{});
+            metrics_.depth.set(queue_.size());
+            metrics_.max_depth.set_max(queue_.size());
+        }
+        std::memcpy(it->second.data.data(), frame.data(), frame.size());
+        it->second.size = frame.size();
+        it->second.queued = std::chrono::steady_clock::now();
+
+        if (state_ == state::idle)
+        {
+            schedule();
+        }
+    }
+
+    /// Discards the frames waiting to be written, and abandons the pending
+    /// wait for the socket, if any. Frames already written to the socket are
+    /// not affected.
+    void cancel()
+    {
+        lifetime_.invalidate();
+        timer_.cancel();
+        queue_.clear();
+        metrics_.depth.set(0);
+        state_ = state::idle;
+    }
+
+    /// Sets the handler invoked when the socket fails to send a frame.
+    void on_error(error_handler handler)
+    {
+        on_error_ = std::move(handler);
+    }
+
+    /// Number of frames waiting to be written.
+    std::size_t size() const noexcept
+    {
+        return queue_.size();
+    }
+
+    /// Returns the priority class of a frame.
+    std::size_t priority_class(frame_header const& h) const noexcept
+    {
+        auto const base = arbitration_key(h) >> 21;
+        std::size_t c = 0;
+        while (c < opts_.class_bounds.size() && base >= opts_.class_bounds[c])
+        {
+            ++c;
+        }
+        return c;
+    }
+
+    /// Copies the current state of all metrics.
+    tx_scheduler_metrics_snapshot metrics() const
+    {
+        tx_scheduler_metrics_snapshot s;
+        s.queue_depth = metrics_.depth.load();
+        s.max_queue_depth = metrics_.max_depth.load();
+        s.frames_sent = metrics_.frames_sent.load();
+        s.replaced = metrics_.replaced.load();
+        s.errors = metrics_.errors.load();
+        s.waits = metrics_.waits.load();
+        for (std::size_t c = 0; c <= opts_.class_bounds.size(); ++c)
+        {
+            s.latency.push_back(latency_[c].snapshot());
+        }
+        return s;
+    }
+
+private:
+    struct entry
+    {
+        std::array<unsigned char, 72> data;
+        std::size_t size;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    enum class state
+    {
+        idle,
+        scheduled,
+        waiting
+    };
+
+    void drain()
+    {
+        for (std::size_t n = 0; n < opts_.batch_size && !queue_.empty(); ++n)
+        {
+            auto const it = queue_.begin();
+            error_code ec;
+            sock_.send(net::buffer(it->second.data.data(), it->second.size),
+                       0,
+                       ec);
+            if (ec == net::error::would_block)
+            {
+                metrics_.waits.add();
+                state_ = state::waiting;
+                auto const alive = lifetime_.get();
+                sock_.async_wait(Socket::wait_write,
+                                 [this, alive](error_code ec) {
+                                     resume(alive, ec);
+                                 });
+                return;
+            }
+            if (ec == net::error::no_buffer_space)
+            {
+                // The interface queue is full, and the socket will not
+                // signal when it drains.
+                metrics_.waits.add();
+                state_ = state::waiting;
+                timer_.expires_after(opts_.retry_interval);
+                auto const alive = lifetime_.get();
+                timer_.async_wait(
+                  [this, alive](error_code ec) { resume(alive, ec); });
+                return;
+            }
+
+            frame_header h;
+            std::memcpy(&h, it->second.data.data(), sizeof(h));
+            if (ec)
+            {
+                metrics_.errors.add();
+            }
+            else
+            {
+                metrics_.frames_sent.add();
+                latency_[priority_class(h)].record(
+                  std::chrono::steady_clock::now() - it->second.queued);
+            }
+            queue_.erase(it);
+            metrics_.depth.set(queue_.size());
+            if (ec && on_error_)
+            {
+                on_error_(ec, h);
+            }
+        }
+
+        if (queue_.empty())
+        {
+            state_ = state::idle;
+            return;
+        }
+        schedule();
+    }
+
+    void schedule()
+    {
+        state_ = state::scheduled;
+        auto const alive = lifetime_.get();
+        net::post(sock_.get_executor(), [this, alive] {
+            if (!alive.expired())
+            {
+                drain();
+            }
+        });
+    }
+
+    // Continues after a wait for the socket or the retry timer. A wait
+    // aborted by closing or cancelling the socket leaves the frames queued,
+    // until the next `send`.
+    void resume(detail::lifetime::token const& alive, error_code ec)
+    {
+        if (alive.expired())
+        {
+            return;
+        }
+        if (ec == net::error::operation_aborted)
+        {
+            state_ = state::idle;
+            return;
+        }
+        drain();
+    }
+
+    struct scheduler_metrics
+    {
+        gauge depth;
+        gauge max_depth;
+        counter frames_sent;
+        counter replaced;
+        counter errors;
+        counter waits;
+    };
+
+    Socket& sock_;
+    options opts_;
+    net::steady_timer timer_;
+    std::multimap<std::uint32_t, entry> queue_;
+    state state_ = state::idle;
+    error_handler on_error_;
+    scheduler_metrics metrics_;
+    std::unique_ptr<latency_histogram[]> latency_;
+    detail::lifetime lifetime_;
+};
+
+/// A transmit scheduler for raw CAN sockets.
+using tx_scheduler = basic_tx_scheduler<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_TX_SCHEDULER_HPP
@@ -0,0 +1,468 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_UDP_TUNNEL_HPP
+#define CANARY_UDP_TUNNEL_HPP
+
+#include <canary/cannelloni.hpp>
+#include <canary/detail/async.hpp>
+#include <canary/frame.hpp>
+#include <canary/raw.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/ip/udp.hpp>
+#include <asio/steady_timer.hpp>
+#else
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <utility>
+#include <vector>
+
+namespace canary
+{
+
+/// Tunnels CAN frames over UDP, in the wire format of cannelloni, so that
+/// either end may be a cannelloni instance.
+///
+/// Frames received from the CAN socket are packed into datagrams, each
+/// holding as many frames as fit into `options::max_datagram_size` bytes. A
+/// datagram is sent once it is full, or once `options::flush_timeout` has
+/// passed since its first frame was received, whichever comes first. Frames
+/// received from the CAN socket at once are read with a single `recvmmsg`
+/// call, and the datagrams they fill are sent with a single `sendmmsg` call.
+///
+/// In the other direction, datagrams received at once are read with a single
+/// `recvmmsg` call, and their frames are written to the CAN socket with
+/// `sendmmsg`. Frames the CAN socket does not accept, e.g. because the
+/// transmit queue of its interface is full, are dropped and counted.
+/// Datagrams which are not valid cannelloni data datagrams are ignored and
+/// counted.
+///
+/// \notes The UDP socket must be connected to the peer. A raw CAN socket must
+/// have `flexible_data_rate` enabled to tunnel CAN FD frames. The tunnel is
+/// not thread-safe. It refers to its sockets, which must outlive it, and
+/// pending operations refer to the tunnel, which must outlive them.
+template<class Socket>
+class basic_udp_tunnel
+{
+public:
+    /// Configuration of the tunnel.
+    struct options
+    {
+        /// Largest size of a sent or received datagram, by default the
+        /// largest UDP payload which fits into an Ethernet frame.
+        std::size_t max_datagram_size = 1472;
+        /// Longest time a frame waits for its datagram to fill up. Zero sends
+        /// a datagram after every batch of frames received from the CAN
+        /// socket.
+        std::chrono::microseconds flush_timeout{1000};
+        /// Largest number of frames, or datagrams, read with one system
+        /// call.
+        std::size_t batch_size = 32;
+    };
+
+    /// Constructs a tunnel with the default options.
+    /// \param can The CAN socket.
+    /// \param udp The UDP socket, connected to the peer.
+    basic_udp_tunnel(Socket& can, net::ip::udp::socket& udp)
+      : basic_udp_tunnel{can, udp, options{}}
+    {
+    }
+
+    /// Constructs a tunnel. Throws `system_error` if the batch size is zero,
+    /// or the largest datagram cannot hold a CAN FD frame.
+    /// \param can The CAN socket.
+    /// \param udp The UDP socket, connected to the peer.
+    /// \param opts Configuration of the tunnel.
+    basic_udp_tunnel(Socket& can,
+                     net::ip::udp::socket& udp,
+                     options const& opts)
+      : can_{can}
+      , udp_{udp}
+      , opts_{checked(opts)}
+      , timer_{can.get_executor()}
+      , can_frames_(opts.batch_size * slot_units)
+      , can_iovs_(opts.batch_size)
+      , can_msgs_(opts.batch_size)
+      , out_(opts.batch_size, std::vector<std::uint8_t>(opts.max_datagram_size))
+      , out_sizes_(opts.batch_size)
+      , out_frames_(opts.batch_size)
+      , out_iovs_(opts.batch_size)
+      , out_msgs_(opts.batch_size)
+      , writer_{net::buffer(out_.front())}
+      , in_(opts.batch_size, std::vector<std::uint8_t>(opts.max_datagram_size))
+      , in_iovs_(opts.batch_size)
+      , in_msgs_(opts.batch_size)
+      , decoded_(opts.batch_size * slot_units)
+      , decoded_iovs_(opts.batch_size)
+      , decoded_msgs_(opts.batch_size)
+    {
+        for (std::size_t i = 0; i < opts.batch_size; ++i)
+        {
+            setup(can_msgs_[i],
+                  can_iovs_[i],
+                  slot(can_frames_, i),
+                  fd_frame_size);
+            setup(in_msgs_[i], in_iovs_[i], in_[i].data(), in_[i].size());
+            setup(decoded_msgs_[i],
+                  decoded_iovs_[i],
+                  slot(decoded_, i),
+                  fd_frame_size);
+            setup(out_msgs_[i], out_iovs_[i], nullptr, 0);
+        }
+    }
+
+    basic_udp_tunnel(basic_udp_tunnel const&) = delete;
+    basic_udp_tunnel& operator=(basic_udp_tunnel const&) = delete;
+
+    /// Starts tunneling in both directions.
+    void start()
+    {
+        running_ = true;
+        wait_can();
+        wait_udp();
+    }
+
+    /// Stops tunneling, after sending the frames waiting for their datagram
+    /// to fill up. Cancels all asynchronous operations on both sockets.
+    void stop()
+    {
+        running_ = false;
+        ++generation_;
+        flush_pending_ = false;
+        timer_.cancel();
+        flush();
+        can_.cancel();
+        udp_.cancel();
+    }
+
+    /// Number of frames sent to the peer.
+    std::size_t frames_sent() const noexcept
+    {
+        return frames_sent_;
+    }
+
+    /// Number of datagrams sent to the peer.
+    std::size_t datagrams_sent() const noexcept
+    {
+        return datagrams_sent_;
+    }
+
+    /// Number of frames received from the peer and written to the CAN
+    /// socket.
+    std::size_t frames_received() const noexcept
+    {
+        return frames_received_;
+    }
+
+    /// Number of valid datagrams received from the peer.
+    std::size_t datagrams_received() const noexcept
+    {
+        return datagrams_received_;
+    }
+
+    /// Number of frames which could not be sent, in either direction.
+    std::size_t dropped() const noexcept
+    {
+        return dropped_;
+    }
+
+    /// Number of invalid or truncated datagrams received.
+    std::size_t invalid_datagrams() const noexcept
+    {
+        return invalid_datagrams_;
+    }
+
+private:
+    static options const& checked(options const& opts)
+    {
+        if (opts.batch_size == 0 ||
+            opts.max_datagram_size <
+              cannelloni::header_size + cannelloni::max_frame_size)
+        {
+            canary::detail::throw_exception(
+              system_error{net::error::invalid_argument});
+        }
+        return opts;
+    }
+
+    static constexpr std::size_t slot_units =
+      (fd_frame_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t);
+
+    static void* slot(std::vector<std::max_align_t>& frames, std::size_t i)
+    {
+        return &frames[i * slot_units];
+    }
+
+    static void
+    setup(::mmsghdr& msg, ::iovec& iov, void* data, std::size_t size) noexcept
+    {
+        iov.iov_base = data;
+        iov.iov_len = size;
+        msg.msg_hdr.msg_iov = &iov;
+        msg.msg_hdr.msg_iovlen = 1;
+    }
+
+    // Sends messages with as few `sendmmsg` calls as possible. Returns the
+    // number of messages sent.
+    static std::size_t
+    send_all(int fd, std::vector<::mmsghdr>& msgs, std::size_t count)
+    {
+        std::size_t sent = 0;
+        while (sent < count)
+        {
+            auto const r = ::sendmmsg(fd,
+                                      msgs.data() + sent,
+                                      static_cast<unsigned>(count - sent),
+                                      MSG_DONTWAIT);
+            if (r <= 0)
+            {
+                if (r < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                break;
+            }
+            sent += static_cast<std::size_t>(r);
+        }
+        return sent;
+    }
+
+    void wait_can()
+    {
+        can_.async_wait(Socket::wait_read, [this](error_code ec) {
+            if (ec || !running_)
+            {
+                return;
+            }
+            read_can();
+            wait_can();
+        });
+    }
+
+    void read_can()
+    {
+        auto const r = ::recvmmsg(can_.native_handle(),
+                                  can_msgs_.data(),
+                                  static_cast<unsigned>(can_msgs_.size()),
+                                  MSG_DONTWAIT,
+                                  nullptr);
+        if (r <= 0)
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < static_cast<std::size_t>(r); ++i)
+        {
+            auto const size = can_msgs_[i].msg_len;
+            if (size != classic_frame_size && size != fd_frame_size)
+            {
+                ++dropped_;
+                continue;
+            }
+            auto const frame = net::buffer(slot(can_frames_, i), size);
+            if (!writer_.append(frame))
+            {
+                finish_datagram();
+                writer_.append(frame);
+            }
+        }
+
+        if (opts_.flush_timeout.count() == 0)
+        {
+            flush();
+            return;
+        }
+        if (complete_ > 0)
+        {
+            send_datagrams();
+        }
+        if (!writer_.empty() && !flush_pending_)
+        {
+            start_timer();
+        }
+    }
+
+    void start_timer()
+    {
+        auto const generation = ++generation_;
+        flush_pending_ = true;
+        timer_.expires_after(opts_.flush_timeout);
+        timer_.async_wait([this, generation](error_code ec) {
+            if (ec || generation != generation_)
+            {
+                return;
+            }
+            flush_pending_ = false;
+            flush();
+        });
+    }
+
+    void flush()
+    {
+        if (!writer_.empty())
+        {
+            finish_datagram();
+        }
+        if (complete_ > 0)
+        {
+            send_datagrams();
+        }
+    }
+
+    void finish_datagram()
+    {
+        out_sizes_[complete_] = writer_.finish(seq_++);
+        out_frames_[complete_] = writer_.frames();
+        if (++complete_ == out_.size())
+        {
+            send_datagrams();
+        }
+        writer_.reset(net::buffer(out_[complete_]));
+    }
+
+    void send_datagrams()
+    {
+        for (std::size_t i = 0; i < complete_; ++i)
+        {
+            out_iovs_[i].iov_base = out_[i].data();
+            out_iovs_[i].iov_len = out_sizes_[i];
+        }
+        auto const sent = send_all(udp_.native_handle(), out_msgs_, complete_);
+        for (std::size_t i = 0; i < complete_; ++i)
+        {
+            (i < sent ? frames_sent_ : dropped_) += out_frames_[i];
+        }
+        datagrams_sent_ += sent;
+        if (complete_ < out_.size())
+        {
+            // The datagram being filled moves to the front, without copying.
+            std::swap(out_.front(), out_[complete_]);
+        }
+        complete_ = 0;
+    }
+
+    void wait_udp()
+    {
+        udp_.async_wait(net::ip::udp::socket::wait_read, [this](error_code ec) {
+            if (ec || !running_)
+            {
+                return;
+            }
+            read_udp();
+            wait_udp();
+        });
+    }
+
+    void read_udp()
+    {
+        auto const r = ::recvmmsg(udp_.native_handle(),
+                                  in_msgs_.data(),
+                                  static_cast<unsigned>(in_msgs_.size()),
+                                  MSG_DONTWAIT,
+                                  nullptr);
+        if (r <= 0)
+        {
+            return;
+        }
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < static_cast<std::size_t>(r); ++i)
+        {
+            if (in_msgs_[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                ++invalid_datagrams_;
+                continue;
+            }
+            error_code ec;
+            cannelloni::reader reader{
+              net::buffer(in_[i].data(), in_msgs_[i].msg_len), ec};
+            if (ec)
+            {
+                ++invalid_datagrams_;
+                continue;
+            }
+            ++datagrams_received_;
+            while (true)
+            {
+                auto const n = reader.next(
+                  net::buffer(slot(decoded_, count), fd_frame_size), ec);
+                if (ec)
+                {
+                    ++invalid_datagrams_;
+                }
+                if (n == 0)
+                {
+                    break;
+                }
+                decoded_iovs_[count].iov_len = n;
+                if (++count == decoded_msgs_.size())
+                {
+                    write_can(count);
+                    count = 0;
+                }
+            }
+        }
+        write_can(count);
+    }
+
+    void write_can(std::size_t count)
+    {
+        auto const sent = send_all(can_.native_handle(), decoded_msgs_, count);
+        frames_received_ += sent;
+        dropped_ += count - sent;
+    }
+
+    Socket& can_;
+    net::ip::udp::socket& udp_;
+    options opts_;
+    net::steady_timer timer_;
+    bool running_ = false;
+
+    // CAN to UDP.
+    std::vector<std::max_align_t> can_frames_;
+    std::vector<::iovec> can_iovs_;
+    std::vector<::mmsghdr> can_msgs_;
+    std::vector<std::vector<std::uint8_t>> out_;
+    std::vector<std::size_t> out_sizes_;
+    std::vector<std::size_t> out_frames_;
+    std::vector<::iovec> out_iovs_;
+    std::vector<::mmsghdr> out_msgs_;
+    cannelloni::writer writer_;
+    std::size_t complete_ = 0;
+    std::uint8_t seq_ = 0;
+    std::size_t generation_ = 0;
+    bool flush_pending_ = false;
+
+    // UDP to CAN.
+    std::vector<std::vector<std::uint8_t>> in_;
+    std::vector<::iovec> in_iovs_;
+    std::vector<::mmsghdr> in_msgs_;
+    std::vector<std::max_align_t> decoded_;
+    std::vector<::iovec> decoded_iovs_;
+    std::vector<::mmsghdr> decoded_msgs_;
+
+    std::size_t frames_sent_ = 0;
+    std::size_t datagrams_sent_ = 0;
+    std::size_t frames_received_ = 0;
+    std::size_t datagrams_received_ = 0;
+    std::size_t dropped_ = 0;
+    std::size_t invalid_datagrams_ = 0;
+};
+
+/// A UDP tunnel for raw CAN sockets.
+using udp_tunnel = basic_udp_tunnel<raw::socket>;
+
+} // namespace canary
+
+#endif // CANARY_UDP_TUNNEL_HPP
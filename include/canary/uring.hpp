@@ -0,0 +1,1085 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_URING_HPP
+#define CANARY_URING_HPP
+
+#include <canary/detail/async.hpp>
+#include <canary/socket_options.hpp>
+#include <canary/timestamp.hpp>
+
+#ifdef CANARY_STANDALONE_ASIO
+#include <asio/buffer.hpp>
+#include <asio/io_context.hpp>
+#include <asio/posix/stream_descriptor.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#endif // CANARY_STANDALONE_ASIO
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <linux/io_uring.h>
+#include <memory>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace canary
+{
+
+namespace detail
+{
+
+template<class T>
+T
+load_acquire(T const* p) noexcept
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+template<class T>
+void
+store_release(T* p, T v) noexcept
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// A memory mapping, unmapped on destruction.
+class mapping
+{
+public:
+    mapping() = default;
+
+    mapping(std::size_t size, int prot, int flags, int fd, off_t offset)
+      : size_{size}
+    {
+        auto* p = ::mmap(nullptr, size, prot, flags, fd, offset);
+        if (p == MAP_FAILED)
+        {
+            detail::throw_errno();
+        }
+        data_ = static_cast<unsigned char*>(p);
+    }
+
+    mapping(mapping&& other) noexcept
+      : data_{other.data_}
+      , size_{other.size_}
+    {
+        other.data_ = nullptr;
+    }
+
+    mapping& operator=(mapping&& other) noexcept
+    {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~mapping()
+    {
+        if (data_ != nullptr)
+        {
+            ::munmap(data_, size_);
+        }
+    }
+
+    template<class T>
+    T* at(std::size_t offset) const noexcept
+    {
+        return reinterpret_cast<T*>(data_ + offset);
+    }
+
+private:
+    unsigned char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// An operation whose completions are reported by the ring. The address of the
+// operation is used as the user data of its submissions.
+class uring_operation
+{
+public:
+    virtual void complete(::io_uring_cqe const& cqe) = 0;
+
+protected:
+    ~uring_operation() = default;
+};
+
+// A bare io_uring instance: the submission and completion queues, set up and
+// driven through the raw system calls.
+class uring
+{
+public:
+    explicit uring(unsigned entries)
+    {
+        ::io_uring_params p{};
+        p.flags = IORING_SETUP_CQSIZE;
+        // Multishot receives post many completions per submission.
+        p.cq_entries = entries * 4;
+        fd_ = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &p));
+        if (fd_ < 0)
+        {
+            detail::throw_errno();
+        }
+
+        try
+        {
+            auto const sq_size =
+              p.sq_off.array + p.sq_entries * sizeof(std::uint32_t);
+            auto const cq_size =
+              p.cq_off.cqes + p.cq_entries * sizeof(::io_uring_cqe);
+            auto const prot = PROT_READ | PROT_WRITE;
+            auto const flags = MAP_SHARED | MAP_POPULATE;
+            if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+            {
+                sq_ring_ = mapping{std::max(sq_size, cq_size),
+                                   prot,
+                                   flags,
+                                   fd_,
+                                   IORING_OFF_SQ_RING};
+            }
+            else
+            {
+                sq_ring_ = mapping{sq_size, prot, flags, fd_, IORING_OFF_SQ_RING};
+                cq_ring_ = mapping{cq_size, prot, flags, fd_, IORING_OFF_CQ_RING};
+            }
+            auto const& cq_ring =
+              (p.features & IORING_FEAT_SINGLE_MMAP) != 0 ? sq_ring_ : cq_ring_;
+            sqe_map_ = mapping{p.sq_entries * sizeof(::io_uring_sqe),
+                               prot,
+                               flags,
+                               fd_,
+                               static_cast<off_t>(IORING_OFF_SQES)};
+
+            sq_head_ = sq_ring_.at<unsigned>(p.sq_off.head);
+            sq_tail_ = sq_ring_.at<unsigned>(p.sq_off.tail);
+            sq_mask_ = *sq_ring_.at<unsigned>(p.sq_off.ring_mask);
+            sq_entries_ = p.sq_entries;
+            sq_array_ = sq_ring_.at<unsigned>(p.sq_off.array);
+            sqes_ = sqe_map_.at<::io_uring_sqe>(0);
+            cq_head_ = cq_ring.at<unsigned>(p.cq_off.head);
+            cq_tail_ = cq_ring.at<unsigned>(p.cq_off.tail);
+            cq_mask_ = *cq_ring.at<unsigned>(p.cq_off.ring_mask);
+            cqes_ = cq_ring.at<::io_uring_cqe>(p.cq_off.cqes);
+            sqe_tail_ = *sq_tail_;
+        }
+        catch (...)
+        {
+            ::close(fd_);
+            throw;
+        }
+    }
+
+    uring(uring const&) = delete;
+    uring& operator=(uring const&) = delete;
+
+    ~uring()
+    {
+        ::close(fd_);
+    }
+
+    int native_handle() const noexcept
+    {
+        return fd_;
+    }
+
+    // Returns a zeroed submission queue entry, or nullptr if the queue is
+    // full. The entry is handed to the kernel by the next call to `enter`.
+    ::io_uring_sqe* get_sqe() noexcept
+    {
+        if (sqe_tail_ - detail::load_acquire(sq_head_) >= sq_entries_)
+        {
+            return nullptr;
+        }
+        auto const index = sqe_tail_ & sq_mask_;
+        auto* sqe = &sqes_[index];
+        *sqe = ::io_uring_sqe{};
+        sq_array_[index] = index;
+        ++sqe_tail_;
+        return sqe;
+    }
+
+    // Number of entries not yet consumed by the kernel.
+    unsigned pending() const noexcept
+    {
+        return sqe_tail_ - detail::load_acquire(sq_head_);
+    }
+
+    // Submits all pending entries and waits for at least `wait_nr`
+    // completions, in a single system call.
+    void enter(unsigned wait_nr, error_code& ec) noexcept
+    {
+        detail::store_release(sq_tail_, sqe_tail_);
+        auto const to_submit = pending();
+        ec.clear();
+        if (to_submit == 0 && wait_nr == 0)
+        {
+            return;
+        }
+        auto const flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0u;
+        while (::syscall(__NR_io_uring_enter,
+                         fd_,
+                         to_submit,
+                         wait_nr,
+                         flags,
+                         nullptr,
+                         0) < 0)
+        {
+            // EBUSY/EAGAIN mean that the completion queue must be drained
+            // before more work can be submitted.
+            if (errno != EINTR)
+            {
+                if (errno != EBUSY && errno != EAGAIN)
+                {
+                    detail::assign_errno(ec);
+                }
+                return;
+            }
+        }
+    }
+
+    // Invokes `f` for each available completion. The completion is consumed
+    // before `f` is invoked, so `f` may submit more work.
+    template<class Function>
+    std::size_t reap(Function&& f)
+    {
+        std::size_t n = 0;
+        auto head = *cq_head_;
+        while (head != detail::load_acquire(cq_tail_))
+        {
+            auto const cqe = cqes_[head & cq_mask_];
+            detail::store_release(cq_head_, ++head);
+            f(cqe);
+            ++n;
+        }
+        return n;
+    }
+
+private:
+    int fd_ = -1;
+    mapping sq_ring_;
+    mapping cq_ring_;
+    mapping sqe_map_;
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sq_entries_ = 0;
+    unsigned sqe_tail_ = 0;
+    ::io_uring_sqe* sqes_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    ::io_uring_cqe* cqes_ = nullptr;
+};
+
+// A ring of equally sized buffers registered with the kernel, from which
+// operations submitted with `IOSQE_BUFFER_SELECT` pick a buffer when data
+// arrives.
+class provided_buffers
+{
+public:
+    provided_buffers(uring& ring,
+                     std::uint16_t group,
+                     std::uint16_t count,
+                     std::size_t size)
+      : fd_{ring.native_handle()}
+      , group_{group}
+      , count_{count}
+      , size_{size}
+      , stride_{(size + 15) & ~std::size_t{15}}
+      , storage_(count * stride_)
+      , ring_{count * sizeof(::io_uring_buf),
+              PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS,
+              -1,
+              0}
+    {
+        ::io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<std::uintptr_t>(ring_.at<void>(0));
+        reg.ring_entries = count;
+        reg.bgid = group;
+        if (::syscall(
+              __NR_io_uring_register, fd_, IORING_REGISTER_PBUF_RING, &reg, 1) <
+            0)
+        {
+            detail::throw_errno();
+        }
+        for (std::uint16_t bid = 0; bid < count; ++bid)
+        {
+            recycle(bid);
+        }
+    }
+
+    provided_buffers(provided_buffers const&) = delete;
+    provided_buffers& operator=(provided_buffers const&) = delete;
+
+    ~provided_buffers()
+    {
+        ::io_uring_buf_reg reg{};
+        reg.bgid = group_;
+        ::syscall(
+          __NR_io_uring_register, fd_, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+
+    std::uint16_t group() const noexcept
+    {
+        return group_;
+    }
+
+    std::size_t buffer_size() const noexcept
+    {
+        return size_;
+    }
+
+    unsigned char* data(std::uint16_t bid) noexcept
+    {
+        return &storage_[bid * stride_];
+    }
+
+    // Hands a buffer back to the kernel.
+    void recycle(std::uint16_t bid) noexcept
+    {
+        // The tail overlays the reserved field of the first entry. In C++ the
+        // flexible array of `io_uring_buf_ring` is not at offset 0, so the
+        // entries are addressed directly.
+        auto* bufs = ring_.at<::io_uring_buf>(0);
+        auto* tail = &bufs[0].resv;
+        auto const t = *tail;
+        auto& b = bufs[t & (count_ - 1)];
+        b.addr = reinterpret_cast<std::uintptr_t>(data(bid));
+        b.len = static_cast<std::uint32_t>(size_);
+        b.bid = bid;
+        detail::store_release(tail, static_cast<std::uint16_t>(t + 1));
+    }
+
+private:
+    int fd_;
+    std::uint16_t group_;
+    std::uint16_t count_;
+    std::size_t size_;
+    // Keeps the control messages of all buffers aligned.
+    std::size_t stride_;
+    std::vector<unsigned char> storage_;
+    mapping ring_;
+};
+
+} // namespace detail
+
+/// An io_uring instance which performs the I/O of `uring_socket` objects.
+///
+/// The context either runs its own event loop (`run` or `poll`), or is
+/// attached to an `io_context`, in which case completions are dispatched by
+/// the threads running the `io_context`: the ring signals an eventfd which is
+/// waited on like any other descriptor.
+///
+/// Submissions are batched: operations started while the context dispatches
+/// completions, or from other handlers of the `io_context`, are handed to the
+/// kernel together, in a single system call.
+///
+/// \notes Except for `stop`, the context must only be used from a single
+/// thread at a time. All sockets must be destroyed before the context.
+class uring_context
+{
+public:
+    /// Constructs a context which runs its own event loop.
+    /// \param entries Size of the submission queue.
+    explicit uring_context(unsigned entries = 256)
+      : ring_{std::make_shared<detail::uring>(entries)}
+      , wake_fd_{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+    {
+        if (wake_fd_ < 0)
+        {
+            detail::throw_errno();
+        }
+    }
+
+    /// Constructs a context whose completions are dispatched by `ioc`.
+    /// \param ioc The io_context which dispatches completions.
+    /// \param entries Size of the submission queue.
+    explicit uring_context(net::io_context& ioc, unsigned entries = 256)
+      : ring_{std::make_shared<detail::uring>(entries)}
+      , ioc_{&ioc}
+    {
+        auto const efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (efd < 0)
+        {
+            detail::throw_errno();
+        }
+        eventfd_.reset(new net::posix::stream_descriptor{ioc, efd});
+        if (::syscall(__NR_io_uring_register,
+                      ring_->native_handle(),
+                      IORING_REGISTER_EVENTFD,
+                      &efd,
+                      1) < 0)
+        {
+            detail::throw_errno();
+        }
+        wait_eventfd();
+    }
+
+    uring_context(uring_context const&) = delete;
+    uring_context& operator=(uring_context const&) = delete;
+
+    ~uring_context()
+    {
+        if (wake_fd_ >= 0)
+        {
+            ::close(wake_fd_);
+        }
+    }
+
+    /// Runs the event loop until `stop` is called. Pending submissions are
+    /// handed to the kernel in the same system call which waits for
+    /// completions.
+    void run()
+    {
+        while (!stopped_.load(std::memory_order_acquire))
+        {
+            run_one();
+        }
+    }
+
+    /// Waits for and dispatches at least one completion, unless the context
+    /// is stopped.
+    /// \returns The number of completions dispatched.
+    std::size_t run_one()
+    {
+        arm_wake();
+        auto n = dispatch();
+        while (n == 0 && !stopped_.load(std::memory_order_acquire))
+        {
+            enter(1);
+            n = dispatch();
+        }
+        return n;
+    }
+
+    /// Submits pending work and dispatches ready completions, without
+    /// blocking.
+    /// \returns The number of completions dispatched.
+    std::size_t poll()
+    {
+        enter(0);
+        auto const n = dispatch();
+        enter(0);
+        return n;
+    }
+
+    /// Makes `run` return as soon as possible. May be called from any
+    /// thread.
+    void stop() noexcept
+    {
+        stopped_.store(true, std::memory_order_release);
+        if (wake_fd_ >= 0)
+        {
+            std::uint64_t one = 1;
+            auto const r = ::write(wake_fd_, &one, sizeof(one));
+            static_cast<void>(r);
+        }
+    }
+
+    /// Prepares a stopped context for another invocation of `run`.
+    void restart() noexcept
+    {
+        stopped_.store(false, std::memory_order_release);
+    }
+
+    /// Hands all pending submissions to the kernel.
+    void flush()
+    {
+        enter(0);
+    }
+
+    /// Returns the io_context which dispatches completions, or nullptr if
+    /// the context runs its own event loop.
+    net::io_context* io_context() const noexcept
+    {
+        return ioc_;
+    }
+
+private:
+    friend class uring_socket;
+
+    // Returns an entry of the submission queue, making room in the queue if
+    // it is full. The entry is submitted in the next batch.
+    ::io_uring_sqe* get_sqe()
+    {
+        auto* sqe = ring_->get_sqe();
+        if (sqe == nullptr)
+        {
+            enter(0);
+            sqe = ring_->get_sqe();
+        }
+        if (sqe != nullptr)
+        {
+            schedule_flush();
+        }
+        return sqe;
+    }
+
+    std::uint16_t allocate_buffer_group() noexcept
+    {
+        return next_group_++;
+    }
+
+    detail::uring& ring() noexcept
+    {
+        return *ring_;
+    }
+
+    // Submits and dispatches completions until `done` returns true, or
+    // submission fails.
+    template<class Predicate>
+    void run_until(Predicate done, error_code& ec)
+    {
+        ec.clear();
+        while (!done())
+        {
+            if (dispatch() == 0)
+            {
+                ring_->enter(1, ec);
+                if (ec)
+                {
+                    return;
+                }
+            }
+        }
+    }
+
+    void enter(unsigned wait_nr)
+    {
+        error_code ec;
+        ring_->enter(wait_nr, ec);
+        if (ec)
+        {
+            canary::detail::throw_exception(system_error{ec});
+        }
+    }
+
+    std::size_t dispatch()
+    {
+        return ring_->reap([](::io_uring_cqe const& cqe) {
+            if (cqe.user_data != 0)
+            {
+                reinterpret_cast<detail::uring_operation*>(cqe.user_data)
+                  ->complete(cqe);
+            }
+        });
+    }
+
+    // Submission in the io_context is deferred until the current handler
+    // returns, so that operations started by it end up in the same batch.
+    void schedule_flush()
+    {
+        if (ioc_ == nullptr || flush_scheduled_)
+        {
+            return;
+        }
+        flush_scheduled_ = true;
+        std::weak_ptr<detail::uring> weak = ring_;
+        bool* scheduled = &flush_scheduled_;
+        net::post(*ioc_, [weak, scheduled]() {
+            auto const ring = weak.lock();
+            if (!ring)
+            {
+                return;
+            }
+            *scheduled = false;
+            error_code ec;
+            ring->enter(0, ec);
+        });
+    }
+
+    void wait_eventfd()
+    {
+        eventfd_->async_wait(net::posix::stream_descriptor::wait_read,
+                             [this](error_code ec) {
+                                 if (ec)
+                                 {
+                                     return;
+                                 }
+                                 std::uint64_t value;
+                                 auto const r = ::read(eventfd_->native_handle(),
+                                                       &value,
+                                                       sizeof(value));
+                                 static_cast<void>(r);
+                                 dispatch();
+                                 enter(0);
+                                 wait_eventfd();
+                             });
+    }
+
+    // In its own event loop, the context waits for the wake-up eventfd along
+    // with the I/O, so that `stop` can interrupt a blocking wait.
+    class wake_op : public detail::uring_operation
+    {
+    public:
+        explicit wake_op(uring_context& ctx)
+          : ctx_{ctx}
+        {
+        }
+
+        void complete(::io_uring_cqe const&) override
+        {
+            std::uint64_t value;
+            auto const r = ::read(ctx_.wake_fd_, &value, sizeof(value));
+            static_cast<void>(r);
+            ctx_.wake_armed_ = false;
+        }
+
+    private:
+        uring_context& ctx_;
+    };
+
+    void arm_wake()
+    {
+        if (wake_armed_ || wake_fd_ < 0)
+        {
+            return;
+        }
+        auto* sqe = get_sqe();
+        if (sqe == nullptr)
+        {
+            return;
+        }
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = wake_fd_;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(
+          static_cast<detail::uring_operation*>(&wake_));
+        wake_armed_ = true;
+    }
+
+    std::shared_ptr<detail::uring> ring_;
+    net::io_context* ioc_ = nullptr;
+    std::unique_ptr<net::posix::stream_descriptor> eventfd_;
+    int wake_fd_ = -1;
+    bool wake_armed_ = false;
+    wake_op wake_{*this};
+    std::atomic<bool> stopped_{false};
+    bool flush_scheduled_ = false;
+    std::uint16_t next_group_ = 0;
+};
+
+/// Performs the I/O of a raw or ISO-TP socket through a `uring_context`.
+///
+/// Frames are received by a single multishot `recvmsg` submission, which
+/// keeps completing as long as frames arrive. The kernel places each frame,
+/// along with its reception timestamp, in a buffer picked from a ring of
+/// buffers registered with the ring; the buffer is handed back to the kernel
+/// as soon as the receive handler returns. If the buffers run out, the
+/// submission is re-armed once they have been recycled.
+///
+/// Frames to send are copied into one of a fixed number of send slots and
+/// submitted in batches. When all slots are in flight, `send` fails, which
+/// lets the caller apply backpressure.
+///
+/// \notes The socket is used only through its native handle and must outlive
+/// this object.
+class uring_socket
+{
+public:
+    /// Invoked with each received frame, or an error. The buffer is only
+    /// valid until the handler returns. Frames larger than
+    /// `options::max_frame_size` are truncated and reported along with
+    /// `net::error::message_size`. After an error other than
+    /// `message_size`, no more frames are received.
+    using receive_handler =
+      std::function<void(error_code, net::const_buffer, timestamp)>;
+
+    /// Invoked when a send completes.
+    using send_handler = std::function<void(error_code, std::size_t)>;
+
+    /// Configuration of the receive and send resources.
+    struct options
+    {
+        /// Largest frame which can be received without truncation.
+        std::size_t max_frame_size = 72;
+        /// Number of receive buffers, must be a power of 2 no larger than
+        /// 32768.
+        std::uint16_t receive_buffers = 256;
+        /// Number of sends which may be in flight at once.
+        std::size_t send_slots = 256;
+        /// Whether to request kernel reception timestamps.
+        bool timestamps = true;
+    };
+
+    /// Constructs an object with the default options.
+    /// \param ctx The context which performs the I/O.
+    /// \param sock The socket, typically a raw or ISO-TP socket.
+    template<class Socket>
+    uring_socket(uring_context& ctx, Socket& sock)
+      : uring_socket{ctx, sock, options{}}
+    {
+    }
+
+    /// Constructs an object.
+    /// \param ctx The context which performs the I/O.
+    /// \param sock The socket, typically a raw or ISO-TP socket.
+    /// \param opts Configuration of the receive and send resources.
+    template<class Socket>
+    uring_socket(uring_context& ctx, Socket& sock, options const& opts)
+      : ctx_{ctx}
+      , fd_{sock.native_handle()}
+      , max_frame_size_{opts.max_frame_size}
+      , buffers_{ctx.ring(),
+                 ctx.allocate_buffer_group(),
+                 opts.receive_buffers,
+                 buffer_size(opts)}
+      , slot_storage_(opts.send_slots * opts.max_frame_size)
+    {
+        if (opts.timestamps)
+        {
+            sock.set_option(receive_timestamp{true});
+            msg_.msg_controllen = CMSG_SPACE(sizeof(::timespec));
+        }
+        slots_.reserve(opts.send_slots);
+        free_slots_.reserve(opts.send_slots);
+        for (std::size_t i = 0; i < opts.send_slots; ++i)
+        {
+            slots_.emplace_back(*this, &slot_storage_[i * max_frame_size_]);
+            free_slots_.push_back(&slots_.back());
+        }
+    }
+
+    uring_socket(uring_socket const&) = delete;
+    uring_socket& operator=(uring_socket const&) = delete;
+
+    /// Cancels the receive and waits for all operations to complete. Handlers
+    /// are not invoked for these completions.
+    ~uring_socket()
+    {
+        on_frame_ = nullptr;
+        on_send_ = nullptr;
+        stopping_ = true;
+        // The cancel is retried until the submission queue has room for it.
+        // Errors cannot be reported from here, so they end the wait.
+        error_code ec;
+        ctx_.run_until(
+          [this] {
+              if (receive_.armed && !cancelling_)
+              {
+                  queue_cancel();
+              }
+              return !receive_.armed && !cancelling_ &&
+                     sends_in_flight() == 0;
+          },
+          ec);
+    }
+
+    /// Starts receiving frames, until `cancel` is called or an error occurs.
+    /// \param handler Invoked with each received frame.
+    void async_receive(receive_handler handler)
+    {
+        on_frame_ = std::move(handler);
+        stopping_ = false;
+        if (!receive_.armed)
+        {
+            arm_receive();
+        }
+    }
+
+    /// Stops receiving. The receive handler is invoked with
+    /// `net::error::operation_aborted` once the receive has stopped.
+    void cancel()
+    {
+        stopping_ = true;
+        if (receive_.armed && !cancelling_ && queue_cancel())
+        {
+            ctx_.schedule_flush();
+        }
+    }
+
+    /// Queues a frame for sending. The frame is copied, so the buffer may be
+    /// reused immediately.
+    /// \param frame The frame, no larger than `options::max_frame_size`.
+    /// \returns false if all send slots are in flight or the submission queue
+    /// is full, in which case nothing is sent.
+    bool send(net::const_buffer frame)
+    {
+        if (free_slots_.empty() || frame.size() > max_frame_size_)
+        {
+            return false;
+        }
+        auto* sqe = ctx_.get_sqe();
+        if (sqe == nullptr)
+        {
+            return false;
+        }
+        auto* slot = free_slots_.back();
+        free_slots_.pop_back();
+        std::memcpy(slot->data, frame.data(), frame.size());
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(slot->data);
+        sqe->len = static_cast<std::uint32_t>(frame.size());
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(
+          static_cast<detail::uring_operation*>(slot));
+        return true;
+    }
+
+    /// Sets the handler invoked when a send completes.
+    void on_send_complete(send_handler handler)
+    {
+        on_send_ = std::move(handler);
+    }
+
+    /// Number of sends which have not completed yet.
+    std::size_t sends_in_flight() const noexcept
+    {
+        return slots_.size() - free_slots_.size();
+    }
+
+    /// Whether a receive is in progress.
+    bool receiving() const noexcept
+    {
+        return receive_.armed;
+    }
+
+    /// Number of times the receive buffers ran out, which forces a re-arm of
+    /// the multishot receive. A frequent occurrence means that more buffers
+    /// are needed.
+    std::size_t buffer_exhaustions() const noexcept
+    {
+        return exhaustions_;
+    }
+
+private:
+    static std::size_t buffer_size(options const& opts)
+    {
+        auto const control =
+          opts.timestamps ? CMSG_SPACE(sizeof(::timespec)) : 0;
+        return sizeof(::io_uring_recvmsg_out) + control + opts.max_frame_size;
+    }
+
+    void arm_receive()
+    {
+        auto* sqe = ctx_.get_sqe();
+        if (sqe == nullptr)
+        {
+            on_error(error_code{EAGAIN, net::error::get_system_category()});
+            return;
+        }
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(&msg_);
+        sqe->ioprio = static_cast<std::uint16_t>(IORING_RECV_MULTISHOT);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffers_.group();
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(
+          static_cast<detail::uring_operation*>(&receive_));
+        receive_.armed = true;
+    }
+
+    void on_error(error_code ec)
+    {
+        if (on_frame_)
+        {
+            auto handler = on_frame_;
+            handler(ec, net::const_buffer{}, timestamp{});
+        }
+    }
+
+    void on_receive(::io_uring_cqe const& cqe)
+    {
+        auto const more = (cqe.flags & IORING_CQE_F_MORE) != 0;
+        if (!more)
+        {
+            receive_.armed = false;
+        }
+
+        if ((cqe.flags & IORING_CQE_F_BUFFER) != 0)
+        {
+            auto const bid =
+              static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            if (cqe.res >= 0)
+            {
+                deliver(buffers_.data(bid));
+            }
+            buffers_.recycle(bid);
+        }
+
+        if (more)
+        {
+            return;
+        }
+        if (cqe.res == -ENOBUFS)
+        {
+            ++exhaustions_;
+        }
+        else if (cqe.res == -ECANCELED || stopping_)
+        {
+            on_error(net::error::operation_aborted);
+            return;
+        }
+        else if (cqe.res < 0)
+        {
+            on_error(error_code{-cqe.res, net::error::get_system_category()});
+            return;
+        }
+        // The kernel terminated the multishot receive, e.g. because all
+        // buffers were in use. They have been recycled by now.
+        if (!stopping_)
+        {
+            arm_receive();
+        }
+    }
+
+    void deliver(unsigned char const* buffer)
+    {
+        ::io_uring_recvmsg_out out;
+        std::memcpy(&out, buffer, sizeof(out));
+        auto* control = buffer + sizeof(out) + msg_.msg_namelen;
+        auto* payload = control + msg_.msg_controllen;
+        auto const size = std::min<std::size_t>(
+          out.payloadlen,
+          buffers_.buffer_size() - static_cast<std::size_t>(payload - buffer));
+
+        ::msghdr msg{};
+        msg.msg_control = const_cast<unsigned char*>(control);
+        msg.msg_controllen = out.controllen;
+        auto const ts = out.controllen > 0 ? detail::find_timestamp(msg)
+                                           : timestamp{};
+        error_code ec;
+        if ((out.flags & MSG_TRUNC) != 0)
+        {
+            ec = net::error::message_size;
+        }
+        if (on_frame_)
+        {
+            on_frame_(ec, net::const_buffer{payload, size}, ts);
+        }
+    }
+
+    // Queues the cancellation of the receive, making room in the submission
+    // queue if it is full.
+    // \returns false if there is still no room, e.g. because the completion
+    // queue must be drained first.
+    bool queue_cancel() noexcept
+    {
+        auto& ring = ctx_.ring();
+        auto* sqe = ring.get_sqe();
+        if (sqe == nullptr)
+        {
+            error_code ec;
+            ring.enter(0, ec);
+            sqe = ring.get_sqe();
+        }
+        if (sqe == nullptr)
+        {
+            return false;
+        }
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(
+          static_cast<detail::uring_operation*>(&receive_));
+        sqe->user_data = reinterpret_cast<std::uintptr_t>(
+          static_cast<detail::uring_operation*>(&cancel_));
+        cancelling_ = true;
+        return true;
+    }
+
+    class receive_op : public detail::uring_operation
+    {
+    public:
+        explicit receive_op(uring_socket& s)
+          : self_{s}
+        {
+        }
+
+        void complete(::io_uring_cqe const& cqe) override
+        {
+            self_.on_receive(cqe);
+        }
+
+        bool armed = false;
+
+    private:
+        uring_socket& self_;
+    };
+
+    class cancel_op : public detail::uring_operation
+    {
+    public:
+        explicit cancel_op(uring_socket& s)
+          : self_{s}
+        {
+        }
+
+        void complete(::io_uring_cqe const&) override
+        {
+            self_.cancelling_ = false;
+        }
+
+    private:
+        uring_socket& self_;
+    };
+
+    class send_slot : public detail::uring_operation
+    {
+    public:
+        send_slot(uring_socket& s, unsigned char* d)
+          : data{d}
+          , self_{s}
+        {
+        }
+
+        void complete(::io_uring_cqe const& cqe) override
+        {
+            self_.free_slots_.push_back(this);
+            if (!self_.on_send_)
+            {
+                return;
+            }
+            if (cqe.res < 0)
+            {
+                self_.on_send_(
+                  error_code{-cqe.res, net::error::get_system_category()}, 0);
+            }
+            else
+            {
+                self_.on_send_(error_code{},
+                               static_cast<std::size_t>(cqe.res));
+            }
+        }
+
+        unsigned char* data;
+
+    private:
+        uring_socket& self_;
+    };
+
+    uring_context& ctx_;
+    int fd_;
+    std::size_t max_frame_size_;
+    detail::provided_buffers buffers_;
+    ::msghdr msg_{};
+    receive_op receive_{*this};
+    cancel_op cancel_{*this};
+    bool cancelling_ = false;
+    bool stopping_ = false;
+    std::size_t exhaustions_ = 0;
+    receive_handler on_frame_;
+    send_handler on_send_;
+    std::vector<unsigned char> slot_storage_;
+    std::vector<send_slot> slots_;
+    std::vector<send_slot*> free_slots_;
+};
+
+} // namespace canary
+
+#endif // CANARY_URING_HPP
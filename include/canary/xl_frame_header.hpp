@@ -0,0 +1,182 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+#ifndef CANARY_XL_FRAME_HEADER_HPP
+#define CANARY_XL_FRAME_HEADER_HPP
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+namespace canary
+{
+
+/// A CAN XL frame header, with the layout of the header of the kernel's
+/// `canxl_frame`.
+///
+/// CAN XL frames carry payloads of 1 to 2048 bytes. They are arbitrated by an
+/// 11-bit priority instead of a CAN ID, and carry a 32-bit acceptance field,
+/// used to address the content, an SDU type describing the payload, and an
+/// optional virtual CAN network ID.
+class xl_frame_header
+{
+public:
+    /// Default constructor. Sets the XL format flag, which the kernel
+    /// requires on all CAN XL frames, everything else is zero.
+    xl_frame_header() = default;
+
+    /// Sets the priority of this frame, used for arbitration.
+    /// \param value The 11-bit priority, lower values win arbitration.
+    void priority(std::uint32_t value) noexcept
+    {
+        prio_ = (value & priority_mask) | (prio_ & ~priority_mask);
+    }
+
+    /// Gets the priority of this frame.
+    /// \returns The 11-bit priority.
+    std::uint32_t priority() const noexcept
+    {
+        return prio_ & priority_mask;
+    }
+
+    /// Sets the virtual CAN network ID of this frame.
+    /// \notes Kernels without VCID support ignore it on transmission, and
+    /// may not accept frames with a non-zero VCID.
+    /// \param value The 8-bit VCID.
+    void virtual_can_id(std::uint8_t value) noexcept
+    {
+        prio_ = (std::uint32_t{value} << vcid_offset) | (prio_ & ~vcid_mask);
+    }
+
+    /// Gets the virtual CAN network ID of this frame.
+    /// \returns The 8-bit VCID.
+    std::uint8_t virtual_can_id() const noexcept
+    {
+        return static_cast<std::uint8_t>((prio_ & vcid_mask) >> vcid_offset);
+    }
+
+    /// Sets the XL format flag (CANXL_XLF), which marks a CAN XL frame.
+    /// \notes The kernel rejects CAN XL frames without this flag.
+    /// \param value The value of the flag.
+    void xl_format(bool value) noexcept
+    {
+        set_flag(xlf_flag, value);
+    }
+
+    /// Gets the XL format flag.
+    /// \returns The value of the flag. True indicates a CAN XL frame.
+    bool xl_format() const noexcept
+    {
+        return (flags_ & xlf_flag);
+    }
+
+    /// Sets the simple extended content flag (CANXL_SEC), which indicates
+    /// the payload is e.g. secured or segmented.
+    /// \param value The value of the flag.
+    void simple_extended_content(bool value) noexcept
+    {
+        set_flag(sec_flag, value);
+    }
+
+    /// Gets the simple extended content flag.
+    /// \returns The value of the flag.
+    bool simple_extended_content() const noexcept
+    {
+        return (flags_ & sec_flag);
+    }
+
+    /// Sets the SDU (service data unit) type of the payload.
+    /// \param value The SDU type.
+    void sdu_type(std::uint8_t value) noexcept
+    {
+        sdt_ = value;
+    }
+
+    /// Gets the SDU (service data unit) type of the payload.
+    /// \returns The SDU type.
+    std::uint8_t sdu_type() const noexcept
+    {
+        return sdt_;
+    }
+
+    /// Sets the payload length of this frame.
+    /// \notes The payload length must be between 1 and 2048 bytes.
+    /// \param n The length of the payload.
+    void payload_length(std::size_t n)
+    {
+        assert(n >= 1 && n <= 2048 &&
+               "CAN XL frame payloads must be between 1 and 2048 bytes.");
+        len_ = static_cast<std::uint16_t>(n);
+    }
+
+    /// Gets the payload length of this frame.
+    /// \returns The length of the payload.
+    std::size_t payload_length() const noexcept
+    {
+        return len_;
+    }
+
+    /// Sets the acceptance field of this frame.
+    /// \param value The 32-bit acceptance field.
+    void acceptance_field(std::uint32_t value) noexcept
+    {
+        af_ = value;
+    }
+
+    /// Gets the acceptance field of this frame.
+    /// \returns The 32-bit acceptance field.
+    std::uint32_t acceptance_field() const noexcept
+    {
+        return af_;
+    }
+
+private:
+    void set_flag(std::uint8_t flag, bool value) noexcept
+    {
+        if (value)
+        {
+            flags_ = static_cast<std::uint8_t>(flags_ | flag);
+        }
+        else
+        {
+            flags_ = static_cast<std::uint8_t>(flags_ & ~flag);
+        }
+    }
+
+    static constexpr std::uint32_t priority_mask = 0x7FF;
+    static constexpr std::uint32_t vcid_mask = 0x00FF0000;
+    static constexpr unsigned vcid_offset = 16;
+    static constexpr std::uint8_t xlf_flag = 0x80;
+    static constexpr std::uint8_t sec_flag = 0x01;
+
+    std::uint32_t prio_ = 0;
+    std::uint8_t flags_ = xlf_flag;
+    std::uint8_t sdt_ = 0;
+    std::uint16_t len_ = 0;
+    std::uint32_t af_ = 0;
+};
+
+static_assert(sizeof(xl_frame_header) == 12,
+              "Size of CAN XL frame header must be exactly 12 bytes");
+
+/// Largest payload of a CAN XL frame.
+constexpr std::size_t xl_max_payload_length = 2048;
+
+/// A CAN XL frame with room for the largest payload. Only the header and
+/// `header.payload_length()` bytes of the payload are transmitted.
+struct xl_frame
+{
+    xl_frame_header header;
+    std::array<std::uint8_t, xl_max_payload_length> payload;
+};
+
+} // namespace canary
+
+#endif // CANARY_XL_FRAME_HEADER_HPP
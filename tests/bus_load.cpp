@@ -0,0 +1,402 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/bus_load.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+namespace net = canary::net;
+using std::chrono::milliseconds;
+
+template<class Frame>
+canary::frame_bits
+count(Frame const& f, canary::stuffing mode = canary::stuffing::exact)
+{
+    return canary::count_frame_bits(net::buffer(&f, sizeof(f)), mode);
+}
+
+// A straightforward model of the bit stream, one bit at a time.
+struct reference
+{
+    std::vector<int> bits;
+
+    void put(std::uint32_t value, int n)
+    {
+        for (int i = n - 1; i >= 0; --i)
+        {
+            bits.push_back(static_cast<int>((value >> i) & 1U));
+        }
+    }
+
+    std::uint32_t crc15() const
+    {
+        std::uint32_t crc = 0;
+        for (auto b : bits)
+        {
+            auto const next = static_cast<std::uint32_t>(b) ^ (crc >> 14);
+            crc = (crc << 1) & 0x7FFF;
+            if (next & 1U)
+            {
+                crc ^= 0x4599;
+            }
+        }
+        return crc;
+    }
+
+    // Stuffs bits [begin, end), returns the number of stuff bits.
+    std::uint32_t stuff(std::size_t begin, std::size_t end, int& last, int& run)
+    {
+        std::uint32_t stuffed = 0;
+        for (auto i = begin; i < end; ++i)
+        {
+            if (run > 0 && bits[i] == last)
+            {
+                ++run;
+            }
+            else
+            {
+                last = bits[i];
+                run = 1;
+            }
+            if (run == 5)
+            {
+                ++stuffed;
+                last = !last;
+                run = 1;
+            }
+        }
+        return stuffed;
+    }
+};
+
+std::uint32_t
+reference_classic(::can_frame const& f)
+{
+    reference r;
+    auto const remote = (f.can_id & CAN_RTR_FLAG) != 0;
+    std::size_t const length = remote ? 0 : f.can_dlc;
+    r.put(0, 1);
+    if (f.can_id & CAN_EFF_FLAG)
+    {
+        auto const id = f.can_id & CAN_EFF_MASK;
+        r.put(id >> 18, 11);
+        r.put(3, 2);
+        r.put(id, 18);
+        r.put(remote, 1);
+        r.put(0, 2);
+    }
+    else
+    {
+        r.put(f.can_id & CAN_SFF_MASK, 11);
+        r.put(remote, 1);
+        r.put(0, 2);
+    }
+    r.put(f.can_dlc, 4);
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        r.put(f.data[i], 8);
+    }
+    r.put(r.crc15(), 15);
+    int last = 0;
+    int run = 0;
+    auto const stuffed = r.stuff(0, r.bits.size(), last, run);
+    return static_cast<std::uint32_t>(r.bits.size()) + stuffed + 13;
+}
+
+canary::frame_bits
+reference_fd(::canfd_frame const& f)
+{
+    reference r;
+    auto const brs = (f.flags & CANFD_BRS) != 0;
+    auto const length = canary::fd_payload_length(f.len);
+    r.put(0, 1);
+    if (f.can_id & CAN_EFF_FLAG)
+    {
+        auto const id = f.can_id & CAN_EFF_MASK;
+        r.put(id >> 18, 11);
+        r.put(3, 2);
+        r.put(id, 18);
+        r.put(0, 1);
+    }
+    else
+    {
+        r.put(f.can_id & CAN_SFF_MASK, 11);
+        r.put(0, 2);
+    }
+    r.put(2, 2);
+    r.put(brs, 1);
+    auto const arbitration = r.bits.size();
+    r.put((f.flags & CANFD_ESI) != 0, 1);
+    r.put(canary::length_to_dlc(length), 4);
+    for (std::size_t i = 0; i < length; ++i)
+    {
+        r.put(f.data[i], 8);
+    }
+    int last = 0;
+    int run = 0;
+    auto const a = r.stuff(0, arbitration, last, run);
+    auto const d = r.stuff(arbitration, r.bits.size(), last, run);
+    canary::frame_bits bits;
+    bits.nominal = static_cast<std::uint32_t>(arbitration) + a + 13;
+    bits.data = static_cast<std::uint32_t>(r.bits.size() - arbitration) + d +
+                (length <= 16 ? 27 : 32);
+    if (!brs)
+    {
+        bits.nominal += bits.data;
+        bits.data = 0;
+    }
+    return bits;
+}
+
+void
+test_crc()
+{
+    // The check value of CRC-15/CAN.
+    std::uint8_t const data[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    BOOST_TEST_EQ(canary::detail::crc15(data, 72), 0x059Eu);
+
+    // Bit streams which do not end on a byte boundary.
+    reference r;
+    r.put(0x5A5, 11);
+    r.put(0x3, 2);
+    canary::detail::bit_writer w;
+    w.put(0x5A5, 11);
+    w.put(0x3, 2);
+    BOOST_TEST_EQ(canary::detail::crc15(w.data(), w.size()), r.crc15());
+}
+
+void
+test_worst_case()
+{
+    auto const worst = canary::stuffing::worst_case;
+    ::can_frame f{};
+    f.can_dlc = 8;
+    BOOST_TEST_EQ(count(f, worst).total(), 135u);
+    BOOST_TEST_EQ(count(f, worst).data, 0u);
+    f.can_id = CAN_EFF_FLAG;
+    BOOST_TEST_EQ(count(f, worst).total(), 160u);
+    f.can_dlc = 0;
+    BOOST_TEST_EQ(count(f, worst).total(), 80u);
+    f.can_id = 0;
+    BOOST_TEST_EQ(count(f, worst).total(), 55u);
+    // Remote frames carry no payload.
+    f.can_dlc = 8;
+    f.can_id = CAN_RTR_FLAG;
+    BOOST_TEST_EQ(count(f, worst).total(), 55u);
+
+    ::canfd_frame fd{};
+    fd.len = 64;
+    BOOST_TEST_EQ(count(fd, worst).nominal, 712u);
+    BOOST_TEST_EQ(count(fd, worst).data, 0u);
+    fd.flags = CANFD_BRS;
+    BOOST_TEST_EQ(count(fd, worst).nominal, 34u);
+    BOOST_TEST_EQ(count(fd, worst).data, 678u);
+    // Payloads are padded to a valid length, with a 17-bit CRC up to 16
+    // bytes.
+    fd.len = 10;
+    BOOST_TEST_EQ(count(fd, worst).total(),
+                  22u + 96 + (22 + 96 - 1) / 4 + 27 + 13);
+}
+
+void
+test_exact()
+{
+    std::mt19937 rng{1};
+    std::uniform_int_distribution<std::uint32_t> id{0, 0x1FFFFFFF};
+    std::uniform_int_distribution<int> byte{0, 255};
+    std::uniform_int_distribution<int> coin{0, 1};
+    for (int i = 0; i < 2000; ++i)
+    {
+        ::can_frame f{};
+        auto extended = coin(rng) != 0;
+        f.can_id = extended ? id(rng) | CAN_EFF_FLAG : id(rng) & CAN_SFF_MASK;
+        f.can_id |= i % 10 == 0 ? CAN_RTR_FLAG : 0;
+        f.can_dlc = static_cast<std::uint8_t>(i % 9);
+        for (auto& b : f.data)
+        {
+            // Runs of equal bits need stuffing.
+            b = static_cast<std::uint8_t>(i % 3 == 0 ? 0 : byte(rng));
+        }
+        auto const bits = count(f);
+        BOOST_TEST_EQ(bits.total(), reference_classic(f));
+        BOOST_TEST_LE(bits.total(),
+                      count(f, canary::stuffing::worst_case).total());
+
+        ::canfd_frame fd{};
+        extended = coin(rng) != 0;
+        fd.can_id = extended ? id(rng) | CAN_EFF_FLAG : id(rng) & CAN_SFF_MASK;
+        fd.flags = static_cast<std::uint8_t>(
+          (coin(rng) != 0 ? CANFD_BRS : 0) | (i % 7 == 0 ? CANFD_ESI : 0));
+        fd.len = static_cast<std::uint8_t>(i % 65);
+        for (auto& b : fd.data)
+        {
+            b = static_cast<std::uint8_t>(i % 3 == 0 ? 0xFF : byte(rng));
+        }
+        auto const fd_bits = count(fd);
+        auto const expected = reference_fd(fd);
+        BOOST_TEST_EQ(fd_bits.nominal, expected.nominal);
+        BOOST_TEST_EQ(fd_bits.data, expected.data);
+        BOOST_TEST_LE(fd_bits.total(),
+                      count(fd, canary::stuffing::worst_case).total());
+    }
+
+    // Error frames and other sizes are not counted.
+    ::can_frame e{};
+    e.can_id = CAN_ERR_FLAG;
+    BOOST_TEST_EQ(count(e).total(), 0u);
+    std::array<std::uint8_t, 20> other{};
+    BOOST_TEST_EQ(canary::count_frame_bits(net::buffer(other)).total(), 0u);
+}
+
+void
+test_duration()
+{
+    canary::frame_bits bits;
+    bits.nominal = 100;
+    bits.data = 400;
+    canary::bit_timing timing;
+    timing.nominal_bitrate = 500000;
+    timing.data_bitrate = 2000000;
+    BOOST_TEST(canary::frame_duration(bits, timing) ==
+               std::chrono::microseconds{400});
+    timing.data_bitrate = 0;
+    BOOST_TEST(canary::frame_duration(bits, timing) ==
+               std::chrono::microseconds{1000});
+}
+
+canary::timestamp
+at(milliseconds ms)
+{
+    return canary::timestamp{ms};
+}
+
+void
+test_monitor()
+{
+    canary::bus_load_monitor::options opts;
+    opts.timing.nominal_bitrate = 1000000;
+    opts.window = std::chrono::seconds{1};
+    opts.buckets = 10;
+    canary::bus_load_monitor monitor{opts};
+    canary::bit_timing slow;
+    slow.nominal_bitrate = 125000;
+    monitor.timing(2, slow);
+
+    ::can_frame a{};
+    a.can_id = 0x100;
+    a.can_dlc = 8;
+    auto b = a;
+    b.can_id = 0x200;
+    b.can_dlc = 0;
+    std::uint64_t a_ns = 0;
+    std::uint64_t b_ns = 0;
+    for (int ms = 0; ms < 1000; ++ms)
+    {
+        auto const bits = monitor.add(net::buffer(&a, sizeof(a)),
+                                      at(milliseconds{ms}));
+        a_ns += bits.total() * 1000u;
+        if (ms % 2 == 0)
+        {
+            b_ns += monitor.add(net::buffer(&b, sizeof(b)),
+                                at(milliseconds{ms}))
+                      .total() *
+                    1000u;
+        }
+    }
+    monitor.add(net::buffer(&a, sizeof(a)), at(milliseconds{0}), 2);
+
+    auto const now = at(milliseconds{999});
+    auto const total = static_cast<double>(a_ns + b_ns) / 1e9;
+    BOOST_TEST(std::abs(monitor.load(0, now) - total) < 1e-9);
+    BOOST_TEST(std::abs(monitor.load(0, 0x100, false, now) -
+                        static_cast<double>(a_ns) / 1e9) < 1e-9);
+    BOOST_TEST_EQ(monitor.load(0, 0x100, true, now), 0.0);
+    BOOST_TEST_EQ(monitor.frames(0), 1500u);
+    BOOST_TEST_GT(monitor.bits(0), 1500u * 47);
+
+    auto const loads = monitor.id_loads(0, now);
+    BOOST_TEST_EQ(loads.size(), 2u);
+    BOOST_TEST_EQ(loads[0].id, 0x100u);
+    BOOST_TEST(!loads[0].extended);
+    BOOST_TEST_EQ(loads[1].id, 0x200u);
+    BOOST_TEST_GT(loads[0].load, loads[1].load);
+
+    // The interface with a lower bit rate is busy for longer.
+    auto const slow_bits = canary::count_frame_bits(net::buffer(&a, sizeof(a)));
+    BOOST_TEST(std::abs(monitor.load(2, now) -
+                        slow_bits.total() * 8e-6) < 1e-9);
+
+    // The window slides in steps of 100ms.
+    auto const later = monitor.load(0, at(milliseconds{1450}));
+    BOOST_TEST_GT(later, 0.0);
+    BOOST_TEST_LT(later, monitor.load(0, now));
+    BOOST_TEST_EQ(monitor.load(0, at(milliseconds{2000})), 0.0);
+    BOOST_TEST_EQ(monitor.load(1, now), 0.0);
+    BOOST_TEST(monitor.id_loads(0, at(milliseconds{5000})).empty());
+
+    opts.buckets = 0;
+    BOOST_TEST_THROWS(canary::bus_load_monitor{opts}, canary::system_error);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep =
+      canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    rx.set_option(canary::receive_timestamp{true});
+
+    ::can_frame f{};
+    f.can_id = 0x123;
+    f.can_dlc = 8;
+    for (int i = 0; i < 10; ++i)
+    {
+        tx.send(net::buffer(&f, sizeof(f)));
+    }
+
+    canary::bus_load_monitor monitor;
+    auto const index = rx.local_endpoint().interface_index();
+    canary::timestamp ts;
+    for (int i = 0; i < 10; ++i)
+    {
+        auto const n =
+          canary::receive_timestamped(rx, net::buffer(&f, sizeof(f)), ts);
+        monitor.add(net::buffer(&f, n), ts, index);
+    }
+    BOOST_TEST_EQ(monitor.frames(index), 10u);
+    BOOST_TEST_GT(monitor.load(index, ts), 0.0);
+    BOOST_TEST_GT(monitor.load(index, 0x123, false, ts), 0.0);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_crc();
+    test_worst_case();
+    test_exact();
+    test_duration();
+    test_monitor();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,149 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/cannelloni.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <linux/can.h>
+
+namespace
+{
+
+namespace net = canary::net;
+
+// Encoding of the frames used below, as produced by cannelloni.
+std::uint8_t const expected[] = {
+  // Header: version, operation code, sequence number, frame count.
+  2, 0, 7, 0, 3,
+  // Classic frame, ID 0x123, 2 bytes of payload.
+  0x00, 0x00, 0x01, 0x23, 2, 0xAA, 0xBB,
+  // Extended format remote transmission request, no payload.
+  0xC1, 0x23, 0x45, 0x67, 4,
+  // CAN FD frame with BRS, 12 bytes of payload.
+  0x00, 0x00, 0x07, 0xFF, 0x80 | 12, CANFD_BRS,
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+
+void
+test_write()
+{
+    ::can_frame classic{};
+    classic.can_id = 0x123;
+    classic.can_dlc = 2;
+    classic.data[0] = 0xAA;
+    classic.data[1] = 0xBB;
+    ::can_frame rtr{};
+    rtr.can_id = CAN_EFF_FLAG | CAN_RTR_FLAG | 0x1234567;
+    rtr.can_dlc = 4;
+    ::canfd_frame fd{};
+    fd.can_id = 0x7FF;
+    fd.len = 12;
+    fd.flags = CANFD_BRS;
+    for (std::uint8_t i = 0; i < 12; ++i)
+    {
+        fd.data[i] = i;
+    }
+
+    std::array<std::uint8_t, sizeof(expected)> datagram{};
+    canary::cannelloni::writer w{net::buffer(datagram)};
+    BOOST_TEST(w.empty());
+    BOOST_TEST(w.append(net::buffer(&classic, sizeof(classic))));
+    BOOST_TEST(w.append(net::buffer(&rtr, sizeof(rtr))));
+    BOOST_TEST(w.append(net::buffer(&fd, sizeof(fd))));
+    BOOST_TEST_EQ(w.frames(), 3u);
+    BOOST_TEST_EQ(w.finish(7), sizeof(expected));
+    BOOST_TEST(std::equal(datagram.begin(), datagram.end(), expected));
+
+    // Full.
+    BOOST_TEST_NOT(w.append(net::buffer(&classic, sizeof(classic))));
+    BOOST_TEST_EQ(w.frames(), 3u);
+    w.reset();
+    BOOST_TEST(w.empty());
+    BOOST_TEST_EQ(w.size(), canary::cannelloni::header_size);
+}
+
+void
+test_read()
+{
+    canary::error_code ec;
+    canary::cannelloni::reader r{net::buffer(expected), ec};
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(r.sequence(), 7u);
+    BOOST_TEST_EQ(r.remaining(), 3u);
+
+    ::canfd_frame f{};
+    auto const buf = net::buffer(&f, sizeof(f));
+    BOOST_TEST_EQ(r.next(buf, ec), canary::classic_frame_size);
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(f.can_id, 0x123u);
+    BOOST_TEST_EQ(f.len, 2u);
+    BOOST_TEST_EQ(f.data[1], 0xBBu);
+
+    BOOST_TEST_EQ(r.next(buf, ec), canary::classic_frame_size);
+    BOOST_TEST_EQ(f.can_id, CAN_EFF_FLAG | CAN_RTR_FLAG | 0x1234567u);
+    BOOST_TEST_EQ(f.len, 4u);
+    BOOST_TEST_EQ(f.data[0], 0u);
+
+    BOOST_TEST_EQ(r.next(buf, ec), canary::fd_frame_size);
+    BOOST_TEST_EQ(f.can_id, 0x7FFu);
+    BOOST_TEST_EQ(f.len, 12u);
+    BOOST_TEST_EQ(f.flags, CANFD_BRS);
+    BOOST_TEST_EQ(f.data[11], 11u);
+
+    BOOST_TEST_EQ(r.next(buf, ec), 0u);
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(r.remaining(), 0u);
+}
+
+void
+test_invalid()
+{
+    canary::error_code ec;
+    canary::cannelloni::reader{net::buffer(expected, 4), ec};
+    BOOST_TEST(ec == net::error::message_size);
+
+    auto bad = std::array<std::uint8_t, sizeof(expected)>{};
+    std::memcpy(bad.data(), expected, sizeof(expected));
+    bad[0] = 1;
+    canary::cannelloni::reader{net::buffer(bad), ec};
+    BOOST_TEST(ec == net::error::operation_not_supported);
+
+    // Truncated in the payload of the last frame.
+    ::canfd_frame f{};
+    canary::cannelloni::reader r{net::buffer(expected, sizeof(expected) - 1),
+                                 ec};
+    BOOST_TEST(!ec);
+    r.next(net::buffer(&f, sizeof(f)), ec);
+    r.next(net::buffer(&f, sizeof(f)), ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(r.next(net::buffer(&f, sizeof(f)), ec), 0u);
+    BOOST_TEST(ec == net::error::message_size);
+
+    // Classic frame with a payload length above 8.
+    std::memcpy(bad.data(), expected, sizeof(expected));
+    bad[9] = 9;
+    canary::cannelloni::reader r2{net::buffer(bad), ec};
+    BOOST_TEST_EQ(r2.next(net::buffer(&f, sizeof(f)), ec), 0u);
+    BOOST_TEST(ec == net::error::message_size);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_write();
+    test_read();
+    test_invalid();
+    return boost::report_errors();
+}
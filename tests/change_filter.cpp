@@ -0,0 +1,171 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/change_filter.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <linux/can.h>
+
+namespace
+{
+
+namespace net = canary::net;
+using std::chrono::milliseconds;
+
+canary::timestamp
+at(milliseconds ms)
+{
+    return canary::timestamp{ms};
+}
+
+template<class Frame>
+bool
+accept(canary::change_filter& filter,
+       Frame const& f,
+       milliseconds ms = milliseconds{0},
+       unsigned int interface_index = 0)
+{
+    return filter.accept(net::buffer(&f, sizeof(f)), at(ms), interface_index);
+}
+
+void
+test_changes()
+{
+    canary::change_filter filter;
+    ::can_frame f{};
+    f.can_id = 0x100;
+    f.can_dlc = 8;
+    BOOST_TEST(accept(filter, f));
+    BOOST_TEST(!accept(filter, f));
+    f.data[7] = 1;
+    BOOST_TEST(accept(filter, f));
+    BOOST_TEST(!accept(filter, f));
+
+    f.can_dlc = 4;
+    BOOST_TEST(accept(filter, f));
+    f.can_id |= CAN_RTR_FLAG;
+    BOOST_TEST(accept(filter, f));
+    BOOST_TEST(!accept(filter, f));
+
+    // The same ID on another interface, and as an extended ID, is tracked
+    // separately.
+    BOOST_TEST(accept(filter, f, milliseconds{0}, 2));
+    BOOST_TEST(!accept(filter, f, milliseconds{0}, 2));
+    ::can_frame e{};
+    e.can_id = 0x100 | CAN_EFF_FLAG;
+    e.can_dlc = 8;
+    BOOST_TEST(accept(filter, e));
+
+    BOOST_TEST_EQ(filter.passed(), 6u);
+    BOOST_TEST_EQ(filter.suppressed(), 4u);
+
+    filter.reset();
+    BOOST_TEST(accept(filter, f));
+}
+
+void
+test_fd()
+{
+    canary::change_filter filter;
+    ::canfd_frame f{};
+    f.can_id = 0x200;
+    f.len = 64;
+    BOOST_TEST(accept(filter, f));
+    BOOST_TEST(!accept(filter, f));
+    f.data[63] = 0x80;
+    BOOST_TEST(accept(filter, f));
+    f.flags = CANFD_BRS;
+    BOOST_TEST(accept(filter, f));
+    BOOST_TEST(!accept(filter, f));
+
+    // A classic frame with the same header and payload is a change.
+    ::can_frame c{};
+    c.can_id = 0x200;
+    c.can_dlc = 8;
+    ::canfd_frame g{};
+    g.can_id = 0x200;
+    g.len = 8;
+    BOOST_TEST(accept(filter, g));
+    BOOST_TEST(accept(filter, c));
+}
+
+void
+test_mask()
+{
+    canary::change_filter filter;
+    ::can_frame f{};
+    f.can_id = 0x300;
+    f.can_dlc = 8;
+    BOOST_TEST(accept(filter, f));
+
+    // Only the first byte, and the low nibble of the second, are compared.
+    std::array<std::uint8_t, 2> const mask{{0xFF, 0x0F}};
+    filter.mask(0x300, false, net::buffer(mask));
+    f.data[1] = 0xF0;
+    BOOST_TEST(!accept(filter, f));
+    f.data[1] = 0xF1;
+    BOOST_TEST(accept(filter, f));
+    f.data[0] = 0x01;
+    BOOST_TEST(accept(filter, f));
+    // Bytes beyond the mask are compared in full.
+    f.data[2] = 0x01;
+    BOOST_TEST(accept(filter, f));
+
+    // The mask applies to IDs seen later, on any interface.
+    BOOST_TEST(accept(filter, f, milliseconds{0}, 3));
+    f.data[1] = 0x31;
+    BOOST_TEST(!accept(filter, f, milliseconds{0}, 3));
+}
+
+void
+test_keep_alive()
+{
+    canary::change_filter::options opts;
+    opts.keep_alive = milliseconds{100};
+    canary::change_filter filter{opts};
+    ::can_frame f{};
+    f.can_id = 0x400;
+    f.can_dlc = 8;
+    BOOST_TEST(accept(filter, f, milliseconds{0}));
+    BOOST_TEST(!accept(filter, f, milliseconds{50}));
+    BOOST_TEST(!accept(filter, f, milliseconds{99}));
+    BOOST_TEST(accept(filter, f, milliseconds{100}));
+    BOOST_TEST(!accept(filter, f, milliseconds{150}));
+    BOOST_TEST(accept(filter, f, milliseconds{200}));
+}
+
+void
+test_passthrough()
+{
+    canary::change_filter filter;
+    ::can_frame e{};
+    e.can_id = 0x001 | CAN_ERR_FLAG;
+    e.can_dlc = 8;
+    BOOST_TEST(accept(filter, e));
+    BOOST_TEST(accept(filter, e));
+    std::array<std::uint8_t, 20> other{};
+    BOOST_TEST(filter.accept(net::buffer(other), at(milliseconds{0})));
+    BOOST_TEST(filter.accept(net::buffer(other), at(milliseconds{0})));
+    BOOST_TEST_EQ(filter.suppressed(), 0u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_changes();
+    test_fd();
+    test_mask();
+    test_keep_alive();
+    test_passthrough();
+    return boost::report_errors();
+}
@@ -0,0 +1,326 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/cycle_supervisor.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <linux/can.h>
+#include <random>
+#include <utility>
+
+namespace
+{
+
+namespace net = canary::net;
+using clock = canary::cycle_supervisor::clock;
+using std::chrono::hours;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+::can_frame
+make_frame(std::uint32_t id, bool extended = false)
+{
+    ::can_frame f{};
+    f.can_id = extended ? id | CAN_EFF_FLAG : id;
+    f.can_dlc = 8;
+    return f;
+}
+
+bool
+update(canary::cycle_supervisor& sup,
+       std::uint32_t id,
+       clock::time_point now,
+       unsigned int interface_index = 0)
+{
+    auto const f = make_frame(id);
+    return sup.update(net::buffer(&f, sizeof(f)), interface_index, now);
+}
+
+struct recorder
+{
+    explicit recorder(canary::cycle_supervisor& sup)
+    {
+        sup.on_event(
+          [this](canary::cycle_event e, canary::cycle_status const& s) {
+              events.emplace_back(e, s);
+          });
+    }
+
+    std::vector<std::pair<canary::cycle_event, canary::cycle_status>> events;
+};
+
+// Frames within the timeout keep an ID running, a missing frame raises a
+// timeout after 3 periods, and the next frame a recovery.
+void
+test_timeout_recovery()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor sup{ioc};
+    recorder r{sup};
+    auto const t0 = clock::now();
+    sup.supervise(0, 0x100, false, milliseconds{10}, t0);
+    BOOST_TEST_EQ(sup.size(), 1u);
+
+    BOOST_TEST(update(sup, 0x100, t0 + milliseconds{10}));
+    BOOST_TEST(update(sup, 0x100, t0 + milliseconds{20}));
+    BOOST_TEST(!update(sup, 0x101, t0 + milliseconds{20}));
+    BOOST_TEST(!update(sup, 0x100, t0 + milliseconds{20}, 1));
+    sup.advance(t0 + milliseconds{49});
+    BOOST_TEST(r.events.empty());
+
+    sup.advance(t0 + milliseconds{52});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+    BOOST_TEST(r.events[0].first == canary::cycle_event::timeout);
+    BOOST_TEST_EQ(r.events[0].second.id, 0x100u);
+    BOOST_TEST(r.events[0].second.period == milliseconds{10});
+    BOOST_TEST(r.events[0].second.last_seen == t0 + milliseconds{20});
+    BOOST_TEST_EQ(r.events[0].second.timeouts, 1u);
+    BOOST_TEST(sup.timed_out(0, 0x100, false));
+    BOOST_TEST_EQ(sup.timed_out(), 1u);
+
+    // A timed out ID raises a single timeout.
+    sup.advance(t0 + seconds{1});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+
+    BOOST_TEST(update(sup, 0x100, t0 + seconds{1}));
+    BOOST_TEST_EQ(r.events.size(), 2u);
+    BOOST_TEST(r.events[1].first == canary::cycle_event::recovery);
+    BOOST_TEST(!sup.timed_out(0, 0x100, false));
+    BOOST_TEST_EQ(sup.timed_out(), 0u);
+    BOOST_TEST_EQ(sup.timeouts(), 1u);
+    BOOST_TEST_EQ(sup.recoveries(), 1u);
+
+    sup.advance(t0 + seconds{1} + milliseconds{29});
+    BOOST_TEST_EQ(r.events.size(), 2u);
+    sup.advance(t0 + seconds{1} + milliseconds{32});
+    BOOST_TEST_EQ(r.events.size(), 3u);
+    BOOST_TEST_EQ(r.events[2].second.timeouts, 2u);
+}
+
+// IDs are kept apart by interface and format. An ID which is never
+// received times out one timeout after supervision started, and removed
+// IDs raise no events.
+void
+test_keys()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor::options opts;
+    opts.timeout_factor = 2.0;
+    canary::cycle_supervisor sup{ioc, opts};
+    recorder r{sup};
+    auto const t0 = clock::now();
+    sup.supervise(0, 0x10, false, milliseconds{100}, t0);
+    sup.supervise(0, 0x10, true, milliseconds{100}, t0);
+    sup.supervise(1, 0x10, false, milliseconds{100}, t0);
+    sup.supervise(1, 0x20, false, milliseconds{100}, t0);
+    BOOST_TEST_EQ(sup.size(), 4u);
+    BOOST_TEST(sup.unsupervise(1, 0x20, false));
+    BOOST_TEST(!sup.unsupervise(1, 0x20, false));
+    BOOST_TEST_EQ(sup.size(), 3u);
+
+    auto const ext = make_frame(0x10, true);
+    BOOST_TEST(
+      sup.update(net::buffer(&ext, sizeof(ext)), 0, t0 + milliseconds{150}));
+    BOOST_TEST(update(sup, 0x10, t0 + milliseconds{150}, 1));
+    auto err = make_frame(0x10);
+    err.can_id |= CAN_ERR_FLAG;
+    BOOST_TEST(!sup.update(net::buffer(&err, sizeof(err)), 0, t0));
+
+    sup.advance(t0 + milliseconds{250});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+    BOOST_TEST_EQ(r.events[0].second.interface_index, 0u);
+    BOOST_TEST(!r.events[0].second.extended);
+    BOOST_TEST(r.events[0].second.last_seen == t0);
+    BOOST_TEST(!sup.timed_out(0, 0x10, true));
+
+    // A removed ID may be supervised again.
+    sup.supervise(1, 0x20, false, milliseconds{10}, t0 + milliseconds{250});
+    BOOST_TEST_EQ(sup.size(), 4u);
+    sup.advance(t0 + milliseconds{400});
+    BOOST_TEST_EQ(r.events.size(), 4u);
+    BOOST_TEST_EQ(sup.timed_out(), 4u);
+
+    BOOST_TEST(sup.unsupervise(0, 0x10, false));
+    BOOST_TEST_EQ(sup.timed_out(), 3u);
+    BOOST_TEST(!update(sup, 0x10, t0 + milliseconds{400}));
+}
+
+// Timeouts beyond the first levels of the wheel, and beyond its horizon,
+// are neither raised early nor late.
+void
+test_long_periods()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor sup{ioc};
+    recorder r{sup};
+    auto const t0 = clock::now();
+    sup.supervise(0, 0x1, false, seconds{10}, t0);
+    sup.supervise(0, 0x2, false, hours{8}, t0);
+
+    for (auto t = t0; t < t0 + seconds{29}; t += milliseconds{700})
+    {
+        sup.advance(t);
+    }
+    BOOST_TEST(r.events.empty());
+    sup.advance(t0 + seconds{30} + milliseconds{2});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+
+    sup.advance(t0 + hours{23});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+    sup.advance(t0 + hours{24} - milliseconds{1});
+    BOOST_TEST_EQ(r.events.size(), 1u);
+    sup.advance(t0 + hours{24} + milliseconds{2});
+    BOOST_TEST_EQ(r.events.size(), 2u);
+    BOOST_TEST_EQ(r.events[1].second.id, 0x2u);
+}
+
+// Random periods, frames and advances, against the definition: an ID times
+// out once its deadline passed, at most one tick late.
+void
+test_random()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor::options opts;
+    opts.capacity = 1024;
+    canary::cycle_supervisor sup{ioc, opts};
+    auto const t0 = clock::now();
+    std::mt19937 rng{5};
+    std::uniform_int_distribution<int> period_ms{1, 2000};
+    constexpr std::uint32_t ids = 500;
+    std::vector<milliseconds> timeout(ids);
+    std::vector<clock::time_point> last(ids, t0);
+    std::vector<bool> timed_out(ids, false);
+    for (std::uint32_t id = 0; id < ids; ++id)
+    {
+        milliseconds const p{period_ms(rng)};
+        timeout[id] = 3 * p;
+        sup.supervise(0, id, false, p, t0);
+    }
+
+    std::size_t errors = 0;
+    sup.on_event([&](canary::cycle_event e, canary::cycle_status const& s) {
+        if (e == canary::cycle_event::timeout)
+        {
+            errors += timed_out[s.id] ? 1 : 0;
+            timed_out[s.id] = true;
+        }
+    });
+    auto now = t0;
+    std::uniform_int_distribution<int> step_us{0, 20000};
+    std::uniform_int_distribution<std::uint32_t> pick{0, 4 * ids};
+    for (int i = 0; i < 20000; ++i)
+    {
+        now += std::chrono::microseconds{step_us(rng)};
+        auto const id = pick(rng);
+        if (id < ids)
+        {
+            update(sup, id, now);
+            timed_out[id] = false;
+            last[id] = now;
+        }
+        sup.advance(now);
+        for (std::uint32_t k = 0; k < ids; ++k)
+        {
+            auto const deadline = last[k] + timeout[k];
+            if (now < deadline)
+            {
+                errors += timed_out[k] ? 1 : 0;
+            }
+            else if (now >= deadline + opts.resolution)
+            {
+                errors += timed_out[k] ? 0 : 1;
+            }
+        }
+    }
+    BOOST_TEST_EQ(errors, 0u);
+    BOOST_TEST_GT(sup.timeouts(), 100u);
+    BOOST_TEST_GT(sup.recoveries(), 100u);
+}
+
+void
+test_options()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor::options opts;
+    opts.capacity = 2;
+    canary::cycle_supervisor sup{ioc, opts};
+    sup.supervise(0, 1, false, milliseconds{1});
+    sup.supervise(0, 2, false, milliseconds{1});
+    sup.supervise(0, 2, false, milliseconds{2});
+    BOOST_TEST_THROWS(sup.supervise(0, 3, false, milliseconds{1}),
+                      canary::system_error);
+    BOOST_TEST_THROWS(sup.supervise(0, 1, false, milliseconds{0}),
+                      canary::system_error);
+
+    auto const invalid = [&](canary::cycle_supervisor::options const& o) {
+        BOOST_TEST_THROWS((canary::cycle_supervisor{ioc, o}),
+                          canary::system_error);
+    };
+    auto o = canary::cycle_supervisor::options{};
+    o.capacity = 3;
+    invalid(o);
+    o = canary::cycle_supervisor::options{};
+    o.timeout_factor = 0.5;
+    invalid(o);
+    o = canary::cycle_supervisor::options{};
+    o.resolution = std::chrono::nanoseconds{0};
+    invalid(o);
+}
+
+// The timer of the supervisor raises timeouts without calls to `advance`.
+void
+test_timer()
+{
+    net::io_context ioc{1};
+    canary::cycle_supervisor sup{ioc};
+    auto const start = clock::now();
+    clock::time_point raised;
+    sup.on_event([&](canary::cycle_event e, canary::cycle_status const& s) {
+        BOOST_TEST(e == canary::cycle_event::timeout);
+        BOOST_TEST_EQ(s.id, 0x5u);
+        raised = clock::now();
+        sup.unsupervise(0, 0x5, false);
+    });
+    sup.supervise(0, 0x5, false, milliseconds{5});
+    sup.supervise(0, 0x6, false, milliseconds{20});
+    net::steady_timer feed{ioc};
+    std::function<void()> send = [&] {
+        update(sup, 0x6, clock::now());
+        if (clock::now() - start < milliseconds{100})
+        {
+            feed.expires_after(milliseconds{5});
+            feed.async_wait([&](canary::error_code) { send(); });
+        }
+        else
+        {
+            sup.unsupervise(0, 0x6, false);
+        }
+    };
+    send();
+    ioc.run();
+    BOOST_TEST(raised - start >= milliseconds{15});
+    BOOST_TEST_EQ(sup.timeouts(), 1u);
+    BOOST_TEST_EQ(sup.size(), 0u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_timeout_recovery();
+    test_keys();
+    test_long_periods();
+    test_random();
+    test_options();
+    test_timer();
+    return boost::report_errors();
+}
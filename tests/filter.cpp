@@ -101,11 +101,36 @@ test_layout()
     BOOST_TEST_EQ(native_filter.can_mask, 0xADAD);
     BOOST_TEST_NOT(filter.negation());
 }
+
+void
+test_matches()
+{
+    BOOST_TEST(canary::filter{}.matches(0x123));
+    BOOST_TEST(canary::filter{}.matches(CAN_EFF_FLAG | 0x1234567));
+
+    auto f = canary::filter{}.id(0x120).id_mask(0x7F0);
+    BOOST_TEST(f.matches(0x120));
+    BOOST_TEST(f.matches(0x12F));
+    BOOST_TEST_NOT(f.matches(0x130));
+    BOOST_TEST(f.matches(CAN_RTR_FLAG | 0x125));
+
+    f.remote_transmission(false);
+    BOOST_TEST_NOT(f.matches(CAN_RTR_FLAG | 0x125));
+    f.clear_remote_transmission().extended_format(true);
+    BOOST_TEST_NOT(f.matches(0x125));
+    BOOST_TEST(f.matches(CAN_EFF_FLAG | 0x125));
+
+    f.negation(true);
+    BOOST_TEST(f.matches(0x125));
+    BOOST_TEST_NOT(f.matches(CAN_EFF_FLAG | 0x125));
+}
+
 } // namespace
 
 int
 main()
 {
     test_layout();
+    test_matches();
     return boost::report_errors();
 }
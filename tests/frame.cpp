@@ -0,0 +1,351 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/frame.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+// One buffer per frame, each large enough for any frame.
+using pool = std::vector<::canfd_frame>;
+
+void
+test_parse()
+{
+    ::canfd_frame buf{};
+    buf.can_id = 0x10;
+    buf.len = 5;
+    canary::error_code ec;
+    auto f = canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), canary::classic_frame_size, ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::classic);
+    BOOST_TEST(static_cast<void const*>(f.header) == &buf);
+    BOOST_TEST(f.payload.data() == buf.data);
+    BOOST_TEST_EQ(f.payload.size(), 5u);
+
+    buf.len = 64;
+    f = canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), canary::fd_frame_size, ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::fd);
+    BOOST_TEST_EQ(f.payload.size(), 64u);
+
+    // Payload length inconsistent with the size.
+    canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), canary::classic_frame_size, ec);
+    BOOST_TEST(ec == net::error::message_size);
+    // Neither a classic nor an FD frame.
+    canary::parse_frame(net::buffer(&buf, sizeof(buf)), 20, ec);
+    BOOST_TEST(ec == net::error::message_size);
+    // Buffer smaller than the frame.
+    canary::parse_frame(
+      net::buffer(&buf, canary::classic_frame_size), canary::fd_frame_size, ec);
+    BOOST_TEST(ec == net::error::message_size);
+}
+
+// Classic and FD frames interleaved on one socket, received into a pool of
+// FD sized buffers.
+void
+test_mixed_receive()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    for (std::uint32_t i = 0; i < 6; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            ::can_frame f{};
+            f.can_id = i;
+            f.can_dlc = 8;
+            f.data[7] = static_cast<std::uint8_t>(i);
+            a.send(net::buffer(&f, sizeof(f)));
+        }
+        else
+        {
+            ::canfd_frame f{};
+            f.can_id = i;
+            f.len = static_cast<std::uint8_t>(canary::fd_payload_length(40));
+            f.flags = CANFD_BRS;
+            f.data[47] = static_cast<std::uint8_t>(i);
+            a.send(net::buffer(&f, sizeof(f)));
+        }
+    }
+
+    pool buffers(6);
+    canary::error_code ec;
+    for (std::uint32_t i = 0; i < 3; ++i)
+    {
+        auto const f = canary::receive_frame(
+          b, net::buffer(&buffers[i], sizeof(::canfd_frame)), ec);
+        BOOST_TEST(!ec);
+        BOOST_TEST_EQ(f.header->id(), i);
+    }
+
+    std::vector<canary::frame_format> formats;
+    std::function<void(canary::error_code, canary::received_frame)> next;
+    std::uint32_t i = 3;
+    next = [&](canary::error_code ec, canary::received_frame f) {
+        BOOST_TEST(!ec);
+        BOOST_TEST(static_cast<void const*>(f.header) == &buffers[i]);
+        BOOST_TEST_EQ(f.header->id(), i);
+        formats.push_back(f.format);
+        if (++i < buffers.size())
+        {
+            canary::async_receive_frame(
+              b, net::buffer(&buffers[i], sizeof(::canfd_frame)), next);
+        }
+    };
+    canary::async_receive_frame(
+      b, net::buffer(&buffers[i], sizeof(::canfd_frame)), next);
+    ioc.run();
+    BOOST_TEST((formats == std::vector<canary::frame_format>{
+                             canary::frame_format::fd,
+                             canary::frame_format::classic,
+                             canary::frame_format::fd}));
+
+    for (std::uint32_t j = 0; j < buffers.size(); ++j)
+    {
+        auto const& f = buffers[j];
+        BOOST_TEST_EQ(f.can_id, j);
+        if (j % 2 == 0)
+        {
+            BOOST_TEST_EQ(f.len, 8u);
+            BOOST_TEST_EQ(f.data[7], j);
+            BOOST_TEST_NOT(f.flags & CANFD_BRS);
+        }
+        else
+        {
+            BOOST_TEST_EQ(f.len, 48u);
+            BOOST_TEST_EQ(f.data[47], j);
+            BOOST_TEST(f.flags & CANFD_BRS);
+        }
+    }
+}
+
+void
+test_parse_xl()
+{
+    canary::xl_frame buf{};
+    buf.header.priority(0x42);
+    buf.header.payload_length(3);
+    buf.payload[2] = 0xAB;
+    canary::error_code ec;
+    auto const f = canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), sizeof(canary::xl_frame_header) + 3, ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::xl);
+    BOOST_TEST(f.header == nullptr);
+    BOOST_TEST(f.xl_header == &buf.header);
+    BOOST_TEST_EQ(f.payload.size(), 3u);
+    BOOST_TEST_EQ(static_cast<std::uint8_t const*>(f.payload.data())[2], 0xABu);
+
+    // An XL frame with 4 bytes of payload is as large as a classic frame.
+    buf.header.payload_length(4);
+    auto const g = canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), canary::classic_frame_size, ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(g.format == canary::frame_format::xl);
+
+    // Size inconsistent with the payload length.
+    canary::parse_frame(
+      net::buffer(&buf, sizeof(buf)), sizeof(canary::xl_frame_header) + 5, ec);
+    BOOST_TEST(ec == net::error::message_size);
+}
+
+void
+test_pool()
+{
+    canary::frame_pool pool{2, canary::xl_frame_max_size};
+    BOOST_TEST_GE(pool.buffer_size(), canary::xl_frame_max_size);
+    BOOST_TEST_EQ(pool.available(), 2u);
+
+    auto a = pool.acquire();
+    auto b = pool.acquire();
+    BOOST_TEST(a && b);
+    BOOST_TEST(a.data().data() != b.data().data());
+    BOOST_TEST_EQ(a.data().size(), pool.buffer_size());
+    BOOST_TEST_EQ(reinterpret_cast<std::uintptr_t>(a.data().data()) %
+                    alignof(canary::xl_frame_header),
+                  0u);
+
+    auto c = pool.acquire();
+    BOOST_TEST_NOT(c);
+    BOOST_TEST_EQ(c.data().size(), 0u);
+
+    auto const p = a.data().data();
+    c = std::move(a);
+    BOOST_TEST_NOT(a);
+    BOOST_TEST(c.data().data() == p);
+    c.release();
+    BOOST_TEST_EQ(pool.available(), 1u);
+    {
+        auto d = pool.acquire();
+        BOOST_TEST(d.data().data() == p);
+    }
+    BOOST_TEST_EQ(pool.available(), 1u);
+}
+
+// All three formats received into pooled buffers from one socket.
+void
+test_pooled_mixed_receive()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    ::can_frame c{};
+    c.can_id = 1;
+    c.can_dlc = 8;
+    a.send(net::buffer(&c, sizeof(c)));
+    ::canfd_frame fd{};
+    fd.can_id = 2;
+    fd.len = 64;
+    a.send(net::buffer(&fd, sizeof(fd)));
+    canary::xl_frame xl{};
+    xl.header.priority(3);
+    xl.header.payload_length(1000);
+    a.send(net::buffer(&xl, sizeof(xl.header) + 1000));
+
+    canary::frame_pool pool{4, canary::xl_frame_max_size};
+    std::vector<canary::frame_pool::buffer> held;
+    std::vector<canary::frame_format> formats;
+    std::function<void(canary::error_code, canary::received_frame)> next;
+    auto start = [&] {
+        held.push_back(pool.acquire());
+        canary::async_receive_frame(b, held.back().data(), next);
+    };
+    next = [&](canary::error_code ec, canary::received_frame f) {
+        BOOST_TEST(!ec);
+        formats.push_back(f.format);
+        if (formats.size() < 3)
+        {
+            start();
+        }
+    };
+    start();
+    ioc.run();
+
+    BOOST_TEST((formats == std::vector<canary::frame_format>{
+                             canary::frame_format::classic,
+                             canary::frame_format::fd,
+                             canary::frame_format::xl}));
+    BOOST_TEST_EQ(pool.available(), 1u);
+    auto const last = static_cast<canary::xl_frame_header const*>(
+      held.back().data().data());
+    BOOST_TEST_EQ(last->priority(), 3u);
+    BOOST_TEST_EQ(last->payload_length(), 1000u);
+    held.clear();
+    BOOST_TEST_EQ(pool.available(), 4u);
+}
+
+void
+test_raw_socket_xl()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    canary::error_code ec;
+    tx.set_option(canary::xl_frames{}, ec);
+    if (!ec)
+    {
+        rx.set_option(canary::xl_frames{});
+        rx.set_option(canary::flexible_data_rate{});
+        canary::xl_frame xl{};
+        xl.header.priority(0x10);
+        xl.header.payload_length(512);
+        tx.send(net::buffer(&xl, sizeof(xl.header) + 512), 0, ec);
+    }
+    if (ec)
+    {
+        // Requires Linux 6.2, and an interface with a CAN XL MTU.
+        std::cerr << "CAN XL not supported on vcan0: " << ec.message() << '\n';
+        return;
+    }
+    ::can_frame c{};
+    c.can_id = 0x20;
+    tx.send(net::buffer(&c, sizeof(c)));
+
+    canary::frame_pool pool{2, canary::xl_frame_max_size};
+    auto first = pool.acquire();
+    auto f = canary::receive_frame(rx, first.data(), ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::xl);
+    BOOST_TEST_EQ(f.payload.size(), 512u);
+    auto second = pool.acquire();
+    f = canary::receive_frame(rx, second.data(), ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::classic);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    tx.set_option(canary::flexible_data_rate{});
+    rx.set_option(canary::flexible_data_rate{});
+
+    ::can_frame c{};
+    c.can_id = 0x1;
+    c.can_dlc = 8;
+    tx.send(net::buffer(&c, sizeof(c)));
+    ::canfd_frame fd{};
+    fd.can_id = 0x2;
+    fd.len = 64;
+    fd.flags = CANFD_BRS;
+    tx.send(net::buffer(&fd, sizeof(fd)));
+
+    ::canfd_frame buf{};
+    canary::error_code ec;
+    auto f = canary::receive_frame(rx, net::buffer(&buf, sizeof(buf)), ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::classic);
+    f = canary::receive_frame(rx, net::buffer(&buf, sizeof(buf)), ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST(f.format == canary::frame_format::fd);
+    BOOST_TEST(f.header->bit_rate_switch());
+    BOOST_TEST_EQ(f.payload.size(), 64u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_parse();
+    test_parse_xl();
+    test_pool();
+    test_mixed_receive();
+    test_pooled_mixed_receive();
+    test_raw_socket();
+    test_raw_socket_xl();
+    return boost::report_errors();
+}
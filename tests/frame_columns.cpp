@@ -0,0 +1,237 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/frame_columns.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <linux/can.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+canary::frame_header const&
+header(void const* frame)
+{
+    return *static_cast<canary::frame_header const*>(frame);
+}
+
+template<class Frame>
+std::vector<Frame>
+make_frames(std::size_t count, std::uint8_t max_length)
+{
+    std::mt19937 rng{11};
+    std::uniform_int_distribution<std::uint32_t> word;
+    std::vector<Frame> frames(count);
+    for (auto& f : frames)
+    {
+        auto& h = *reinterpret_cast<canary::frame_header*>(&f);
+        auto const bits = word(rng);
+        h.extended_format((bits & 1) != 0);
+        h.id(h.extended_format() ? word(rng) & 0x1FFFFFFF : word(rng) & 0x7FF);
+        h.remote_transmission((bits & 2) != 0);
+        h.error((bits & 4) != 0);
+        h.payload_length((bits >> 8) % (max_length + 1u));
+        if (max_length > CAN_MAX_DLEN)
+        {
+            h.bit_rate_switch((bits & 8) != 0);
+            h.error_state_indicator((bits & 16) != 0);
+            h.fd_format(true);
+        }
+        for (auto& b : f.data)
+        {
+            b = static_cast<std::uint8_t>(word(rng));
+        }
+    }
+    return frames;
+}
+
+struct column_storage
+{
+    explicit column_storage(std::size_t n)
+      : id(n)
+      , flags(n)
+      , length(n)
+      , payload(8, std::vector<std::uint64_t>(n))
+      , time(n)
+    {
+    }
+
+    canary::frame_columns columns(std::size_t words)
+    {
+        canary::frame_columns c;
+        c.id = id.data();
+        c.flags = flags.data();
+        c.length = length.data();
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            c.payload[w] = payload[w].data();
+        }
+        c.time = time.data();
+        return c;
+    }
+
+    std::vector<std::uint32_t> id;
+    std::vector<std::uint8_t> flags;
+    std::vector<std::uint8_t> length;
+    std::vector<std::vector<std::uint64_t>> payload;
+    std::vector<std::int64_t> time;
+};
+
+// Columns match the frame_header accessors and the payload bytes, and
+// converting them back reproduces the frames. Counts that are not a
+// multiple of the vector width exercise the scalar remainder.
+template<class Frame>
+void
+test_round_trip(std::size_t count, std::uint8_t max_length)
+{
+    constexpr std::size_t words = sizeof(Frame().data) / 8;
+    auto const frames = make_frames<Frame>(count, max_length);
+    std::vector<canary::timestamp> times(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        times[i] = canary::timestamp{std::chrono::nanoseconds{
+          1600000000000000000LL + static_cast<std::int64_t>(i) * 1000}};
+    }
+
+    column_storage s{count};
+    auto const columns = s.columns(words);
+    canary::to_columns(frames.data(), count, columns, times.data());
+
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto const& h = header(&frames[i]);
+        BOOST_TEST_EQ(s.id[i], h.id());
+        BOOST_TEST_EQ(s.length[i], h.payload_length());
+        BOOST_TEST_EQ((s.flags[i] & canary::frame_flag::extended) != 0,
+                      h.extended_format());
+        BOOST_TEST_EQ((s.flags[i] & canary::frame_flag::remote) != 0,
+                      h.remote_transmission());
+        BOOST_TEST_EQ((s.flags[i] & canary::frame_flag::error) != 0,
+                      h.error());
+        BOOST_TEST_EQ((s.flags[i] & canary::frame_flag::bit_rate_switch) != 0,
+                      h.bit_rate_switch());
+        BOOST_TEST_EQ(
+          (s.flags[i] & canary::frame_flag::error_state_indicator) != 0,
+          h.error_state_indicator());
+        BOOST_TEST_EQ((s.flags[i] & canary::frame_flag::fd_format) != 0,
+                      h.fd_format());
+        for (std::size_t w = 0; w < words; ++w)
+        {
+            std::uint64_t expected;
+            std::memcpy(&expected, frames[i].data + 8 * w, 8);
+            BOOST_TEST_EQ(s.payload[w][i], expected);
+        }
+        BOOST_TEST_EQ(s.time[i], times[i].time_since_epoch().count());
+    }
+
+    std::vector<Frame> back(count);
+    std::vector<canary::timestamp> back_times(count);
+    canary::from_columns(columns, count, back.data(), back_times.data());
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto const& h = header(&back[i]);
+        auto const& expected = header(&frames[i]);
+        BOOST_TEST_EQ(h.id(), expected.id());
+        BOOST_TEST_EQ(h.payload_length(), expected.payload_length());
+        BOOST_TEST_EQ(h.extended_format(), expected.extended_format());
+        BOOST_TEST_EQ(h.remote_transmission(), expected.remote_transmission());
+        BOOST_TEST_EQ(h.error(), expected.error());
+        BOOST_TEST_EQ(h.bit_rate_switch(), expected.bit_rate_switch());
+        BOOST_TEST_EQ(h.fd_format(), expected.fd_format());
+        BOOST_TEST(std::memcmp(back[i].data, frames[i].data,
+                               sizeof(frames[i].data)) == 0);
+        BOOST_TEST(back_times[i] == times[i]);
+    }
+}
+
+// Null columns are skipped when converting to columns, and produce zeros
+// when converting back.
+void
+test_null_columns()
+{
+    auto frames = make_frames<::can_frame>(13, CAN_MAX_DLEN);
+    std::vector<std::uint32_t> ids(frames.size());
+    canary::frame_columns columns;
+    columns.id = ids.data();
+    canary::to_columns(frames.data(), frames.size(), columns);
+    for (std::size_t i = 0; i < frames.size(); ++i)
+    {
+        BOOST_TEST_EQ(ids[i], header(&frames[i]).id());
+    }
+
+    canary::from_columns(columns, frames.size(), frames.data());
+    for (std::size_t i = 0; i < frames.size(); ++i)
+    {
+        auto const& h = header(&frames[i]);
+        BOOST_TEST_EQ(h.id(), ids[i]);
+        BOOST_TEST_EQ(h.payload_length(), 0u);
+        BOOST_TEST(!h.extended_format());
+        for (auto b : frames[i].data)
+        {
+            BOOST_TEST_EQ(b, 0u);
+        }
+    }
+}
+
+// The vectorized kernels agree with the scalar ones for frame types of
+// every stride.
+template<class Frame>
+void
+test_kernels(std::uint8_t max_length)
+{
+    constexpr std::size_t words = sizeof(Frame().data) / 8;
+    auto const frames = make_frames<Frame>(37, max_length);
+    column_storage expected{frames.size()};
+    column_storage actual{frames.size()};
+    auto const* bytes = reinterpret_cast<unsigned char const*>(frames.data());
+    canary::detail::to_columns_scalar(bytes,
+                                      sizeof(Frame),
+                                      words,
+                                      0,
+                                      frames.size(),
+                                      expected.columns(words));
+    canary::to_columns(frames.data(), frames.size(), actual.columns(words));
+    BOOST_TEST(actual.id == expected.id);
+    BOOST_TEST(actual.flags == expected.flags);
+    BOOST_TEST(actual.length == expected.length);
+    BOOST_TEST(actual.payload == expected.payload);
+
+    std::vector<Frame> scalar(frames.size());
+    std::vector<Frame> vector(frames.size());
+    canary::detail::from_columns_scalar(
+      expected.columns(words),
+      words,
+      0,
+      frames.size(),
+      reinterpret_cast<unsigned char*>(scalar.data()),
+      sizeof(Frame));
+    canary::from_columns(expected.columns(words), frames.size(), vector.data());
+    BOOST_TEST(std::memcmp(scalar.data(),
+                           vector.data(),
+                           sizeof(Frame) * frames.size()) == 0);
+}
+
+} // namespace
+
+int
+main()
+{
+    for (std::size_t count : {0u, 1u, 7u, 8u, 9u, 64u, 1001u})
+    {
+        test_round_trip<::can_frame>(count, CAN_MAX_DLEN);
+        test_round_trip<::canfd_frame>(count, CANFD_MAX_DLEN);
+    }
+    test_null_columns();
+    test_kernels<::can_frame>(CAN_MAX_DLEN);
+    test_kernels<::canfd_frame>(CANFD_MAX_DLEN);
+    return boost::report_errors();
+}
@@ -80,11 +80,76 @@ test_layout()
     BOOST_TEST_EQ(f.fh.payload_length(), 4);
 }
 
+void
+test_fd_flags()
+{
+    struct frame
+    {
+        canary::frame_header fh;
+        std::array<std::uint8_t, 64> data{};
+    } f{};
+    ::canfd_frame cf{};
+    static_assert(sizeof(f) == sizeof(cf),
+                  "Frame header layout must match native canfd_frame struct.");
+
+    f.fh.id(0x123);
+    f.fh.payload_length(48);
+    f.fh.bit_rate_switch(true);
+    f.fh.fd_format(true);
+    std::memcpy(&cf, &f, sizeof(f));
+    BOOST_TEST_EQ(cf.can_id, 0x123u);
+    BOOST_TEST_EQ(static_cast<int>(cf.len), 48);
+    BOOST_TEST_EQ(cf.flags, CANFD_BRS | CANFD_FDF);
+    BOOST_TEST(f.fh.bit_rate_switch());
+    BOOST_TEST_NOT(f.fh.error_state_indicator());
+    BOOST_TEST(f.fh.fd_format());
+
+    cf.flags = CANFD_ESI;
+    std::memcpy(static_cast<void*>(&f), &cf, sizeof(f));
+    BOOST_TEST_NOT(f.fh.bit_rate_switch());
+    BOOST_TEST(f.fh.error_state_indicator());
+    BOOST_TEST_NOT(f.fh.fd_format());
+    f.fh.error_state_indicator(false);
+    BOOST_TEST_NOT(f.fh.error_state_indicator());
+    BOOST_TEST_EQ(f.fh.id(), 0x123u);
+    BOOST_TEST_EQ(f.fh.payload_length(), 48u);
+}
+
+void
+test_dlc()
+{
+    std::size_t const lengths[] = {
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+    for (std::uint8_t dlc = 0; dlc < 16; ++dlc)
+    {
+        BOOST_TEST_EQ(canary::dlc_to_length(dlc), lengths[dlc]);
+        BOOST_TEST_EQ(canary::length_to_dlc(lengths[dlc]), dlc);
+    }
+    BOOST_TEST_EQ(canary::dlc_to_length(0xFF), 64u);
+
+    // Lengths between valid FD lengths round up.
+    BOOST_TEST_EQ(canary::length_to_dlc(9), 9u);
+    BOOST_TEST_EQ(canary::length_to_dlc(33), 14u);
+    BOOST_TEST_EQ(canary::length_to_dlc(100), 15u);
+    BOOST_TEST_EQ(canary::fd_payload_length(9), 12u);
+    BOOST_TEST_EQ(canary::fd_payload_length(13), 16u);
+    BOOST_TEST_EQ(canary::fd_payload_length(25), 32u);
+    BOOST_TEST_EQ(canary::fd_payload_length(49), 64u);
+    for (std::size_t n = 0; n <= 64; ++n)
+    {
+        auto const rounded = canary::fd_payload_length(n);
+        BOOST_TEST_GE(rounded, n);
+        BOOST_TEST_EQ(canary::fd_payload_length(rounded), rounded);
+    }
+}
+
 } // namespace
 
 int
 main()
 {
     test_layout();
+    test_fd_flags();
+    test_dlc();
     return boost::report_errors();
 }
@@ -0,0 +1,261 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/frame_merger.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+
+#include <thread>
+
+namespace
+{
+
+namespace net = canary::net;
+using std::chrono::milliseconds;
+
+canary::timestamp
+at(int ms)
+{
+    return canary::timestamp{milliseconds{ms}};
+}
+
+std::uint32_t
+id_of(canary::merged_frame const& m)
+{
+    canary::frame_header h;
+    std::memcpy(&h, m.data.data(), sizeof(h));
+    return h.id();
+}
+
+bool
+push(canary::frame_merger& merger,
+     std::size_t source,
+     std::uint32_t id,
+     int ms)
+{
+    ::can_frame f{};
+    f.can_id = id;
+    f.can_dlc = 8;
+    return merger.push(source, net::buffer(&f, sizeof(f)), at(ms));
+}
+
+canary::frame_merger::options
+make_options(std::size_t sources)
+{
+    canary::frame_merger::options opts;
+    opts.sources = sources;
+    return opts;
+}
+
+// Three sorted traces, read in chunks of different sizes, are merged into
+// one sorted stream.
+void
+test_traces()
+{
+    std::vector<std::vector<int>> const traces{
+      {1, 4, 7, 10, 13, 16}, {2, 3, 5, 20}, {6, 8, 9, 11, 12, 14, 15}};
+    canary::frame_merger merger{make_options(traces.size())};
+    std::vector<std::size_t> positions(traces.size(), 0);
+    std::vector<canary::merged_frame> out;
+    std::vector<int> merged;
+    auto const collect = [&] {
+        for (auto const& m : out)
+        {
+            merged.push_back(static_cast<int>(id_of(m)));
+            BOOST_TEST(m.time == at(static_cast<int>(id_of(m))));
+        }
+    };
+
+    bool more = true;
+    while (more)
+    {
+        more = false;
+        for (std::size_t s = 0; s < traces.size(); ++s)
+        {
+            // Source s reads s + 1 frames at a time.
+            for (std::size_t i = 0; i <= s && positions[s] < traces[s].size();
+                 ++i)
+            {
+                auto const t = traces[s][positions[s]++];
+                BOOST_TEST(push(merger, s, static_cast<std::uint32_t>(t), t));
+            }
+            if (positions[s] == traces[s].size())
+            {
+                merger.finish(s);
+            }
+            else
+            {
+                more = true;
+            }
+            while (merger.pop(out) > 0)
+            {
+                collect();
+            }
+        }
+    }
+    BOOST_TEST_EQ(merger.pending(), 0u);
+    BOOST_TEST_EQ(merged.size(), 17u);
+    for (std::size_t i = 0; i < merged.size(); ++i)
+    {
+        BOOST_TEST_EQ(merged[i], static_cast<int>(i + 1) + (i >= 16 ? 3 : 0));
+    }
+    BOOST_TEST_EQ(merger.late(), 0u);
+}
+
+void
+test_window()
+{
+    auto opts = make_options(2);
+    opts.reorder_window = milliseconds{10};
+    canary::frame_merger merger{opts};
+    std::vector<canary::merged_frame> out;
+
+    // Source 1 has not pushed anything yet, so it may still push an earlier
+    // frame.
+    push(merger, 0, 0x1, 100);
+    push(merger, 0, 0x2, 105);
+    BOOST_TEST_EQ(merger.pop(out), 0u);
+    BOOST_TEST_EQ(merger.pop(out, at(109)), 0u);
+    BOOST_TEST_EQ(merger.pop(out, at(110)), 1u);
+    BOOST_TEST_EQ(id_of(out[0]), 0x1u);
+    BOOST_TEST_EQ(out[0].source, 0u);
+
+    // Source 1 catches up, frames up to its latest timestamp are safe.
+    push(merger, 1, 0x3, 103);
+    BOOST_TEST_EQ(merger.pop(out), 1u);
+    BOOST_TEST_EQ(id_of(out[0]), 0x3u);
+    BOOST_TEST_EQ(merger.pending(), 1u);
+
+    // A frame older than one already emitted is late.
+    push(merger, 1, 0x4, 101);
+    BOOST_TEST_EQ(merger.late(), 1u);
+    BOOST_TEST(merger.max_lateness() == milliseconds{2});
+    BOOST_TEST_EQ(merger.pop(out), 1u);
+    BOOST_TEST_EQ(id_of(out[0]), 0x4u);
+
+    BOOST_TEST_EQ(merger.drain(out), 1u);
+    BOOST_TEST_EQ(id_of(out[0]), 0x2u);
+    BOOST_TEST_EQ(merger.pending(), 0u);
+}
+
+void
+test_batches()
+{
+    auto opts = make_options(2);
+    opts.batch_size = 3;
+    canary::frame_merger merger{opts};
+    std::vector<canary::merged_frame> out;
+
+    // Frames with equal timestamps are emitted in the order they were
+    // pushed.
+    for (std::uint32_t i = 0; i < 4; ++i)
+    {
+        push(merger, i % 2, i, 50);
+    }
+    push(merger, 0, 0x10, 60);
+    push(merger, 1, 0x11, 60);
+    BOOST_TEST_EQ(merger.pop(out), 3u);
+    BOOST_TEST_EQ(id_of(out[0]), 0u);
+    BOOST_TEST_EQ(id_of(out[1]), 1u);
+    BOOST_TEST_EQ(id_of(out[2]), 2u);
+    BOOST_TEST_EQ(merger.pop(out), 3u);
+    BOOST_TEST_EQ(id_of(out[0]), 3u);
+    BOOST_TEST_EQ(id_of(out[1]), 0x10u);
+    BOOST_TEST_EQ(id_of(out[2]), 0x11u);
+    BOOST_TEST_EQ(merger.pop(out), 0u);
+    BOOST_TEST(out.empty());
+}
+
+void
+test_invalid()
+{
+    BOOST_TEST_THROWS(canary::frame_merger{make_options(0)},
+                      canary::system_error);
+    auto opts = make_options(1);
+    opts.batch_size = 0;
+    BOOST_TEST_THROWS(canary::frame_merger{opts}, canary::system_error);
+
+    canary::frame_merger merger{make_options(1)};
+    std::array<std::uint8_t, canary::fd_frame_size + 1> large{};
+    BOOST_TEST(!merger.push(0, net::buffer(large), at(0)));
+    BOOST_TEST_THROWS(push(merger, 1, 0, 0), std::out_of_range);
+    BOOST_TEST_EQ(merger.pending(), 0u);
+}
+
+// Frames received on two interfaces are merged by reception timestamp.
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    char const* names[] = {"vcan0", "vcan1"};
+    std::vector<canary::raw::socket> tx;
+    std::vector<canary::raw::socket> rx;
+    for (auto name : names)
+    {
+        auto const ep =
+          canary::raw::endpoint{canary::get_interface_index(name)};
+        tx.emplace_back(ioc, ep);
+        rx.emplace_back(ioc, ep);
+        rx.back().set_option(canary::receive_timestamp{true});
+    }
+
+    for (std::uint32_t i = 0; i < 6; ++i)
+    {
+        ::can_frame f{};
+        f.can_id = i;
+        f.can_dlc = 8;
+        tx[i % 2].send(net::buffer(&f, sizeof(f)));
+        std::this_thread::sleep_for(milliseconds{1});
+    }
+
+    canary::frame_merger merger{make_options(2)};
+    std::vector<canary::merged_frame> out;
+    std::vector<std::uint32_t> ids;
+    ::can_frame f{};
+    canary::timestamp ts;
+    for (std::size_t s = 0; s < 2; ++s)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            canary::receive_timestamped(rx[s], net::buffer(&f, sizeof(f)), ts);
+            merger.push(s, net::buffer(&f, sizeof(f)), ts);
+        }
+        merger.finish(s);
+    }
+    while (merger.pop(out) > 0)
+    {
+        for (auto const& m : out)
+        {
+            ids.push_back(id_of(m));
+        }
+    }
+    BOOST_TEST_EQ(ids.size(), 6u);
+    for (std::uint32_t i = 0; i < ids.size(); ++i)
+    {
+        BOOST_TEST_EQ(ids[i], i);
+    }
+}
+
+} // namespace
+
+int
+main()
+{
+    test_traces();
+    test_window();
+    test_batches();
+    test_invalid();
+    test_raw_socket();
+    return boost::report_errors();
+}
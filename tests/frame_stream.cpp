@@ -0,0 +1,249 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/frame_stream.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+using local_stream = canary::basic_frame_stream<::can_frame, local_socket>;
+
+void
+send_frames(local_socket& sock, std::uint32_t first, std::uint32_t last)
+{
+    for (auto id = first; id < last; ++id)
+    {
+        ::can_frame f{};
+        f.can_id = id;
+        sock.send(net::buffer(&f, sizeof(f)));
+    }
+}
+
+// Everything available is received at once, up to the batch size.
+void
+test_batches()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_stream::options opts;
+    opts.batch_size = 8;
+    local_stream stream{b, opts};
+
+    std::vector<std::size_t> sizes;
+    std::vector<std::uint32_t> ids;
+    std::function<void(canary::error_code, local_stream::batch_type)> next =
+      [&](canary::error_code ec, local_stream::batch_type batch) {
+          BOOST_TEST(!ec);
+          sizes.push_back(batch.size());
+          for (auto const& f : batch)
+          {
+              ids.push_back(f.can_id);
+          }
+          if (ids.size() < 20)
+          {
+              stream.async_next(next);
+          }
+      };
+
+    // Frames already queued, the first batch is received immediately, but
+    // does not complete within the initiating function.
+    send_frames(a, 0, 12);
+    stream.async_next(next);
+    BOOST_TEST(sizes.empty());
+    ioc.poll();
+    ioc.restart();
+    send_frames(a, 12, 20);
+    ioc.run();
+
+    BOOST_TEST((sizes == std::vector<std::size_t>{8, 4, 8}));
+    BOOST_TEST_EQ(ids.size(), 20u);
+    for (std::uint32_t i = 0; i < ids.size(); ++i)
+    {
+        BOOST_TEST_EQ(ids[i], i);
+    }
+}
+
+void
+test_timeout()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_stream stream{b};
+
+    canary::error_code result;
+    stream.async_next(std::chrono::milliseconds{10},
+                      [&](canary::error_code ec, local_stream::batch_type b) {
+                          result = ec;
+                          BOOST_TEST(b.empty());
+                      });
+    auto const start = std::chrono::steady_clock::now();
+    ioc.run();
+    BOOST_TEST(result == net::error::timed_out);
+    BOOST_TEST(std::chrono::steady_clock::now() - start >=
+               std::chrono::milliseconds{10});
+
+    // A frame arriving before the timeout completes the receive, and the
+    // expired timer does not affect the next one.
+    send_frames(a, 0, 1);
+    std::size_t received = 0;
+    stream.async_next(std::chrono::milliseconds{1},
+                      [&](canary::error_code ec, local_stream::batch_type b) {
+                          BOOST_TEST(!ec);
+                          received += b.size();
+                      });
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(received, 1u);
+
+    ioc.restart();
+    stream.async_next(std::chrono::seconds{5},
+                      [&](canary::error_code ec, local_stream::batch_type b) {
+                          BOOST_TEST(!ec);
+                          received += b.size();
+                      });
+    ioc.poll();
+    send_frames(a, 1, 2);
+    ioc.run();
+    BOOST_TEST_EQ(received, 2u);
+}
+
+void
+test_cancel()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_stream stream{b};
+
+    canary::error_code result;
+    stream.async_next(std::chrono::seconds{5},
+                      [&](canary::error_code ec, local_stream::batch_type) {
+                          result = ec;
+                      });
+    ioc.poll();
+    stream.cancel();
+    ioc.run();
+    BOOST_TEST(result == net::error::operation_aborted);
+
+    local_stream::options opts;
+    opts.batch_size = 0;
+    BOOST_TEST_THROWS(local_stream(b, opts), canary::system_error);
+}
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+
+void
+test_coroutine()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_stream stream{b};
+
+    std::vector<std::uint32_t> ids;
+    std::size_t resumes = 0;
+    net::co_spawn(
+      ioc,
+      [&]() -> net::awaitable<void> {
+          while (ids.size() < 30)
+          {
+              for (auto const& f :
+                   co_await stream.async_next(net::use_awaitable))
+              {
+                  ids.push_back(f.can_id);
+              }
+              ++resumes;
+          }
+          try
+          {
+              co_await stream.async_next(std::chrono::milliseconds{1},
+                                         net::use_awaitable);
+          }
+          catch (canary::system_error const& e)
+          {
+              BOOST_TEST(e.code() == net::error::timed_out);
+              ++resumes;
+          }
+      },
+      net::detached);
+    send_frames(a, 0, 30);
+    ioc.run();
+
+    BOOST_TEST_EQ(ids.size(), 30u);
+    BOOST_TEST_EQ(resumes, 2u);
+}
+
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    canary::frame_stream<::can_frame> stream{rx};
+
+    for (std::uint32_t i = 0; i < 3; ++i)
+    {
+        ::can_frame f{};
+        f.can_id = i;
+        tx.send(net::buffer(&f, sizeof(f)));
+    }
+    using batch_type = canary::frame_batch<::can_frame>;
+    std::size_t received = 0;
+    std::function<void(canary::error_code, batch_type)> next =
+      [&](canary::error_code ec, batch_type batch) {
+          BOOST_TEST(!ec);
+          received += batch.size();
+          if (received < 3)
+          {
+              stream.async_next(next);
+          }
+      };
+    stream.async_next(next);
+    ioc.run();
+    BOOST_TEST_EQ(received, 3u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_batches();
+    test_timeout();
+    test_cancel();
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+    test_coroutine();
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+    test_raw_socket();
+    return boost::report_errors();
+}
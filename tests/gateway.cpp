@@ -0,0 +1,322 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/gateway.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/socket_options.hpp>
+
+#include <iostream>
+#include <linux/can/gw.h>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using local_gateway = canary::basic_gateway<local_socket>;
+
+// Two connected socket pairs, frames written to `in` are received by the
+// gateway on `src`, frames sent by the gateway to `dst` are read from `out`.
+struct fixture
+{
+    net::io_context ioc{1};
+    local_socket in{ioc};
+    local_socket src{ioc};
+    local_socket dst{ioc};
+    local_socket out{ioc};
+
+    fixture()
+    {
+        net::local::connect_pair(in, src);
+        net::local::connect_pair(dst, out);
+        out.non_blocking(true);
+    }
+
+    template<class Frame>
+    void send(std::uint32_t id, std::size_t length)
+    {
+        Frame f{};
+        f.can_id = id;
+        f.len = static_cast<std::uint8_t>(length);
+        for (std::size_t i = 0; i < length; ++i)
+        {
+            f.data[i] = static_cast<std::uint8_t>(id + i);
+        }
+        in.send(net::buffer(&f, sizeof(f)));
+    }
+
+    // Reads all frames sent to `out`.
+    std::vector<::canfd_frame> received()
+    {
+        std::vector<::canfd_frame> frames;
+        while (true)
+        {
+            ::canfd_frame f{};
+            canary::error_code ec;
+            auto const n = out.receive(net::buffer(&f, sizeof(f)), 0, ec);
+            if (ec)
+            {
+                return frames;
+            }
+            BOOST_TEST(n == CAN_MTU || n == CANFD_MTU);
+            frames.push_back(f);
+        }
+    }
+};
+
+void
+test_forward()
+{
+    fixture fx;
+    local_gateway gw;
+    local_gateway::route r;
+    r.filters.push_back(canary::filter{}.id(0x100).id_mask(0x7F0));
+    r.filters.push_back(canary::filter{}.id(0x300).id_mask(0x7FF));
+    r.rewrite = canary::id_rewrite{0xF00, 0x500};
+    gw.add_route(fx.src, fx.dst, std::move(r));
+    gw.start();
+
+    fx.send<::can_frame>(0x105, 8);
+    fx.send<::can_frame>(0x200, 8);
+    fx.send<::canfd_frame>(0x10A, 64);
+    fx.send<::can_frame>(0x300, 3);
+    std::uint8_t junk[3] = {};
+    fx.in.send(net::buffer(junk));
+    fx.ioc.poll();
+
+    auto const frames = fx.received();
+    BOOST_TEST_EQ(frames.size(), 3u);
+    BOOST_TEST_EQ(gw.forwarded(), 3u);
+    BOOST_TEST_EQ(gw.dropped(), 0u);
+    if (frames.size() == 3)
+    {
+        BOOST_TEST_EQ(frames[0].can_id, 0x505u);
+        BOOST_TEST_EQ(frames[0].data[7], 0x05u + 7);
+        BOOST_TEST_EQ(frames[1].can_id, 0x50Au);
+        BOOST_TEST_EQ(frames[1].len, 64u);
+        BOOST_TEST_EQ(frames[1].data[63], 0x0Au + 63);
+        BOOST_TEST_EQ(frames[2].can_id, 0x500u);
+        BOOST_TEST_EQ(frames[2].len, 3u);
+    }
+
+    gw.stop();
+    fx.ioc.poll();
+    fx.send<::can_frame>(0x105, 8);
+    fx.ioc.restart();
+    fx.ioc.poll();
+    BOOST_TEST(fx.received().empty());
+
+    local_gateway::options opts;
+    opts.batch_size = 0;
+    BOOST_TEST_THROWS(local_gateway{opts}, canary::system_error);
+}
+
+// Routes from one source rewrite their own copy of each header.
+void
+test_routes()
+{
+    fixture fx;
+    net::io_context& ioc = fx.ioc;
+    local_socket dst2{ioc};
+    local_socket out2{ioc};
+    net::local::connect_pair(dst2, out2);
+    out2.non_blocking(true);
+
+    local_gateway gw;
+    local_gateway::route r1;
+    r1.rewrite = canary::id_rewrite::replace(0x7FF);
+    gw.add_route(fx.src, fx.dst, std::move(r1));
+    local_gateway::route r2;
+    r2.fd_frames = false;
+    gw.add_route(fx.src, dst2, std::move(r2));
+    gw.start();
+
+    fx.send<::can_frame>(0x42, 1);
+    fx.send<::canfd_frame>(0x43, 12);
+    fx.ioc.poll();
+
+    auto const frames = fx.received();
+    BOOST_TEST_EQ(frames.size(), 2u);
+    for (auto const& f : frames)
+    {
+        BOOST_TEST_EQ(f.can_id, 0x7FFu);
+    }
+    ::can_frame f{};
+    canary::error_code ec;
+    out2.receive(net::buffer(&f, sizeof(f)), 0, ec);
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(f.can_id, 0x42u);
+    out2.receive(net::buffer(&f, sizeof(f)), 0, ec);
+    BOOST_TEST(ec == net::error::would_block);
+    BOOST_TEST_EQ(gw.forwarded(), 3u);
+}
+
+// Frames which the destination does not accept are dropped.
+void
+test_dropped()
+{
+    fixture fx;
+    local_gateway gw;
+    gw.add_route(fx.src, fx.dst, local_gateway::route{});
+    gw.start();
+
+    std::size_t sent = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        for (int j = 0; j < 5; ++j, ++sent)
+        {
+            fx.send<::can_frame>(0x10, 8);
+        }
+        fx.ioc.poll();
+        fx.ioc.restart();
+    }
+    BOOST_TEST_EQ(gw.forwarded() + gw.dropped(), sent);
+    BOOST_TEST_GT(gw.dropped(), 0u);
+    BOOST_TEST_EQ(fx.received().size(), gw.forwarded());
+}
+
+template<class Attribute>
+Attribute
+attribute(std::vector<std::uint8_t> const& msg, std::uint16_t type)
+{
+    auto const offset = NLMSG_LENGTH(sizeof(::rtcanmsg));
+    auto len = static_cast<int>(msg.size() - offset);
+    auto a = reinterpret_cast<::rtattr const*>(msg.data() + offset);
+    for (; RTA_OK(a, len); a = RTA_NEXT(a, len))
+    {
+        if (a->rta_type == type)
+        {
+            BOOST_TEST_EQ(RTA_PAYLOAD(a), sizeof(Attribute));
+            Attribute value;
+            std::memcpy(&value, RTA_DATA(a), sizeof(value));
+            return value;
+        }
+    }
+    BOOST_ERROR("Attribute not found");
+    return Attribute{};
+}
+
+void
+test_kernel_message()
+{
+    canary::kernel_gateway::rule rule;
+    rule.source = 3;
+    rule.destination = 4;
+    rule.match = canary::filter{}.id(0x100).id_mask(0x700);
+    rule.rewrite = canary::id_rewrite{0x0FF, 0x042};
+    rule.max_hops = 2;
+
+    auto const m =
+      canary::kernel_gateway::make_message(RTM_NEWROUTE, rule, 7).data();
+    ::nlmsghdr h;
+    std::memcpy(&h, m.data(), sizeof(h));
+    BOOST_TEST_EQ(h.nlmsg_len, m.size());
+    BOOST_TEST_EQ(h.nlmsg_type, RTM_NEWROUTE);
+    BOOST_TEST_EQ(h.nlmsg_seq, 7u);
+    BOOST_TEST(h.nlmsg_flags & NLM_F_ACK);
+    ::rtcanmsg rtcan;
+    std::memcpy(&rtcan, m.data() + NLMSG_HDRLEN, sizeof(rtcan));
+    BOOST_TEST_EQ(rtcan.can_family, AF_CAN);
+    BOOST_TEST_EQ(rtcan.gwtype, CGW_TYPE_CAN_CAN);
+    BOOST_TEST_EQ(rtcan.flags, 0u);
+
+    BOOST_TEST_EQ(attribute<std::uint32_t>(m, CGW_SRC_IF), 3u);
+    BOOST_TEST_EQ(attribute<std::uint32_t>(m, CGW_DST_IF), 4u);
+    auto const f = attribute<::can_filter>(m, CGW_FILTER);
+    BOOST_TEST_EQ(f.can_id, 0x100u);
+    BOOST_TEST_EQ(f.can_mask, 0x700u);
+    auto const and_mod = attribute<::cgw_frame_mod>(m, CGW_MOD_AND);
+    BOOST_TEST_EQ(and_mod.cf.can_id, ~0x0FFu);
+    BOOST_TEST_EQ(and_mod.modtype, CGW_MOD_ID);
+    auto const or_mod = attribute<::cgw_frame_mod>(m, CGW_MOD_OR);
+    BOOST_TEST_EQ(or_mod.cf.can_id, 0x042u);
+    BOOST_TEST_EQ(attribute<std::uint8_t>(m, CGW_LIM_HOPS), 2u);
+
+    rule.fd_frames = true;
+    auto const fd =
+      canary::kernel_gateway::make_message(RTM_DELROUTE, rule, 8).data();
+    std::memcpy(&rtcan, fd.data() + NLMSG_HDRLEN, sizeof(rtcan));
+    BOOST_TEST_EQ(rtcan.flags, CGW_FLAGS_CAN_FD);
+    auto const fd_mod = attribute<::cgw_fdframe_mod>(fd, CGW_FDMOD_OR);
+    BOOST_TEST_EQ(fd_mod.cf.can_id, 0x042u);
+
+    BOOST_TEST_EQ(canary::id_rewrite{}.apply(0x123), 0x123u);
+    BOOST_TEST_EQ(canary::id_rewrite::replace(0x1FFFFFFF).apply(0),
+                  0x1FFFFFFFu);
+    BOOST_TEST_EQ((canary::id_rewrite{0xF0, 0xAB}.apply(0x105)), 0x1A5u);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep0 =
+      canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    auto const ep1 =
+      canary::raw::endpoint{canary::get_interface_index("vcan1")};
+    canary::raw::socket tx{ioc, ep0};
+    canary::raw::socket src{ioc, ep0};
+    canary::raw::socket dst{ioc, ep1};
+    canary::raw::socket rx{ioc, ep1};
+    src.set_option(canary::flexible_data_rate{});
+    rx.set_option(canary::flexible_data_rate{});
+
+    canary::gateway gw;
+    canary::gateway::route r;
+    r.rewrite = canary::id_rewrite::replace(0x20);
+    gw.add_route(src, dst, r);
+    gw.start();
+    ::can_frame f{};
+    f.can_id = 0x10;
+    tx.send(net::buffer(&f, sizeof(f)));
+    ioc.run_one();
+    gw.stop();
+    ioc.run();
+    rx.receive(net::buffer(&f, sizeof(f)));
+    BOOST_TEST_EQ(f.can_id, 0x20u);
+
+    canary::kernel_gateway kernel;
+    try
+    {
+        BOOST_TEST_EQ(gw.offload(kernel), 1u);
+    }
+    catch (canary::system_error const& e)
+    {
+        // Requires the can-gw module and CAP_NET_ADMIN.
+        std::cerr << "CAN gateway offload unavailable: " << e.what() << '\n';
+        return;
+    }
+    BOOST_TEST_EQ(gw.offloaded().size(), 2u);
+    f.can_id = 0x11;
+    tx.send(net::buffer(&f, sizeof(f)));
+    rx.receive(net::buffer(&f, sizeof(f)));
+    BOOST_TEST_EQ(f.can_id, 0x20u);
+    for (auto const& rule : gw.offloaded())
+    {
+        kernel.remove(rule);
+    }
+}
+
+} // namespace
+
+int
+main()
+{
+    test_forward();
+    test_routes();
+    test_dropped();
+    test_kernel_message();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,156 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/instrumented_socket.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <sstream>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using instrumented_local_socket =
+  canary::basic_instrumented_socket<local_socket>;
+
+void
+test_sync()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    instrumented_local_socket tx{std::move(a)};
+    instrumented_local_socket rx{std::move(b)};
+
+    ::can_frame f{};
+    f.can_id = 0x123;
+    f.can_dlc = 8;
+    BOOST_TEST_EQ(tx.send(net::buffer(&f, sizeof(f))), sizeof(f));
+    BOOST_TEST_EQ(tx.send(net::buffer(&f, sizeof(f))), sizeof(f));
+
+    ::can_frame in{};
+    BOOST_TEST_EQ(rx.receive(net::buffer(&in, sizeof(in))), sizeof(in));
+    BOOST_TEST_EQ(in.can_id, 0x123u);
+    BOOST_TEST_EQ(rx.receive(net::buffer(&in, sizeof(in))), sizeof(in));
+
+    rx.next_layer().non_blocking(true);
+    canary::error_code ec;
+    rx.receive(net::buffer(&in, sizeof(in)), 0, ec);
+    BOOST_TEST(ec == net::error::would_block);
+
+    auto const tx_metrics = tx.metrics().snapshot();
+    auto const rx_metrics = rx.metrics().snapshot();
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST_EQ(tx_metrics.frames_sent, 2u);
+    BOOST_TEST_EQ(tx_metrics.bytes_sent, 2 * sizeof(f));
+    BOOST_TEST_EQ(tx_metrics.frames_received, 0u);
+    BOOST_TEST_EQ(rx_metrics.frames_received, 2u);
+    BOOST_TEST_EQ(rx_metrics.bytes_received, 2 * sizeof(f));
+    BOOST_TEST_EQ(rx_metrics.would_block, 1u);
+    BOOST_TEST_EQ(rx_metrics.errors, 0u);
+    BOOST_TEST_EQ(rx_metrics.receive_latency.count, 2u);
+#else
+    BOOST_TEST_EQ(tx_metrics.frames_sent, 0u);
+    BOOST_TEST_EQ(rx_metrics.frames_received, 0u);
+#endif // CANARY_DISABLE_METRICS
+}
+
+void
+test_async()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    instrumented_local_socket tx{std::move(a)};
+    instrumented_local_socket rx{std::move(b)};
+
+    ::can_frame out{};
+    ::can_frame in{};
+    int received = 0;
+    int sent = 0;
+    rx.async_receive(net::buffer(&in, sizeof(in)),
+                     [&](canary::error_code ec, std::size_t n) {
+                         BOOST_TEST(!ec);
+                         BOOST_TEST_EQ(n, sizeof(in));
+                         ++received;
+                     });
+    tx.async_send(net::buffer(&out, sizeof(out)),
+                  [&](canary::error_code ec, std::size_t n) {
+                      BOOST_TEST(!ec);
+                      BOOST_TEST_EQ(n, sizeof(out));
+                      ++sent;
+                  });
+    ioc.run();
+    BOOST_TEST_EQ(received, 1);
+    BOOST_TEST_EQ(sent, 1);
+
+    rx.async_receive(net::buffer(&in, sizeof(in)),
+                     [&](canary::error_code ec, std::size_t) {
+                         BOOST_TEST(ec == net::error::operation_aborted);
+                         ++received;
+                     });
+    ioc.restart();
+    ioc.poll();
+    rx.next_layer().cancel();
+    ioc.run();
+    BOOST_TEST_EQ(received, 2);
+
+#ifndef CANARY_DISABLE_METRICS
+    auto const s = rx.metrics().snapshot();
+    BOOST_TEST_EQ(s.frames_received, 1u);
+    BOOST_TEST_EQ(s.receive_latency.count, 1u);
+    // Cancellation is not an error.
+    BOOST_TEST_EQ(s.errors, 0u);
+    BOOST_TEST_EQ(tx.metrics().snapshot().frames_sent, 1u);
+
+    std::ostringstream os;
+    canary::write_text(os, s);
+    BOOST_TEST(os.str().find("canary_frames_received_total 1\n") !=
+               std::string::npos);
+#endif // CANARY_DISABLE_METRICS
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::instrumented_raw_socket tx{ioc, ep};
+    canary::instrumented_raw_socket rx{ioc, ep};
+
+    ::can_frame f{};
+    f.can_id = 0x42;
+    f.can_dlc = 4;
+    tx.send(net::buffer(&f, sizeof(f)));
+    ::can_frame in{};
+    rx.receive(net::buffer(&in, sizeof(in)));
+    BOOST_TEST_EQ(in.can_id, 0x42u);
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST_EQ(rx.metrics().snapshot().frames_received, 1u);
+    BOOST_TEST_EQ(rx.metrics().snapshot().receive_latency.count, 1u);
+#endif // CANARY_DISABLE_METRICS
+}
+
+} // namespace
+
+int
+main()
+{
+    test_sync();
+    test_async();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,186 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/last_value_cache.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <cstring>
+#include <linux/can.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+namespace net = canary::net;
+using snapshot = canary::last_value_cache::snapshot;
+
+void
+test_standard()
+{
+    canary::last_value_cache cache;
+    snapshot s{};
+    BOOST_TEST(!cache.get(0x123, false, s));
+
+    ::can_frame f{};
+    f.can_id = 0x123;
+    f.can_dlc = 8;
+    std::memset(f.data, 1, 8);
+    auto const t = canary::timestamp{std::chrono::seconds{5}};
+    BOOST_TEST(cache.update(net::buffer(&f, sizeof(f)), t));
+    BOOST_TEST(cache.get(0x123, false, s));
+    BOOST_TEST_EQ(s.header.id(), 0x123u);
+    BOOST_TEST_EQ(s.header.payload_length(), 8u);
+    BOOST_TEST_EQ(s.payload[7], 1u);
+    BOOST_TEST(s.time == t);
+    BOOST_TEST_EQ(s.updates, 1u);
+    BOOST_TEST(!cache.get(0x124, false, s));
+    BOOST_TEST(!cache.get(0x123, true, s));
+    // Not an 11-bit ID, must not alias 0x123.
+    BOOST_TEST(!cache.get(0x923, false, s));
+
+    // A shorter frame replaces the whole payload.
+    ::canfd_frame fd{};
+    fd.can_id = 0x123;
+    fd.len = 2;
+    std::memset(fd.data, 9, 2);
+    BOOST_TEST(cache.update(net::buffer(&fd, sizeof(fd))));
+    BOOST_TEST(cache.get(0x123, false, s));
+    BOOST_TEST_EQ(s.payload[1], 9u);
+    BOOST_TEST_EQ(s.payload[7], 0u);
+    BOOST_TEST_EQ(s.updates, 2u);
+}
+
+void
+test_extended()
+{
+    canary::last_value_cache cache;
+    ::can_frame standard{};
+    standard.can_id = 0x100;
+    standard.can_dlc = 1;
+    standard.data[0] = 1;
+    auto extended = standard;
+    extended.can_id = 0x100 | CAN_EFF_FLAG;
+    extended.data[0] = 2;
+    auto large = standard;
+    large.can_id = 0x1FFFFFFF | CAN_EFF_FLAG;
+    large.data[0] = 3;
+    BOOST_TEST(cache.update(net::buffer(&standard, sizeof(standard))));
+    BOOST_TEST(cache.update(net::buffer(&extended, sizeof(extended))));
+    BOOST_TEST(cache.update(net::buffer(&large, sizeof(large))));
+
+    snapshot s{};
+    BOOST_TEST(cache.get(0x100, false, s));
+    BOOST_TEST_EQ(s.payload[0], 1u);
+    BOOST_TEST(cache.get(0x100, true, s));
+    BOOST_TEST(s.header.extended_format());
+    BOOST_TEST_EQ(s.payload[0], 2u);
+    BOOST_TEST(cache.get(0x1FFFFFFF, true, s));
+    BOOST_TEST_EQ(s.payload[0], 3u);
+    BOOST_TEST(!cache.get(0x101, true, s));
+    BOOST_TEST(!cache.get(0x3FFFFFFF, true, s));
+}
+
+void
+test_rejected()
+{
+    canary::last_value_cache::options opts;
+    opts.extended_capacity = 4;
+    canary::last_value_cache cache{opts};
+    for (std::uint32_t id = 0; id < 5; ++id)
+    {
+        ::can_frame f{};
+        f.can_id = (0x1000 + id) | CAN_EFF_FLAG;
+        f.can_dlc = 1;
+        BOOST_TEST_EQ(cache.update(net::buffer(&f, sizeof(f))), id < 4);
+    }
+    BOOST_TEST_EQ(cache.overflows(), 1u);
+    snapshot s{};
+    for (std::uint32_t id = 0; id < 4; ++id)
+    {
+        BOOST_TEST(cache.get(0x1000 + id, true, s));
+    }
+    BOOST_TEST(!cache.get(0x1004, true, s));
+
+    ::can_frame error{};
+    error.can_id = 0x001 | CAN_ERR_FLAG;
+    error.can_dlc = 8;
+    BOOST_TEST(!cache.update(net::buffer(&error, sizeof(error))));
+    std::array<std::uint8_t, 12> truncated{};
+    BOOST_TEST(!cache.update(net::buffer(truncated)));
+    BOOST_TEST(!cache.get(0x001, false, s));
+
+    opts.extended_capacity = 3;
+    BOOST_TEST_THROWS(canary::last_value_cache{opts}, canary::system_error);
+}
+
+// Readers must never observe a frame which is partially updated.
+void
+test_concurrent()
+{
+    canary::last_value_cache cache;
+    constexpr std::size_t updates = 200000;
+    std::atomic<bool> done{false};
+    std::atomic<std::size_t> torn{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 3; ++i)
+    {
+        readers.emplace_back([&] {
+            snapshot s{};
+            while (!done.load())
+            {
+                if (!cache.get(0x42, true, s))
+                {
+                    continue;
+                }
+                auto const value = static_cast<std::uint8_t>(s.updates);
+                for (auto b : s.payload)
+                {
+                    if (b != value)
+                    {
+                        ++torn;
+                        break;
+                    }
+                }
+            }
+        });
+    }
+
+    for (std::size_t i = 1; i <= updates; ++i)
+    {
+        ::canfd_frame f{};
+        f.can_id = 0x42 | CAN_EFF_FLAG;
+        f.len = 64;
+        std::memset(f.data, static_cast<std::uint8_t>(i), 64);
+        cache.update(net::buffer(&f, sizeof(f)));
+    }
+    done = true;
+    for (auto& r : readers)
+    {
+        r.join();
+    }
+    BOOST_TEST_EQ(torn.load(), 0u);
+    snapshot s{};
+    BOOST_TEST(cache.get(0x42, true, s));
+    BOOST_TEST_EQ(s.updates, updates);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_standard();
+    test_extended();
+    test_rejected();
+    test_concurrent();
+    return boost::report_errors();
+}
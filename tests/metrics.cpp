@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/metrics.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+void
+test_buckets()
+{
+    using h = canary::histogram_snapshot;
+    for (std::uint64_t v = 0; v < 16; ++v)
+    {
+        BOOST_TEST_EQ(h::bucket_index(v), v);
+    }
+
+    std::size_t prev = 0;
+    for (std::uint64_t v = 1; v < (std::uint64_t{1} << 40); v = v * 3 / 2 + 1)
+    {
+        auto const i = h::bucket_index(v);
+        BOOST_TEST(i < h::bucket_count);
+        BOOST_TEST(i >= prev);
+        BOOST_TEST_LE(h::bucket_lower_bound(i), v);
+        BOOST_TEST_GE(h::bucket_upper_bound(i), v);
+        // Relative error bounded by the number of sub-buckets.
+        BOOST_TEST_LE(h::bucket_upper_bound(i) - h::bucket_lower_bound(i),
+                      v / 16);
+        prev = i;
+    }
+
+    for (std::size_t i = 0; i < h::bucket_count; ++i)
+    {
+        BOOST_TEST_EQ(h::bucket_index(h::bucket_lower_bound(i)), i);
+        BOOST_TEST_EQ(h::bucket_index(h::bucket_upper_bound(i)), i);
+    }
+
+    BOOST_TEST_EQ(h::bucket_index(~std::uint64_t{0}), h::bucket_count - 1);
+}
+
+void
+test_histogram()
+{
+    canary::latency_histogram hist;
+    for (std::uint64_t v = 1; v <= 1000; ++v)
+    {
+        hist.record(v * 1000);
+    }
+    hist.record(std::chrono::microseconds{-5});
+
+    auto const s = hist.snapshot();
+    BOOST_TEST_EQ(s.count, 1001u);
+    BOOST_TEST_EQ(s.max, 1000000u);
+    BOOST_TEST_EQ(s.buckets[0], 1u);
+    BOOST_TEST_EQ(s.percentile(100), 1000000u);
+
+    auto const p50 = s.percentile(50);
+    BOOST_TEST_GE(p50, 500000u);
+    BOOST_TEST_LE(p50, 500000u + 500000u / 16);
+    auto const p99 = s.percentile(99);
+    BOOST_TEST_GE(p99, 990000u);
+    BOOST_TEST_LE(p99, 1000000u);
+}
+
+void
+test_concurrent_updates()
+{
+    canary::socket_metrics m;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&m] {
+            for (int i = 0; i < 10000; ++i)
+            {
+                m.frames_received.add();
+                m.bytes_received.add(16);
+                m.receive_latency.record(std::uint64_t{100});
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    auto const s = m.snapshot();
+    BOOST_TEST_EQ(s.frames_received, 40000u);
+    BOOST_TEST_EQ(s.bytes_received, 640000u);
+    BOOST_TEST_EQ(s.frames_sent, 0u);
+    BOOST_TEST_EQ(s.receive_latency.count, 40000u);
+    BOOST_TEST_EQ(s.receive_latency.sum, 4000000u);
+}
+
+void
+test_gauge()
+{
+    canary::gauge g;
+    g.set(5);
+    BOOST_TEST_EQ(g.load(), 5u);
+    g.set(2);
+    BOOST_TEST_EQ(g.load(), 2u);
+    g.set_max(1);
+    BOOST_TEST_EQ(g.load(), 2u);
+    g.set_max(7);
+    BOOST_TEST_EQ(g.load(), 7u);
+}
+
+void
+test_write_text()
+{
+    canary::socket_metrics m;
+    m.frames_sent.add(3);
+    m.bytes_sent.add(48);
+    m.errors.add();
+    m.receive_latency.record(std::uint64_t{1000});
+
+    std::ostringstream os;
+    canary::write_text(os, m.snapshot(), "socket=\"vcan0\"");
+    auto const text = os.str();
+    BOOST_TEST(text.find("canary_frames_sent_total{socket=\"vcan0\"} 3\n") !=
+               std::string::npos);
+    BOOST_TEST(text.find("canary_bytes_sent_total{socket=\"vcan0\"} 48\n") !=
+               std::string::npos);
+    BOOST_TEST(text.find("canary_errors_total{socket=\"vcan0\"} 1\n") !=
+               std::string::npos);
+    BOOST_TEST(text.find("canary_receive_latency_ns{socket=\"vcan0\","
+                         "quantile=\"0.5\"} 1000\n") != std::string::npos);
+    BOOST_TEST(text.find("canary_receive_latency_ns_count{socket=\"vcan0\"} "
+                         "1\n") != std::string::npos);
+
+    std::ostringstream unlabeled;
+    canary::write_text(unlabeled, m.snapshot());
+    BOOST_TEST(unlabeled.str().find("canary_frames_sent_total 3\n") !=
+               std::string::npos);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_buckets();
+    test_histogram();
+    test_concurrent_updates();
+    test_gauge();
+    test_write_text();
+    return boost::report_errors();
+}
@@ -0,0 +1,190 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/polling_receiver.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <thread>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using local_receiver = canary::basic_polling_receiver<local_socket>;
+
+void
+test_receive()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    local_receiver rx{b};
+    BOOST_TEST(b.non_blocking());
+
+    ::can_frame out{};
+    for (std::uint32_t i = 0; i < 3; ++i)
+    {
+        out.can_id = i;
+        a.send(net::buffer(&out, sizeof(out)));
+    }
+
+    ::can_frame in{};
+    std::vector<std::uint32_t> ids;
+    std::function<void(canary::error_code, std::size_t)> on_receive =
+      [&](canary::error_code ec, std::size_t n) {
+          BOOST_TEST(!ec);
+          BOOST_TEST_EQ(n, sizeof(in));
+          ids.push_back(in.can_id);
+          if (ids.size() < 3)
+          {
+              rx.async_receive(net::buffer(&in, sizeof(in)), on_receive);
+          }
+      };
+    rx.async_receive(net::buffer(&in, sizeof(in)), on_receive);
+
+    // Returns once no receive is outstanding.
+    BOOST_TEST_EQ(rx.run(), 3u);
+    BOOST_TEST((ids == std::vector<std::uint32_t>{0, 1, 2}));
+    BOOST_TEST_EQ(rx.blocking_waits(), 0u);
+}
+
+// With nothing to receive, the receiver backs off to a blocking wait and
+// resumes as soon as a frame arrives.
+void
+test_back_off()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    local_receiver::options opts;
+    opts.spin = std::chrono::microseconds{100};
+    opts.yield = std::chrono::microseconds{100};
+    local_receiver rx{b, opts};
+
+    ::can_frame in{};
+    bool received = false;
+    rx.async_receive(net::buffer(&in, sizeof(in)),
+                     [&](canary::error_code ec, std::size_t) {
+                         BOOST_TEST(!ec);
+                         received = true;
+                     });
+    std::thread sender{[&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{50});
+        ::can_frame out{};
+        out.can_id = 0x42;
+        a.send(net::buffer(&out, sizeof(out)));
+    }};
+    BOOST_TEST_EQ(rx.run(), 1u);
+    sender.join();
+    BOOST_TEST(received);
+    BOOST_TEST_EQ(in.can_id, 0x42u);
+    BOOST_TEST_EQ(rx.blocking_waits(), 1u);
+}
+
+void
+test_stop()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    local_receiver::options opts;
+    opts.spin = std::chrono::microseconds{0};
+    opts.yield = std::chrono::microseconds{0};
+    local_receiver rx{b, opts};
+
+    ::can_frame in{};
+    int calls = 0;
+    rx.async_receive(net::buffer(&in, sizeof(in)),
+                     [&](canary::error_code, std::size_t) { ++calls; });
+    std::thread stopper{[&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        rx.stop();
+    }};
+    BOOST_TEST_EQ(rx.run(), 0u);
+    stopper.join();
+    BOOST_TEST_EQ(calls, 0);
+
+    // Stays stopped until restarted, the receive is still outstanding.
+    BOOST_TEST_EQ(rx.run(), 0u);
+    rx.restart();
+    ::can_frame out{};
+    a.send(net::buffer(&out, sizeof(out)));
+    BOOST_TEST_EQ(rx.run(), 1u);
+    BOOST_TEST_EQ(calls, 1);
+}
+
+void
+test_error()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_receiver rx{b};
+
+    // Receiving from a closed socket fails immediately.
+    b.close();
+    ::can_frame in{};
+    canary::error_code result;
+    rx.async_receive(
+      net::buffer(&in, sizeof(in)),
+      [&](canary::error_code ec, std::size_t) { result = ec; });
+    BOOST_TEST_EQ(rx.run(), 1u);
+    BOOST_TEST(result == net::error::bad_descriptor);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx_sock{ioc, ep};
+    canary::polling_receiver::options opts;
+    opts.busy_poll = std::chrono::microseconds{50};
+    canary::polling_receiver rx{rx_sock, opts};
+
+    ::can_frame out{};
+    out.can_id = 0x7;
+    out.can_dlc = 8;
+    tx.send(net::buffer(&out, sizeof(out)));
+
+    ::can_frame in{};
+    rx.async_receive(net::buffer(&in, sizeof(in)),
+                     [&](canary::error_code ec, std::size_t n) {
+                         BOOST_TEST(!ec);
+                         BOOST_TEST_EQ(n, sizeof(in));
+                     });
+    BOOST_TEST_EQ(rx.run(), 1u);
+    BOOST_TEST_EQ(in.can_id, 0x7u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_receive();
+    test_back_off();
+    test_stop();
+    test_error();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,305 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/receive_loop.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <atomic>
+#include <cstdlib>
+#include <thread>
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+namespace
+{
+
+std::atomic<std::size_t> allocations{0};
+
+} // namespace
+
+void*
+operator new(std::size_t size)
+{
+    ++allocations;
+    if (auto const p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+    throw std::bad_alloc{};
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+constexpr std::size_t warm_up = 16;
+constexpr std::size_t count = 1000;
+
+// Sends frames in bursts, waiting for the receiver to catch up after each.
+void
+send_bursts(local_socket& tx,
+            std::size_t first,
+            std::size_t last,
+            std::atomic<std::size_t> const& received)
+{
+    for (auto i = first; i < last;)
+    {
+        for (std::size_t n = 0; n < 10 && i < last; ++n, ++i)
+        {
+            ::can_frame f{};
+            f.can_id = static_cast<std::uint32_t>(i & 0x7FF);
+            tx.send(net::buffer(&f, sizeof(f)));
+        }
+        while (received < i)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Runs the io_context, which runs a receive loop on `rx`, while another
+// thread sends frames to it, and returns the number of allocations made
+// after the warm-up. The loop is then stopped by cancelling the receive.
+std::size_t
+steady_state_allocations(net::io_context& ioc,
+                         local_socket& tx,
+                         local_socket& rx,
+                         std::atomic<std::size_t> const& received)
+{
+    std::size_t steady = 0;
+    std::thread sender{[&] {
+        send_bursts(tx, 0, warm_up, received);
+        auto const before = allocations.load();
+        send_bursts(tx, warm_up, warm_up + count, received);
+        steady = allocations.load() - before;
+        net::post(ioc, [&] { rx.cancel(); });
+    }};
+    ioc.run();
+    sender.join();
+    BOOST_TEST_EQ(received.load(), warm_up + count);
+    return steady;
+}
+
+void
+test_arena()
+{
+    canary::handler_arena arena{2, 100};
+    BOOST_TEST_EQ(arena.block_size() % alignof(std::max_align_t), 0u);
+    BOOST_TEST_GE(arena.block_size(), 100u);
+
+    auto const a = arena.allocate(64);
+    auto const b = arena.allocate(arena.block_size());
+    BOOST_TEST(a != b);
+    BOOST_TEST_EQ(arena.fallbacks(), 0u);
+
+    // All blocks in use.
+    auto const c = arena.allocate(8);
+    BOOST_TEST_EQ(arena.fallbacks(), 1u);
+    // Too large.
+    auto const d = arena.allocate(arena.block_size() + 1);
+    BOOST_TEST_EQ(arena.fallbacks(), 2u);
+    arena.deallocate(c);
+    arena.deallocate(d);
+
+    // Released blocks are reused.
+    arena.deallocate(a);
+    BOOST_TEST(arena.allocate(16) == a);
+    BOOST_TEST_EQ(arena.fallbacks(), 2u);
+    arena.deallocate(a);
+    arena.deallocate(b);
+
+    canary::arena_allocator<int> ints{arena};
+    canary::arena_allocator<double> doubles{ints};
+    BOOST_TEST(ints == doubles);
+    auto const p = doubles.allocate(4);
+    BOOST_TEST(static_cast<void*>(p) == a);
+    doubles.deallocate(p, 4);
+}
+
+void
+test_callback_loop()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    canary::handler_arena arena;
+    ::can_frame in{};
+    std::atomic<std::size_t> received{0};
+    bool ids_ok = true;
+    canary::async_receive_loop(
+      b,
+      arena,
+      net::buffer(&in, sizeof(in)),
+      [&](canary::error_code ec, std::size_t n) {
+          if (ec)
+          {
+              return false;
+          }
+          BOOST_TEST_EQ(n, sizeof(::can_frame));
+          ids_ok = ids_ok && in.can_id == (received.load() & 0x7FF);
+          ++received;
+          return true;
+      });
+    BOOST_TEST_EQ(steady_state_allocations(ioc, a, b, received), 0u);
+    BOOST_TEST_EQ(arena.fallbacks(), 0u);
+    BOOST_TEST(ids_ok);
+}
+
+void
+test_batch_loop()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    canary::handler_arena arena;
+    std::array<::can_frame, 8> frames{};
+    std::atomic<std::size_t> received{0};
+    std::size_t batches = 0;
+    bool ids_ok = true;
+    canary::async_receive_batch_loop(
+      b,
+      arena,
+      net::buffer(frames),
+      sizeof(::can_frame),
+      [&](canary::error_code ec, std::size_t n) {
+          if (ec)
+          {
+              return false;
+          }
+          BOOST_TEST_GE(n, 1u);
+          BOOST_TEST_LE(n, frames.size());
+          for (std::size_t i = 0; i < n; ++i, ++received)
+          {
+              ids_ok =
+                ids_ok && frames[i].can_id == (received.load() & 0x7FF);
+          }
+          ++batches;
+          return true;
+      });
+    BOOST_TEST_EQ(steady_state_allocations(ioc, a, b, received), 0u);
+    BOOST_TEST_EQ(arena.fallbacks(), 0u);
+    BOOST_TEST(ids_ok);
+    BOOST_TEST_LT(batches, received.load());
+
+    std::array<unsigned char, 4> tiny{};
+    BOOST_TEST_THROWS(canary::async_receive_batch_loop(
+                        b,
+                        arena,
+                        net::buffer(tiny),
+                        sizeof(::can_frame),
+                        [](canary::error_code, std::size_t) { return false; }),
+                      canary::system_error);
+}
+
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+
+net::awaitable<void>
+coroutine_loop(local_socket& sock,
+               canary::handler_arena& arena,
+               std::atomic<std::size_t>& received)
+{
+    ::can_frame in{};
+    for (;;)
+    {
+        auto const n = co_await sock.async_receive(
+          net::buffer(&in, sizeof(in)),
+          canary::bind_arena(arena, net::use_awaitable));
+        BOOST_TEST_EQ(n, sizeof(::can_frame));
+        BOOST_TEST_EQ(in.can_id, received.load() & 0x7FF);
+        ++received;
+    }
+}
+
+void
+test_coroutine_loop()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+
+    canary::handler_arena arena;
+    std::atomic<std::size_t> received{0};
+    net::co_spawn(ioc, coroutine_loop(b, arena, received), net::detached);
+    BOOST_TEST_EQ(steady_state_allocations(ioc, a, b, received), 0u);
+    BOOST_TEST_EQ(arena.fallbacks(), 0u);
+}
+
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+
+    canary::handler_arena arena;
+    ::can_frame in{};
+    std::size_t received = 0;
+    canary::async_receive_loop(
+      rx,
+      arena,
+      net::buffer(&in, sizeof(in)),
+      [&](canary::error_code ec, std::size_t) {
+          BOOST_TEST(!ec);
+          return ++received < 3;
+      });
+    for (std::uint32_t i = 0; i < 3; ++i)
+    {
+        ::can_frame f{};
+        f.can_id = i;
+        tx.send(net::buffer(&f, sizeof(f)));
+    }
+    ioc.run();
+    BOOST_TEST_EQ(received, 3u);
+    BOOST_TEST_EQ(arena.fallbacks(), 0u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_arena();
+    test_callback_loop();
+    test_batch_loop();
+#ifdef BOOST_ASIO_HAS_CO_AWAIT
+    test_coroutine_loop();
+#endif // BOOST_ASIO_HAS_CO_AWAIT
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,366 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/send_queue.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/socket_options.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+// Fails sends with ENOBUFS a given number of times, like a raw socket whose
+// interface transmit queue is full.
+class flaky_socket
+{
+public:
+    using executor_type = net::io_context::executor_type;
+
+    enum wait_type
+    {
+        wait_read,
+        wait_write
+    };
+
+    explicit flaky_socket(net::io_context& ioc)
+      : ioc_{ioc}
+    {
+    }
+
+    executor_type get_executor() noexcept
+    {
+        return ioc_.get_executor();
+    }
+
+    void non_blocking(bool)
+    {
+    }
+
+    template<class ConstBufferSequence>
+    std::size_t send(ConstBufferSequence const& buffers,
+                     int,
+                     canary::error_code& ec)
+    {
+        if (failures > 0)
+        {
+            --failures;
+            ec = net::error::no_buffer_space;
+            return 0;
+        }
+        ::can_frame f{};
+        auto const n = net::buffer_copy(net::buffer(&f, sizeof(f)), buffers);
+        sent.push_back(f.can_id);
+        ec.clear();
+        return n;
+    }
+
+    template<class Handler>
+    void async_wait(wait_type, Handler&& h)
+    {
+        net::post(ioc_,
+                  std::bind(std::forward<Handler>(h), canary::error_code{}));
+    }
+
+    std::size_t failures = 0;
+    std::vector<std::uint32_t> sent;
+
+private:
+    net::io_context& ioc_;
+};
+
+using flaky_queue = canary::basic_send_queue<flaky_socket>;
+using local_queue = canary::basic_send_queue<local_socket>;
+
+std::vector<::can_frame>
+make_frames(std::size_t n)
+{
+    std::vector<::can_frame> frames(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        frames[i].can_id = static_cast<std::uint32_t>(i);
+        frames[i].can_dlc = 8;
+    }
+    return frames;
+}
+
+void
+test_retry()
+{
+    net::io_context ioc{1};
+    flaky_socket sock{ioc};
+    sock.failures = 5;
+    flaky_queue q{sock};
+
+    auto const frames = make_frames(10);
+    std::vector<std::uint32_t> completed;
+    for (auto const& f : frames)
+    {
+        q.async_send(net::buffer(&f, sizeof(f)),
+                     [&](canary::error_code ec, std::size_t n) {
+                         BOOST_TEST(!ec);
+                         BOOST_TEST_EQ(n, sizeof(::can_frame));
+                         completed.push_back(
+                           static_cast<std::uint32_t>(completed.size()));
+                     });
+    }
+    // Nothing completes within the initiating function.
+    BOOST_TEST(completed.empty());
+    BOOST_TEST_EQ(q.in_flight(), 10u);
+    ioc.run();
+
+    BOOST_TEST_EQ(completed.size(), 10u);
+    BOOST_TEST_EQ(q.retries(), 5u);
+    BOOST_TEST_EQ(q.in_flight(), 0u);
+    // No frame lost or reordered.
+    BOOST_TEST_EQ(sock.sent.size(), 10u);
+    for (std::uint32_t i = 0; i < sock.sent.size(); ++i)
+    {
+        BOOST_TEST_EQ(sock.sent[i], i);
+    }
+}
+
+void
+test_full()
+{
+    net::io_context ioc{1};
+    flaky_socket sock{ioc};
+    sock.failures = 1000;
+    flaky_queue::options opts;
+    opts.max_in_flight = 2;
+    opts.max_retry = std::chrono::microseconds{100};
+    flaky_queue q{sock, opts};
+
+    std::vector<bool> full_events;
+    q.on_full([&](bool full) { full_events.push_back(full); });
+
+    auto const frames = make_frames(3);
+    int ok = 0;
+    int rejected = 0;
+    auto const handler = [&](canary::error_code ec, std::size_t) {
+        if (ec == net::error::no_buffer_space)
+        {
+            ++rejected;
+        }
+        else if (!ec)
+        {
+            ++ok;
+        }
+    };
+    for (auto const& f : frames)
+    {
+        q.async_send(net::buffer(&f, sizeof(f)), handler);
+    }
+    BOOST_TEST(q.full());
+    BOOST_TEST((full_events == std::vector<bool>{true}));
+
+    ioc.run_for(std::chrono::milliseconds{5});
+    BOOST_TEST_EQ(rejected, 1);
+    BOOST_TEST_EQ(ok, 0);
+
+    // Once the interface queue drains, the waiting frames go out.
+    sock.failures = 0;
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(ok, 2);
+    BOOST_TEST((full_events == std::vector<bool>{true, false}));
+    BOOST_TEST_NOT(q.full());
+}
+
+// The socket would block, the queue waits for it to become writable.
+void
+test_would_block()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    a.set_option(net::socket_base::send_buffer_size{1});
+    local_queue q{a};
+
+    auto const frames = make_frames(50);
+    std::size_t completed = 0;
+    for (auto const& f : frames)
+    {
+        q.async_send(net::buffer(&f, sizeof(f)),
+                     [&](canary::error_code ec, std::size_t) {
+                         BOOST_TEST(!ec);
+                         ++completed;
+                     });
+    }
+    ioc.poll();
+    BOOST_TEST_LT(completed, 50u);
+
+    for (std::uint32_t i = 0; i < 50; ++i)
+    {
+        ::can_frame in{};
+        b.receive(net::buffer(&in, sizeof(in)));
+        BOOST_TEST_EQ(in.can_id, i);
+        ioc.poll();
+    }
+    BOOST_TEST_EQ(completed, 50u);
+}
+
+// Queued sends complete with operation_aborted when the queue is destroyed or
+// cancelled, or when the wait for the socket is cancelled.
+void
+test_abort()
+{
+    net::io_context ioc{1};
+    auto const frames = make_frames(10);
+    std::size_t aborted = 0;
+    std::size_t ok = 0;
+    auto const handler = [&](canary::error_code ec, std::size_t) {
+        if (ec == net::error::operation_aborted)
+        {
+            ++aborted;
+        }
+        else if (!ec)
+        {
+            ++ok;
+        }
+    };
+
+    flaky_socket sock{ioc};
+    sock.failures = 1000;
+    {
+        flaky_queue q{sock};
+        for (auto const& f : frames)
+        {
+            q.async_send(net::buffer(&f, sizeof(f)), handler);
+        }
+        ioc.poll();
+    }
+    BOOST_TEST_EQ(aborted, 0u);
+    ioc.run();
+    BOOST_TEST_EQ(aborted, 10u);
+
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    a.set_option(net::socket_base::send_buffer_size{1});
+    local_queue q{a};
+    std::vector<bool> full_events;
+    q.on_full([&](bool full) { full_events.push_back(full); });
+    for (auto const& f : frames)
+    {
+        q.async_send(net::buffer(&f, sizeof(f)), handler);
+    }
+    ioc.restart();
+    ioc.poll();
+    auto const waiting = q.in_flight();
+    BOOST_TEST_GT(waiting, 0u);
+    a.cancel();
+    ioc.restart();
+    ioc.poll();
+    BOOST_TEST_EQ(q.in_flight(), 0u);
+    BOOST_TEST_EQ(aborted, 10u + waiting);
+    BOOST_TEST_EQ(ok, 10u - waiting);
+
+    ok = 0;
+    aborted = 0;
+    while (b.available() > 0)
+    {
+        ::can_frame in{};
+        b.receive(net::buffer(&in, sizeof(in)));
+    }
+    flaky_queue::options opts;
+    opts.max_in_flight = 10;
+    flaky_queue r{sock, opts};
+    r.on_full([&](bool full) { full_events.push_back(full); });
+    for (auto const& f : frames)
+    {
+        r.async_send(net::buffer(&f, sizeof(f)), handler);
+    }
+    ioc.restart();
+    ioc.poll();
+    r.cancel();
+    BOOST_TEST_EQ(r.in_flight(), 0u);
+    BOOST_TEST((full_events == std::vector<bool>{true, false}));
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(aborted, 10u);
+    BOOST_TEST_EQ(ok, 0u);
+}
+
+// Floods vcan0 through a send queue with a small send buffer, which keeps
+// hitting ENOBUFS or EAGAIN, and checks that every frame arrives.
+void
+test_raw_socket_stress()
+{
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    constexpr std::size_t count = 20000;
+
+    net::io_context rx_ioc{1};
+    canary::raw::socket rx{rx_ioc, ep};
+    rx.set_option(net::socket_base::receive_buffer_size{1 << 23});
+    std::atomic<std::size_t> received{0};
+    std::thread receiver{[&] {
+        ::can_frame in{};
+        std::uint32_t expected = 0;
+        while (received < count)
+        {
+            rx.receive(net::buffer(&in, sizeof(in)));
+            BOOST_TEST_EQ(in.can_id, expected & 0x7FF);
+            ++expected;
+            ++received;
+        }
+    }};
+
+    net::io_context ioc{1};
+    canary::raw::socket tx{ioc, ep};
+    tx.set_option(net::socket_base::send_buffer_size{1});
+    canary::send_queue q{tx};
+
+    // Keeps the queue full, refilling it as frames complete.
+    std::vector<::can_frame> frames(count);
+    std::size_t next = 0;
+    std::size_t failed = 0;
+    std::function<void()> pump;
+    auto const on_sent = [&](canary::error_code ec, std::size_t) {
+        failed += ec ? 1 : 0;
+        pump();
+    };
+    pump = [&] {
+        while (!q.full() && next < count)
+        {
+            auto& f = frames[next];
+            f.can_id = static_cast<std::uint32_t>(next++ & 0x7FF);
+            q.async_send(net::buffer(&f, sizeof(f)), on_sent);
+        }
+    };
+    pump();
+    ioc.run();
+    receiver.join();
+
+    BOOST_TEST_EQ(failed, 0u);
+    BOOST_TEST_EQ(received.load(), count);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_retry();
+    test_full();
+    test_would_block();
+    test_abort();
+    test_raw_socket_stress();
+    return boost::report_errors();
+}
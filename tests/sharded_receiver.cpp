@@ -0,0 +1,198 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/sharded_receiver.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <map>
+
+namespace
+{
+
+namespace net = canary::net;
+
+void
+test_rebalance_buckets()
+{
+    // Worker 0 owns the 2 hot buckets.
+    std::vector<std::uint64_t> const load = {100, 100, 1, 1, 1, 1, 1, 1};
+    std::vector<std::size_t> assignment = {0, 0, 1, 1, 1, 1, 1, 1};
+    BOOST_TEST(canary::detail::rebalance_buckets(load, assignment, 2, 1.25));
+    BOOST_TEST_NE(assignment[0], assignment[1]);
+    // Cold buckets stay where they were.
+    for (std::size_t b = 2; b < assignment.size(); ++b)
+    {
+        BOOST_TEST_EQ(assignment[b], 1u);
+    }
+
+    // Already balanced.
+    auto const before = assignment;
+    BOOST_TEST_NOT(
+      canary::detail::rebalance_buckets(load, assignment, 2, 1.25));
+    BOOST_TEST(assignment == before);
+
+    // A single hot bucket cannot be split, nothing to gain from moving it.
+    std::vector<std::uint64_t> const single = {1000, 0, 0, 0};
+    std::vector<std::size_t> a2 = {0, 1, 0, 1};
+    BOOST_TEST_NOT(canary::detail::rebalance_buckets(single, a2, 2, 1.25));
+}
+
+// Records the sequence numbers delivered for each ID.
+class recorder
+{
+public:
+    void operator()(std::size_t /*worker*/,
+                    canary::sharded_receiver::frame const& f)
+    {
+        std::uint32_t seq;
+        std::memcpy(&seq, f.payload.data(), sizeof(seq));
+        std::lock_guard<std::mutex> lock{mutex_};
+        seqs_[f.header.id()].push_back(seq);
+        ++total_;
+    }
+
+    bool wait_for(std::size_t n)
+    {
+        for (int i = 0; i < 500; ++i)
+        {
+            {
+                std::lock_guard<std::mutex> lock{mutex_};
+                if (total_ >= n)
+                {
+                    return true;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }
+        return false;
+    }
+
+    // Every ID must have been delivered exactly once per sequence number, in
+    // order.
+    void check(std::uint32_t ids, std::uint32_t per_id)
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        BOOST_TEST_EQ(seqs_.size(), ids);
+        for (auto const& kv : seqs_)
+        {
+            BOOST_TEST_EQ(kv.second.size(), per_id);
+            for (std::uint32_t i = 0; i < kv.second.size(); ++i)
+            {
+                BOOST_TEST_EQ(kv.second[i], i);
+            }
+        }
+    }
+
+private:
+    std::mutex mutex_;
+    std::map<std::uint32_t, std::vector<std::uint32_t>> seqs_;
+    std::size_t total_ = 0;
+};
+
+void
+send_all(canary::raw::socket& sock,
+         std::uint32_t ids,
+         std::uint32_t per_id,
+         std::uint32_t stride = 1,
+         std::function<void(std::uint32_t)> const& between = {})
+{
+    for (std::uint32_t seq = 0; seq < per_id; ++seq)
+    {
+        for (std::uint32_t id = 0; id < ids; ++id)
+        {
+            ::can_frame f{};
+            f.can_id = id * stride;
+            f.can_dlc = sizeof(seq);
+            std::memcpy(f.data, &seq, sizeof(seq));
+            sock.send(net::buffer(&f, sizeof(f)));
+        }
+        if (between)
+        {
+            between(seq);
+        }
+    }
+}
+
+void
+test_receive()
+{
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::sharded_receiver::options opts;
+    opts.workers = 2;
+    opts.bucket_bits = 2;
+    opts.rebalance_interval = std::chrono::milliseconds{0};
+
+    recorder rec;
+    canary::sharded_receiver receiver{ep, opts, std::ref(rec)};
+    receiver.start();
+
+    net::io_context ioc{1};
+    canary::raw::socket tx{ioc, ep};
+    send_all(tx, 16, 50);
+    BOOST_TEST(rec.wait_for(16 * 50));
+    receiver.stop();
+    rec.check(16, 50);
+
+    // Both workers received their share.
+    auto const frames = receiver.frames_per_worker();
+    BOOST_TEST_EQ(frames.size(), 2u);
+    BOOST_TEST_EQ(frames[0], 8u * 50u);
+    BOOST_TEST_EQ(frames[1], 8u * 50u);
+}
+
+void
+test_handoff()
+{
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::sharded_receiver::options opts;
+    opts.workers = 2;
+    opts.bucket_bits = 3;
+    opts.rebalance_interval = std::chrono::milliseconds{0};
+    opts.imbalance_threshold = 1.0;
+
+    recorder rec;
+    canary::sharded_receiver receiver{ep, opts, std::ref(rec)};
+    receiver.start();
+
+    // Only buckets 0, 2 and 4 carry traffic, and worker 0 owns all of them.
+    net::io_context ioc{1};
+    canary::raw::socket tx{ioc, ep};
+    auto const before = receiver.assignment();
+    BOOST_TEST_EQ(before[0], 0u);
+    BOOST_TEST_EQ(before[2], 0u);
+    BOOST_TEST_EQ(before[4], 0u);
+    auto const ids = 3u;
+    send_all(tx, ids, 2000, 2, [&](std::uint32_t seq) {
+        if (seq % 500 == 250)
+        {
+            receiver.rebalance();
+        }
+    });
+    BOOST_TEST(rec.wait_for(ids * 2000));
+    std::this_thread::sleep_for(std::chrono::milliseconds{50});
+    receiver.stop();
+    rec.check(ids, 2000);
+
+    BOOST_TEST_GE(receiver.handoffs(), 1u);
+    auto const after = receiver.assignment();
+    BOOST_TEST_EQ(after[0] + after[2] + after[4], 1u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_rebalance_buckets();
+    test_receive();
+    test_handoff();
+    return boost::report_errors();
+}
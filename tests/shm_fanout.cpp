@@ -0,0 +1,349 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/shm_fanout.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <canary/socket_options.hpp>
+
+#include <array>
+#include <sys/wait.h>
+#include <thread>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+using buffer = std::array<std::uint8_t, canary::fd_frame_size>;
+
+std::string
+ring_path(char const* name)
+{
+    return "/dev/shm/canary-test-" + std::string{name} + "-" +
+           std::to_string(::getpid());
+}
+
+std::uint32_t
+id_of(buffer const& b)
+{
+    canary::frame_header h;
+    std::memcpy(&h, b.data(), sizeof(h));
+    return h.id();
+}
+
+void
+test_publish()
+{
+    auto const path = ring_path("publish");
+    canary::shm_publisher pub{path};
+    ::can_frame before{};
+    before.can_id = 0x10;
+    pub.publish(net::buffer(&before, sizeof(before)));
+
+    canary::shm_subscriber sub{path};
+    buffer b{};
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), 0u);
+
+    ::can_frame classic{};
+    classic.can_id = 0x11;
+    classic.can_dlc = 1;
+    classic.data[0] = 0x11;
+    ::canfd_frame fd{};
+    fd.can_id = 0x12;
+    fd.len = CANFD_MAX_DLEN;
+    pub.publish(net::buffer(&classic, sizeof(classic)));
+    pub.publish(net::buffer(&fd, sizeof(fd)));
+    BOOST_TEST_EQ(pub.published(), 3u);
+    BOOST_TEST_EQ(pub.wakeups(), 0u);
+    BOOST_TEST_EQ(sub.lag(), 2u);
+
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::classic_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x11u);
+    BOOST_TEST_EQ(b[sizeof(canary::frame_header)], 0x11u);
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::fd_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x12u);
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), 0u);
+    BOOST_TEST_EQ(sub.lag(), 0u);
+    BOOST_TEST_EQ(sub.lost(), 0u);
+
+    // Every subscriber has its own cursor.
+    canary::shm_subscriber other{path};
+    pub.publish(net::buffer(&classic, sizeof(classic)));
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::classic_frame_size);
+    BOOST_TEST_EQ(other.try_receive(net::buffer(b)),
+                  canary::classic_frame_size);
+}
+
+void
+test_overrun()
+{
+    auto const path = ring_path("overrun");
+    canary::shm_publisher::options opts;
+    opts.capacity = 8;
+    canary::shm_publisher pub{path, opts};
+    canary::shm_subscriber sub{path};
+
+    for (std::uint32_t i = 0; i < 20; ++i)
+    {
+        ::can_frame f{};
+        f.can_id = i;
+        pub.publish(net::buffer(&f, sizeof(f)));
+    }
+
+    // Half of the ring is left to catch up with.
+    buffer b{};
+    std::size_t received = 0;
+    while (sub.try_receive(net::buffer(b)) > 0)
+    {
+        BOOST_TEST_EQ(id_of(b), 16 + received);
+        ++received;
+    }
+    BOOST_TEST_EQ(received, 4u);
+    BOOST_TEST_EQ(sub.lost(), 16u);
+}
+
+void
+test_wait()
+{
+    auto const path = ring_path("wait");
+    canary::shm_publisher pub{path};
+    canary::shm_subscriber sub{path};
+
+    buffer b{};
+    canary::error_code ec;
+    BOOST_TEST_EQ(
+      sub.receive(net::buffer(b), std::chrono::milliseconds{10}, ec), 0u);
+    BOOST_TEST(ec == net::error::timed_out);
+
+    std::thread publisher{[&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        ::can_frame f{};
+        f.can_id = 0x42;
+        pub.publish(net::buffer(&f, sizeof(f)));
+    }};
+    BOOST_TEST_EQ(sub.receive(net::buffer(b), ec), canary::classic_frame_size);
+    BOOST_TEST(!ec);
+    BOOST_TEST_EQ(id_of(b), 0x42u);
+    publisher.join();
+    BOOST_TEST_EQ(pub.wakeups(), 1u);
+
+    // Frames left in a closed ring are still read.
+    ::can_frame f{};
+    f.can_id = 0x43;
+    pub.publish(net::buffer(&f, sizeof(f)));
+    pub.close();
+    BOOST_TEST_EQ(sub.receive(net::buffer(b), ec), canary::classic_frame_size);
+    BOOST_TEST_EQ(sub.receive(net::buffer(b), ec), 0u);
+    BOOST_TEST(ec == net::error::eof);
+}
+
+void
+test_processes()
+{
+    auto const path = ring_path("processes");
+    canary::shm_publisher pub{path};
+    constexpr std::uint32_t frames = 100;
+    constexpr int children = 3;
+    ::pid_t pids[children];
+    for (auto& pid : pids)
+    {
+        pid = ::fork();
+        if (pid == 0)
+        {
+            canary::shm_subscriber sub{path};
+            buffer b{};
+            canary::error_code ec;
+            std::uint32_t expected = 0;
+            while (sub.receive(net::buffer(b), ec) > 0)
+            {
+                if (id_of(b) != expected++)
+                {
+                    ::_exit(1);
+                }
+            }
+            ::_exit(ec == net::error::eof && expected == frames &&
+                        sub.lost() == 0
+                      ? 0
+                      : 2);
+        }
+    }
+
+    // Subscribers start reading at the frame published after they open the
+    // ring, so give them time to do so.
+    std::this_thread::sleep_for(std::chrono::milliseconds{100});
+    for (std::uint32_t i = 0; i < frames; ++i)
+    {
+        ::can_frame f{};
+        f.can_id = i;
+        pub.publish(net::buffer(&f, sizeof(f)));
+    }
+    pub.close();
+    for (auto pid : pids)
+    {
+        int status = 0;
+        BOOST_TEST_EQ(::waitpid(pid, &status, 0), pid);
+        BOOST_TEST(WIFEXITED(status));
+        BOOST_TEST_EQ(WEXITSTATUS(status), 0);
+    }
+}
+
+void
+test_socket()
+{
+    auto const path = ring_path("socket");
+    net::io_context ioc{1};
+    local_socket in{ioc};
+    local_socket src{ioc};
+    net::local::connect_pair(in, src);
+    canary::shm_publisher pub{path};
+    canary::shm_subscriber sub{path};
+    pub.start(src);
+
+    ::can_frame classic{};
+    classic.can_id = 0x21;
+    ::canfd_frame fd{};
+    fd.can_id = 0x22;
+    fd.len = CANFD_MAX_DLEN;
+    std::array<std::uint8_t, 3> invalid{};
+    in.send(net::buffer(&classic, sizeof(classic)));
+    in.send(net::buffer(invalid));
+    in.send(net::buffer(&fd, sizeof(fd)));
+    ioc.poll();
+
+    buffer b{};
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::classic_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x21u);
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::fd_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x22u);
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), 0u);
+    BOOST_TEST_EQ(pub.published(), 2u);
+
+    pub.stop(src);
+    ioc.poll();
+}
+
+void
+test_invalid()
+{
+    auto const path = ring_path("invalid");
+    canary::shm_publisher::options opts;
+    opts.capacity = 6;
+    BOOST_TEST_THROWS((canary::shm_publisher{path, opts}),
+                      canary::system_error);
+    opts.capacity = 8;
+    opts.batch_size = 0;
+    BOOST_TEST_THROWS((canary::shm_publisher{path, opts}),
+                      canary::system_error);
+    BOOST_TEST_THROWS(canary::shm_subscriber{path}, canary::system_error);
+
+    canary::shm_publisher pub{path};
+    BOOST_TEST_THROWS(canary::shm_publisher{path}, canary::system_error);
+    BOOST_TEST_THROWS(canary::shm_subscriber{"/dev/null"},
+                      canary::system_error);
+}
+
+// A ring left behind by a publisher which died is closed and replaced, but
+// other files are not.
+void
+test_stale()
+{
+    auto const path = ring_path("stale");
+    auto const pid = ::fork();
+    if (pid == 0)
+    {
+        canary::shm_publisher pub{path};
+        ::_exit(0);
+    }
+    int status = 0;
+    BOOST_TEST_EQ(::waitpid(pid, &status, 0), pid);
+    BOOST_TEST(WIFEXITED(status));
+
+    canary::shm_subscriber stale{path};
+    canary::shm_publisher pub{path};
+    buffer b{};
+    canary::error_code ec;
+    BOOST_TEST_EQ(stale.receive(net::buffer(b), ec), 0u);
+    BOOST_TEST(ec == net::error::eof);
+
+    canary::shm_subscriber sub{path};
+    ::can_frame f{};
+    f.can_id = 0x40;
+    pub.publish(net::buffer(&f, sizeof(f)));
+    BOOST_TEST_EQ(sub.try_receive(net::buffer(b)), canary::classic_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x40u);
+
+    auto const other = ring_path("other");
+    auto const fd = ::open(other.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    BOOST_TEST(fd >= 0);
+    BOOST_TEST_EQ(::write(fd, b.data(), b.size()),
+                  static_cast<::ssize_t>(b.size()));
+    ::close(fd);
+    BOOST_TEST_THROWS(canary::shm_publisher{other}, canary::system_error);
+    BOOST_TEST_EQ(::unlink(other.c_str()), 0);
+}
+
+void
+test_raw_socket()
+{
+    auto const path = ring_path("raw");
+    net::io_context ioc{1};
+    auto const ep =
+      canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    rx.set_option(canary::flexible_data_rate{true});
+    tx.set_option(canary::flexible_data_rate{true});
+    canary::shm_publisher pub{path};
+    canary::shm_subscriber sub{path};
+    pub.start(rx);
+
+    ::can_frame classic{};
+    classic.can_id = 0x31;
+    ::canfd_frame fd{};
+    fd.can_id = 0x32;
+    fd.len = CANFD_MAX_DLEN;
+    tx.send(net::buffer(&classic, sizeof(classic)));
+    tx.send(net::buffer(&fd, sizeof(fd)));
+    while (pub.published() < 2)
+    {
+        ioc.run_one();
+    }
+
+    buffer b{};
+    canary::error_code ec;
+    BOOST_TEST_EQ(sub.receive(net::buffer(b), ec), canary::classic_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x31u);
+    BOOST_TEST_EQ(sub.receive(net::buffer(b), ec), canary::fd_frame_size);
+    BOOST_TEST_EQ(id_of(b), 0x32u);
+    pub.stop(rx);
+    ioc.poll();
+}
+
+} // namespace
+
+int
+main()
+{
+    test_publish();
+    test_overrun();
+    test_wait();
+    test_processes();
+    test_socket();
+    test_invalid();
+    test_stale();
+    test_raw_socket();
+    return boost::report_errors();
+}
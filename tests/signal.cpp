@@ -0,0 +1,181 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/signal.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <linux/can.h>
+#include <random>
+#include <vector>
+
+namespace
+{
+
+// Bit-by-bit reference implementation of the DBC bit numbering.
+std::uint64_t
+reference_extract(canary::signal_definition const& s,
+                  unsigned char const* payload,
+                  std::size_t n)
+{
+    auto bit = [&](unsigned int pos) -> std::uint64_t {
+        return pos / 8 < n ? (payload[pos / 8] >> (pos % 8)) & 1u : 0u;
+    };
+
+    std::uint64_t v = 0;
+    if (s.order() == canary::byte_order::intel)
+    {
+        for (unsigned int i = 0; i < s.length(); ++i)
+        {
+            v |= bit(s.start_bit() + i) << i;
+        }
+        return v;
+    }
+
+    auto pos = s.start_bit();
+    for (unsigned int i = 0; i < s.length(); ++i)
+    {
+        v = (v << 1) | bit(pos);
+        pos = (pos % 8 == 0) ? pos + 15 : pos - 1;
+    }
+    return v;
+}
+
+void
+test_known_values()
+{
+    unsigned char const payload[8] = {
+      0x12, 0x34, 0x56, 0x78, 0x9A, 0xBC, 0xDE, 0xF0};
+
+    auto const intel =
+      canary::signal_definition{}.start_bit(8).length(16).order(
+        canary::byte_order::intel);
+    BOOST_TEST_EQ(canary::extract(intel, payload, 8), 0x5634u);
+
+    auto const motorola =
+      canary::signal_definition{}.start_bit(15).length(16).order(
+        canary::byte_order::motorola);
+    BOOST_TEST_EQ(canary::extract(motorola, payload, 8), 0x3456u);
+
+    auto const nibble =
+      canary::signal_definition{}.start_bit(4).length(4).is_signed(true);
+    BOOST_TEST_EQ(canary::decode_raw(nibble, payload, 8), 1);
+
+    auto const negative = canary::signal_definition{}
+                            .start_bit(56)
+                            .length(8)
+                            .is_signed(true)
+                            .scale(0.5, -10.0);
+    BOOST_TEST_EQ(canary::decode_raw(negative, payload, 8), -16);
+    BOOST_TEST_EQ(canary::decode(negative, payload, 8), -18.0);
+
+    // Bits past the payload length read as zero.
+    BOOST_TEST_EQ(canary::extract(intel, payload, 2), 0x34u);
+
+    auto const full =
+      canary::signal_definition{}.start_bit(7).length(64).order(
+        canary::byte_order::motorola);
+    BOOST_TEST_EQ(canary::extract(full, payload, 8), 0x123456789ABCDEF0u);
+}
+
+std::vector<canary::signal_definition>
+make_signals(std::mt19937_64& rng, unsigned int payload_bits, std::size_t n)
+{
+    std::vector<canary::signal_definition> signals;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        auto const len = static_cast<unsigned int>(rng() % 64 + 1);
+        auto const order = (i % 2 == 0) ? canary::byte_order::intel
+                                        : canary::byte_order::motorola;
+        unsigned int start;
+        if (order == canary::byte_order::intel)
+        {
+            start = static_cast<unsigned int>(rng() % (payload_bits - len + 1));
+        }
+        else
+        {
+            auto const linear =
+              static_cast<unsigned int>(rng() % (payload_bits - len + 1));
+            start = (linear / 8) * 8 + (7 - linear % 8);
+        }
+        signals.push_back(canary::signal_definition{}
+                            .start_bit(start)
+                            .length(len)
+                            .order(order)
+                            .is_signed((i / 2) % 2 == 0)
+                            .scale(0.25 * static_cast<double>(i + 1),
+                                   -static_cast<double>(i)));
+    }
+    return signals;
+}
+
+template<class Frame>
+void
+test_batch(std::size_t payload_size, std::size_t frames, unsigned seed)
+{
+    std::mt19937_64 rng{seed};
+    std::vector<Frame> in(frames);
+    for (auto& f : in)
+    {
+        auto* p = reinterpret_cast<unsigned char*>(&f);
+        for (std::size_t i = 0; i < sizeof(Frame); ++i)
+        {
+            p[i] = static_cast<unsigned char>(rng());
+        }
+    }
+
+    auto const signals = make_signals(
+      rng, static_cast<unsigned int>(payload_size * 8), 64);
+    std::vector<std::vector<std::int64_t>> raw(
+      signals.size(), std::vector<std::int64_t>(frames));
+    std::vector<std::vector<double>> physical(signals.size(),
+                                              std::vector<double>(frames));
+    std::vector<canary::signal_column> columns(signals.size());
+    for (std::size_t k = 0; k < signals.size(); ++k)
+    {
+        columns[k].signal = signals[k];
+        columns[k].raw = raw[k].data();
+        columns[k].physical = physical[k].data();
+    }
+
+    canary::decode_columns(in.data(), in.size(), columns.data(), columns.size());
+
+    for (std::size_t k = 0; k < signals.size(); ++k)
+    {
+        auto const& s = signals[k];
+        for (std::size_t i = 0; i < frames; ++i)
+        {
+            auto const* payload =
+              reinterpret_cast<unsigned char const*>(&in[i]) +
+              sizeof(canary::frame_header);
+            auto const expected = reference_extract(s, payload, payload_size);
+            BOOST_TEST_EQ(canary::extract(s, payload, payload_size), expected);
+
+            auto const scalar_raw =
+              canary::decode_raw(s, payload, payload_size);
+            auto const scalar_physical =
+              canary::decode(s, payload, payload_size);
+            BOOST_TEST_EQ(raw[k][i], scalar_raw);
+            BOOST_TEST(std::memcmp(&physical[k][i],
+                                   &scalar_physical,
+                                   sizeof(double)) == 0);
+        }
+    }
+}
+
+} // namespace
+
+int
+main()
+{
+    test_known_values();
+    test_batch<::can_frame>(CAN_MAX_DLEN, 1027, 1);
+    test_batch<::canfd_frame>(CANFD_MAX_DLEN, 515, 2);
+    return boost::report_errors();
+}
@@ -0,0 +1,362 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/sim.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <canary/receive_loop.hpp>
+
+namespace
+{
+
+namespace net = canary::net;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+::can_frame
+make_frame(std::uint32_t id, std::uint8_t value = 0)
+{
+    ::can_frame f{};
+    f.can_id = id;
+    f.can_dlc = 1;
+    f.data[0] = value;
+    return f;
+}
+
+void
+send(canary::sim::socket& sock, ::can_frame const& f)
+{
+    sock.send(net::buffer(&f, sizeof(f)));
+}
+
+::can_frame
+receive(canary::sim::socket& sock)
+{
+    ::can_frame f{};
+    sock.receive(net::buffer(&f, sizeof(f)));
+    return f;
+}
+
+nanoseconds
+duration(::can_frame const& f, canary::bit_timing const& timing = {})
+{
+    return canary::frame_duration(
+      canary::count_frame_bits(net::buffer(&f, sizeof(f))), timing);
+}
+
+// Frames are delivered to every other node, not to the sender, and the bus
+// clock advances by the duration of each frame.
+void
+test_send_receive()
+{
+    net::io_context ioc{1};
+    canary::sim::bus bus{ioc};
+    canary::sim::socket a{bus};
+    canary::sim::socket b{bus};
+    canary::sim::socket c{bus};
+    BOOST_TEST_EQ(bus.nodes(), 3u);
+
+    auto const f1 = make_frame(0x123, 1);
+    auto const f2 = make_frame(0x456, 2);
+    send(a, f1);
+    send(a, f2);
+    ioc.run();
+
+    BOOST_TEST_EQ(bus.frames(), 2u);
+    BOOST_TEST(bus.elapsed() == duration(f1) + duration(f2));
+    for (auto s : {&b, &c})
+    {
+        BOOST_TEST_EQ(s->available(), sizeof(::can_frame));
+        auto const r = receive(*s);
+        BOOST_TEST_EQ(r.can_id, 0x123u);
+        BOOST_TEST_EQ(r.data[0], 1u);
+        BOOST_TEST_EQ(receive(*s).can_id, 0x456u);
+    }
+    BOOST_TEST_EQ(a.available(), 0u);
+
+    canary::error_code ec;
+    ::can_frame r;
+    BOOST_TEST_EQ(b.receive(net::buffer(&r, sizeof(r)), 0, ec), 0u);
+    BOOST_TEST(ec == net::error::would_block);
+
+    std::array<unsigned char, 20> bad{};
+    a.send(net::buffer(bad), 0, ec);
+    BOOST_TEST(ec == net::error::invalid_argument);
+
+    // CAN FD frames carry the data phase at the data bit rate.
+    ::canfd_frame fd{};
+    fd.can_id = 0x10;
+    fd.len = 64;
+    fd.flags = CANFD_BRS;
+    a.send(net::buffer(&fd, sizeof(fd)));
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(b.available(), canary::fd_frame_size);
+}
+
+// Frames queued by several nodes at once are transmitted in arbitration
+// order, while each node keeps its own order.
+void
+test_arbitration()
+{
+    net::io_context ioc{1};
+    canary::sim::bus bus{ioc};
+    canary::sim::socket rx{bus};
+    std::vector<std::unique_ptr<canary::sim::socket>> nodes;
+    for (int i = 0; i < 4; ++i)
+    {
+        nodes.emplace_back(new canary::sim::socket{bus});
+    }
+
+    send(*nodes[0], make_frame(0x300));
+    send(*nodes[0], make_frame(0x001));
+    send(*nodes[1], make_frame(0x200));
+    send(*nodes[2], make_frame(0x100));
+    send(*nodes[3], make_frame(0x400));
+    ioc.run();
+
+    // 0x001 waits behind 0x300 in the queue of the first node.
+    std::uint32_t const expected[] = {0x100, 0x200, 0x300, 0x001, 0x400};
+    for (auto id : expected)
+    {
+        BOOST_TEST_EQ(receive(rx).can_id, id);
+    }
+}
+
+void
+test_queue_limits()
+{
+    net::io_context ioc{1};
+    canary::sim::bus::options opts;
+    opts.transmit_queue_limit = 2;
+    opts.receive_queue_limit = 3;
+    canary::sim::bus bus{ioc, opts};
+    canary::sim::socket a{bus};
+    canary::sim::socket b{bus};
+
+    canary::error_code ec;
+    auto const f = make_frame(0x1);
+    a.send(net::buffer(&f, sizeof(f)), 0, ec);
+    a.send(net::buffer(&f, sizeof(f)), 0, ec);
+    BOOST_TEST(!ec);
+    a.send(net::buffer(&f, sizeof(f)), 0, ec);
+    BOOST_TEST(ec == net::error::no_buffer_space);
+
+    // Waits until the transmit queue has room.
+    bool writable = false;
+    a.async_wait(canary::sim::socket::wait_write, [&](canary::error_code ec) {
+        BOOST_TEST(!ec);
+        writable = true;
+        send(a, f);
+        send(a, f);
+    });
+    ioc.run();
+    BOOST_TEST(writable);
+    BOOST_TEST_EQ(bus.frames(), 4u);
+    BOOST_TEST_EQ(b.dropped(), 1u);
+
+    BOOST_TEST_THROWS((canary::sim::bus{ioc, [] {
+                          canary::sim::bus::options o;
+                          o.loss_probability = 2.0;
+                          return o;
+                      }()}),
+                      canary::system_error);
+}
+
+void
+test_async()
+{
+    net::io_context ioc{1};
+    canary::sim::bus bus{ioc};
+    canary::sim::socket a{bus};
+    canary::sim::socket b{bus};
+
+    ::can_frame in{};
+    std::size_t received = 0;
+    b.async_receive(net::buffer(&in, sizeof(in)),
+                    [&](canary::error_code ec, std::size_t n) {
+                        BOOST_TEST(!ec);
+                        received = n;
+                    });
+    auto const out = make_frame(0x77, 7);
+    bool sent = false;
+    a.async_send(net::buffer(&out, sizeof(out)),
+                 [&](canary::error_code ec, std::size_t n) {
+                     BOOST_TEST(!ec);
+                     BOOST_TEST_EQ(n, sizeof(out));
+                     sent = true;
+                 });
+    BOOST_TEST(!sent);
+    ioc.run();
+    BOOST_TEST(sent);
+    BOOST_TEST_EQ(received, sizeof(::can_frame));
+    BOOST_TEST_EQ(in.can_id, 0x77u);
+
+    // Closing aborts pending operations.
+    canary::error_code result;
+    b.async_receive(net::buffer(&in, sizeof(in)),
+                    [&](canary::error_code ec, std::size_t) { result = ec; });
+    b.close();
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST(result == net::error::operation_aborted);
+    BOOST_TEST(!b.is_open());
+    BOOST_TEST_EQ(bus.nodes(), 1u);
+    BOOST_TEST_THROWS(send(b, out), canary::system_error);
+}
+
+// Injected errors cause retransmissions, injected loss drops frames for
+// single receivers, and both are reproducible.
+void
+test_injection()
+{
+    auto const run = [](double error, double loss, std::size_t& dropped) {
+        net::io_context ioc{1};
+        canary::sim::bus::options opts;
+        opts.error_probability = error;
+        opts.loss_probability = loss;
+        opts.seed = 42;
+        opts.transmit_queue_limit = 1000;
+        canary::sim::bus bus{ioc, opts};
+        canary::sim::socket a{bus};
+        canary::sim::socket b{bus};
+        canary::sim::socket c{bus};
+        for (std::uint8_t i = 0; i < 200; ++i)
+        {
+            send(a, make_frame(0x10, i));
+        }
+        ioc.run();
+        dropped = b.dropped() + c.dropped();
+        BOOST_TEST_EQ(bus.frames(), 200u);
+        BOOST_TEST_EQ(bus.lost(), b.dropped() + c.dropped());
+        return std::make_pair(bus.errors(), bus.elapsed());
+    };
+
+    std::size_t dropped = 0;
+    auto const clean = run(0.0, 0.0, dropped);
+    BOOST_TEST_EQ(clean.first, 0u);
+    BOOST_TEST_EQ(dropped, 0u);
+
+    auto const noisy = run(0.1, 0.05, dropped);
+    BOOST_TEST_GT(noisy.first, 5u);
+    BOOST_TEST_LT(noisy.first, 50u);
+    BOOST_TEST_GT(dropped, 5u);
+    BOOST_TEST_LT(dropped, 50u);
+    BOOST_TEST(noisy.second > clean.second);
+
+    std::size_t again = 0;
+    auto const repeated = run(0.1, 0.05, again);
+    BOOST_TEST_EQ(repeated.first, noisy.first);
+    BOOST_TEST_EQ(again, dropped);
+}
+
+void
+test_real_time()
+{
+    net::io_context ioc{1};
+    canary::sim::bus::options opts;
+    opts.real_time = true;
+    opts.timing.nominal_bitrate = 10000;
+    canary::sim::bus bus{ioc, opts};
+    canary::sim::socket a{bus};
+    canary::sim::socket b{bus};
+
+    // About 5 ms per frame at 10 kbit/s.
+    auto const f = make_frame(0x5);
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 4; ++i)
+    {
+        send(a, f);
+    }
+    ioc.run();
+    auto const elapsed = std::chrono::steady_clock::now() - start;
+    BOOST_TEST(elapsed >= 4 * duration(f, opts.timing));
+    BOOST_TEST_EQ(bus.frames(), 4u);
+    BOOST_TEST(bus.elapsed() >= 4 * duration(f, opts.timing));
+}
+
+// Handlers of a destroyed bus do nothing.
+void
+test_destroy()
+{
+    net::io_context ioc{1};
+    auto const f = make_frame(0x5);
+    for (auto real_time : {false, true})
+    {
+        canary::sim::bus::options opts;
+        opts.real_time = real_time;
+        opts.timing.nominal_bitrate = 10000;
+        {
+            canary::sim::bus bus{ioc, opts};
+            canary::sim::socket a{bus};
+            canary::sim::socket b{bus};
+            send(a, f);
+            send(a, f);
+            ioc.restart();
+            ioc.poll();
+        }
+        ioc.restart();
+        ioc.run();
+    }
+}
+
+// Components templated on the socket type run on the simulated bus.
+void
+test_components()
+{
+    net::io_context ioc{1};
+    canary::sim::bus bus{ioc};
+    canary::sim::socket tx{bus};
+    canary::sim::socket rx{bus};
+    // The send buffer size limits the transmit queue to a single frame.
+    canary::basic_tx_scheduler<canary::sim::socket>::options opts;
+    opts.send_buffer_size = 1;
+    canary::basic_tx_scheduler<canary::sim::socket> sched{tx, opts};
+
+    std::uint32_t const ids[] = {0x300, 0x100, 0x200};
+    for (auto id : ids)
+    {
+        auto const f = make_frame(id);
+        sched.send(net::buffer(&f, sizeof(f)));
+    }
+
+    canary::handler_arena arena;
+    ::can_frame in{};
+    std::vector<std::uint32_t> received;
+    canary::async_receive_loop(
+      rx,
+      arena,
+      net::buffer(&in, sizeof(in)),
+      [&](canary::error_code ec, std::size_t) {
+          BOOST_TEST(!ec);
+          received.push_back(in.can_id);
+          return received.size() < 3;
+      });
+    ioc.run();
+
+    std::vector<std::uint32_t> const expected{0x100, 0x200, 0x300};
+    BOOST_TEST(received == expected);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_send_receive();
+    test_arbitration();
+    test_queue_limits();
+    test_async();
+    test_injection();
+    test_real_time();
+    test_destroy();
+    test_components();
+    return boost::report_errors();
+}
@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/timestamp.hpp>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/socket_options.hpp>
+
+namespace
+{
+
+namespace net = canary::net;
+using socket_type = net::local::datagram_protocol::socket;
+
+// Timestamps do not depend on the protocol, so a local datagram socket pair
+// stands in for CAN sockets.
+void
+make_pair(socket_type& tx, socket_type& rx)
+{
+    net::local::connect_pair(tx, rx);
+    rx.set_option(canary::receive_timestamp{true});
+}
+
+void
+test_sync()
+{
+    net::io_context ioc{1};
+    socket_type tx{ioc};
+    socket_type rx{ioc};
+    make_pair(tx, rx);
+
+    auto const before = canary::timestamp_now();
+    std::uint8_t const out[] = {1, 2, 3, 4};
+    tx.send(net::buffer(out));
+
+    std::uint8_t in[8] = {};
+    canary::timestamp ts;
+    auto const n = canary::receive_timestamped(rx, net::buffer(in), ts);
+    auto const after = canary::timestamp_now();
+    BOOST_TEST_EQ(n, sizeof(out));
+    BOOST_TEST_EQ(in[3], 4);
+    BOOST_TEST(ts >= before - std::chrono::milliseconds{1});
+    BOOST_TEST(ts <= after);
+
+    rx.non_blocking(true);
+    canary::error_code ec;
+    canary::receive_timestamped(rx, net::buffer(in), ts, ec);
+    BOOST_TEST(ec == net::error::would_block);
+}
+
+void
+test_async()
+{
+    net::io_context ioc{1};
+    socket_type tx{ioc};
+    socket_type rx{ioc};
+    make_pair(tx, rx);
+
+    std::uint8_t in[8] = {};
+    canary::timestamp ts;
+    int completions = 0;
+    auto const before = canary::timestamp_now();
+    // Nothing to read yet, the operation has to wait for readiness.
+    canary::async_receive_timestamped(
+      rx, net::buffer(in), ts, [&](canary::error_code ec, std::size_t n) {
+          BOOST_TEST(!ec);
+          BOOST_TEST_EQ(n, 2u);
+          ++completions;
+      });
+    BOOST_TEST_EQ(ioc.poll(), 0u);
+    std::uint8_t const out[] = {5, 6};
+    tx.send(net::buffer(out));
+    ioc.run();
+    BOOST_TEST_EQ(completions, 1);
+    BOOST_TEST_EQ(in[1], 6);
+    BOOST_TEST(ts >= before - std::chrono::milliseconds{1});
+
+    // Data is already available, the handler must still not be invoked from
+    // within the initiating function.
+    tx.send(net::buffer(out));
+    canary::async_receive_timestamped(
+      rx, net::buffer(in), ts, [&](canary::error_code ec, std::size_t n) {
+          BOOST_TEST(!ec);
+          BOOST_TEST_EQ(n, 2u);
+          ++completions;
+      });
+    BOOST_TEST_EQ(completions, 1);
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(completions, 2);
+
+    // Cancellation
+    canary::async_receive_timestamped(
+      rx, net::buffer(in), ts, [&](canary::error_code ec, std::size_t n) {
+          BOOST_TEST(ec == net::error::operation_aborted);
+          BOOST_TEST_EQ(n, 0u);
+          ++completions;
+      });
+    ioc.restart();
+    ioc.poll();
+    rx.cancel();
+    ioc.run();
+    BOOST_TEST_EQ(completions, 3);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_sync();
+    test_async();
+    return boost::report_errors();
+}
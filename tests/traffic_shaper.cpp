@@ -0,0 +1,397 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/traffic_shaper.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using local_shaper = canary::basic_traffic_shaper<local_socket>;
+using clock = std::chrono::steady_clock;
+using std::chrono::milliseconds;
+
+::can_frame
+make_frame(std::uint32_t id, std::uint8_t value = 0)
+{
+    ::can_frame f{};
+    f.can_id = id;
+    f.can_dlc = 1;
+    f.data[0] = value;
+    return f;
+}
+
+::can_frame
+receive(local_socket& sock)
+{
+    ::can_frame f{};
+    sock.receive(net::buffer(&f, sizeof(f)));
+    return f;
+}
+
+canary::shaping_result
+send(local_shaper& shaper, ::can_frame const& f)
+{
+    return shaper.send(net::buffer(&f, sizeof(f)));
+}
+
+void
+test_token_bucket()
+{
+    auto const t0 = clock::time_point{} + std::chrono::seconds{1};
+    canary::token_bucket unlimited;
+    BOOST_TEST(!unlimited.limited());
+    BOOST_TEST(unlimited.available(1000000));
+
+    // 1000 tokens per second, 3 at once.
+    canary::token_bucket b{1000, 3, t0};
+    BOOST_TEST(b.limited());
+    BOOST_TEST(b.available(3));
+    b.take(1);
+    b.take(1);
+    b.take(1);
+    BOOST_TEST(!b.available(1));
+    BOOST_TEST(b.ready_at(1) == t0 + milliseconds{1});
+    BOOST_TEST(b.ready_at(2) == t0 + milliseconds{2});
+
+    b.refill(t0 + std::chrono::microseconds{999});
+    BOOST_TEST(!b.available(1));
+    b.refill(t0 + milliseconds{1});
+    BOOST_TEST(b.available(1));
+    BOOST_TEST(!b.available(2));
+
+    // Refilling stops at the burst size, even after a long time.
+    b.refill(t0 + std::chrono::hours{24 * 365});
+    BOOST_TEST(b.available(3));
+    b.take(3);
+    BOOST_TEST(!b.available(1));
+
+    // A cost above the burst size passes once the bucket is full, and the
+    // debt is paid back at the configured rate.
+    auto const t1 = t0 + std::chrono::hours{24 * 365} + milliseconds{3};
+    b.refill(t1);
+    BOOST_TEST(b.available(10));
+    b.take(10);
+    BOOST_TEST(b.ready_at(1) == t1 + milliseconds{8});
+
+    BOOST_TEST_THROWS((canary::token_bucket{1000, 0, t0}),
+                      canary::system_error);
+    BOOST_TEST_THROWS((canary::token_bucket{1, 2000000000, t0}),
+                      canary::system_error);
+    // Without a rate, the burst size does not matter.
+    canary::token_bucket{0, 0, t0};
+}
+
+// Frames above the socket limit are delayed, and sent in order at the
+// configured rate.
+void
+test_delay()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper::options opts;
+    opts.socket_limit.frames_per_second = 200;
+    opts.socket_limit.frame_burst = 2;
+    local_shaper shaper{a, opts};
+
+    auto const start = clock::now();
+    for (std::uint8_t i = 0; i < 6; ++i)
+    {
+        auto const expected = i < 2 ? canary::shaping_result::sent
+                                    : canary::shaping_result::delayed;
+        BOOST_TEST(send(shaper, make_frame(0x100, i)) == expected);
+    }
+    BOOST_TEST_EQ(shaper.pending(), 4u);
+    ioc.run();
+    auto const elapsed = clock::now() - start;
+
+    for (std::uint8_t i = 0; i < 6; ++i)
+    {
+        BOOST_TEST_EQ(receive(b).data[0], i);
+    }
+    // 4 frames at 5 ms intervals.
+    BOOST_TEST(elapsed >= milliseconds{19});
+    BOOST_TEST_EQ(shaper.pending(), 0u);
+    BOOST_TEST_EQ(shaper.sent(), 6u);
+    BOOST_TEST_EQ(shaper.shaped(), 4u);
+    BOOST_TEST_EQ(shaper.dropped(), 0u);
+}
+
+void
+test_drop()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper::options opts;
+    opts.socket_limit.frames_per_second = 10;
+    opts.socket_limit.frame_burst = 2;
+    opts.socket_limit.policy = canary::shaping_policy::drop;
+    local_shaper shaper{a, opts};
+
+    for (std::uint8_t i = 0; i < 5; ++i)
+    {
+        auto const expected = i < 2 ? canary::shaping_result::sent
+                                    : canary::shaping_result::dropped;
+        BOOST_TEST(send(shaper, make_frame(0x100, i)) == expected);
+    }
+    BOOST_TEST_EQ(shaper.pending(), 0u);
+    BOOST_TEST_EQ(shaper.sent(), 2u);
+    BOOST_TEST_EQ(shaper.dropped(), 3u);
+    BOOST_TEST_EQ(b.available(), sizeof(::can_frame));
+}
+
+// A flooding ID is delayed by its own limit, without holding back other IDs.
+void
+test_per_id()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper shaper{a};
+    canary::rate_limit limit;
+    limit.frames_per_second = 100;
+    shaper.limit(0x100, false, limit);
+
+    BOOST_TEST(send(shaper, make_frame(0x100, 1)) ==
+               canary::shaping_result::sent);
+    BOOST_TEST(send(shaper, make_frame(0x100, 2)) ==
+               canary::shaping_result::delayed);
+    BOOST_TEST(send(shaper, make_frame(0x100, 3)) ==
+               canary::shaping_result::delayed);
+    // Queued behind the delayed frames, but not limited.
+    BOOST_TEST(send(shaper, make_frame(0x200, 4)) ==
+               canary::shaping_result::delayed);
+    ioc.run();
+
+    std::uint8_t const expected[] = {1, 4, 2, 3};
+    for (auto v : expected)
+    {
+        BOOST_TEST_EQ(receive(b).data[0], v);
+    }
+    BOOST_TEST_EQ(shaper.sent(), 4u);
+
+    // Frames of an ID with the drop policy are dropped, others pass.
+    limit.policy = canary::shaping_policy::drop;
+    shaper.limit(0x300, false, limit);
+    BOOST_TEST(send(shaper, make_frame(0x300)) ==
+               canary::shaping_result::sent);
+    BOOST_TEST(send(shaper, make_frame(0x300)) ==
+               canary::shaping_result::dropped);
+    BOOST_TEST(send(shaper, make_frame(0x200)) ==
+               canary::shaping_result::sent);
+    // Extended IDs are limited separately.
+    auto ext = make_frame(0x300);
+    ext.can_id |= CAN_EFF_FLAG;
+    BOOST_TEST(send(shaper, ext) == canary::shaping_result::sent);
+}
+
+// The bit limit applies to the estimated number of bits on the wire.
+void
+test_bits()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    // A classic frame with one byte has at most 65 bits in total.
+    local_shaper::options opts;
+    opts.mode = canary::stuffing::worst_case;
+    opts.socket_limit.bits_per_second = 6500;
+    opts.socket_limit.bit_burst = 130;
+    local_shaper shaper{a, opts};
+
+    auto const start = clock::now();
+    BOOST_TEST(send(shaper, make_frame(0x1)) == canary::shaping_result::sent);
+    BOOST_TEST(send(shaper, make_frame(0x2)) == canary::shaping_result::sent);
+    BOOST_TEST(send(shaper, make_frame(0x3)) ==
+               canary::shaping_result::delayed);
+    BOOST_TEST(send(shaper, make_frame(0x4)) ==
+               canary::shaping_result::delayed);
+    ioc.run();
+    BOOST_TEST(clock::now() - start >= milliseconds{19});
+    BOOST_TEST_EQ(shaper.sent(), 4u);
+    for (std::uint32_t id = 1; id <= 4; ++id)
+    {
+        BOOST_TEST_EQ(receive(b).can_id, id);
+    }
+}
+
+void
+test_queue_limit()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper::options opts;
+    opts.socket_limit.frames_per_second = 1000;
+    opts.queue_limit = 2;
+    local_shaper shaper{a, opts};
+
+    BOOST_TEST(send(shaper, make_frame(0x1)) == canary::shaping_result::sent);
+    BOOST_TEST(send(shaper, make_frame(0x2)) ==
+               canary::shaping_result::delayed);
+    BOOST_TEST(send(shaper, make_frame(0x3)) ==
+               canary::shaping_result::delayed);
+    BOOST_TEST(send(shaper, make_frame(0x4)) ==
+               canary::shaping_result::dropped);
+    BOOST_TEST_EQ(shaper.dropped(), 1u);
+    ioc.run();
+    BOOST_TEST_EQ(shaper.sent(), 3u);
+
+    opts.queue_limit = 0;
+    BOOST_TEST_THROWS((local_shaper{a, opts}), canary::system_error);
+    opts.queue_limit = 1;
+    opts.socket_limit.frame_burst = 0;
+    BOOST_TEST_THROWS((local_shaper{a, opts}), canary::system_error);
+}
+
+void
+test_errors()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper shaper{a};
+    std::vector<std::uint32_t> failed;
+    shaper.on_error([&](canary::error_code ec, canary::frame_header h) {
+        BOOST_TEST(ec);
+        failed.push_back(h.id());
+    });
+
+    b.close();
+    BOOST_TEST(send(shaper, make_frame(0x42)) ==
+               canary::shaping_result::dropped);
+    BOOST_TEST_EQ(failed.size(), 1u);
+    BOOST_TEST_EQ(failed[0], 0x42u);
+    BOOST_TEST_EQ(shaper.errors(), 1u);
+
+    std::array<unsigned char, 100> big{};
+    BOOST_TEST_THROWS(shaper.send(net::buffer(big)), canary::system_error);
+}
+
+// Pending handlers do nothing once the shaper is destroyed or cancelled,
+// and cancelling the socket keeps the frames held back.
+void
+test_lifetime()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_shaper::options opts;
+    opts.socket_limit.frames_per_second = 1000;
+    opts.socket_limit.frame_burst = 1;
+    {
+        local_shaper shaper{a, opts};
+        send(shaper, make_frame(0x1));
+        send(shaper, make_frame(0x2));
+        BOOST_TEST_EQ(shaper.pending(), 1u);
+    }
+    ioc.run();
+    BOOST_TEST_EQ(receive(b).can_id, 0x1u);
+    BOOST_TEST_EQ(b.available(), 0u);
+
+    local_shaper limited{a, opts};
+    send(limited, make_frame(0x3));
+    send(limited, make_frame(0x4));
+    limited.cancel();
+    BOOST_TEST_EQ(limited.pending(), 0u);
+    ioc.restart();
+    ioc.run();
+    BOOST_TEST_EQ(receive(b).can_id, 0x3u);
+    BOOST_TEST_EQ(b.available(), 0u);
+    BOOST_TEST_EQ(limited.sent(), 1u);
+
+    a.set_option(net::socket_base::send_buffer_size{1});
+    local_shaper shaper{a};
+    std::size_t count = 0;
+    while (send(shaper, make_frame(0x5)) == canary::shaping_result::sent)
+    {
+        ++count;
+    }
+    ++count;
+    ioc.restart();
+    ioc.poll();
+    a.cancel();
+    ioc.restart();
+    ioc.poll();
+    BOOST_TEST_EQ(shaper.errors(), 0u);
+    BOOST_TEST_EQ(shaper.pending(), 1u);
+
+    // The next frame resumes sending.
+    BOOST_TEST(send(shaper, make_frame(0x5)) ==
+               canary::shaping_result::delayed);
+    ++count;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        BOOST_TEST_EQ(receive(b).can_id, 0x5u);
+        ioc.restart();
+        ioc.poll();
+    }
+    BOOST_TEST_EQ(shaper.sent(), count);
+    BOOST_TEST_EQ(shaper.pending(), 0u);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    canary::traffic_shaper::options opts;
+    opts.socket_limit.frames_per_second = 1000;
+    canary::traffic_shaper shaper{tx, opts};
+
+    for (std::uint8_t i = 0; i < 10; ++i)
+    {
+        auto const f = make_frame(0x123, i);
+        shaper.send(net::buffer(&f, sizeof(f)));
+    }
+    ioc.run();
+    BOOST_TEST_EQ(shaper.sent(), 10u);
+
+    for (std::uint8_t i = 0; i < 10; ++i)
+    {
+        ::can_frame in{};
+        rx.receive(net::buffer(&in, sizeof(in)));
+        BOOST_TEST_EQ(in.data[0], i);
+    }
+}
+
+} // namespace
+
+int
+main()
+{
+    test_token_bucket();
+    test_delay();
+    test_drop();
+    test_per_id();
+    test_bits();
+    test_queue_limit();
+    test_errors();
+    test_lifetime();
+    test_raw_socket();
+    return boost::report_errors();
+}
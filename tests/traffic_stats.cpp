@@ -0,0 +1,257 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/traffic_stats.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+
+#include <linux/can.h>
+#include <sstream>
+
+namespace
+{
+
+namespace net = canary::net;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::nanoseconds;
+
+::can_frame
+make_frame(std::uint32_t id, std::size_t length = 8, bool extended = false)
+{
+    ::can_frame f{};
+    f.can_id = extended ? id | CAN_EFF_FLAG : id;
+    f.can_dlc = static_cast<std::uint8_t>(length);
+    return f;
+}
+
+canary::timestamp
+at(nanoseconds t)
+{
+    return canary::timestamp{t};
+}
+
+template<class Frame>
+bool
+add(canary::traffic_stats& stats,
+    Frame const& f,
+    nanoseconds t,
+    unsigned int interface_index = 0)
+{
+    return stats.add(net::buffer(&f, sizeof(f)), at(t), interface_index);
+}
+
+// Inter-arrival times of 10 ms with alternating deviations of +-1 ms.
+void
+test_intervals()
+{
+    canary::traffic_stats stats;
+    auto const f = make_frame(0x123);
+    nanoseconds t{milliseconds{5}};
+    BOOST_TEST(add(stats, f, t));
+    for (int i = 0; i < 100; ++i)
+    {
+        t += i % 2 == 0 ? milliseconds{11} : milliseconds{9};
+        BOOST_TEST(add(stats, f, t));
+    }
+
+    auto const s = stats.snapshot(at(t));
+    BOOST_TEST_EQ(s.ids.size(), 1u);
+    auto const e = s.find(0, 0x123, false);
+    BOOST_TEST(e != nullptr);
+    BOOST_TEST_EQ(e->frames, 101u);
+    BOOST_TEST_EQ(e->intervals, 100u);
+    BOOST_TEST(e->first_seen == at(milliseconds{5}));
+    BOOST_TEST(e->last_seen == at(t));
+    BOOST_TEST(e->min_interval == milliseconds{9});
+    BOOST_TEST(e->max_interval == milliseconds{11});
+    BOOST_TEST(e->mean_interval() == milliseconds{10});
+    BOOST_TEST(e->jitter() == milliseconds{1});
+    BOOST_TEST_EQ(e->rate(), 100.0);
+    BOOST_TEST_EQ(e->dlc[8], 101u);
+    BOOST_TEST(s.find(0, 0x123, true) == nullptr);
+    BOOST_TEST(s.find(1, 0x123, false) == nullptr);
+
+    // A frame older than the last one is counted, but not measured.
+    BOOST_TEST(add(stats, f, t - milliseconds{1}));
+    auto const late = stats.snapshot(at(t)).ids.front();
+    BOOST_TEST_EQ(late.frames, 102u);
+    BOOST_TEST_EQ(late.intervals, 100u);
+    BOOST_TEST(late.last_seen == at(t));
+}
+
+// IDs are kept apart by interface and format, and ordered in snapshots.
+void
+test_keys()
+{
+    canary::traffic_stats stats;
+    ::canfd_frame fd{};
+    fd.can_id = 0x10;
+    fd.len = 64;
+    fd.flags = CANFD_FDF;
+    BOOST_TEST(add(stats, make_frame(0x10, 3, true), nanoseconds{1}, 2));
+    BOOST_TEST(add(stats, fd, nanoseconds{2}, 2));
+    BOOST_TEST(add(stats, make_frame(0x10, 0), nanoseconds{3}, 1));
+    BOOST_TEST(add(stats, make_frame(0x7FF, 1), nanoseconds{4}, 1));
+    BOOST_TEST(add(stats, make_frame(0x10, 1), nanoseconds{5}, 1));
+    BOOST_TEST_EQ(stats.size(), 4u);
+
+    auto const s = stats.snapshot();
+    BOOST_TEST_EQ(s.frames(), 5u);
+    BOOST_TEST_EQ(s.ids.size(), 4u);
+    BOOST_TEST_EQ(s.ids[0].interface_index, 1u);
+    BOOST_TEST_EQ(s.ids[0].id, 0x10u);
+    BOOST_TEST_EQ(s.ids[0].dlc[0], 1u);
+    BOOST_TEST_EQ(s.ids[0].dlc[1], 1u);
+    BOOST_TEST_EQ(s.ids[1].id, 0x7FFu);
+    BOOST_TEST_EQ(s.ids[2].interface_index, 2u);
+    BOOST_TEST(!s.ids[2].extended);
+    BOOST_TEST_EQ(s.ids[2].dlc[15], 1u);
+    BOOST_TEST(s.ids[3].extended);
+    BOOST_TEST_EQ(s.ids[3].dlc[3], 1u);
+    BOOST_TEST_EQ(s.find(2, 0x10, true)->frames, 1u);
+
+    // Error frames and frames of other sizes are ignored.
+    auto err = make_frame(0x1);
+    err.can_id |= CAN_ERR_FLAG;
+    BOOST_TEST(!add(stats, err, nanoseconds{6}));
+    std::array<unsigned char, 20> bad{};
+    BOOST_TEST(!add(stats, bad, nanoseconds{6}));
+    BOOST_TEST_EQ(stats.size(), 4u);
+
+    stats.clear();
+    BOOST_TEST_EQ(stats.size(), 0u);
+    BOOST_TEST(stats.snapshot().ids.empty());
+}
+
+void
+test_capacity()
+{
+    canary::traffic_stats::options opts;
+    opts.capacity = 4;
+    canary::traffic_stats stats{opts};
+    for (std::uint32_t id = 0; id < 6; ++id)
+    {
+        BOOST_TEST_EQ(add(stats, make_frame(id), nanoseconds{id}), id < 4);
+    }
+    BOOST_TEST_EQ(stats.size(), 4u);
+    BOOST_TEST_EQ(stats.overflows(), 2u);
+    BOOST_TEST(add(stats, make_frame(3), nanoseconds{10}));
+
+    opts.capacity = 3;
+    BOOST_TEST_THROWS(canary::traffic_stats{opts}, canary::system_error);
+}
+
+// The activity between two snapshots only covers frames added in between.
+void
+test_since()
+{
+    canary::traffic_stats stats;
+    auto const a = make_frame(0x1);
+    auto const b = make_frame(0x2, 2);
+    auto const c = make_frame(0x3);
+    add(stats, a, milliseconds{0});
+    add(stats, a, milliseconds{10});
+    add(stats, b, milliseconds{10});
+    auto const older = stats.snapshot(at(milliseconds{15}));
+
+    add(stats, a, milliseconds{30});
+    add(stats, a, milliseconds{40});
+    add(stats, c, milliseconds{45});
+    auto const newer = stats.snapshot(at(milliseconds{50}));
+
+    auto const d = newer.since(older);
+    BOOST_TEST(d.time == at(milliseconds{50}));
+    BOOST_TEST_EQ(d.ids.size(), 2u);
+    auto const ea = d.find(0, 0x1, false);
+    BOOST_TEST_EQ(ea->frames, 2u);
+    BOOST_TEST_EQ(ea->dlc[8], 2u);
+    BOOST_TEST_EQ(ea->intervals, 2u);
+    BOOST_TEST(ea->mean_interval() == milliseconds{15});
+    BOOST_TEST(ea->jitter() == milliseconds{5});
+    BOOST_TEST(ea->min_interval == milliseconds{10});
+    BOOST_TEST(ea->max_interval == milliseconds{20});
+    BOOST_TEST(d.find(0, 0x2, false) == nullptr);
+    BOOST_TEST_EQ(d.find(0, 0x3, false)->frames, 1u);
+    BOOST_TEST_EQ(newer.since(newer).ids.size(), 0u);
+}
+
+void
+test_write_text()
+{
+    canary::traffic_stats stats;
+    add(stats, make_frame(0x1AB, 4), milliseconds{0}, 3);
+    add(stats, make_frame(0x1AB, 4), milliseconds{20}, 3);
+    add(stats, make_frame(0x18DAF110, 8, true), milliseconds{0}, 3);
+    std::ostringstream os;
+    canary::write_text(os, stats.snapshot(), "host=\"gw\"");
+    auto const text = os.str();
+    BOOST_TEST(
+      text.find("canary_id_frames_total{host=\"gw\",interface=\"3\","
+                "id=\"0x1ab\",extended=\"0\"} 2\n") != std::string::npos);
+    BOOST_TEST(text.find("canary_id_rate_hz{host=\"gw\",interface=\"3\","
+                         "id=\"0x1ab\",extended=\"0\"} 50\n") !=
+               std::string::npos);
+    BOOST_TEST(text.find("canary_id_dlc_frames_total{host=\"gw\","
+                         "interface=\"3\",id=\"0x18daf110\",extended=\"1\","
+                         "dlc=\"8\"} 1\n") != std::string::npos);
+}
+
+void
+test_reporter()
+{
+    net::io_context ioc{1};
+    canary::traffic_stats stats;
+    canary::traffic_reporter::options opts;
+    opts.interval = milliseconds{10};
+    canary::traffic_reporter reporter{ioc, stats, opts};
+
+    std::vector<std::uint64_t> reports;
+    std::uint32_t next = 0;
+    auto const send = [&] {
+        add(stats, make_frame(next++), nanoseconds{canary::timestamp_now()
+                                                     .time_since_epoch()});
+    };
+    send();
+    reporter.start([&](canary::traffic_snapshot const& s) {
+        reports.push_back(s.frames());
+        if (reports.size() == 3)
+        {
+            reporter.stop();
+            return;
+        }
+        send();
+        send();
+    });
+    send();
+    ioc.run();
+
+    std::vector<std::uint64_t> const expected{1, 2, 2};
+    BOOST_TEST(reports == expected);
+    BOOST_TEST_EQ(reporter.previous().frames(), 6u);
+
+    opts.interval = nanoseconds{0};
+    BOOST_TEST_THROWS((canary::traffic_reporter{ioc, stats, opts}),
+                      canary::system_error);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_intervals();
+    test_keys();
+    test_capacity();
+    test_since();
+    test_write_text();
+    test_reporter();
+    return boost::report_errors();
+}
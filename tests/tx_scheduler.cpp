@@ -0,0 +1,350 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/tx_scheduler.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <sstream>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using local_scheduler = canary::basic_tx_scheduler<local_socket>;
+
+::can_frame
+make_frame(std::uint32_t id, std::uint8_t value = 0, bool extended = false)
+{
+    ::can_frame f{};
+    f.can_id = extended ? id | CAN_EFF_FLAG : id;
+    f.can_dlc = 1;
+    f.data[0] = value;
+    return f;
+}
+
+::can_frame
+receive(local_socket& sock)
+{
+    ::can_frame f{};
+    sock.receive(net::buffer(&f, sizeof(f)));
+    return f;
+}
+
+void
+test_arbitration_key()
+{
+    auto const key = [](std::uint32_t id, bool ext, bool rtr) {
+        canary::frame_header h;
+        h.extended_format(ext);
+        h.id(id);
+        h.remote_transmission(rtr);
+        return canary::arbitration_key(h);
+    };
+    BOOST_TEST_LT(key(0x100, false, false), key(0x101, false, false));
+    BOOST_TEST_LT(key(0x100, false, false), key(0x100, false, true));
+    // A standard frame beats an extended frame with the same base ID.
+    BOOST_TEST_LT(key(0x100, false, true), key(0x100 << 18, true, false));
+    // But not one with a lower base ID.
+    BOOST_TEST_LT(key(0x0FF << 18 | 0x3FFFF, true, false),
+                  key(0x100, false, false));
+    BOOST_TEST_LT(key(0x100 << 18, true, false),
+                  key(0x100 << 18 | 1, true, false));
+    BOOST_TEST_LT(key(0x100 << 18, true, false), key(0x100 << 18, true, true));
+}
+
+// Frames queued together are written in arbitration order.
+void
+test_order()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_scheduler sched{a};
+
+    std::uint32_t const ids[] = {0x500, 0x010, 0x7FF, 0x123, 0x001};
+    for (auto id : ids)
+    {
+        auto const f = make_frame(id);
+        sched.send(net::buffer(&f, sizeof(f)));
+    }
+    BOOST_TEST_EQ(sched.size(), 5u);
+    ioc.run();
+    BOOST_TEST_EQ(sched.size(), 0u);
+
+    std::uint32_t const expected[] = {0x001, 0x010, 0x123, 0x500, 0x7FF};
+    for (auto id : expected)
+    {
+        BOOST_TEST_EQ(receive(b).can_id, id);
+    }
+
+#ifndef CANARY_DISABLE_METRICS
+    auto const m = sched.metrics();
+    BOOST_TEST_EQ(m.frames_sent, 5u);
+    BOOST_TEST_EQ(m.queue_depth, 0u);
+    BOOST_TEST_EQ(m.max_queue_depth, 5u);
+    BOOST_TEST_EQ(m.latency.size(), 3u);
+    // Classes are split at 0x100 and 0x400.
+    BOOST_TEST_EQ(m.latency[0].count, 2u);
+    BOOST_TEST_EQ(m.latency[1].count, 1u);
+    BOOST_TEST_EQ(m.latency[2].count, 2u);
+#endif // CANARY_DISABLE_METRICS
+}
+
+void
+test_replace()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_scheduler sched{a};
+
+    auto f = make_frame(0x200, 1);
+    sched.send(net::buffer(&f, sizeof(f)));
+    f = make_frame(0x200, 2);
+    sched.send(net::buffer(&f, sizeof(f)));
+    f = make_frame(0x300, 3);
+    sched.send(net::buffer(&f, sizeof(f)));
+    BOOST_TEST_EQ(sched.size(), 2u);
+    ioc.run();
+
+    auto const first = receive(b);
+    BOOST_TEST_EQ(first.can_id, 0x200u);
+    BOOST_TEST_EQ(first.data[0], 2u);
+    BOOST_TEST_EQ(receive(b).can_id, 0x300u);
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST_EQ(sched.metrics().replaced, 1u);
+    BOOST_TEST_EQ(sched.metrics().frames_sent, 2u);
+#endif // CANARY_DISABLE_METRICS
+
+    // Without replacement, frames with the same ID keep their order.
+    local_scheduler::options opts;
+    opts.replace_stale = false;
+    local_scheduler fifo{a, opts};
+    for (std::uint8_t v = 0; v < 3; ++v)
+    {
+        f = make_frame(0x200, v);
+        fifo.send(net::buffer(&f, sizeof(f)));
+    }
+    ioc.restart();
+    ioc.run();
+    for (std::uint8_t v = 0; v < 3; ++v)
+    {
+        BOOST_TEST_EQ(receive(b).data[0], v);
+    }
+}
+
+// Once the socket stops accepting frames, a high priority frame overtakes the
+// low priority frames still waiting in the scheduler.
+void
+test_backpressure()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_scheduler::options opts;
+    opts.send_buffer_size = 1;
+    local_scheduler sched{a, opts};
+
+    for (std::uint8_t i = 0; i < 100; ++i)
+    {
+        auto const f = make_frame(0x700u << 18 | i, i, true);
+        sched.send(net::buffer(&f, sizeof(f)));
+    }
+    ioc.poll();
+    auto const waiting = sched.size();
+    BOOST_TEST_GT(waiting, 0u);
+    BOOST_TEST_LT(waiting, 100u);
+
+    auto const urgent = make_frame(0x001, 0xFF);
+    sched.send(net::buffer(&urgent, sizeof(urgent)));
+
+    // Everything written before the urgent frame was queued arrives first.
+    std::size_t before = 0;
+    while (true)
+    {
+        auto const f = receive(b);
+        ioc.poll();
+        if (f.can_id == 0x001)
+        {
+            break;
+        }
+        ++before;
+    }
+    BOOST_TEST_EQ(before, 100 - waiting);
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST_GE(sched.metrics().waits, 1u);
+#endif // CANARY_DISABLE_METRICS
+}
+
+void
+test_errors()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_scheduler sched{a};
+    std::vector<std::uint32_t> failed;
+    sched.on_error([&](canary::error_code ec, canary::frame_header h) {
+        BOOST_TEST(ec);
+        failed.push_back(h.id());
+    });
+
+    // The peer is gone.
+    b.close();
+    auto const f = make_frame(0x42);
+    sched.send(net::buffer(&f, sizeof(f)));
+    ioc.run();
+    BOOST_TEST_EQ(failed.size(), 1u);
+    BOOST_TEST_EQ(failed[0], 0x42u);
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST_EQ(sched.metrics().errors, 1u);
+    BOOST_TEST_EQ(sched.metrics().frames_sent, 0u);
+#endif // CANARY_DISABLE_METRICS
+
+    std::array<unsigned char, 100> big{};
+    BOOST_TEST_THROWS(sched.send(net::buffer(big)), canary::system_error);
+}
+
+// Pending handlers do nothing once the scheduler is destroyed or cancelled,
+// and cancelling the socket leaves queued frames alone.
+void
+test_lifetime()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    auto const f = make_frame(0x42);
+    {
+        local_scheduler sched{a};
+        sched.send(net::buffer(&f, sizeof(f)));
+    }
+    ioc.run();
+    BOOST_TEST_EQ(b.available(), 0u);
+
+    local_scheduler::options opts;
+    opts.send_buffer_size = 1;
+    local_scheduler sched{a, opts};
+    std::size_t errors = 0;
+    sched.on_error([&](canary::error_code, canary::frame_header) { ++errors; });
+    for (std::uint32_t i = 0; i < 100; ++i)
+    {
+        auto const g = make_frame(i);
+        sched.send(net::buffer(&g, sizeof(g)));
+    }
+    ioc.restart();
+    ioc.poll();
+    auto const waiting = sched.size();
+    BOOST_TEST_GT(waiting, 0u);
+    a.cancel();
+    ioc.restart();
+    ioc.poll();
+    BOOST_TEST_EQ(errors, 0u);
+    BOOST_TEST_EQ(sched.size(), waiting);
+
+    sched.send(net::buffer(&f, sizeof(f)));
+    ioc.restart();
+    ioc.poll();
+    sched.cancel();
+    BOOST_TEST_EQ(sched.size(), 0u);
+    ioc.restart();
+    ioc.poll();
+    BOOST_TEST_EQ(errors, 0u);
+
+    // Destroyed while waiting for the socket.
+    {
+        local_scheduler other{a, opts};
+        for (std::uint32_t i = 0; i < 100; ++i)
+        {
+            auto const g = make_frame(i);
+            other.send(net::buffer(&g, sizeof(g)));
+        }
+        ioc.restart();
+        ioc.poll();
+        BOOST_TEST_GT(other.size(), 0u);
+    }
+    while (b.available() > 0)
+    {
+        receive(b);
+    }
+    ioc.restart();
+    ioc.run();
+}
+
+void
+test_write_text()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    local_scheduler sched{a};
+    auto const f = make_frame(0x10);
+    sched.send(net::buffer(&f, sizeof(f)));
+    ioc.run();
+
+    std::ostringstream os;
+    canary::write_text(os, sched.metrics(), "socket=\"a\"");
+    auto const text = os.str();
+#ifndef CANARY_DISABLE_METRICS
+    BOOST_TEST(text.find("canary_tx_frames_sent_total{socket=\"a\"} 1\n") !=
+               std::string::npos);
+    BOOST_TEST(text.find("canary_tx_queue_latency_ns_count{socket=\"a\","
+                         "class=\"0\"} 1\n") != std::string::npos);
+#endif // CANARY_DISABLE_METRICS
+    BOOST_TEST(text.find("canary_tx_replaced_total{socket=\"a\"}") !=
+               std::string::npos);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx{ioc, ep};
+    canary::raw::socket rx{ioc, ep};
+    canary::tx_scheduler sched{tx};
+
+    auto const low = make_frame(0x600);
+    auto const high = make_frame(0x060);
+    sched.send(net::buffer(&low, sizeof(low)));
+    sched.send(net::buffer(&high, sizeof(high)));
+    ioc.run();
+
+    ::can_frame in{};
+    rx.receive(net::buffer(&in, sizeof(in)));
+    BOOST_TEST_EQ(in.can_id, 0x060u);
+    rx.receive(net::buffer(&in, sizeof(in)));
+    BOOST_TEST_EQ(in.can_id, 0x600u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_arbitration_key();
+    test_order();
+    test_replace();
+    test_backpressure();
+    test_errors();
+    test_lifetime();
+    test_write_text();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,270 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/udp_tunnel.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/socket_options.hpp>
+
+#include <functional>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+using local_tunnel = canary::basic_udp_tunnel<local_socket>;
+using udp = net::ip::udp;
+
+// A pair of UDP sockets on the loopback interface, connected to each other.
+struct udp_pair
+{
+    udp::socket a;
+    udp::socket b;
+
+    explicit udp_pair(net::io_context& ioc)
+      : a{ioc, udp::endpoint{net::ip::address_v4::loopback(), 0}}
+      , b{ioc, udp::endpoint{net::ip::address_v4::loopback(), 0}}
+    {
+        a.connect(b.local_endpoint());
+        b.connect(a.local_endpoint());
+    }
+};
+
+// Two tunnel ends, frames written to `in` come out of `out`.
+struct fixture
+{
+    net::io_context ioc{1};
+    local_socket in{ioc};
+    local_socket can_a{ioc};
+    local_socket can_b{ioc};
+    local_socket out{ioc};
+    udp_pair link{ioc};
+
+    fixture()
+    {
+        net::local::connect_pair(in, can_a);
+        net::local::connect_pair(can_b, out);
+        out.non_blocking(true);
+    }
+
+    void send(std::uint32_t first, std::uint32_t last)
+    {
+        for (auto id = first; id < last; ++id)
+        {
+            ::can_frame f{};
+            f.can_id = id;
+            f.can_dlc = 8;
+            f.data[7] = static_cast<std::uint8_t>(id);
+            in.send(net::buffer(&f, sizeof(f)));
+        }
+    }
+
+    std::vector<std::uint32_t> received()
+    {
+        std::vector<std::uint32_t> ids;
+        while (true)
+        {
+            ::canfd_frame f{};
+            canary::error_code ec;
+            auto const n = out.receive(net::buffer(&f, sizeof(f)), 0, ec);
+            if (ec)
+            {
+                return ids;
+            }
+            if (n == CAN_MTU)
+            {
+                BOOST_TEST_EQ(f.data[7], f.can_id & 0xFF);
+            }
+            ids.push_back(f.can_id);
+        }
+    }
+
+    // Runs until `n` frames came out of the tunnel, or a second passed.
+    void run_until(std::vector<std::uint32_t>& ids, std::size_t n)
+    {
+        auto const deadline =
+          std::chrono::steady_clock::now() + std::chrono::seconds{1};
+        while (ids.size() < n && std::chrono::steady_clock::now() < deadline)
+        {
+            ioc.run_for(std::chrono::milliseconds{1});
+            auto const more = received();
+            ids.insert(ids.end(), more.begin(), more.end());
+        }
+    }
+};
+
+// Frames are packed into as few datagrams as possible.
+void
+test_packing()
+{
+    fixture fx;
+    local_tunnel::options opts;
+    // Room for 5 classic frames with 8 bytes of payload.
+    opts.max_datagram_size = canary::cannelloni::header_size +
+                             canary::cannelloni::max_frame_size;
+    opts.flush_timeout = std::chrono::milliseconds{20};
+    local_tunnel a{fx.can_a, fx.link.a, opts};
+    local_tunnel b{fx.can_b, fx.link.b, opts};
+    a.start();
+    b.start();
+
+    fx.send(0, 12);
+    std::vector<std::uint32_t> ids;
+    fx.ioc.run_for(std::chrono::milliseconds{5});
+    // The last datagram waits for the flush timeout.
+    BOOST_TEST_EQ(a.datagrams_sent(), 2u);
+    BOOST_TEST_EQ(a.frames_sent(), 10u);
+    fx.run_until(ids, 12);
+    BOOST_TEST_EQ(a.datagrams_sent(), 3u);
+    BOOST_TEST_EQ(b.datagrams_received(), 3u);
+    BOOST_TEST_EQ(b.frames_received(), 12u);
+    BOOST_TEST_EQ(ids.size(), 12u);
+    for (std::uint32_t i = 0; i < ids.size(); ++i)
+    {
+        BOOST_TEST_EQ(ids[i], i);
+    }
+
+    a.stop();
+    b.stop();
+    fx.ioc.restart();
+    fx.ioc.run();
+    BOOST_TEST_EQ(a.dropped() + b.dropped(), 0u);
+}
+
+// Both directions, CAN FD frames, and frames flushed on stop.
+void
+test_bidirectional()
+{
+    fixture fx;
+    local_tunnel::options opts;
+    opts.flush_timeout = std::chrono::seconds{10};
+    local_tunnel a{fx.can_a, fx.link.a, opts};
+    local_tunnel b{fx.can_b, fx.link.b};
+    a.start();
+    b.start();
+
+    ::canfd_frame f{};
+    f.can_id = 0x7FF;
+    f.len = 64;
+    f.flags = CANFD_BRS;
+    f.data[63] = 0x42;
+    fx.out.send(net::buffer(&f, sizeof(f)));
+    fx.ioc.run_for(std::chrono::milliseconds{5});
+    f = ::canfd_frame{};
+    auto const n = fx.in.receive(net::buffer(&f, sizeof(f)));
+    BOOST_TEST_EQ(n, CANFD_MTU);
+    BOOST_TEST_EQ(f.can_id, 0x7FFu);
+    BOOST_TEST(f.flags & CANFD_BRS);
+    BOOST_TEST_EQ(f.data[63], 0x42u);
+
+    // Would wait 10 seconds for more frames.
+    fx.send(1, 3);
+    fx.ioc.run_for(std::chrono::milliseconds{5});
+    BOOST_TEST_EQ(a.datagrams_sent(), 0u);
+    a.stop();
+    BOOST_TEST_EQ(a.datagrams_sent(), 1u);
+    std::vector<std::uint32_t> ids;
+    fx.run_until(ids, 2);
+    BOOST_TEST((ids == std::vector<std::uint32_t>{1, 2}));
+}
+
+void
+test_invalid()
+{
+    fixture fx;
+    local_tunnel b{fx.can_b, fx.link.b};
+    b.start();
+    std::uint8_t junk[] = {1, 0, 0, 0, 0};
+    fx.link.a.send(net::buffer(junk));
+    fx.ioc.run_for(std::chrono::milliseconds{5});
+    BOOST_TEST_EQ(b.invalid_datagrams(), 1u);
+    BOOST_TEST_EQ(b.datagrams_received(), 0u);
+
+    local_tunnel::options opts;
+    opts.max_datagram_size = 16;
+    BOOST_TEST_THROWS(local_tunnel(fx.can_a, fx.link.a, opts),
+                      canary::system_error);
+}
+
+// End-to-end over loopback, between vcan0 and vcan1.
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep0 =
+      canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    auto const ep1 =
+      canary::raw::endpoint{canary::get_interface_index("vcan1")};
+    canary::raw::socket tx{ioc, ep0};
+    canary::raw::socket can0{ioc, ep0};
+    canary::raw::socket can1{ioc, ep1};
+    canary::raw::socket rx{ioc, ep1};
+    can0.set_option(canary::flexible_data_rate{});
+    can1.set_option(canary::flexible_data_rate{});
+    rx.set_option(canary::flexible_data_rate{});
+    udp_pair link{ioc};
+
+    canary::udp_tunnel::options opts;
+    opts.flush_timeout = std::chrono::microseconds{100};
+    canary::udp_tunnel a{can0, link.a, opts};
+    canary::udp_tunnel b{can1, link.b, opts};
+    a.start();
+    b.start();
+
+    for (std::uint32_t id = 0; id < 100; ++id)
+    {
+        ::can_frame f{};
+        f.can_id = id;
+        tx.send(net::buffer(&f, sizeof(f)));
+    }
+    ::canfd_frame f{};
+    f.can_id = 0x100;
+    f.len = 48;
+    tx.send(net::buffer(&f, sizeof(f)));
+
+    std::vector<std::uint32_t> ids;
+    std::function<void(canary::error_code, std::size_t)> on_receive =
+      [&](canary::error_code ec, std::size_t) {
+          BOOST_TEST(!ec);
+          ids.push_back(f.can_id);
+          if (ids.size() < 101)
+          {
+              rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+              return;
+          }
+          BOOST_TEST_EQ(f.len, 48u);
+          a.stop();
+          b.stop();
+      };
+    rx.async_receive(net::buffer(&f, sizeof(f)), on_receive);
+    ioc.run();
+    BOOST_TEST_EQ(ids.size(), 101u);
+    for (std::uint32_t i = 0; i < 100; ++i)
+    {
+        BOOST_TEST_EQ(ids[i], i);
+    }
+    BOOST_TEST_LT(a.datagrams_sent(), 101u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_packing();
+    test_bidirectional();
+    test_invalid();
+    test_raw_socket();
+    return boost::report_errors();
+}
@@ -0,0 +1,308 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/uring.hpp>
+
+#include <boost/asio/local/connect_pair.hpp>
+#include <boost/asio/local/datagram_protocol.hpp>
+#include <boost/core/lightweight_test.hpp>
+#include <canary/frame_header.hpp>
+#include <canary/interface_index.hpp>
+#include <canary/raw.hpp>
+#include <iostream>
+#include <thread>
+
+namespace
+{
+
+namespace net = canary::net;
+using local_socket = net::local::datagram_protocol::socket;
+
+::can_frame
+make_frame(std::uint32_t seq)
+{
+    ::can_frame f{};
+    f.can_id = 0x100;
+    f.can_dlc = sizeof(seq);
+    std::memcpy(f.data, &seq, sizeof(seq));
+    return f;
+}
+
+std::uint32_t
+sequence_of(net::const_buffer b)
+{
+    std::uint32_t seq;
+    std::memcpy(&seq,
+                static_cast<unsigned char const*>(b.data()) +
+                  sizeof(canary::frame_header),
+                sizeof(seq));
+    return seq;
+}
+
+// Receives more frames than there are buffers, in several bursts, so that the
+// multishot receive runs out of buffers and has to be re-armed.
+void
+test_receive()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    b.set_option(net::socket_base::receive_buffer_size{1 << 20});
+
+    canary::uring_context ctx;
+    canary::uring_socket::options opts;
+    opts.receive_buffers = 8;
+    canary::uring_socket rx{ctx, b, opts};
+
+    std::vector<std::uint32_t> seqs;
+    auto const start = canary::timestamp_now();
+    bool timestamps_ok = true;
+    rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer f, canary::timestamp ts) {
+          if (ec)
+          {
+              BOOST_TEST(ec == net::error::operation_aborted);
+              return;
+          }
+          BOOST_TEST_EQ(f.size(), sizeof(::can_frame));
+          timestamps_ok = timestamps_ok && ts >= start;
+          seqs.push_back(sequence_of(f));
+      });
+    BOOST_TEST(rx.receiving());
+
+    std::uint32_t seq = 0;
+    for (int burst = 0; burst < 4; ++burst)
+    {
+        for (int i = 0; i < 20; ++i, ++seq)
+        {
+            auto const f = make_frame(seq);
+            a.send(net::buffer(&f, sizeof(f)));
+        }
+        while (seqs.size() < seq)
+        {
+            ctx.run_one();
+        }
+    }
+    BOOST_TEST_EQ(seqs.size(), 80u);
+    for (std::uint32_t i = 0; i < seqs.size(); ++i)
+    {
+        BOOST_TEST_EQ(seqs[i], i);
+    }
+    BOOST_TEST(timestamps_ok);
+    BOOST_TEST_GE(rx.buffer_exhaustions(), 1u);
+    BOOST_TEST(rx.receiving());
+
+    // Truncated frames are reported, but do not stop the receive.
+    std::array<unsigned char, 100> big{};
+    a.send(net::buffer(big));
+    canary::error_code truncated;
+    rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer f, canary::timestamp) {
+          truncated = ec;
+          BOOST_TEST_EQ(f.size(), 72u);
+      });
+    ctx.run_one();
+    BOOST_TEST(truncated == net::error::message_size);
+    BOOST_TEST(rx.receiving());
+
+    int aborted = 0;
+    rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer, canary::timestamp) {
+          BOOST_TEST(ec == net::error::operation_aborted);
+          ++aborted;
+      });
+    rx.cancel();
+    while (rx.receiving())
+    {
+        ctx.run_one();
+    }
+    BOOST_TEST_EQ(aborted, 1);
+}
+
+void
+test_send()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    net::local::connect_pair(a, b);
+    b.set_option(net::socket_base::receive_buffer_size{1 << 20});
+
+    canary::uring_context ctx;
+    canary::uring_socket::options opts;
+    opts.send_slots = 4;
+    canary::uring_socket tx{ctx, a, opts};
+    std::size_t completed = 0;
+    tx.on_send_complete([&](canary::error_code ec, std::size_t n) {
+        BOOST_TEST(!ec);
+        BOOST_TEST_EQ(n, sizeof(::can_frame));
+        ++completed;
+    });
+
+    // All slots in flight until the batch is submitted and completes.
+    for (std::uint32_t i = 0; i < 4; ++i)
+    {
+        auto const f = make_frame(i);
+        BOOST_TEST(tx.send(net::buffer(&f, sizeof(f))));
+    }
+    auto const f = make_frame(4);
+    BOOST_TEST_NOT(tx.send(net::buffer(&f, sizeof(f))));
+    BOOST_TEST_EQ(tx.sends_in_flight(), 4u);
+    while (completed < 4)
+    {
+        ctx.run_one();
+    }
+    BOOST_TEST_EQ(tx.sends_in_flight(), 0u);
+
+    for (std::uint32_t i = 0; i < 4; ++i)
+    {
+        ::can_frame in{};
+        BOOST_TEST_EQ(b.receive(net::buffer(&in, sizeof(in))), sizeof(in));
+        BOOST_TEST_EQ(sequence_of(net::buffer(&in, sizeof(in))), i);
+    }
+
+    // Frames which do not fit into a slot are rejected.
+    std::array<unsigned char, 100> big{};
+    BOOST_TEST_NOT(tx.send(net::buffer(big)));
+}
+
+// Completions are dispatched by an io_context, and frames sent from a handler
+// are submitted in one batch.
+void
+test_io_context()
+{
+    net::io_context ioc{1};
+    local_socket a{ioc};
+    local_socket b{ioc};
+    local_socket c{ioc};
+    local_socket d{ioc};
+    net::local::connect_pair(a, b);
+    net::local::connect_pair(c, d);
+
+    canary::uring_context ctx{ioc};
+    BOOST_TEST(ctx.io_context() == &ioc);
+    canary::uring_socket echo_rx{ctx, b};
+    canary::uring_socket echo_tx{ctx, c};
+
+    // Echo everything received on b out through c.
+    std::size_t echoed = 0;
+    echo_rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer f, canary::timestamp) {
+          if (ec)
+          {
+              BOOST_TEST(ec == net::error::operation_aborted);
+              ioc.stop();
+              return;
+          }
+          BOOST_TEST(echo_tx.send(f));
+          ++echoed;
+      });
+
+    std::thread peer{[&] {
+        for (std::uint32_t i = 0; i < 10; ++i)
+        {
+            auto const f = make_frame(i);
+            a.send(net::buffer(&f, sizeof(f)));
+            ::can_frame in{};
+            d.receive(net::buffer(&in, sizeof(in)));
+            BOOST_TEST_EQ(sequence_of(net::buffer(&in, sizeof(in))), i);
+        }
+        net::post(ioc, [&] { echo_rx.cancel(); });
+    }};
+
+    ioc.run_for(std::chrono::seconds{5});
+    peer.join();
+    BOOST_TEST_EQ(echoed, 10u);
+    BOOST_TEST_NOT(echo_rx.receiving());
+}
+
+void
+test_stop()
+{
+    canary::uring_context ctx;
+    std::thread t{[&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds{20});
+        ctx.stop();
+    }};
+    ctx.run();
+    t.join();
+
+    // Stays stopped until restarted.
+    BOOST_TEST_EQ(ctx.run_one(), 0u);
+    ctx.restart();
+    BOOST_TEST_EQ(ctx.poll(), 0u);
+}
+
+void
+test_raw_socket()
+{
+    net::io_context ioc{1};
+    auto const ep = canary::raw::endpoint{canary::get_interface_index("vcan0")};
+    canary::raw::socket tx_sock{ioc, ep};
+    canary::raw::socket rx_sock{ioc, ep};
+
+    canary::uring_context ctx;
+    canary::uring_socket tx{ctx, tx_sock};
+    canary::uring_socket rx{ctx, rx_sock};
+    std::size_t received = 0;
+    rx.async_receive(
+      [&](canary::error_code ec, net::const_buffer f, canary::timestamp) {
+          BOOST_TEST(!ec);
+          BOOST_TEST_EQ(f.size(), sizeof(::can_frame));
+          ++received;
+      });
+    for (std::uint32_t i = 0; i < 3; ++i)
+    {
+        auto const f = make_frame(i);
+        BOOST_TEST(tx.send(net::buffer(&f, sizeof(f))));
+    }
+    while (received < 3)
+    {
+        ctx.run_one();
+    }
+}
+
+bool
+uring_supported()
+{
+    try
+    {
+        canary::uring_context ctx;
+        net::io_context ioc{1};
+        local_socket a{ioc};
+        local_socket b{ioc};
+        net::local::connect_pair(a, b);
+        canary::uring_socket s{ctx, a};
+        return true;
+    }
+    catch (canary::system_error const& e)
+    {
+        std::cerr << "io_uring not supported: " << e.what() << '\n';
+        return false;
+    }
+}
+
+} // namespace
+
+int
+main()
+{
+    if (!uring_supported())
+    {
+        return 0;
+    }
+    test_receive();
+    test_send();
+    test_io_context();
+    test_stop();
+    test_raw_socket();
+    return boost::report_errors();
+}
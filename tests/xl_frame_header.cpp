@@ -0,0 +1,67 @@
+//
+// Copyright (c) 2020 Damian Jarek (damian.jarek93@gmail.com)
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+// Official repository: https://github.com/djarek/canary
+//
+
+// Test if header is self-contained
+#include <canary/xl_frame_header.hpp>
+
+#include <boost/core/lightweight_test.hpp>
+#include <cstring>
+#include <linux/can.h>
+
+namespace
+{
+
+void
+test_layout()
+{
+    static_assert(sizeof(canary::xl_frame) == CANXL_MTU,
+                  "Frame layout must match native canxl_frame struct.");
+    static_assert(sizeof(canary::xl_frame_header) == CANXL_HDR_SIZE,
+                  "Header layout must match native canxl_frame struct.");
+
+    canary::xl_frame f{};
+    BOOST_TEST(f.header.xl_format());
+    f.header.priority(0x7AB);
+    f.header.virtual_can_id(0x5C);
+    f.header.sdu_type(0x03);
+    f.header.simple_extended_content(true);
+    f.header.payload_length(2048);
+    f.header.acceptance_field(0xDEADBEEF);
+
+    ::canxl_frame cf{};
+    std::memcpy(&cf, &f, sizeof(f));
+    BOOST_TEST_EQ(cf.prio & CANXL_PRIO_MASK, 0x7ABu);
+    BOOST_TEST_EQ((cf.prio >> 16) & 0xFF, 0x5Cu);
+    BOOST_TEST_EQ(cf.flags, CANXL_XLF | CANXL_SEC);
+    BOOST_TEST_EQ(cf.sdt, 0x03u);
+    BOOST_TEST_EQ(cf.len, 2048u);
+    BOOST_TEST_EQ(cf.af, 0xDEADBEEFu);
+
+    // Fields do not overlap.
+    f.header.priority(0xFFFF);
+    BOOST_TEST_EQ(f.header.priority(), 0x7FFu);
+    BOOST_TEST_EQ(f.header.virtual_can_id(), 0x5Cu);
+    f.header.virtual_can_id(0);
+    BOOST_TEST_EQ(f.header.priority(), 0x7FFu);
+    f.header.simple_extended_content(false);
+    BOOST_TEST(f.header.xl_format());
+    BOOST_TEST_NOT(f.header.simple_extended_content());
+    f.header.xl_format(false);
+    BOOST_TEST_NOT(f.header.xl_format());
+    BOOST_TEST_EQ(f.header.payload_length(), 2048u);
+}
+
+} // namespace
+
+int
+main()
+{
+    test_layout();
+    return boost::report_errors();
+}
@@ -15,5 +15,8 @@ for ifname in "$@"
 do
     ip link delete $ifname || true
     ip link add dev $ifname type vcan
+    # CAN XL MTU, which still carries classic and CAN FD frames. Requires
+    # Linux 6.2 or later.
+    ip link set $ifname mtu 2060 || echo "CAN XL not supported on $ifname"
     ip link set up $ifname
 done